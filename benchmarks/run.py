@@ -0,0 +1,340 @@
+#!/usr/bin/env python3
+"""Benchmarks for the native kernels and the end-to-end event throughput.
+
+Each benchmark runs on synthetic events of a fixed size and reports the number of events processed per second. The
+benchmarks are run once for each requested thread count, in a separate process with ``OMP_NUM_THREADS`` set, so
+that the OpenMP kernels can be compared at different thread counts. The results can be saved as a baseline and
+compared against later to catch regressions. For the command options, try::
+
+    python benchmarks/run.py -h
+
+or run ``python setup.py benchmark`` after building the extensions.
+
+The benchmarks of the mcopt bindings (the tracker, event generator, and minimizer) need a fit config file, since
+they need the gas and pad plane lookup tables. They are skipped if no config is given.
+
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+import numpy as np
+
+#: The number of points (or pads, for the trace-based benchmarks) in the synthetic events
+DEFAULT_SIZES = [1000, 5000, 20000, 50000]
+
+
+def time_call(func, min_time=1.0, min_calls=3, trials=3):
+    """Find the rate at which `func` can be called, in calls per second.
+
+    The function is called repeatedly for at least `min_time` seconds (and at least `min_calls` times) in each
+    trial, and the median rate of the trials is returned.
+    """
+    func()  # Warm up any caches first
+
+    rates = []
+    for _ in range(trials):
+        num_calls = 0
+        begin = time.perf_counter()
+        elapsed = 0
+        while elapsed < min_time or num_calls < min_calls:
+            func()
+            num_calls += 1
+            elapsed = time.perf_counter() - begin
+        rates.append(num_calls / elapsed)
+
+    return float(np.median(rates))
+
+
+def make_spiral(num_pts, rng):
+    """Make a noisy spiral with `num_pts` points, like the xyz data from a real event, in mm."""
+    t = np.linspace(0, 6 * np.pi, num_pts)
+    rad = 200 * np.exp(-t / 10)
+    xyz = np.column_stack((rad * np.cos(t), rad * np.sin(t), np.linspace(0, 1000, num_pts)))
+    xyz += rng.normal(0, 2, size=xyz.shape)
+    return np.ascontiguousarray(xyz)
+
+
+def hough_benchmarks(sizes, rng):
+    from pytpc.cleaning.hough_wrapper import hough_line, hough_circle, nearest_neighbor_count
+
+    for size in sizes:
+        xyz = make_spiral(size, rng)
+        xy = np.ascontiguousarray(xyz[:, :2])
+        yield 'houghline', size, lambda: hough_line(xy)
+        yield 'houghcircle', size, lambda: hough_circle(xy)
+        yield 'neighborcount', size, lambda: nearest_neighbor_count(xyz, 15.0)
+
+
+def trigger_benchmarks(sizes, rng):
+    from pytpc.trigger.multiplicity import MultiplicityTrigger
+
+    config = {
+        'clock': 12.5,
+        'pad_thresh_MSB': 1,
+        'pad_thresh_LSB': 2,
+        'trigger_signal_width': 235e-9,
+        'multiplicity_threshold': 20000,
+        'multiplicity_window': 300,
+        'trigger_discriminator_fraction': 0.175,
+    }
+    padmap = {pad: (pad // 1024, 0, 0, 0) for pad in range(10240)}
+    trigger = MultiplicityTrigger(config, padmap)
+
+    # The size is the number of points, so use one pad for each 5 points, up to the number of pads
+    for size in sizes:
+        num_pads = min(10240, max(1, size // 5))
+        pads = rng.choice(10240, size=num_pads, replace=False)
+        traces = rng.uniform(0, 2 * trigger.pad_threshold, size=(num_pads, 512))
+        yield 'multiplicity', size, lambda: trigger.process_event(pads, traces)
+
+
+def make_traces(num_traces, rng):
+    from pytpc.evtdata import Event
+
+    traces = np.zeros(num_traces, dtype=Event().dt)
+    traces['cobo'] = np.arange(num_traces) // 1024 % 10
+    traces['asad'] = np.arange(num_traces) // 256 % 4
+    traces['aget'] = np.arange(num_traces) // 64 % 4
+    traces['channel'] = np.arange(num_traces) % 64
+    traces['pad'] = np.arange(num_traces) % 10240
+    traces['data'] = rng.randint(0, 4096, size=(num_traces, 512))
+    return traces
+
+
+def hdf_benchmarks(sizes, rng, tmpdir, max_traces=200000):
+    from pytpc.evtdata import Event
+    from pytpc.hdfdata import HDFDataFile
+
+    for size in sizes:
+        num_traces = min(10240, max(1, size // 5))
+        num_events = max(8, min(64, max_traces // num_traces))  # This keeps the files from getting too large
+        for layout in ('per_event', 'stacked'):
+            path = os.path.join(tmpdir, 'bench_{}_{}.h5'.format(layout, size))
+            with HDFDataFile(path, 'w', layout=layout) as hf:
+                for i in range(num_events):
+                    evt = Event(i, i)
+                    evt.traces = make_traces(num_traces, rng)
+                    hf.write_get_event(evt)
+
+            hf = HDFDataFile(path, 'r')
+            evtids = np.array(list(hf.evtids()))
+            order = rng.permutation(len(evtids))
+            state = {'idx': 0}
+
+            def read_next(hf=hf, evtids=evtids, order=order, state=state):
+                hf.read_get_event(int(evtids[order[state['idx'] % len(order)]]))
+                state['idx'] += 1
+
+            yield 'hdf_read_{}'.format(layout), size, read_next
+            hf.close()
+
+
+def mcopt_benchmarks(config_path, num_threads):
+    import yaml
+    from pytpc.fitting import MCFitter
+
+    with open(config_path, 'r') as f:
+        config = yaml.load(f, Loader=yaml.SafeLoader)
+    config['num_threads'] = num_threads
+    fitter = MCFitter(config)
+
+    # These parameters give a track that stays in the detector for most gases
+    params = np.array([0.0, 0.0, 0.5, 2.0, 0.0, 1.5])
+    track = fitter.tracker.track_particle(*params)
+    pos = np.ascontiguousarray(track[:, :3])
+    en = np.ascontiguousarray(track[:, 4])
+    size = len(track)
+
+    exp_pos = np.ascontiguousarray(pos[::max(1, len(pos) // 500)])
+    exp_hits = fitter.evtgen.make_hit_pattern(pos, en)
+    sigma = fitter.sigma
+    minimizer = fitter.minimizer
+
+    # The pad lookups for the points along the track, one at a time and in one batch
+    xy = np.asfortranarray(pos[:, :2])
+    padplane, pad_lookup = fitter.padplane, fitter.pad_lookup
+
+    def lookup_each():
+        for x, y in xy:
+            try:
+                padplane.get_pad_number_from_coordinates(x, y)
+            except (RuntimeError, IndexError):
+                pass
+
+    yield 'pad_lookup', size, lookup_each
+    yield 'pad_lookup_batch', size, lambda: pad_lookup.get_pad_numbers(xy)
+    yield 'track_particle', size, lambda: fitter.tracker.track_particle(*params)
+    yield 'make_event', size, lambda: fitter.evtgen.make_event(pos, en)
+    yield 'minimize', size, lambda: minimizer.minimize(params, sigma, exp_pos, exp_hits)
+
+
+def run_benchmarks(args):
+    """Run every benchmark at the current thread count, and return a list of result dicts."""
+    rng = np.random.RandomState(42)
+    results = []
+
+    def run(group):
+        try:
+            for name, size, func in group:
+                rate = time_call(func, min_time=args.min_time)
+                results.append({'name': name, 'size': size, 'threads': args.threads_for_worker, 'rate': rate})
+                print('  {:20s} size={:<6d} threads={:<3d} {:12.2f} events/s'.format(
+                    name, size, args.threads_for_worker, rate), file=sys.stderr, flush=True)
+        except ImportError as err:
+            print('  Skipping benchmarks: {}'.format(err), file=sys.stderr)
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        run(hough_benchmarks(args.sizes, rng))
+        run(trigger_benchmarks(args.sizes, rng))
+        run(hdf_benchmarks(args.sizes, rng, tmpdir))
+        if args.config is not None:
+            run(mcopt_benchmarks(args.config, args.threads_for_worker))
+
+    return results
+
+
+def result_key(res):
+    return '{}/{}/{}'.format(res['name'], res['size'], res['threads'])
+
+
+def print_scaling(results):
+    """Print the rate at each thread count, and the speedup relative to the lowest thread count."""
+    by_bench = {}
+    for res in results:
+        by_bench.setdefault((res['name'], res['size']), {})[res['threads']] = res['rate']
+
+    thread_counts = sorted({res['threads'] for res in results})
+    header = '{:20s} {:>6s}'.format('benchmark', 'size') + ''.join(' {:>16s}'.format('{} thr'.format(t))
+                                                                  for t in thread_counts)
+    print(header)
+    print('-' * len(header))
+    for (name, size), rates in sorted(by_bench.items()):
+        base = rates.get(thread_counts[0])
+        cols = []
+        for t in thread_counts:
+            if t not in rates:
+                cols.append(' {:>16s}'.format('-'))
+            elif base:
+                cols.append(' {:>9.1f} ({:.1f}x)'.format(rates[t], rates[t] / base))
+            else:
+                cols.append(' {:>16.1f}'.format(rates[t]))
+        print('{:20s} {:>6d}'.format(name, size) + ''.join(cols))
+
+
+def compare_baseline(results, baseline, tolerance):
+    """Compare the results to a baseline. Returns the list of regressed benchmark keys."""
+    regressions = []
+    print()
+    print('Comparison with baseline (tolerance {:.0%}):'.format(tolerance))
+    for res in results:
+        key = result_key(res)
+        if key not in baseline:
+            continue
+        ratio = res['rate'] / baseline[key]
+        status = 'REGRESSION' if ratio < 1 - tolerance else 'ok'
+        if status != 'ok':
+            regressions.append(key)
+        print('  {:40s} {:12.2f} vs {:12.2f} events/s ({:+.1%}) {}'.format(
+            key, res['rate'], baseline[key], ratio - 1, status))
+    return regressions
+
+
+def plot_scaling(results, path):
+    import matplotlib
+    matplotlib.use('Agg')
+    import matplotlib.pyplot as plt
+
+    by_bench = {}
+    for res in results:
+        by_bench.setdefault((res['name'], res['size']), []).append((res['threads'], res['rate']))
+
+    fig, ax = plt.subplots()
+    for (name, size), pts in sorted(by_bench.items()):
+        pts.sort()
+        threads, rates = zip(*pts)
+        ax.plot(threads, np.array(rates) / rates[0], marker='o', label='{} ({})'.format(name, size))
+    ax.set_xlabel('Threads')
+    ax.set_ylabel('Speedup')
+    ax.legend(fontsize='x-small')
+    fig.savefig(path)
+
+
+def parse_args(argv=None):
+    parser = argparse.ArgumentParser(description='Benchmark the pytpc kernels')
+    parser.add_argument('--config', '-c', help='A fit config file. This is needed for the mcopt benchmarks.')
+    parser.add_argument('--sizes', type=int, nargs='+', default=DEFAULT_SIZES,
+                        help='The event sizes, in points')
+    parser.add_argument('--threads', '-t', type=int, nargs='+', default=[1, os.cpu_count() or 1],
+                        help='The thread counts to run the benchmarks with')
+    parser.add_argument('--min-time', type=float, default=1.0,
+                        help='The minimum time to run each benchmark for, in seconds')
+    parser.add_argument('--baseline', '-b', default=os.path.join(os.path.dirname(__file__), 'baseline.json'),
+                        help='The baseline results to compare to')
+    parser.add_argument('--save-baseline', action='store_true',
+                        help='Save the results as the new baseline instead of comparing to it')
+    parser.add_argument('--tolerance', type=float, default=0.1,
+                        help='The fractional slowdown that counts as a regression')
+    parser.add_argument('--output', '-o', help='Write the results to this JSON file')
+    parser.add_argument('--plot', help='Plot the scaling curves to this image file')
+    parser.add_argument('--worker', type=int, dest='threads_for_worker', help=argparse.SUPPRESS)
+    return parser.parse_args(argv)
+
+
+def main(argv=None):
+    args = parse_args(argv)
+
+    if args.threads_for_worker is not None:
+        # This is a worker process for one thread count, so just report the results to the parent
+        json.dump(run_benchmarks(args), sys.stdout)
+        return 0
+
+    results = []
+    for num_threads in sorted(set(args.threads)):
+        print('Running benchmarks with {} thread(s)'.format(num_threads), file=sys.stderr)
+        env = dict(os.environ, OMP_NUM_THREADS=str(num_threads))
+        cmd = [sys.executable, os.path.abspath(__file__), '--worker', str(num_threads),
+               '--sizes'] + [str(s) for s in args.sizes] + ['--min-time', str(args.min_time)]
+        if args.config is not None:
+            cmd += ['--config', args.config]
+        out = subprocess.run(cmd, env=env, stdout=subprocess.PIPE, check=True).stdout
+        results += json.loads(out.decode())
+
+    print()
+    print_scaling(results)
+
+    if args.output is not None:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+
+    if args.plot is not None:
+        plot_scaling(results, args.plot)
+
+    if args.save_baseline:
+        with open(args.baseline, 'w') as f:
+            json.dump({result_key(res): res['rate'] for res in results}, f, indent=2, sort_keys=True)
+        print('\nSaved the baseline to {}'.format(args.baseline))
+        return 0
+
+    if not os.path.exists(args.baseline):
+        print('\nNo baseline at {}. Run with --save-baseline to make one.'.format(args.baseline))
+        return 0
+
+    with open(args.baseline, 'r') as f:
+        baseline = json.load(f)
+
+    regressions = compare_baseline(results, baseline, args.tolerance)
+    if regressions:
+        print('\n{} benchmark(s) regressed'.format(len(regressions)))
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,2 +1,2 @@
 from .effsim import EfficiencySimulator
-from .database import initialize_database, count_finished_events
+from .database import initialize_database, count_finished_events, find_unfinished_events
@@ -1,6 +1,6 @@
 from sqlalchemy.orm import sessionmaker
 from sqlalchemy.ext.declarative import declarative_base
-from sqlalchemy import Column, Integer, Float, Boolean
+from sqlalchemy import Column, Integer, Float, Boolean, inspect
 import logging
 from contextlib import contextmanager
 
@@ -33,9 +33,27 @@ def managed_session():
 
 def initialize_database(engine):
     SQLBase.metadata.create_all(bind=engine)
+    add_missing_columns(engine)
     Session.configure(bind=engine)
 
 
+def add_missing_columns(engine):
+    """Add any columns that are in the tables' definitions but not in the database.
+
+    `create_all` doesn't change tables that already exist, so a database written by an older version would
+    otherwise reject every insert that uses a newer column, like `MinimizerResult.num_iters_used`. The added
+    columns are null in the existing rows.
+    """
+    inspector = inspect(engine)
+    for table in SQLBase.metadata.sorted_tables:
+        existing = {col['name'] for col in inspector.get_columns(table.name)}
+        for col in table.columns:
+            if col.name not in existing:
+                logger.warning('Adding missing column %s to table %s', col.name, table.name)
+                engine.execute('ALTER TABLE {} ADD COLUMN {} {}'.format(
+                    table.name, col.name, col.type.compile(dialect=engine.dialect)))
+
+
 class ClockOffsets(SQLBase):
     __tablename__ = 'clock_offsets'
     evt_id = Column(Integer, primary_key=True)
@@ -96,6 +114,7 @@ class MinimizerResult(SQLBase):
     posChi2 = Column(Float)
     enChi2 = Column(Float)
     vertChi2 = Column(Float)
+    num_iters_used = Column(Integer)
     lin_scat_ang = Column(Float)
     lin_beam_int = Column(Float)
     lin_chi2 = Column(Float)
@@ -111,3 +130,40 @@ def count_finished_events():
         num_finished = session.query(ParameterSet).count()
         assert num_finished >= 0, 'Negative number of events finished?'
         return num_finished
+
+
+def find_unfinished_events(num_evts):
+    """Find the event IDs below `num_evts` that don't have a row in the parameter table yet.
+
+    This is used to resume a run. The events aren't necessarily written in order when several workers are used, and
+    some may be missing if a write failed, so the number of finished events doesn't say which ones are left.
+
+    Parameters
+    ----------
+    num_evts : int
+        The total number of events in the run.
+
+    Returns
+    -------
+    list
+        The missing event IDs, in increasing order.
+    """
+    with managed_session() as session:
+        finished = {evt_id for (evt_id,) in session.query(ParameterSet.evt_id)}
+    return [i for i in range(num_evts) if i not in finished]
+
+
+def write_rows(session, rows):
+    """Add rows to the database with one bulk insert per table.
+
+    Parameters
+    ----------
+    session : sqlalchemy.orm.Session
+        The session to use. The caller must commit it.
+    rows : dict
+        Maps each table class to a list of dicts of column values, like the output of
+        :meth:`effsim.EfficiencySimulator.simulate_event`.
+    """
+    for table, mappings in rows.items():
+        if len(mappings) > 0:
+            session.bulk_insert_mappings(table, mappings)
@@ -10,9 +10,10 @@ from pytpc.constants import pi
 from pytpc.padplane import generate_pad_plane
 import logging
 from copy import copy
+from collections import OrderedDict
 
 from .database import ParameterSet, TriggerResult, CleaningResult, MinimizerResult, ClockOffsets, BeamVectorValues
-from .database import EventCannotContinue, managed_session
+from .database import EventCannotContinue, managed_session, write_rows
 
 logger = logging.getLogger(__name__)
 
@@ -37,7 +38,12 @@ class EventSimulator(TrackerMixin, EventGeneratorMixin):
         self.reverse_padmap = {v: k for k, v in self.padmap.items()}  # maps pad -> (cobo, asad, aget, ch)
         self.noise_stddev = config['noise_stddev']
 
-    def make_event(self, x0, y0, z0, enu0, azi0, pol0):
+        self.badpad_array = np.array(sorted(self.badpads), dtype=np.int64)
+        self.pad_addresses = np.zeros((10240, 4), dtype='u1')  # Row index = pad, value = (cobo, asad, aget, ch)
+        for addr, pad in self.padmap.items():
+            self.pad_addresses[pad] = addr
+
+    def simulate_track(self, x0, y0, z0, enu0, azi0, pol0):
         tr = self.tracker.track_particle(x0, y0, z0, enu0, azi0, pol0)
         tr = tr[np.where(np.logical_and(tr[:, 2] > 0, tr[:, 2] < 1))].copy()
         pos = tr[:, :3]
@@ -49,6 +55,11 @@ class EventSimulator(TrackerMixin, EventGeneratorMixin):
         center[1] -= np.tan(self.tilt) * 1000
         center = pytpc.evtdata.uncalibrate(center.reshape((-1, 3)), self.vd, self.clock).ravel()
 
+        return pos, en, center
+
+    def make_event(self, x0, y0, z0, enu0, azi0, pol0):
+        pos, en, center = self.simulate_track(x0, y0, z0, enu0, azi0, pol0)
+
         evt = self.evtgen.make_event(pos, en)
 
         hitpads = set(evt.keys())
@@ -57,6 +68,18 @@ class EventSimulator(TrackerMixin, EventGeneratorMixin):
 
         return evt, center[:2]
 
+    def make_event_dense(self, x0, y0, z0, enu0, azi0, pol0):
+        """Like :meth:`make_event`, but the event is returned as an array of pads and an (N, 512) array of traces."""
+        pos, en, center = self.simulate_track(x0, y0, z0, enu0, azi0, pol0)
+
+        pads, traces = self.evtgen.make_event_dense(pos, en)
+
+        if len(self.badpad_array) > 0:
+            keep = ~np.in1d(pads, self.badpad_array)
+            pads, traces = pads[keep], traces[keep]
+
+        return pads, traces, center[:2]
+
     def convert_event(self, dict_evt, evt_id=0, timestamp=0):
         py_evt = Event(evt_id, timestamp)
         py_evt.traces = np.zeros(len(dict_evt), dtype=py_evt.dt)
@@ -69,6 +92,20 @@ class EventSimulator(TrackerMixin, EventGeneratorMixin):
 
         return py_evt
 
+    def convert_dense_event(self, pads, traces, evt_id=0, timestamp=0):
+        py_evt = Event(evt_id, timestamp)
+        py_evt.traces = np.zeros(len(pads), dtype=py_evt.dt)
+
+        addrs = self.pad_addresses[pads]
+        py_evt.traces['cobo'] = addrs[:, 0]
+        py_evt.traces['asad'] = addrs[:, 1]
+        py_evt.traces['aget'] = addrs[:, 2]
+        py_evt.traces['channel'] = addrs[:, 3]
+        py_evt.traces['pad'] = pads
+        py_evt.traces['data'] = traces
+
+        return py_evt
+
 
 class NoiseMaker(object):
     def __init__(self, config, pedestals=None, corrupt_cobo_clocks=False):
@@ -87,6 +124,8 @@ class NoiseMaker(object):
         self.bigpads = np.where(np.round(np.abs(pads[:, 1, 1] - pads[:, 0, 1])) > 6)[0]
         self.smallpads = np.where(np.round(np.abs(pads[:, 1, 1] - pads[:, 0, 1])) < 6)[0]
         assert(len(self.bigpads) + len(self.smallpads) == 10240)
+        self.bigpad_mask = np.zeros(10240, dtype=bool)
+        self.bigpad_mask[self.bigpads] = True
 
         self.baseline_depression_scale = config['baseline_depression_scale']
         self.big_pad_multiplier = config['big_pad_multiplier']
@@ -121,6 +160,20 @@ class NoiseMaker(object):
 
         return evt
 
+    def add_noise_dense(self, pads, traces, depress_baseline=True, add_gaussian_noise=True, clip=True):
+        """Like :meth:`add_noise`, but for the dense (pads, traces) form of an event. Modifies `traces` in place."""
+        if add_gaussian_noise:
+            traces += np.random.normal(self.pedestals[pads][:, np.newaxis], self.noise_stddev, traces.shape)
+
+        if depress_baseline:
+            mult = np.where(self.bigpad_mask[pads], self.big_pad_multiplier, 1)
+            traces -= np.outer(mult, self.beam_mesh * self.baseline_depression_scale)
+
+        if clip:
+            np.clip(traces, a_min=0, a_max=4095, out=traces)  # Perform clip in-place
+
+        return traces
+
     def make_cobo_clock_offsets(self):
         cobo_offsets = np.zeros(10)
         cobo_offsets[1:] = np.random.triangular(left=-1, mode=0, right=1, size=9)
@@ -169,13 +222,26 @@ class EfficiencySimulator(object):
 
         cobo_names = ('cobo{:d}'.format(i) for i in range(10))
         offset_map = dict(zip(cobo_names, self.noisemaker.cobo_offsets))
-        return ClockOffsets(evt_id=evt_id, **offset_map)
+        offset_map['evt_id'] = evt_id
+        return offset_map
 
     def make_event(self, evt_id, params):
         dict_evt, true_ctr = self.evtsim.make_event(*params)
 
         return dict_evt, true_ctr
 
+    def make_event_dense(self, evt_id, params):
+        pads, traces, true_ctr = self.evtsim.make_event_dense(*params)
+
+        return pads, traces, true_ctr
+
+    def prepare_dense_event_for_cleaner(self, pads, traces, hitmask):
+        hit = hitmask[pads].astype(bool)
+        if np.any(hit):
+            return self.evtsim.convert_dense_event(pads[hit], traces[hit])
+        else:
+            raise BadEventError('No triggered pads remain')
+
     def prepare_event_for_cleaner(self, dict_evt, hitmask):
         sliced_evt = {k: v for k, v in dict_evt.items() if bool(hitmask[k])}
         if len(sliced_evt) > 0:
@@ -186,7 +252,12 @@ class EfficiencySimulator(object):
     def run_trigger(self, evt_id, dict_evt):
         didtrig, hitmask = self.trigger.process_event(dict_evt)
         num_hits = len(hitmask.nonzero()[0])
-        return TriggerResult(evt_id=evt_id, did_trigger=didtrig, num_pads_hit=num_hits), hitmask
+        return dict(evt_id=evt_id, did_trigger=bool(didtrig), num_pads_hit=num_hits), hitmask
+
+    def run_dense_trigger(self, evt_id, pads, traces):
+        didtrig, hitmask = self.trigger.process_dense_event(pads, traces)
+        num_hits = len(hitmask.nonzero()[0])
+        return dict(evt_id=evt_id, did_trigger=bool(didtrig), num_pads_hit=num_hits), hitmask
 
     def run_cleaner(self, evt_id, evt):
         clean_xyz_full, ctr = self.cleaner.process_event(evt)
@@ -195,7 +266,7 @@ class EfficiencySimulator(object):
         num_pts_before = len(clean_xyz_full)
         num_pts_after = len(clean_xyz)
 
-        clean_res = CleaningResult(evt_id=evt_id, num_pts_before=num_pts_before, num_pts_after=num_pts_after)
+        clean_res = dict(evt_id=evt_id, num_pts_before=num_pts_before, num_pts_after=num_pts_after)
 
         return clean_res, clean_xyz, ctr
 
@@ -205,68 +276,98 @@ class EfficiencySimulator(object):
 
         mcres = self.fitter.process_event(calib_xyz, calib_ctr[0], calib_ctr[1])
         mcres['evt_id'] = int(evt_id)
-        return MinimizerResult(**mcres)
+        return mcres
+
+    def simulate_event(self, evt_id, param_vector, beam_vector):
+        """Run one event through the simulation, trigger, cleaning, and fit without touching the database.
+
+        Parameters
+        ----------
+        evt_id : int
+            The event ID to use in the results.
+        param_vector : array-like
+            The track parameters (x0, y0, z0, enu0, azi0, pol0).
+        beam_vector : array-like
+            The beam direction.
+
+        Returns
+        -------
+        rows : dict
+            The rows to add to the database, as a dict mapping each table class from :mod:`effsim.database` to a list
+            of dicts of column values. This has the results of every step that finished, even if a later one failed.
+        error : EventCannotContinue or None
+            The error that stopped the event, or None if it got through the whole chain. If the fit fails because the
+            event is bad, that is logged and is not an error. Unexpected exceptions are also returned as an
+            EventCannotContinue, with the original exception as its cause, so the parameter set is still recorded.
+        """
+        rows = OrderedDict()
+        rows[ParameterSet] = [dict(evt_id=evt_id, x0=param_vector[0], y0=param_vector[1], z0=param_vector[2],
+                                   enu0=param_vector[3], azi0=param_vector[4], pol0=param_vector[5])]
+        rows[BeamVectorValues] = [dict(evt_id=evt_id, x=beam_vector[0], y=beam_vector[1], z=beam_vector[2])]
+
+        try:
+            if self.clocks_are_corrupted:
+                rows[ClockOffsets] = [self.setup_clock_offsets(evt_id)]
+
+            self._simulate_event_chain(evt_id, param_vector, rows)
+        except EventCannotContinue as err:
+            return rows, err
+        except Exception as err:
+            error = EventCannotContinue('Unexpected error in event {:d}'.format(evt_id))
+            error.__cause__ = err
+            return rows, error
+
+        return rows, None
+
+    def _simulate_event_chain(self, evt_id, param_vector, rows):
+        try:
+            pads, traces, true_ctr = self.make_event_dense(evt_id, param_vector)
+        except Exception as err:
+            raise EventCannotContinue('Simulation failed for event {:d}'.format(evt_id)) from err
+
+        try:
+            self.noisemaker.add_noise_dense(pads, traces)
+        except Exception as err:
+            raise EventCannotContinue('Failed to add noise for event {:d}'.format(evt_id)) from err
+
+        try:
+            trig_res, hitmask = self.run_dense_trigger(evt_id, pads, traces)
+        except Exception as err:
+            raise EventCannotContinue('Trigger failed for event {:d}'.format(evt_id)) from err
+        else:
+            rows[TriggerResult] = [trig_res]
+
+        try:
+            evt = self.prepare_dense_event_for_cleaner(pads, traces, hitmask)
+            clean_res, clean_xyz, ctr = self.run_cleaner(evt_id, evt)
+        except Exception as err:
+            raise EventCannotContinue('Cleaning failed for event {:d}'.format(evt_id)) from err
+        else:
+            rows[CleaningResult] = [clean_res]
+
+        try:
+            calib_xyz, calib_ctr = self.fitter.preprocess(clean_xyz, ctr, rotate_pads=False)
+        except Exception as err:
+            raise EventCannotContinue('Preprocessing failed for event {:d}'.format(evt_id)) from err
+
+        try:
+            fit_res = self.run_fit(evt_id, calib_xyz, calib_ctr)
+        except BadEventError as err:
+            logger.warning('Fit failed for event %d: %s', evt_id, str(err))
+        except Exception as err:
+            raise EventCannotContinue('Fit failed for event {:d}'.format(evt_id)) from err
+        else:
+            rows[MinimizerResult] = [fit_res]
 
     def process_event(self, evt_id, param_vector, beam_vector):
+        """Simulate one event with :meth:`simulate_event` and write its results to the database.
+
+        The results of the steps that finished are written even if the event fails, and then the error is raised.
+        """
+        rows, error = self.simulate_event(evt_id, param_vector, beam_vector)
+
         with managed_session() as session:
-            param_set = ParameterSet(
-                evt_id=evt_id,
-                x0=param_vector[0],
-                y0=param_vector[1],
-                z0=param_vector[2],
-                enu0=param_vector[3],
-                azi0=param_vector[4],
-                pol0=param_vector[5],
-            )
-            session.add(param_set)
-
-            beam_vec_vals = BeamVectorValues(
-                evt_id=evt_id,
-                x=beam_vector[0],
-                y=beam_vector[1],
-                z=beam_vector[2],
-            )
-            session.add(beam_vec_vals)
+            write_rows(session, rows)
 
-            if self.clocks_are_corrupted:
-                clock_res = self.setup_clock_offsets(evt_id)
-                session.add(clock_res)
-
-            try:
-                dict_evt, true_ctr = self.make_event(evt_id, param_vector)
-            except Exception as err:
-                raise EventCannotContinue('Simulation failed for event {:d}'.format(evt_id)) from err
-
-            try:
-                dict_evt = self.noisemaker.add_noise(dict_evt)
-            except Exception as err:
-                raise EventCannotContinue('Failed to add noise for event {:d}'.format(evt_id)) from err
-
-            try:
-                trig_res, hitmask = self.run_trigger(evt_id, dict_evt)
-            except Exception as err:
-                raise EventCannotContinue('Trigger failed for event {:d}'.format(evt_id)) from err
-            else:
-                session.add(trig_res)
-
-            try:
-                evt = self.prepare_event_for_cleaner(dict_evt, hitmask)
-                clean_res, clean_xyz, ctr = self.run_cleaner(evt_id, evt)
-            except Exception as err:
-                raise EventCannotContinue('Cleaning failed for event {:d}'.format(evt_id)) from err
-            else:
-                session.add(clean_res)
-
-            try:
-                calib_xyz, calib_ctr = self.fitter.preprocess(clean_xyz, ctr, rotate_pads=False)
-            except Exception as err:
-                raise EventCannotContinue('Preprocessing failed for event {:d}'.format(evt_id)) from err
-
-            try:
-                fit_res = self.run_fit(evt_id, calib_xyz, calib_ctr)
-            except BadEventError as err:
-                logger.warning('Fit failed for event %d: %s', evt_id, str(err))
-            except Exception as err:
-                raise EventCannotContinue('Fit failed for event {:d}'.format(evt_id)) from err
-            else:
-                session.add(fit_res)
+        if error is not None:
+            raise error
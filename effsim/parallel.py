@@ -0,0 +1,245 @@
+"""Run the efficiency simulation in several processes.
+
+Each worker process makes its own :class:`EfficiencySimulator` and takes parameter sets from a task queue. The rows
+from each event are sent through a result queue to a single writer process, which is the only one that touches the
+database. It adds the rows of many events in one transaction with one bulk insert per table, so the workers never
+wait on the SQLite lock.
+
+"""
+
+from collections import OrderedDict
+import itertools
+import multiprocessing
+import queue
+import logging
+
+import numpy as np
+from sqlalchemy import create_engine
+
+from .effsim import EfficiencySimulator
+from .database import initialize_database, managed_session, write_rows
+
+logger = logging.getLogger(__name__)
+
+
+def simulation_worker_main(worker_idx, sim_kwargs, task_queue, result_queue):
+    """The main function of a worker process.
+
+    The worker takes tuples ``(evt_id, param_vector, beam_vector)`` from `task_queue` until it gets None, and puts the
+    rows from each event on `result_queue`. When it is done, it puts None on `result_queue`.
+
+    Parameters
+    ----------
+    worker_idx : int
+        The index of this worker, for logging.
+    sim_kwargs : dict
+        The keyword arguments for :class:`EfficiencySimulator`.
+    task_queue, result_queue : multiprocessing.Queue
+        The queues to read tasks from and write results to.
+    """
+    # Forked workers start with the same random state, so they would all add the same noise without this
+    np.random.seed()
+
+    try:
+        sim = EfficiencySimulator(**sim_kwargs)
+    except Exception:
+        logger.exception('Worker %d failed to set up the simulator', worker_idx)
+        result_queue.put(None)
+        return
+
+    while True:
+        task = task_queue.get()
+        if task is None:
+            break
+
+        evt_id, param_vector, beam_vector = task
+        try:
+            rows, error = sim.simulate_event(evt_id, param_vector, beam_vector)
+        except Exception:
+            logger.exception('Event %d failed', evt_id)
+            continue
+
+        if error is not None:
+            logger.error('Event %d failed: %s', evt_id, error, exc_info=error)
+
+        result_queue.put(rows)
+
+    result_queue.put(None)
+
+
+def database_writer_main(db_path, result_queue, num_workers, batch_size):
+    """The main function of the writer process.
+
+    This takes the rows of each event from `result_queue` and writes them to the database in batches of
+    `batch_size` events. If a batch can't be written, e.g. because one of its events is already in the database,
+    its events are written again one at a time so only the bad ones are lost. It stops once it has gotten None from
+    each of the `num_workers` workers.
+    """
+    initialize_database(create_engine('sqlite:///{}'.format(db_path)))
+
+    batch = []
+    num_written = 0
+    num_finished_workers = 0
+
+    def flush():
+        nonlocal batch, num_written
+        if len(batch) == 0:
+            return
+
+        merged = OrderedDict()
+        for rows in batch:
+            for table, mappings in rows.items():
+                merged.setdefault(table, []).extend(mappings)
+
+        try:
+            with managed_session() as session:
+                write_rows(session, merged)
+        except Exception:
+            logger.warning('Failed to write a batch of %d events. Writing them one at a time.', len(batch),
+                           exc_info=True)
+            for rows in batch:
+                try:
+                    with managed_session() as session:
+                        write_rows(session, rows)
+                except Exception:
+                    logger.exception('Failed to write event %s', _event_id(rows))
+                else:
+                    num_written += 1
+        else:
+            num_written += len(batch)
+
+        batch = []
+
+    while num_finished_workers < num_workers:
+        rows = result_queue.get()
+        if rows is None:
+            num_finished_workers += 1
+            continue
+
+        batch.append(rows)
+
+        if len(batch) >= batch_size:
+            flush()
+            logger.info('Wrote %d events', num_written)
+
+    flush()
+    logger.info('Finished writing %d events', num_written)
+
+
+def _event_id(rows):
+    """Find the event ID of the rows from one event, for logging."""
+    for mappings in rows.values():
+        if len(mappings) > 0:
+            return mappings[0].get('evt_id')
+    return None
+
+
+def _put_task(task_queue, task, workers, writer):
+    """Put a task on the queue, but give up if all of the workers or the writer have died instead of blocking
+    forever."""
+    while True:
+        try:
+            task_queue.put(task, timeout=5)
+            return
+        except queue.Full:
+            if not writer.is_alive():
+                raise RuntimeError('The database writer exited with code {}'.format(writer.exitcode))
+            if not any(w.is_alive() for w in workers):
+                raise RuntimeError('All of the simulation workers exited')
+
+
+def _join_workers(workers, writer):
+    """Wait for the workers to exit. If the writer dies first, the workers would block forever putting results on
+    the full result queue, so they are terminated instead.
+
+    Returns
+    -------
+    bool
+        True if the writer died and the workers were terminated.
+    """
+    for proc in workers:
+        while proc.exitcode is None:
+            proc.join(timeout=5)
+            if proc.exitcode is None and not writer.is_alive():
+                for other in workers:
+                    if other.is_alive():
+                        other.terminate()
+                    other.join()
+                return True
+    return False
+
+
+def run_parallel(sim_kwargs, param_gen, db_path, num_workers, evt_ids=None, num_evts=None, batch_size=100):
+    """Simulate the events from `param_gen` in `num_workers` processes, writing the results to `db_path`.
+
+    Parameters
+    ----------
+    sim_kwargs : dict
+        The keyword arguments for :class:`EfficiencySimulator`. Each worker makes its own simulator from these.
+    param_gen : iterable
+        Yields ``(param_vector, beam_vector)`` for each event, like the generators in :mod:`effsim.paramgen`.
+    db_path : str
+        The path to the SQLite database. The tables must already exist.
+    num_workers : int
+        The number of worker processes.
+    evt_ids : iterable of int, optional
+        The event ID to use for each parameter set. This is used to resume a run, e.g. with the IDs from
+        :func:`effsim.database.find_unfinished_events`. Only as many events as there are IDs are run. By default,
+        the events are numbered from 0.
+    num_evts : int, optional
+        The number of events, for the progress messages.
+    batch_size : int, optional
+        The number of events to write in each transaction.
+    """
+    num_workers = max(1, num_workers)
+    task_queue = multiprocessing.Queue(maxsize=4 * num_workers)
+    result_queue = multiprocessing.Queue(maxsize=4 * batch_size)
+
+    writer = multiprocessing.Process(target=database_writer_main,
+                                     args=(db_path, result_queue, num_workers, batch_size),
+                                     daemon=True)
+    writer.start()
+
+    workers = []
+    for i in range(num_workers):
+        proc = multiprocessing.Process(target=simulation_worker_main,
+                                       args=(i, sim_kwargs, task_queue, result_queue),
+                                       daemon=True)
+        proc.start()
+        workers.append(proc)
+
+    logger.info('Started %d simulation workers', num_workers)
+
+    try:
+        if evt_ids is None:
+            evt_ids = itertools.count()
+
+        for i, (evt_id, (param_vector, beam_vector)) in enumerate(zip(evt_ids, param_gen)):
+            if i % 100 == 0:
+                logger.info('Progress: at event %d / %s', i, num_evts if num_evts is not None else '?')
+            _put_task(task_queue, (evt_id, param_vector, beam_vector), workers, writer)
+
+        for _ in workers:
+            _put_task(task_queue, None, workers, writer)
+
+    except BaseException:
+        # The workers won't get their stop signal, so stop them here
+        for proc in workers:
+            if proc.is_alive():
+                proc.terminate()
+        raise
+
+    finally:
+        if _join_workers(workers, writer):
+            raise RuntimeError('The database writer exited with code {}'.format(writer.exitcode))
+
+        for i, proc in enumerate(workers):
+            if proc.exitcode != 0:
+                logger.error('Worker %d exited with code %s', i, proc.exitcode)
+                if writer.is_alive():
+                    # The worker didn't get to tell the writer that it was done
+                    result_queue.put(None)
+
+        writer.join()
+        if writer.exitcode != 0:
+            raise RuntimeError('The database writer exited with code {}'.format(writer.exitcode))
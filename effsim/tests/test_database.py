@@ -0,0 +1,126 @@
+from unittest import TestCase
+from collections import OrderedDict
+import itertools
+import os
+import queue
+import tempfile
+from unittest import mock
+
+from sqlalchemy import create_engine
+
+from ..database import (initialize_database, managed_session, write_rows, find_unfinished_events, ParameterSet,
+                        TriggerResult, MinimizerResult)
+from ..parallel import database_writer_main, run_parallel
+
+
+def make_rows(evt_id):
+    rows = OrderedDict()
+    rows[ParameterSet] = [dict(evt_id=evt_id, x0=0.0, y0=0.0, z0=0.5, enu0=2.0, azi0=0.1, pol0=1.5)]
+    rows[TriggerResult] = [dict(evt_id=evt_id, did_trigger=True, num_pads_hit=evt_id)]
+    return rows
+
+
+class WriteRowsTestCase(TestCase):
+    def setUp(self):
+        initialize_database(create_engine('sqlite://'))
+
+    def test_write_rows(self):
+        with managed_session() as session:
+            write_rows(session, make_rows(1))
+            write_rows(session, make_rows(2))
+
+        with managed_session() as session:
+            self.assertEqual(session.query(ParameterSet).count(), 2)
+            trig = session.query(TriggerResult).filter_by(evt_id=2).one()
+            self.assertEqual(trig.num_pads_hit, 2)
+
+    def test_empty_table(self):
+        rows = make_rows(1)
+        rows[TriggerResult] = []
+        with managed_session() as session:
+            write_rows(session, rows)
+
+        with managed_session() as session:
+            self.assertEqual(session.query(ParameterSet).count(), 1)
+            self.assertEqual(session.query(TriggerResult).count(), 0)
+
+
+    def test_find_unfinished_events(self):
+        with managed_session() as session:
+            for evt_id in (0, 1, 4, 2, 7):
+                write_rows(session, make_rows(evt_id))
+
+        self.assertEqual(find_unfinished_events(6), [3, 5])
+        self.assertEqual(find_unfinished_events(3), [])
+
+    def test_missing_column(self):
+        # A results table from before the num_iters_used column was added
+        engine = create_engine('sqlite://')
+        engine.execute('CREATE TABLE minres (evt_id INTEGER PRIMARY KEY, x0 FLOAT)')
+        engine.execute('INSERT INTO minres (evt_id, x0) VALUES (1, 0.5)')
+
+        initialize_database(engine)
+        with managed_session() as session:
+            session.bulk_insert_mappings(MinimizerResult, [dict(evt_id=2, x0=0.1, num_iters_used=5)])
+
+        with managed_session() as session:
+            self.assertIsNone(session.query(MinimizerResult).filter_by(evt_id=1).one().num_iters_used)
+            self.assertEqual(session.query(MinimizerResult).filter_by(evt_id=2).one().num_iters_used, 5)
+
+
+def flooding_worker_main(worker_idx, sim_kwargs, task_queue, result_queue):
+    """A worker that fills the result queue without reading any tasks."""
+    while True:
+        result_queue.put(make_rows(worker_idx))
+
+
+class DatabaseWriterTestCase(TestCase):
+    def setUp(self):
+        fd, self.db_path = tempfile.mkstemp(suffix='.db')
+        os.close(fd)
+
+    def tearDown(self):
+        os.remove(self.db_path)
+
+    def test_writer(self):
+        num_workers = 2
+        results = queue.Queue()
+        for i in range(25):
+            results.put(make_rows(i))
+        for i in range(num_workers):
+            results.put(None)
+
+        database_writer_main(self.db_path, results, num_workers, batch_size=10)
+
+        initialize_database(create_engine('sqlite:///{}'.format(self.db_path)))
+        with managed_session() as session:
+            self.assertEqual(session.query(ParameterSet).count(), 25)
+            self.assertEqual(session.query(TriggerResult).count(), 25)
+
+    def test_failed_batch(self):
+        initialize_database(create_engine('sqlite:///{}'.format(self.db_path)))
+        with managed_session() as session:
+            write_rows(session, make_rows(3))
+
+        # Event 3 is already there, so its batch can't be written at once
+        results = queue.Queue()
+        for i in range(10):
+            results.put(make_rows(i))
+        results.put(None)
+
+        database_writer_main(self.db_path, results, 1, batch_size=5)
+
+        initialize_database(create_engine('sqlite:///{}'.format(self.db_path)))
+        with managed_session() as session:
+            self.assertEqual(session.query(ParameterSet).count(), 10)
+            self.assertEqual(session.query(TriggerResult).count(), 10)
+            self.assertEqual(session.query(TriggerResult).filter_by(evt_id=4).one().num_pads_hit, 4)
+
+    def test_writer_died(self):
+        # The writer can't open a database in a directory that doesn't exist, so it exits right away, and the
+        # workers block on the full result queue
+        db_path = os.path.join(self.db_path + '.missing', 'test.db')
+        params = itertools.repeat((None, None))
+        with mock.patch('effsim.parallel.simulation_worker_main', flooding_worker_main):
+            with self.assertRaises(RuntimeError):
+                run_parallel({}, params, db_path, num_workers=2, batch_size=2)
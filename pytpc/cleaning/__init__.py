@@ -1,2 +1,3 @@
-from .cleaning import HoughCleaner, EventCleaner, linefunc, nn_remove_noise, apply_clean_cut
-from .hough_wrapper import hough_circle, hough_line, nearest_neighbor_count
+from .cleaning import HoughCleaner, EventCleaner, linefunc, nn_remove_noise, apply_clean_cut, compare_precision
+from .hough_wrapper import hough_circle, hough_line, hough_line_refined, nearest_neighbor_count
+from .hough_wrapper import hough_circle_batch, hough_line_batch, nearest_neighbor_count_batch, hough_clean
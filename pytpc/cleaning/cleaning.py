@@ -4,13 +4,15 @@ This module contains the main Python part of the cleaning functions.
 
 """
 
+import copy
 import numpy as np
 import pandas as pd
 from scipy.signal import argrelextrema
-from .hough_wrapper import hough_line, hough_circle, nearest_neighbor_count
+from .hough_wrapper import hough_line, hough_line_refined, hough_circle, nearest_neighbor_count, hough_clean
 from ..fitting.mixins import PreprocessMixin
-from ..utilities import Base, rot_matrix, tilt_matrix
-from ..padplane import generate_pad_plane
+from ..geometry import get_geometry
+from ..utilities import Base
+from ..instrumentation import StageTimer
 from ..constants import pi, degrees
 
 
@@ -65,6 +67,39 @@ class HoughCleaner(Base):
         #: The largest separation between two points that will still allow them to be considered neighbors.
         self.neighbor_radius = clean_conf['neighbor_radius']
 
+        #: If this is greater than 1, the linear Hough space is found at a resolution this many times coarser first,
+        #: and only the angles near the largest peaks are refined at full resolution. This saves time but not memory,
+        #: since the full accumulator is still returned. This is optional, and the default is None, which computes
+        #: the full Hough space.
+        self.linear_hough_coarse_factor = clean_conf.get('linear_hough_coarse_factor', None)
+
+        #: The number of coarse Hough space peaks to refine if `linear_hough_coarse_factor` is set.
+        self.linear_hough_ntop = clean_conf.get('linear_hough_ntop', 3)
+
+        #: If True, each point's vote in the linear Hough transform is weighted by its amplitude, which is taken
+        #: from column 3 of the data passed to :meth:`clean`. This is optional, and the default is False.
+        self.linear_hough_weighted = clean_conf.get('linear_hough_weighted', False)
+
+        #: If True, :meth:`clean` runs the whole algorithm in C using :func:`~pytpc.cleaning.hough_clean`.
+        #: Otherwise, it calls each of the steps below from Python. This is optional, and the default is False.
+        #: The C version does not support the coarse-to-fine or weighted linear Hough transform, so this is
+        #: ignored if either of those is enabled. It uses `linear_hough_max` and `circle_hough_max` as given,
+        #: while the Hough transforms called from Python truncate them to integers, so the two only give the
+        #: same results if the maxima are integers.
+        self.native_clean = clean_conf.get('native_clean', False)
+
+        #: If True, the cleaning is done in single precision: the data is converted to float32, and the Hough
+        #: accumulators, neighbor counts, and labels are int32. This halves the memory traffic of the cleaning, and
+        #: the results only differ from the double precision ones for points within rounding error of a bin edge.
+        #: See :func:`~pytpc.cleaning.compare_precision` to check this on a set of events. This is optional, and
+        #: the default is False. The weighted and coarse-to-fine linear Hough transform are always done in double
+        #: precision.
+        self.single_precision = clean_conf.get('single_precision', False)
+
+        #: Timers and counters for the stages of the cleaning. This is enabled by the top-level config key
+        #: `enable_timing`, which is optional and defaults to False.
+        self.timer = StageTimer(enabled=config.get('enable_timing', False))
+
     def neighbor_count(self, xyz):
         """Count the number of neighbors each point has within radius `self.neighbor_radius`
 
@@ -83,7 +118,7 @@ class HoughCleaner(Base):
         nncts = nearest_neighbor_count(xyz_cont, self.neighbor_radius)
         return nncts
 
-    def find_center(self, xyz):
+    def find_center(self, xyz, nn_counts=None):
         """Finds the center using the circular Hough transform.
 
         A nearest-neighbor cut will be applied to the data before finding the center.
@@ -92,6 +127,9 @@ class HoughCleaner(Base):
         ----------
         xyz : array-like
             The 2D data to consider. The first two columns must be x and y positions.
+        nn_counts : array-like, optional
+            The neighbor counts for `xyz`, as returned by :meth:`neighbor_count`. If these are not provided,
+            they will be calculated.
 
         Returns
         -------
@@ -99,7 +137,9 @@ class HoughCleaner(Base):
             The x, y position of the found center.
 
         """
-        xyz = np.ascontiguousarray(xyz[self.neighbor_count(xyz) > 1])
+        if nn_counts is None:
+            nn_counts = self.neighbor_count(xyz)
+        xyz = np.ascontiguousarray(xyz[nn_counts > 1])
         return hough_circle(xyz, nbins=self.circle_hough_nbins, max_val=self.circle_hough_max)
 
     def find_arclen(self, xyz, cu, cv, extra_rotation=None):
@@ -128,13 +168,18 @@ class HoughCleaner(Base):
 
         return rads * thetas
 
-    def find_linear_hough_space(self, zs, arclens):
+    def find_linear_hough_space(self, zs, arclens, weights=None):
         """Performs the linear Hough transform.
 
+        If `self.linear_hough_coarse_factor` is set or `weights` are given, the coarse-to-fine weighted transform
+        from :func:`~pytpc.cleaning.hough_line_refined` is used.
+
         Parameters
         ----------
         zs, arclens : array-like
             One-dimensional arrays containing the z-axis and arc-length coordinate values to be transformed.
+        weights : array-like, optional
+            The weight of each point's vote, such as its amplitude.
 
         Returns
         -------
@@ -143,7 +188,13 @@ class HoughCleaner(Base):
 
         """
         linear_hough_data = np.ascontiguousarray(np.column_stack((zs, arclens)))
-        return hough_line(linear_hough_data, nbins=self.linear_hough_nbins, max_val=self.linear_hough_max)
+        if self.linear_hough_coarse_factor is not None or weights is not None:
+            return hough_line_refined(linear_hough_data.astype('float64', copy=False), nbins=self.linear_hough_nbins,
+                                      max_val=self.linear_hough_max,
+                                      coarse_factor=self.linear_hough_coarse_factor or 1,
+                                      ntop=self.linear_hough_ntop, weights=weights)
+        else:
+            return hough_line(linear_hough_data, nbins=self.linear_hough_nbins, max_val=self.linear_hough_max)
 
     def find_hough_max_angle(self, lin_space):
         """Finds the maximum angle slice in the linear Hough space.
@@ -167,7 +218,9 @@ class HoughCleaner(Base):
 
         """
         # Find angle of max in Hough space
-        maxidx = lin_space.ravel().argsort()  # List of peak indices in increasing order: look at last few in next step
+        # List of peak indices in increasing order: look at last few in next step. The sort is stable so ties
+        # between bins are always broken the same way, in favor of the later bin.
+        maxidx = lin_space.ravel().argsort(kind='mergesort')
         thmax = np.floor(np.unravel_index(maxidx[-5:], lin_space.shape)[0].mean()).astype('int')  # Index of average max
         theta_max = self.linhough_theta_from_bin(thmax)  # The value in angle units, rather than bins
 
@@ -269,7 +322,8 @@ class HoughCleaner(Base):
         Parameters
         ----------
         xyz : array-like
-            The data, with first three columns (x, y, z).
+            The data, with first three columns (x, y, z). If `self.linear_hough_weighted` is True, the fourth
+            column must be the amplitude.
 
         Returns
         -------
@@ -283,28 +337,71 @@ class HoughCleaner(Base):
         (cu, cv) : tuple of floats
             The center of the event.
 
-        """
-        # Find center
-        cu, cv = self.find_center(xyz)
-
-        # Find r-theta (arclength)
-        arclens = self.find_arclen(xyz, cu, cv)
-
-        # Perform linear Hough transform
-        lin_space = self.find_linear_hough_space(xyz[:, 2], arclens)
-
-        # Find angle of max in Hough space and make a slice around that angle
-        theta_max, hough_slice = self.find_hough_max_angle(lin_space)
+        If `self.single_precision` is True, the arrays from the native version are int32 and float32.
 
-        # Find Hough space radii corresponding to each line
-        pkctrs = self.find_peaks(hough_slice)
-        radii = self.linhough_rad_from_bin(pkctrs)
-
-        # Identify which line (if any) each point belongs to
-        labels, mindists = self.classify_points(xyz, arclens, theta_max, radii)
-
-        # Nearest neighbor cut
-        nn_counts = self.neighbor_count(xyz)
+        """
+        timer = self.timer
+        num_points = len(xyz)
+
+        if self.single_precision:
+            xyz = np.asarray(xyz, dtype='float32')
+
+        use_refined_hough = self.linear_hough_coarse_factor is not None or self.linear_hough_weighted
+        if self.native_clean and not use_refined_hough:
+            native_stats = {} if timer.enabled else None
+            with timer.stage('clean', num_points):
+                result = hough_clean(
+                    np.ascontiguousarray(xyz, dtype='float32' if self.single_precision else 'float64'),
+                    peak_width=self.peak_width,
+                    linear_hough_max=self.linear_hough_max,
+                    linear_hough_nbins=self.linear_hough_nbins,
+                    circle_hough_max=self.circle_hough_max,
+                    circle_hough_nbins=self.circle_hough_nbins,
+                    min_pts_per_line=self.min_pts_per_line,
+                    neighbor_radius=self.neighbor_radius,
+                    stats=native_stats,
+                )
+
+            if native_stats is not None:
+                for stage in ('neighbor_count', 'find_center', 'linear_hough', 'classify'):
+                    timer.add_time('clean.' + stage, native_stats[stage + '_time'], num_points=num_points)
+                for key in ('center_points', 'lines_found', 'labeled_points'):
+                    timer.count('clean.' + key, native_stats[key])
+
+            return result
+
+        with timer.stage('clean', num_points):
+            # Nearest neighbor cut. The counts are reused for the center finding below.
+            with timer.stage('clean.neighbor_count', num_points):
+                nn_counts = self.neighbor_count(xyz)
+
+            # Find center
+            with timer.stage('clean.find_center', num_points):
+                cu, cv = self.find_center(xyz, nn_counts)
+
+            with timer.stage('clean.linear_hough', num_points):
+                # Find r-theta (arclength)
+                arclens = self.find_arclen(xyz, cu, cv)
+
+                # Perform linear Hough transform
+                weights = xyz[:, 3] if self.linear_hough_weighted else None
+                lin_space = self.find_linear_hough_space(xyz[:, 2], arclens, weights)
+
+                # Find angle of max in Hough space and make a slice around that angle
+                theta_max, hough_slice = self.find_hough_max_angle(lin_space)
+
+                # Find Hough space radii corresponding to each line
+                pkctrs = self.find_peaks(hough_slice)
+                radii = self.linhough_rad_from_bin(pkctrs)
+
+            # Identify which line (if any) each point belongs to
+            with timer.stage('clean.classify', num_points):
+                labels, mindists = self.classify_points(xyz, arclens, theta_max, radii)
+
+        if timer.enabled:
+            timer.count('clean.center_points', int(np.count_nonzero(nn_counts > 1)))
+            timer.count('clean.lines_found', len(radii))
+            timer.count('clean.labeled_points', int(np.count_nonzero(labels >= 0)))
 
         return labels, mindists, nn_counts, (cu, cv)
 
@@ -328,10 +425,12 @@ class EventCleaner(HoughCleaner, PreprocessMixin):
         self.vd = np.array(config['vd'])  #: The drift velocity vector, in cm/µs.
         self.clock = config['clock']  #: The CoBo write clock frequency, in MHz.
         self.pad_rot_angle = config['pad_rot_angle'] * degrees  #: The pad plane rotation angle, in radians.
-        self.padrotmat = rot_matrix(self.pad_rot_angle)  #: The pad plane rotation matrix.
         self.beampads = []  #: A list of pads to exclude. Should be an empty list for this class.
-        self.untilt_mat = tilt_matrix(self.tilt)  #: A matrix that transforms from beam to detector coordinates.
-        self.pads = generate_pad_plane(self.pad_rot_angle)  #: The pad plane.
+
+        geometry = self.geometry
+        self.padrotmat = geometry.padrotmat  #: The pad plane rotation matrix.
+        self.untilt_mat = geometry.untilt_mat  #: A matrix that transforms from beam to detector coordinates.
+        self.pads = geometry.pads  #: The pad plane.
 
         #: The last time bucket to consider. Anything past it is discarded.
         self.last_tb = config['cleaning_config']['last_tb']
@@ -364,10 +463,20 @@ class EventCleaner(HoughCleaner, PreprocessMixin):
             The x and y position of the center of the spiral.
 
         """
-        raw_xyz = evt.xyzs(pads=self.pads, peaks_only=True, return_pads=True, cg_times=True, baseline_correction=True)
-        xyz = self.preprocess(raw_xyz, rotate_pads=False, last_tb=self.last_tb)
+        timer = self.timer
+        timer.count('events')
+
+        # The points must stay in time buckets here since `preprocess` calibrates them, so the geometry passed to
+        # `xyzs` has no drift velocity or clock.
+        with timer.stage('xyzs', len(evt.traces)):
+            pad_geometry = get_geometry(self.pad_rot_angle, self.tilt)
+            raw_xyz = evt.xyzs(geometry=pad_geometry, peaks_only=True, return_pads=True, cg_times=True,
+                               baseline_correction=True, dtype='float32' if self.single_precision else None)
+
+        with timer.stage('preprocess', len(raw_xyz)):
+            xyz = self.preprocess(raw_xyz, rotate_pads=False, last_tb=self.last_tb)
 
-        cleaning_data = xyz[['u', 'v', 'w']].values
+        cleaning_data = xyz[['u', 'v', 'w', 'a']].values
 
         labels, mindists, nn_counts, (cu, cv) = self.clean(cleaning_data)
 
@@ -444,3 +553,55 @@ def apply_clean_cut(raw_xyz_full, qthresh=40, nthresh=2, tbthresh=500):
     tbcut = raw_xyz_full[:, 2] <= tbthresh
     cut = qcut & ncut & tbcut
     return raw_xyz_full[cut, :5]
+
+
+def compare_precision(cleaner, events, qthresh=40, nthresh=2):
+    """Clean a set of events in both double and single precision, and compare the results.
+
+    This is meant to check that the single precision mode (the `single_precision` cleaning config key) is accurate
+    enough for a given dataset and set of cleaning parameters before using it for a full run.
+
+    Parameters
+    ----------
+    cleaner : HoughCleaner
+        The cleaner to use. Its `single_precision` setting is ignored, and it is not modified.
+    events : iterable of array-like
+        The data to clean for each event, in the format taken by :meth:`HoughCleaner.clean`.
+    qthresh, nthresh : number, optional
+        The cut on the distance to the nearest line and on the number of neighbors, as in :func:`apply_clean_cut`.
+        The number of points that pass this cut in one version but not the other is reported.
+
+    Returns
+    -------
+    pandas.DataFrame
+        One row per event, with the columns ``num_points``, ``label_mismatches``, ``nn_count_mismatches``,
+        ``cut_mismatches``, ``max_mindist_diff`` (ignoring points that are not near any line in either version),
+        and ``center_diff`` (the distance between the two centers).
+
+    """
+    double_cleaner = copy.copy(cleaner)
+    double_cleaner.single_precision = False
+    single_cleaner = copy.copy(cleaner)
+    single_cleaner.single_precision = True
+
+    rows = []
+    for xyz in events:
+        labels, mindists, nn_counts, center = double_cleaner.clean(xyz)
+        labels_32, mindists_32, nn_counts_32, center_32 = single_cleaner.clean(xyz)
+
+        finite = np.isfinite(mindists) & np.isfinite(mindists_32)
+        cut = (mindists <= qthresh) & (nn_counts >= nthresh)
+        cut_32 = (mindists_32 <= qthresh) & (nn_counts_32 >= nthresh)
+
+        rows.append({
+            'num_points': len(labels),
+            'label_mismatches': int(np.count_nonzero(labels != labels_32)),
+            'nn_count_mismatches': int(np.count_nonzero(nn_counts != nn_counts_32)),
+            'cut_mismatches': int(np.count_nonzero(cut != cut_32)),
+            'max_mindist_diff': float(np.abs(mindists[finite] - mindists_32[finite]).max()) if finite.any() else 0.0,
+            'center_diff': float(np.hypot(center[0] - center_32[0], center[1] - center_32[1])),
+        })
+
+    columns = ['num_points', 'label_mismatches', 'nn_count_mismatches', 'cut_mismatches', 'max_mindist_diff',
+               'center_diff']
+    return pd.DataFrame(rows, columns=columns)
@@ -1,111 +1,259 @@
 #include "hough.h"
+#include <time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // This indexing macro assumes C-style row-major ordering
 #define INDEX(i, j, ncols) ( (j) + ( (i) * (ncols) ))
 
-/* The type of the helper function to find a radius. I define it as a function pointer in order
-   to re-use the same code to find the Hough transform for both the linear and circular functions.
+/* The Hough transforms are computed over blocks of points and tiles of theta bins. Each block of points is small
+   enough to stay in L1 cache while all of the angles in a tile are computed from it, and each tile's accumulator
+   rows are kept in a thread-local int32 buffer that stays in L2 cache until the tile is finished.
  */
-typedef double (*RadiusFunction)(const double *const restrict, const int, const int, const double, const double);
-
-/* A helper function that does the actual computation. Both of the front-end Hough transform functions call
-   this with an appropriate radfunc pointer to find the Hough space.
-
-   Parameters:
-   - xy: The input XYZ data. This must have at least a column for X and Y. Any other columns are ignored.
-   - nrows, ncols: The number of rows and columns in xy
-   - accum: An output array for the Hough transform accumulator (the Hough space map). Dimension must be nbins x nbins.
-   - nbins: The number of bins to use in the computation. This should be the
-   - max_val: Max radius value in Hough space. The space is symmetric about 0, so the min radius is -max_val.
-   - radfunc: A pointer to a function to compute the radius.
-   - firstRowIdx: Start the iteration through xy at this row.
+#define HOUGH_BLOCK_SIZE 512
+#define HOUGH_THETA_TILE 8
+
+/* On x86-64 Linux with GCC, build AVX2 and AVX-512 clones of the binning kernels next to the baseline version. The
+   best one for the running CPU is chosen when the library is loaded.
  */
-static void hough_helper(const double *restrict xy, const int nrows, const int ncols, int64_t *restrict accum,
-                         const int nbins, const double max_val, const RadiusFunction radfunc, const int firstRowIdx)
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define HOUGH_KERNEL __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define HOUGH_KERNEL
+#endif
+
+typedef enum {
+    HOUGH_LINE,
+    HOUGH_CIRCLE,
+} HoughKind;
+
+// The grid is coarsened until it has no more than this many cells per point
+#define NGRID_MAX_CELLS_PER_POINT 2
+
+#define HOUGH_MAX_ANGLE_NPEAKS 5
+
+/* The wall clock time, in seconds, for the stage timings in `houghclean`. */
+static double hough_wtime(void)
 {
-    const double thstep = M_PI / nbins;  // Size of theta (angle) bins
-    const double min_val = -max_val;
-
-    #pragma omp parallel for
-    for (int theta_idx = 0; theta_idx < nbins; theta_idx++) {
-        double theta = theta_idx * thstep;
-        // Precompute sin and cos here so they aren't done nrows times for each theta
-        double costh = cos(theta);
-        double sinth = sin(theta);
-
-        for (int xyz_idx = firstRowIdx; xyz_idx < nrows; xyz_idx++) {
-            double rad = radfunc(xy, ncols, xyz_idx, costh, sinth);
-            if (rad >= min_val && rad < max_val) {
-                // Find and increment histogram/accumulator bin corresponding to rad
-                size_t radbin = (size_t) floor((rad + max_val) * nbins / (2 * max_val));
-                accum[INDEX(theta_idx, radbin, nbins)] += 1;
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* Instantiate the implementation in double precision, with the original names, and in single precision, with
+   the suffix _f32. The single precision version uses int32 accumulators and counts, which halves the memory traffic
+   of the accumulators. An int32 bin can't overflow since the number of points is an int.
+ */
+#define HOUGH_REAL double
+#define HOUGH_INT int64_t
+#define HOUGH_MATH(fn) fn
+#define HOUGH_NAME(name) name
+#include "hough_impl.h"
+#undef HOUGH_REAL
+#undef HOUGH_INT
+#undef HOUGH_MATH
+#undef HOUGH_NAME
+
+#define HOUGH_REAL float
+#define HOUGH_INT int32_t
+#define HOUGH_MATH(fn) fn##f
+#define HOUGH_NAME(name) name##_f32
+#include "hough_impl.h"
+#undef HOUGH_REAL
+#undef HOUGH_INT
+#undef HOUGH_MATH
+#undef HOUGH_NAME
+
+/* Fill the given rows of a weighted accumulator at full resolution. Each point votes with its weight, or with
+   weight 1 if `weights` is NULL. Only the rows listed in `rows` are written.
+ */
+static void hough_weighted_rows(const HoughPoints *pts, const double *restrict weights, double *restrict accum,
+                                const int *restrict rows, const int nrows_accum, const int nbins,
+                                const double max_val)
+{
+    const double thstep = M_PI / nbins;
+
+    #pragma omp parallel
+    {
+        int32_t bins[HOUGH_BLOCK_SIZE];
+
+        #pragma omp for schedule(dynamic)
+        for (int row_idx = 0; row_idx < nrows_accum; row_idx++) {
+            const int theta_idx = rows[row_idx];
+            const double costh = cos(theta_idx * thstep);
+            const double sinth = sin(theta_idx * thstep);
+            double *restrict row = accum + INDEX(theta_idx, 0, nbins);
+
+            for (int block_start = 0; block_start < pts->npts; block_start += HOUGH_BLOCK_SIZE) {
+                const int block_len = pts->npts - block_start < HOUGH_BLOCK_SIZE ?
+                                      pts->npts - block_start : HOUGH_BLOCK_SIZE;
+
+                hough_bin_line_block(pts->a + block_start, pts->b + block_start, block_len,
+                                     costh, sinth, nbins, max_val, bins);
+
+                for (int i = 0; i < block_len; i++) {
+                    if (bins[i] >= 0) row[bins[i]] += weights ? weights[block_start + i] : 1;
+                }
             }
         }
     }
 }
 
-static inline double
-houghline_find_rad(const double *const restrict xy, const int ncols, const int rowIdx,
-                   const double costh, const double sinth)
+/* Fill a coarse accumulator with `ncoarse` bins in each dimension. The angle of each coarse row is the center of
+   the block of `factor` fine rows that it covers.
+ */
+static void hough_coarse(const HoughPoints *pts, const double *restrict weights, double *restrict coarse,
+                         const int ncoarse, const int factor, const int nbins, const double max_val)
 {
-    const double x = xy[INDEX(rowIdx, 0, ncols)];
-    const double y = xy[INDEX(rowIdx, 1, ncols)];
-    return x * costh + y * sinth;
-}
+    const double thstep = M_PI / nbins;
 
-static inline double
-houghcircle_find_rad(const double *const restrict xy, const int ncols, const int rowIdx,
-                     const double costh, const double sinth)
-{
-    const double x1 = xy[INDEX(rowIdx,     0, ncols)];
-    const double x0 = xy[INDEX(rowIdx - 5, 0, ncols)];
-    const double y1 = xy[INDEX(rowIdx,     1, ncols)];
-    const double y0 = xy[INDEX(rowIdx - 5, 1, ncols)];
-
-    double numer = (x1*x1 - x0*x0) + (y1*y1 - y0*y0);
-    double denom = 2 * ((x1 - x0) * costh + (y1 - y0) * sinth);
-    return numer / denom;
+    #pragma omp parallel
+    {
+        int32_t bins[HOUGH_BLOCK_SIZE];
+
+        #pragma omp for schedule(dynamic)
+        for (int coarse_idx = 0; coarse_idx < ncoarse; coarse_idx++) {
+            const double theta = (coarse_idx * factor + (factor - 1) / 2.0) * thstep;
+            const double costh = cos(theta);
+            const double sinth = sin(theta);
+            double *restrict row = coarse + INDEX(coarse_idx, 0, ncoarse);
+
+            for (int block_start = 0; block_start < pts->npts; block_start += HOUGH_BLOCK_SIZE) {
+                const int block_len = pts->npts - block_start < HOUGH_BLOCK_SIZE ?
+                                      pts->npts - block_start : HOUGH_BLOCK_SIZE;
+
+                hough_bin_line_block(pts->a + block_start, pts->b + block_start, block_len,
+                                     costh, sinth, ncoarse, max_val, bins);
+
+                for (int i = 0; i < block_len; i++) {
+                    if (bins[i] >= 0) row[bins[i]] += weights ? weights[block_start + i] : 1;
+                }
+            }
+        }
+    }
 }
 
-void houghline(const double *restrict xy, const int nrows, const int ncols, int64_t *restrict accum, const int nbins,
-               const double max_val)
+int houghline_refined(const double *restrict xy, const int nrows, const int ncols, const double *restrict weights,
+                      double *restrict accum, const int nbins, const double max_val, const int coarse_factor,
+                      const int ntop)
 {
-    const int firstRowIdx = 0;
-    hough_helper(xy, nrows, ncols, accum, nbins, max_val, &houghline_find_rad, firstRowIdx);
+    // The fine rows within this distance of a selected coarse row are refined too. This must be at least as wide
+    // as the slice taken around the max angle in the cleaning algorithm.
+    const int margin = 5;
+
+    const int factor = coarse_factor > 1 ? coarse_factor : 1;
+    const int ncoarse = (nbins + factor - 1) / factor;
+    int status = 0;
+
+    HoughPoints pts;
+    if (hough_points_init(&pts, xy, nrows, ncols, HOUGH_LINE) != 0) return -1;
+
+    int *rows = malloc(nbins * sizeof(int) + 1);
+    char *row_mask = calloc(nbins + 1, 1);
+    double *coarse = factor > 1 ? calloc((size_t) ncoarse * ncoarse, sizeof(double)) : NULL;
+
+    if (!rows || !row_mask || (factor > 1 && !coarse)) {
+        status = -1;
+        goto cleanup;
+    }
+
+    if (factor > 1) {
+        hough_coarse(&pts, weights, coarse, ncoarse, factor, nbins, max_val);
+
+        // Select the coarse rows that contain the ntop largest coarse bins, and mark the fine rows they cover
+        for (int k = 0; k < ntop; k++) {
+            size_t maxidx = 0;
+            for (size_t i = 1; i < (size_t) ncoarse * ncoarse; i++) {
+                if (coarse[i] > coarse[maxidx]) maxidx = i;
+            }
+            if (!(coarse[maxidx] > 0)) break;
+            coarse[maxidx] = 0;
+
+            const int coarse_row = (int) (maxidx / ncoarse);
+            const int first = coarse_row * factor - margin;
+            const int last = (coarse_row + 1) * factor + margin;
+            for (int r = first > 0 ? first : 0; r < last && r < nbins; r++) {
+                row_mask[r] = 1;
+            }
+        }
+    }
+    else {
+        memset(row_mask, 1, nbins);
+    }
+
+    int nselected = 0;
+    for (int r = 0; r < nbins; r++) {
+        if (row_mask[r]) rows[nselected++] = r;
+    }
+
+    hough_weighted_rows(&pts, weights, accum, rows, nselected, nbins, max_val);
+
+cleanup:
+    hough_points_free(&pts);
+    free(rows);
+    free(row_mask);
+    free(coarse);
+
+    return status;
 }
 
-void houghcircle(const double *restrict xy, const int nrows, const int ncols, int64_t *restrict accum, const int nbins,
-                 const double max_val)
+/* The batched functions process whole events in parallel, and each event is processed by a single thread. This
+   avoids starting a parallel region for each event, which costs more than the transform itself for small events.
+ */
+
+void houghline_batch(const double *restrict xy, const int ncols, const int64_t *restrict offsets, const int nevents,
+                     int64_t *restrict accums, const int nbins, const double max_val)
 {
-    const int firstRowIdx = 5;  // Must start at 5 since we compare x_i and x_(i-5) in the rad-finding function
-    hough_helper(xy, nrows, ncols, accum, nbins, max_val, &houghcircle_find_rad, firstRowIdx);
+    const size_t accum_size = (size_t) nbins * nbins;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int evt_idx = 0; evt_idx < nevents; evt_idx++) {
+        const double *evt_xy = xy + INDEX(offsets[evt_idx], 0, ncols);
+        const int nrows = (int) (offsets[evt_idx + 1] - offsets[evt_idx]);
+        hough_transform(evt_xy, nrows, ncols, accums + evt_idx * accum_size, nbins, max_val, HOUGH_LINE, 0);
+    }
 }
 
-void neighborcount(const double *restrict xy, const int nrows, const int ncols, int64_t *restrict counts, const double radius)
+void houghcircle_batch(const double *restrict xy, const int ncols, const int64_t *restrict offsets, const int nevents,
+                       double *restrict centers, const int nbins, const double max_val)
 {
-    const double rad2 = radius * radius;
+    const size_t accum_size = (size_t) nbins * nbins;
 
-    #pragma omp parallel for
-    for (size_t myidx = 0; myidx < nrows; myidx++) {
-        const double myX = xy[INDEX(myidx, 0, ncols)];
-        const double myY = xy[INDEX(myidx, 1, ncols)];
-        const double myZ = xy[INDEX(myidx, 2, ncols)];
+    #pragma omp parallel
+    {
+        // Each thread reuses one accumulator for all of its events
+        int64_t *accum = malloc(accum_size * sizeof(int64_t));
 
-        counts[myidx] = -1;  // Start at -1 to cancel out counting of self as neighbor
+        #pragma omp for schedule(dynamic)
+        for (int evt_idx = 0; evt_idx < nevents; evt_idx++) {
+            if (!accum) {
+                centers[INDEX(evt_idx, 0, 2)] = NAN;
+                centers[INDEX(evt_idx, 1, 2)] = NAN;
+                continue;
+            }
+            const double *evt_xy = xy + INDEX(offsets[evt_idx], 0, ncols);
+            const int nrows = (int) (offsets[evt_idx + 1] - offsets[evt_idx]);
 
-        for (size_t otheridx = 0; otheridx < nrows; otheridx++) {
-            const double otherX = xy[INDEX(otheridx, 0, ncols)];
-            const double otherY = xy[INDEX(otheridx, 1, ncols)];
-            const double otherZ = xy[INDEX(otheridx, 2, ncols)];
+            memset(accum, 0, accum_size * sizeof(int64_t));
+            hough_transform(evt_xy, nrows, ncols, accum, nbins, max_val, HOUGH_CIRCLE, 0);
+            houghcircle_center(accum, nbins, max_val, &centers[INDEX(evt_idx, 0, 2)], &centers[INDEX(evt_idx, 1, 2)]);
+        }
 
-            const double dx = myX - otherX;
-            const double dy = myY - otherY;
-            const double dz = myZ - otherZ;
-            const double dist2 = dx*dx + dy*dy + dz*dz;
+        free(accum);
+    }
+}
 
-            if (dist2 < rad2) {
-                counts[myidx] += 1;
-            }
-        }
+void neighborcount_batch(const double *restrict xy, const int ncols, const int64_t *restrict offsets,
+                         const int nevents, int64_t *restrict counts, const double radius)
+{
+    #pragma omp parallel for schedule(dynamic)
+    for (int evt_idx = 0; evt_idx < nevents; evt_idx++) {
+        const double *evt_xy = xy + INDEX(offsets[evt_idx], 0, ncols);
+        const int nrows = (int) (offsets[evt_idx + 1] - offsets[evt_idx]);
+        neighborcount_impl(evt_xy, nrows, ncols, counts + offsets[evt_idx], radius, 0);
     }
 }
@@ -9,6 +9,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
 
 #ifndef M_PI
@@ -18,6 +19,81 @@
 void houghline(const double *restrict xy, const int dim0, const int dim1, int64_t *restrict accum, const int nbins, const double max_val);
 void houghcircle(const double *restrict xy, const int dim0, const int dim1, int64_t *restrict accum, const int nbins, const double max_val);
 
+/* A weighted, coarse-to-fine version of `houghline`. The accumulator is first filled at a resolution of
+   nbins / coarse_factor bins in each dimension, and then only the full-resolution rows (angles) near the `ntop`
+   largest coarse bins are computed. Rows that are not refined are left unchanged. If coarse_factor <= 1, every row
+   is computed. Each point votes with its value in `weights`, or with weight 1 if `weights` is NULL.
+
+   This saves time, not memory. `accum` is still the full nbins x nbins array, and each refined row is computed
+   over its whole range of radii.
+
+   Returns 0 on success and -1 if the scratch space could not be allocated.
+ */
+int houghline_refined(const double *restrict xy, const int nrows, const int ncols, const double *restrict weights,
+                      double *restrict accum, const int nbins, const double max_val, const int coarse_factor,
+                      const int ntop);
+
+void houghcircle_center(const int64_t *restrict accum, const int nbins, const double max_val, double *cx, double *cy);
+
 void neighborcount(const double *restrict xy, const int nrows, const int ncols, int64_t *restrict counts, const double radius);
 
+/* Batched versions of the functions above. The events are stored one after another in `xy`, and the rows of event
+   `i` are `offsets[i]` to `offsets[i + 1]`, so `offsets` must have `nevents + 1` entries.
+ */
+void houghline_batch(const double *restrict xy, const int ncols, const int64_t *restrict offsets, const int nevents,
+                     int64_t *restrict accums, const int nbins, const double max_val);
+void houghcircle_batch(const double *restrict xy, const int ncols, const int64_t *restrict offsets, const int nevents,
+                       double *restrict centers, const int nbins, const double max_val);
+void neighborcount_batch(const double *restrict xy, const int ncols, const int64_t *restrict offsets,
+                         const int nevents, int64_t *restrict counts, const double radius);
+
+/* The parameters for `houghclean`. These have the same meanings as the attributes of the Python `HoughCleaner`. */
+typedef struct {
+    int peak_width;
+    double linear_hough_max;
+    int linear_hough_nbins;
+    double circle_hough_max;
+    int circle_hough_nbins;
+    int64_t min_pts_per_line;
+    double neighbor_radius;
+} HoughCleanConfig;
+
+/* Counters and stage timings from one call to `houghclean`. The times are wall clock times, in seconds. */
+typedef struct {
+    int64_t num_points;         // The number of points in the event
+    int64_t num_center_points;  // The number of points with enough neighbors to be used to find the center
+    int64_t num_lines_found;    // The number of peaks found in the linear Hough space slice
+    int64_t num_labeled;        // The number of points left on a line after the short lines are removed
+    double neighbor_count_time;
+    double find_center_time;
+    double linear_hough_time;
+    double classify_time;
+} HoughCleanStats;
+
+/* Run the full Hough space cleaning algorithm on one event. This is equivalent to `HoughCleaner.clean`.
+
+   The outputs `labels`, `mindists`, and `nn_counts` must each have `nrows` elements, and `center` must have 2.
+   If `stats` is not NULL, the counters and stage times are written to it. Otherwise, the stages aren't timed.
+   Returns 0 on success and -1 if the scratch space could not be allocated.
+ */
+int houghclean(const double *restrict xyz, const int nrows, const int ncols, const HoughCleanConfig *config,
+               int64_t *restrict labels, double *restrict mindists, int64_t *restrict nn_counts, double *center,
+               HoughCleanStats *stats);
+
+/* Single precision versions of the functions above. These take float points and write int32 accumulators, counts,
+   and labels. The results match the double precision versions except for points that land within rounding error
+   of a bin edge or of the neighbor radius. The circle center is still computed and returned in double precision.
+ */
+void houghline_f32(const float *restrict xy, const int dim0, const int dim1, int32_t *restrict accum, const int nbins,
+                   const float max_val);
+void houghcircle_f32(const float *restrict xy, const int dim0, const int dim1, int32_t *restrict accum,
+                     const int nbins, const float max_val);
+void houghcircle_center_f32(const int32_t *restrict accum, const int nbins, const double max_val, double *cx,
+                            double *cy);
+void neighborcount_f32(const float *restrict xy, const int nrows, const int ncols, int32_t *restrict counts,
+                       const float radius);
+int houghclean_f32(const float *restrict xyz, const int nrows, const int ncols, const HoughCleanConfig *config,
+                   int32_t *restrict labels, float *restrict mindists, int32_t *restrict nn_counts, double *center,
+                   HoughCleanStats *stats);
+
 #endif /* end of include guard: HOUGH_H */
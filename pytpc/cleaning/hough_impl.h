@@ -0,0 +1,708 @@
+/* hough_impl.h
+   The Hough transforms, neighbor count, and cleaning algorithm, written once for both precisions. This is included
+   twice by hough.c, which defines these macros before each inclusion:
+
+   - HOUGH_REAL: The type of the point data and the distances, either double or float.
+   - HOUGH_INT: The type of the accumulators, counts, and labels, either int64_t or int32_t.
+   - HOUGH_MATH(fn): The math function `fn` for HOUGH_REAL, e.g. floor or floorf.
+   - HOUGH_NAME(name): The public or file-local name of a function or type for this precision.
+
+   The angles and the circle center are computed in double precision for both versions, since they are only computed
+   once per bin or event. There is no include guard, on purpose.
+ */
+
+/* The point data needed by the kernels, in structure-of-arrays order.
+
+   For lines, `a` and `b` are the x and y positions, and the radius is a*cos(theta) + b*sin(theta).
+
+   For circles, `a` and `b` are the differences between the x and y positions of each point and the point 5 rows
+   before it, `numer` is the difference of their squared magnitudes, and the radius is
+   numer / (2 * (a*cos(theta) + b*sin(theta))).
+ */
+typedef struct {
+    HOUGH_REAL *a;
+    HOUGH_REAL *b;
+    HOUGH_REAL *numer;
+    int npts;
+} HOUGH_NAME(HoughPoints);
+
+/* Convert a radius to its bin in the accumulator. Radii outside [-max_val, max_val) are given bin -1. */
+static inline int32_t HOUGH_NAME(hough_rad_to_bin)(const HOUGH_REAL rad, const int nbins, const HOUGH_REAL max_val)
+{
+    const int inrange = rad >= -max_val && rad < max_val;
+    const HOUGH_REAL safe_rad = inrange ? rad : -max_val;  // Avoid converting NaN or inf to an integer
+    const int32_t radbin = (int32_t) HOUGH_MATH(floor)((safe_rad + max_val) * nbins / (2 * max_val));
+    return inrange ? (radbin < nbins ? radbin : nbins - 1) : -1;
+}
+
+/* Find the accumulator bin of each point in a block for one angle. These are written without branches so the
+   compiler can vectorize them.
+ */
+HOUGH_KERNEL
+static void HOUGH_NAME(hough_bin_line_block)(const HOUGH_REAL *restrict a, const HOUGH_REAL *restrict b, const int npts,
+                                 const HOUGH_REAL costh, const HOUGH_REAL sinth, const int nbins, const HOUGH_REAL max_val,
+                                 int32_t *restrict bins)
+{
+    for (int i = 0; i < npts; i++) {
+        const HOUGH_REAL rad = a[i] * costh + b[i] * sinth;
+        bins[i] = HOUGH_NAME(hough_rad_to_bin)(rad, nbins, max_val);
+    }
+}
+
+HOUGH_KERNEL
+static void HOUGH_NAME(hough_bin_circle_block)(const HOUGH_REAL *restrict a, const HOUGH_REAL *restrict b, const HOUGH_REAL *restrict numer,
+                                   const int npts, const HOUGH_REAL costh, const HOUGH_REAL sinth, const int nbins,
+                                   const HOUGH_REAL max_val, int32_t *restrict bins)
+{
+    for (int i = 0; i < npts; i++) {
+        const HOUGH_REAL rad = numer[i] / (2 * (a[i] * costh + b[i] * sinth));
+        bins[i] = HOUGH_NAME(hough_rad_to_bin)(rad, nbins, max_val);
+    }
+}
+
+/* Fill the SoA point arrays for the given transform. Returns 0 on success, or nonzero if allocation failed. */
+static int HOUGH_NAME(hough_points_init)(HOUGH_NAME(HoughPoints) *pts, const HOUGH_REAL *restrict xy, const int nrows, const int ncols,
+                             const HoughKind kind)
+{
+    // The circle transform compares each point to the one 5 rows before it, so the first 5 rows have no radius
+    const int firstRowIdx = kind == HOUGH_CIRCLE ? 5 : 0;
+    const int npts = nrows > firstRowIdx ? nrows - firstRowIdx : 0;
+
+    // Allocate one extra byte so that malloc(0) returning NULL isn't mistaken for a failure
+    pts->npts = npts;
+    pts->a = malloc(npts * sizeof(HOUGH_REAL) + 1);
+    pts->b = malloc(npts * sizeof(HOUGH_REAL) + 1);
+    pts->numer = kind == HOUGH_CIRCLE ? malloc(npts * sizeof(HOUGH_REAL) + 1) : NULL;
+
+    if (!pts->a || !pts->b || (kind == HOUGH_CIRCLE && !pts->numer)) {
+        free(pts->a);
+        free(pts->b);
+        free(pts->numer);
+        return 1;
+    }
+
+    for (int i = 0; i < npts; i++) {
+        const int rowIdx = i + firstRowIdx;
+        if (kind == HOUGH_LINE) {
+            pts->a[i] = xy[INDEX(rowIdx, 0, ncols)];
+            pts->b[i] = xy[INDEX(rowIdx, 1, ncols)];
+        }
+        else {
+            const HOUGH_REAL x1 = xy[INDEX(rowIdx,     0, ncols)];
+            const HOUGH_REAL x0 = xy[INDEX(rowIdx - 5, 0, ncols)];
+            const HOUGH_REAL y1 = xy[INDEX(rowIdx,     1, ncols)];
+            const HOUGH_REAL y0 = xy[INDEX(rowIdx - 5, 1, ncols)];
+
+            pts->numer[i] = (x1*x1 - x0*x0) + (y1*y1 - y0*y0);
+            pts->a[i] = x1 - x0;
+            pts->b[i] = y1 - y0;
+        }
+    }
+
+    return 0;
+}
+
+static void HOUGH_NAME(hough_points_free)(HOUGH_NAME(HoughPoints) *pts)
+{
+    free(pts->a);
+    free(pts->b);
+    free(pts->numer);
+}
+
+/* A helper function that does the actual computation. Both of the front-end Hough transform functions call
+   this with the appropriate kind of transform. Since this is inlined into each front-end with a constant `kind`,
+   the choice of radius kernel is made at compile time.
+
+   Parameters:
+   - pts: The prepared point data.
+   - accum: An output array for the Hough transform accumulator (the Hough space map). Dimension must be nbins x nbins.
+     The counts are added to the values already in this array.
+   - nbins: The number of bins to use in each dimension of the accumulator.
+   - max_val: Max radius value in Hough space. The space is symmetric about 0, so the min radius is -max_val.
+   - kind: The type of transform to compute.
+   - parallel: If nonzero, split the angles between OpenMP threads. This is turned off when the caller is already
+     processing several events in parallel.
+ */
+static inline void HOUGH_NAME(hough_helper)(const HOUGH_NAME(HoughPoints) *pts, HOUGH_INT *restrict accum, const int nbins,
+                                const HOUGH_REAL max_val, const HoughKind kind, const int parallel)
+{
+    const double thstep = M_PI / nbins;  // Size of theta (angle) bins
+    const int ntiles = (nbins + HOUGH_THETA_TILE - 1) / HOUGH_THETA_TILE;
+
+    #pragma omp parallel if(parallel)
+    {
+        // Thread-local accumulator rows for one tile. If this can't be allocated, fall back to filling accum directly.
+        int32_t *tile_rows = malloc(HOUGH_THETA_TILE * nbins * sizeof(int32_t));
+        int32_t bins[HOUGH_BLOCK_SIZE];
+
+        #pragma omp for schedule(dynamic)
+        for (int tile_idx = 0; tile_idx < ntiles; tile_idx++) {
+            const int first_theta = tile_idx * HOUGH_THETA_TILE;
+            const int tile_len = nbins - first_theta < HOUGH_THETA_TILE ? nbins - first_theta : HOUGH_THETA_TILE;
+
+            // Precompute sin and cos here so they aren't done for each block
+            HOUGH_REAL costh[HOUGH_THETA_TILE];
+            HOUGH_REAL sinth[HOUGH_THETA_TILE];
+            for (int t = 0; t < tile_len; t++) {
+                const double theta = (first_theta + t) * thstep;
+                costh[t] = cos(theta);
+                sinth[t] = sin(theta);
+            }
+
+            if (tile_rows) memset(tile_rows, 0, tile_len * nbins * sizeof(int32_t));
+
+            for (int block_start = 0; block_start < pts->npts; block_start += HOUGH_BLOCK_SIZE) {
+                const int block_len = pts->npts - block_start < HOUGH_BLOCK_SIZE ?
+                                      pts->npts - block_start : HOUGH_BLOCK_SIZE;
+
+                for (int t = 0; t < tile_len; t++) {
+                    if (kind == HOUGH_LINE) {
+                        HOUGH_NAME(hough_bin_line_block)(pts->a + block_start, pts->b + block_start, block_len,
+                                             costh[t], sinth[t], nbins, max_val, bins);
+                    }
+                    else {
+                        HOUGH_NAME(hough_bin_circle_block)(pts->a + block_start, pts->b + block_start, pts->numer + block_start,
+                                               block_len, costh[t], sinth[t], nbins, max_val, bins);
+                    }
+
+                    // Increment the histogram/accumulator bin corresponding to each radius
+                    if (tile_rows) {
+                        int32_t *restrict row = tile_rows + INDEX(t, 0, nbins);
+                        for (int i = 0; i < block_len; i++) {
+                            if (bins[i] >= 0) row[bins[i]] += 1;
+                        }
+                    }
+                    else {
+                        HOUGH_INT *restrict row = accum + INDEX(first_theta + t, 0, nbins);
+                        for (int i = 0; i < block_len; i++) {
+                            if (bins[i] >= 0) row[bins[i]] += 1;
+                        }
+                    }
+                }
+            }
+
+            if (tile_rows) {
+                for (int t = 0; t < tile_len; t++) {
+                    for (int j = 0; j < nbins; j++) {
+                        accum[INDEX(first_theta + t, j, nbins)] += tile_rows[INDEX(t, j, nbins)];
+                    }
+                }
+            }
+        }
+
+        free(tile_rows);
+    }
+}
+
+/* A scalar version of the transform that works directly on xy. This is used if the SoA point arrays can't be
+   allocated.
+ */
+static void HOUGH_NAME(hough_scalar)(const HOUGH_REAL *restrict xy, const int nrows, const int ncols, HOUGH_INT *restrict accum,
+                         const int nbins, const HOUGH_REAL max_val, const HoughKind kind, const int parallel)
+{
+    const double thstep = M_PI / nbins;
+    const int firstRowIdx = kind == HOUGH_CIRCLE ? 5 : 0;
+
+    #pragma omp parallel for if(parallel)
+    for (int theta_idx = 0; theta_idx < nbins; theta_idx++) {
+        const HOUGH_REAL costh = cos(theta_idx * thstep);
+        const HOUGH_REAL sinth = sin(theta_idx * thstep);
+
+        for (int rowIdx = firstRowIdx; rowIdx < nrows; rowIdx++) {
+            HOUGH_REAL rad;
+            if (kind == HOUGH_LINE) {
+                rad = xy[INDEX(rowIdx, 0, ncols)] * costh + xy[INDEX(rowIdx, 1, ncols)] * sinth;
+            }
+            else {
+                const HOUGH_REAL x1 = xy[INDEX(rowIdx,     0, ncols)];
+                const HOUGH_REAL x0 = xy[INDEX(rowIdx - 5, 0, ncols)];
+                const HOUGH_REAL y1 = xy[INDEX(rowIdx,     1, ncols)];
+                const HOUGH_REAL y0 = xy[INDEX(rowIdx - 5, 1, ncols)];
+                rad = ((x1*x1 - x0*x0) + (y1*y1 - y0*y0)) / (2 * ((x1 - x0) * costh + (y1 - y0) * sinth));
+            }
+
+            const int32_t radbin = HOUGH_NAME(hough_rad_to_bin)(rad, nbins, max_val);
+            if (radbin >= 0) accum[INDEX(theta_idx, radbin, nbins)] += 1;
+        }
+    }
+}
+
+static void HOUGH_NAME(hough_transform)(const HOUGH_REAL *restrict xy, const int nrows, const int ncols, HOUGH_INT *restrict accum,
+                            const int nbins, const HOUGH_REAL max_val, const HoughKind kind, const int parallel)
+{
+    HOUGH_NAME(HoughPoints) pts;
+    if (HOUGH_NAME(hough_points_init)(&pts, xy, nrows, ncols, kind) != 0) {
+        HOUGH_NAME(hough_scalar)(xy, nrows, ncols, accum, nbins, max_val, kind, parallel);
+        return;
+    }
+    if (kind == HOUGH_LINE) {
+        HOUGH_NAME(hough_helper)(&pts, accum, nbins, max_val, HOUGH_LINE, parallel);
+    }
+    else {
+        HOUGH_NAME(hough_helper)(&pts, accum, nbins, max_val, HOUGH_CIRCLE, parallel);
+    }
+    HOUGH_NAME(hough_points_free)(&pts);
+}
+
+void HOUGH_NAME(houghline)(const HOUGH_REAL *restrict xy, const int nrows, const int ncols, HOUGH_INT *restrict accum, const int nbins,
+               const HOUGH_REAL max_val)
+{
+    HOUGH_NAME(hough_transform)(xy, nrows, ncols, accum, nbins, max_val, HOUGH_LINE, 1);
+}
+
+void HOUGH_NAME(houghcircle)(const HOUGH_REAL *restrict xy, const int nrows, const int ncols, HOUGH_INT *restrict accum, const int nbins,
+                 const HOUGH_REAL max_val)
+{
+    HOUGH_NAME(hough_transform)(xy, nrows, ncols, accum, nbins, max_val, HOUGH_CIRCLE, 1);
+}
+
+void HOUGH_NAME(houghcircle_center)(const HOUGH_INT *restrict accum, const int nbins, const double max_val, double *cx, double *cy)
+{
+    // Find the first maximum bin, in row-major order
+    size_t maxidx = 0;
+    for (size_t i = 1; i < (size_t) nbins * nbins; i++) {
+        if (accum[i] > accum[maxidx]) maxidx = i;
+    }
+    const size_t imax = maxidx / nbins;
+    const size_t jmax = maxidx % nbins;
+
+    // Convert max bin to theta, radius values
+    const double tRad = imax * M_PI / nbins;
+    const double rRad = jmax * 2 * max_val / nbins - max_val;
+
+    // Convert theta, r to positions in xy space
+    *cx = rRad * cos(tRad);
+    *cy = rRad * sin(tRad);
+}
+
+/* Brute-force neighbor count. This is O(N^2), so it is only used as a fallback when the grid can't be built (e.g.
+   if the data contains non-finite values or the radius is not positive).
+ */
+static void HOUGH_NAME(neighborcount_brute)(const HOUGH_REAL *restrict xy, const int nrows, const int ncols, HOUGH_INT *restrict counts,
+                                const HOUGH_REAL radius, const int parallel)
+{
+    const HOUGH_REAL rad2 = radius * radius;
+
+    #pragma omp parallel for if(parallel)
+    for (int myidx = 0; myidx < nrows; myidx++) {
+        const HOUGH_REAL myX = xy[INDEX(myidx, 0, ncols)];
+        const HOUGH_REAL myY = xy[INDEX(myidx, 1, ncols)];
+        const HOUGH_REAL myZ = xy[INDEX(myidx, 2, ncols)];
+
+        counts[myidx] = -1;  // Start at -1 to cancel out counting of self as neighbor
+
+        for (int otheridx = 0; otheridx < nrows; otheridx++) {
+            const HOUGH_REAL otherX = xy[INDEX(otheridx, 0, ncols)];
+            const HOUGH_REAL otherY = xy[INDEX(otheridx, 1, ncols)];
+            const HOUGH_REAL otherZ = xy[INDEX(otheridx, 2, ncols)];
+
+            const HOUGH_REAL dx = myX - otherX;
+            const HOUGH_REAL dy = myY - otherY;
+            const HOUGH_REAL dz = myZ - otherZ;
+            const HOUGH_REAL dist2 = dx*dx + dy*dy + dz*dz;
+
+            if (dist2 < rad2) {
+                counts[myidx] += 1;
+            }
+        }
+    }
+}
+
+/* A uniform grid of cubic cells used to find neighbors quickly. The cells are at least `radius` wide, so all of the
+   neighbors of a point are in the 3x3x3 block of cells around the point's own cell.
+
+   The points are stored sorted by cell (in SoA order) so the points in one cell are contiguous in memory. The points
+   in cell `c` are at positions `cell_start[c]` to `cell_start[c + 1]` in the sorted arrays.
+ */
+typedef struct {
+    double mins[3];     // Lower corner of the grid
+    double cellsize;    // Edge length of each cell
+    size_t dims[3];     // Number of cells in each dimension
+    size_t *cell_start; // Start of each cell in the sorted arrays. Length is (number of cells + 1).
+    size_t *cell_of;    // Cell of each point, in the original order
+    HOUGH_REAL *sorted[3];  // The x, y, and z coordinates sorted by cell
+} HOUGH_NAME(NeighborGrid);
+
+
+static size_t HOUGH_NAME(ngrid_cell_coord)(const HOUGH_NAME(NeighborGrid) *grid, const int dim, const double val)
+{
+    size_t c = (size_t) floor((val - grid->mins[dim]) / grid->cellsize);
+    return c < grid->dims[dim] ? c : grid->dims[dim] - 1;
+}
+
+static void HOUGH_NAME(ngrid_free)(HOUGH_NAME(NeighborGrid) *grid)
+{
+    free(grid->cell_start);
+    free(grid->cell_of);
+    for (int d = 0; d < 3; d++) free(grid->sorted[d]);
+}
+
+/* Build the grid. Returns 0 on success, and nonzero if the grid could not be built. In case of failure, the grid
+   does not need to be freed.
+ */
+static int HOUGH_NAME(ngrid_build)(HOUGH_NAME(NeighborGrid) *grid, const HOUGH_REAL *restrict xy, const int nrows, const int ncols,
+                       const HOUGH_REAL radius)
+{
+    double maxs[3];
+    *grid = (HOUGH_NAME(NeighborGrid)) {0};
+
+    if (!(radius > 0) || !isfinite(radius) || nrows <= 0) return 1;
+
+    for (int d = 0; d < 3; d++) {
+        grid->mins[d] = INFINITY;
+        maxs[d] = -INFINITY;
+    }
+    for (int i = 0; i < nrows; i++) {
+        for (int d = 0; d < 3; d++) {
+            const double val = xy[INDEX(i, d, ncols)];
+            if (!isfinite(val)) return 1;
+            if (val < grid->mins[d]) grid->mins[d] = val;
+            if (val > maxs[d]) maxs[d] = val;
+        }
+    }
+
+    // Grow the cells if needed so the number of cells stays proportional to the number of points
+    const double max_cells = (double) nrows * NGRID_MAX_CELLS_PER_POINT + 1;
+    grid->cellsize = radius * (1 + 1e-6);  // Slightly enlarged to guard against rounding at cell edges
+    double ncells;
+    for (;;) {
+        ncells = 1;
+        for (int d = 0; d < 3; d++) {
+            ncells *= floor((maxs[d] - grid->mins[d]) / grid->cellsize) + 1;
+        }
+        if (ncells <= max_cells) break;
+        grid->cellsize *= 1.5;
+    }
+    for (int d = 0; d < 3; d++) {
+        grid->dims[d] = (size_t) floor((maxs[d] - grid->mins[d]) / grid->cellsize) + 1;
+    }
+    const size_t num_cells = grid->dims[0] * grid->dims[1] * grid->dims[2];
+
+    grid->cell_start = calloc(num_cells + 1, sizeof(size_t));
+    grid->cell_of = malloc(nrows * sizeof(size_t));
+    for (int d = 0; d < 3; d++) grid->sorted[d] = malloc(nrows * sizeof(HOUGH_REAL));
+    if (!grid->cell_start || !grid->cell_of || !grid->sorted[0] || !grid->sorted[1] || !grid->sorted[2]) {
+        HOUGH_NAME(ngrid_free)(grid);
+        return 1;
+    }
+
+    // Counting sort of the points by cell
+    for (int i = 0; i < nrows; i++) {
+        const size_t cx = HOUGH_NAME(ngrid_cell_coord)(grid, 0, xy[INDEX(i, 0, ncols)]);
+        const size_t cy = HOUGH_NAME(ngrid_cell_coord)(grid, 1, xy[INDEX(i, 1, ncols)]);
+        const size_t cz = HOUGH_NAME(ngrid_cell_coord)(grid, 2, xy[INDEX(i, 2, ncols)]);
+        const size_t cell = (cx * grid->dims[1] + cy) * grid->dims[2] + cz;
+        grid->cell_of[i] = cell;
+        grid->cell_start[cell + 1]++;
+    }
+    for (size_t c = 0; c < num_cells; c++) {
+        grid->cell_start[c + 1] += grid->cell_start[c];
+    }
+    // Use cell_start as the insertion cursor for each cell, then shift it back afterwards
+    for (int i = 0; i < nrows; i++) {
+        const size_t pos = grid->cell_start[grid->cell_of[i]]++;
+        for (int d = 0; d < 3; d++) grid->sorted[d][pos] = xy[INDEX(i, d, ncols)];
+    }
+    for (size_t c = num_cells; c > 0; c--) {
+        grid->cell_start[c] = grid->cell_start[c - 1];
+    }
+    grid->cell_start[0] = 0;
+
+    return 0;
+}
+
+/* Count the neighbors of each point using the grid. The distance is computed the same way as in the brute-force
+   version, so the counts are identical.
+ */
+static void HOUGH_NAME(ngrid_count)(const HOUGH_NAME(NeighborGrid) *grid, const HOUGH_REAL *restrict xy, const int nrows, const int ncols,
+                        HOUGH_INT *restrict counts, const HOUGH_REAL radius, const int parallel)
+{
+    const HOUGH_REAL rad2 = radius * radius;
+    const size_t *dims = grid->dims;
+    const HOUGH_REAL *restrict sx = grid->sorted[0];
+    const HOUGH_REAL *restrict sy = grid->sorted[1];
+    const HOUGH_REAL *restrict sz = grid->sorted[2];
+
+    #pragma omp parallel for schedule(dynamic, 256) if(parallel)
+    for (int myidx = 0; myidx < nrows; myidx++) {
+        const HOUGH_REAL myX = xy[INDEX(myidx, 0, ncols)];
+        const HOUGH_REAL myY = xy[INDEX(myidx, 1, ncols)];
+        const HOUGH_REAL myZ = xy[INDEX(myidx, 2, ncols)];
+
+        const size_t cell = grid->cell_of[myidx];
+        const size_t cz = cell % dims[2];
+        const size_t cy = (cell / dims[2]) % dims[1];
+        const size_t cx = cell / (dims[2] * dims[1]);
+
+        HOUGH_INT count = -1;  // Start at -1 to cancel out counting of self as neighbor
+
+        for (size_t ix = (cx > 0 ? cx - 1 : 0); ix <= cx + 1 && ix < dims[0]; ix++) {
+            for (size_t iy = (cy > 0 ? cy - 1 : 0); iy <= cy + 1 && iy < dims[1]; iy++) {
+                // The cells along z are adjacent in memory, so scan the whole z range in one go
+                const size_t zfirst = cz > 0 ? cz - 1 : 0;
+                const size_t zlast = cz + 1 < dims[2] ? cz + 1 : dims[2] - 1;
+                const size_t rowbase = (ix * dims[1] + iy) * dims[2];
+                const size_t first = grid->cell_start[rowbase + zfirst];
+                const size_t last = grid->cell_start[rowbase + zlast + 1];
+
+                for (size_t j = first; j < last; j++) {
+                    const HOUGH_REAL dx = myX - sx[j];
+                    const HOUGH_REAL dy = myY - sy[j];
+                    const HOUGH_REAL dz = myZ - sz[j];
+                    const HOUGH_REAL dist2 = dx*dx + dy*dy + dz*dz;
+
+                    count += (dist2 < rad2);
+                }
+            }
+        }
+
+        counts[myidx] = count;
+    }
+}
+
+static void HOUGH_NAME(neighborcount_impl)(const HOUGH_REAL *restrict xy, const int nrows, const int ncols, HOUGH_INT *restrict counts,
+                               const HOUGH_REAL radius, const int parallel)
+{
+    HOUGH_NAME(NeighborGrid) grid;
+
+    if (HOUGH_NAME(ngrid_build)(&grid, xy, nrows, ncols, radius) != 0) {
+        HOUGH_NAME(neighborcount_brute)(xy, nrows, ncols, counts, radius, parallel);
+        return;
+    }
+
+    HOUGH_NAME(ngrid_count)(&grid, xy, nrows, ncols, counts, radius, parallel);
+    HOUGH_NAME(ngrid_free)(&grid);
+}
+
+void HOUGH_NAME(neighborcount)(const HOUGH_REAL *restrict xy, const int nrows, const int ncols, HOUGH_INT *restrict counts, const HOUGH_REAL radius)
+{
+    HOUGH_NAME(neighborcount_impl)(xy, nrows, ncols, counts, radius, 1);
+}
+
+/* Find the row of the linear Hough space containing the peaks. This is the floor of the mean row index of the
+   HOUGH_MAX_ANGLE_NPEAKS largest bins, which are found with a partial selection rather than a full sort. Ties are
+   broken in favor of the later bin, which matches the stable (mergesort) argsort in
+   `HoughCleaner.find_hough_max_angle`.
+ */
+static int HOUGH_NAME(houghclean_max_angle_row)(const HOUGH_INT *restrict lin_space, const int nbins)
+{
+    size_t top[HOUGH_MAX_ANGLE_NPEAKS];  // Indices of the largest bins, in decreasing order
+    int ntop = 0;
+    const size_t size = (size_t) nbins * nbins;
+
+    for (size_t idx = 0; idx < size; idx++) {
+        const HOUGH_INT val = lin_space[idx];
+        if (ntop == HOUGH_MAX_ANGLE_NPEAKS && val < lin_space[top[ntop - 1]]) continue;
+
+        // Insert idx into the sorted list, keeping the later index first if the values are equal
+        int pos = ntop < HOUGH_MAX_ANGLE_NPEAKS ? ntop++ : ntop - 1;
+        while (pos > 0 && val >= lin_space[top[pos - 1]]) {
+            top[pos] = top[pos - 1];
+            pos--;
+        }
+        top[pos] = idx;
+    }
+
+    if (ntop == 0) return 0;
+
+    size_t rowsum = 0;
+    for (int i = 0; i < ntop; i++) {
+        rowsum += top[i] / nbins;
+    }
+    return (int) (rowsum / ntop);
+}
+
+/* Sum the rows of the linear Hough space in [thmax - 5, thmax + 5) and zero any bins below the noise threshold.
+   The row range follows Python slicing rules to match `HoughCleaner.find_hough_max_angle`.
+ */
+static void HOUGH_NAME(houghclean_slice)(const HOUGH_INT *restrict lin_space, const int nbins, const int thmax,
+                             HOUGH_INT *restrict hough_slice)
+{
+    int first = thmax - 5;
+    if (first < 0) first = first + nbins > 0 ? first + nbins : 0;
+    const int last = thmax + 5 < nbins ? thmax + 5 : nbins;
+
+    memset(hough_slice, 0, nbins * sizeof(HOUGH_INT));
+    for (int i = first; i < last; i++) {
+        for (int j = 0; j < nbins; j++) {
+            hough_slice[j] += lin_space[INDEX(i, j, nbins)];
+        }
+    }
+
+    for (int j = 0; j < nbins; j++) {
+        if (hough_slice[j] < 60) hough_slice[j] = 0;
+    }
+}
+
+/* Find the center of gravity of each peak in the Hough space slice. This matches `HoughCleaner.find_peaks`: a
+   peak is a positive bin that is >= its neighbors within 2 bins (clipping at the edges), and a peak is dropped if
+   its value is the same as the next peak's (wrapping around at the end). Returns the number of peaks found.
+ */
+static int HOUGH_NAME(houghclean_find_peaks)(const HOUGH_INT *restrict data, const int n, const int peak_width,
+                                 int *restrict maxima, double *restrict pkctrs)
+{
+    const int order = 2;
+    int nmaxima = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (data[i] <= 0) continue;
+        int is_max = 1;
+        for (int shift = 1; shift <= order && is_max; shift++) {
+            const int plus = i + shift < n ? i + shift : n - 1;
+            const int minus = i - shift > 0 ? i - shift : 0;
+            is_max = data[i] >= data[plus] && data[i] >= data[minus];
+        }
+        if (is_max) maxima[nmaxima++] = i;
+    }
+
+    int npeaks = 0;
+    for (int k = 0; k < nmaxima; k++) {
+        const int m = maxima[k];
+        if (data[m] == data[maxima[(k + 1) % nmaxima]]) continue;
+
+        const int first = m - peak_width > 0 ? m - peak_width : 0;
+        const int last = m + peak_width < n ? m + peak_width : n;
+        int64_t weighted_sum = 0;
+        int64_t sum = 0;
+        for (int j = first; j < last; j++) {
+            weighted_sum += data[j] * j;
+            sum += data[j];
+        }
+        pkctrs[npeaks++] = (double) weighted_sum / sum;
+    }
+
+    return npeaks;
+}
+
+int HOUGH_NAME(houghclean)(const HOUGH_REAL *restrict xyz, const int nrows, const int ncols, const HoughCleanConfig *config,
+               HOUGH_INT *restrict labels, HOUGH_REAL *restrict mindists, HOUGH_INT *restrict nn_counts, double *center,
+               HoughCleanStats *stats)
+{
+    const int lin_nbins = config->linear_hough_nbins;
+    const int circ_nbins = config->circle_hough_nbins;
+    const size_t lin_size = (size_t) lin_nbins * lin_nbins;
+    const size_t circ_size = (size_t) circ_nbins * circ_nbins;
+    int status = 0;
+
+    // All of the scratch space is allocated at once. The largest parts are the two Hough accumulators.
+    HOUGH_REAL *ctr_xy = malloc(nrows * 2 * sizeof(HOUGH_REAL) + 1);       // Points with enough neighbors, for the center
+    HOUGH_REAL *lin_xy = malloc(nrows * 2 * sizeof(HOUGH_REAL) + 1);       // (z, arclength) pairs
+    HOUGH_INT *accum = calloc(lin_size > circ_size ? lin_size : circ_size, sizeof(HOUGH_INT));
+    HOUGH_INT *hough_slice = malloc(lin_nbins * sizeof(HOUGH_INT) + 1);
+    int *maxima = malloc(lin_nbins * sizeof(int) + 1);
+    double *radii = malloc(lin_nbins * sizeof(double) + 1);
+    int64_t *line_counts = calloc(lin_nbins + 1, sizeof(int64_t));
+
+    if (!ctr_xy || !lin_xy || !accum || !hough_slice || !maxima || !radii || !line_counts) {
+        status = -1;
+        goto cleanup;
+    }
+
+    double tstart = stats ? hough_wtime() : 0;
+    double tnow;
+
+    // Nearest neighbor count. This is used both for the center finding and as an output.
+    HOUGH_NAME(neighborcount)(xyz, nrows, ncols, nn_counts, config->neighbor_radius);
+
+    if (stats) {
+        tnow = hough_wtime();
+        stats->neighbor_count_time = tnow - tstart;
+        tstart = tnow;
+    }
+
+    // Find the center using only points that have neighbors
+    int nctr = 0;
+    for (int i = 0; i < nrows; i++) {
+        if (nn_counts[i] > 1) {
+            ctr_xy[INDEX(nctr, 0, 2)] = xyz[INDEX(i, 0, ncols)];
+            ctr_xy[INDEX(nctr, 1, 2)] = xyz[INDEX(i, 1, ncols)];
+            nctr++;
+        }
+    }
+    double cu, cv;
+    HOUGH_NAME(houghcircle)(ctr_xy, nctr, 2, accum, circ_nbins, config->circle_hough_max);
+    HOUGH_NAME(houghcircle_center)(accum, circ_nbins, config->circle_hough_max, &cu, &cv);
+    center[0] = cu;
+    center[1] = cv;
+
+    if (stats) {
+        tnow = hough_wtime();
+        stats->find_center_time = tnow - tstart;
+        tstart = tnow;
+    }
+
+    // Find the arclength (r-phi) of each point. The arclengths are stored in column 1 of lin_xy.
+    for (int i = 0; i < nrows; i++) {
+        const HOUGH_REAL du = xyz[INDEX(i, 0, ncols)] - cu;
+        const HOUGH_REAL dv = xyz[INDEX(i, 1, ncols)] - cv;
+        lin_xy[INDEX(i, 0, 2)] = xyz[INDEX(i, 2, ncols)];
+        lin_xy[INDEX(i, 1, 2)] = HOUGH_MATH(sqrt)(du*du + dv*dv) * HOUGH_MATH(atan)(dv / du);
+    }
+
+    // Linear Hough transform, and the angle of the lines
+    memset(accum, 0, lin_size * sizeof(HOUGH_INT));
+    HOUGH_NAME(houghline)(lin_xy, nrows, 2, accum, lin_nbins, config->linear_hough_max);
+
+    const int thmax = HOUGH_NAME(houghclean_max_angle_row)(accum, lin_nbins);
+    const double theta_max = thmax * M_PI / lin_nbins;
+    HOUGH_NAME(houghclean_slice)(accum, lin_nbins, thmax, hough_slice);
+
+    // Find the Hough space radius corresponding to each line
+    const int npeaks = HOUGH_NAME(houghclean_find_peaks)(hough_slice, lin_nbins, config->peak_width, maxima, radii);
+    for (int k = 0; k < npeaks; k++) {
+        radii[k] = radii[k] * config->linear_hough_max * 2 / lin_nbins - config->linear_hough_max;
+    }
+
+    if (stats) {
+        tnow = hough_wtime();
+        stats->linear_hough_time = tnow - tstart;
+        tstart = tnow;
+    }
+
+    // Identify which line (if any) each point belongs to
+    const HOUGH_REAL costh = cos(theta_max);
+    const HOUGH_REAL sinth = sin(theta_max);
+    for (int i = 0; i < nrows; i++) {
+        const HOUGH_REAL z = lin_xy[INDEX(i, 0, 2)];
+        const HOUGH_REAL arclen = lin_xy[INDEX(i, 1, 2)];
+        labels[i] = -1;
+        mindists[i] = INFINITY;
+
+        for (int k = 0; k < npeaks; k++) {
+            const HOUGH_REAL dist = HOUGH_MATH(fabs)(((HOUGH_REAL) radii[k] - z * costh) / sinth - arclen);
+            if (dist < mindists[i]) {
+                labels[i] = k;
+                mindists[i] = dist;
+            }
+        }
+        if (labels[i] >= 0) line_counts[labels[i]]++;
+    }
+
+    // Remove lines with too few points
+    int64_t nlabeled = 0;
+    for (int i = 0; i < nrows; i++) {
+        if (labels[i] >= 0 && line_counts[labels[i]] < config->min_pts_per_line) {
+            labels[i] = -1;
+        }
+        if (labels[i] >= 0) nlabeled++;
+    }
+
+    if (stats) {
+        stats->classify_time = hough_wtime() - tstart;
+        stats->num_points = nrows;
+        stats->num_center_points = nctr;
+        stats->num_lines_found = npeaks;
+        stats->num_labeled = nlabeled;
+    }
+
+cleanup:
+    free(ctr_xy);
+    free(lin_xy);
+    free(accum);
+    free(hough_slice);
+    free(maxima);
+    free(radii);
+    free(line_counts);
+
+    return status;
+}
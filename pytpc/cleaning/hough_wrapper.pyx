@@ -2,22 +2,89 @@
 
 A Cython wrapper around `hough.c` that provides the Hough transform functions.
 
+The functions that take a single event accept either float64 or float32 data. For float32 data, the single
+precision versions of the C functions are used, and the accumulators, counts, and labels are int32.
+
 """
 
 import numpy as np
 cimport numpy as np
 import cython
-from libc.stdint cimport int64_t
-from libc.math cimport sin, cos, M_PI
+from libc.stdint cimport int32_t, int64_t
+
+ctypedef fused real_t:
+    float
+    double
 
 
-cdef extern from "hough.h":
+cdef extern from "hough.h" nogil:
     void houghline(const double *xy, const int dim0, const int dim1, int64_t *accum, const int nbins, const double max_val)
     void houghcircle(const double *xy, const int dim0, const int dim1, int64_t *accum, const int nbins, const double max_val)
+    void houghcircle_center(const int64_t *accum, const int nbins, const double max_val, double *cx, double *cy)
+    int houghline_refined(const double *xy, const int nrows, const int ncols, const double *weights,
+                          double *accum, const int nbins, const double max_val, const int coarse_factor,
+                          const int ntop)
     void neighborcount(const double *xy, const int nrows, const int ncols, int64_t *counts, const double radius)
 
+    void houghline_batch(const double *xy, const int ncols, const int64_t *offsets, const int nevents,
+                         int64_t *accums, const int nbins, const double max_val)
+    void houghcircle_batch(const double *xy, const int ncols, const int64_t *offsets, const int nevents,
+                           double *centers, const int nbins, const double max_val)
+    void neighborcount_batch(const double *xy, const int ncols, const int64_t *offsets, const int nevents,
+                             int64_t *counts, const double radius)
+
+    ctypedef struct HoughCleanConfig:
+        int peak_width
+        double linear_hough_max
+        int linear_hough_nbins
+        double circle_hough_max
+        int circle_hough_nbins
+        int64_t min_pts_per_line
+        double neighbor_radius
+
+    ctypedef struct HoughCleanStats:
+        int64_t num_points
+        int64_t num_center_points
+        int64_t num_lines_found
+        int64_t num_labeled
+        double neighbor_count_time
+        double find_center_time
+        double linear_hough_time
+        double classify_time
+
+    int houghclean(const double *xyz, const int nrows, const int ncols, const HoughCleanConfig *config,
+                   int64_t *labels, double *mindists, int64_t *nn_counts, double *center, HoughCleanStats *stats)
+
+    void houghline_f32(const float *xy, const int dim0, const int dim1, int32_t *accum, const int nbins,
+                       const float max_val)
+    void houghcircle_f32(const float *xy, const int dim0, const int dim1, int32_t *accum, const int nbins,
+                         const float max_val)
+    void houghcircle_center_f32(const int32_t *accum, const int nbins, const double max_val, double *cx, double *cy)
+    void neighborcount_f32(const float *xy, const int nrows, const int ncols, int32_t *counts, const float radius)
+    int houghclean_f32(const float *xyz, const int nrows, const int ncols, const HoughCleanConfig *config,
+                       int32_t *labels, float *mindists, int32_t *nn_counts, double *center, HoughCleanStats *stats)
+
+
+cdef void check_offsets(np.ndarray offsets, Py_ssize_t nrows) except *:
+    """Make sure the event offsets for a batched function are valid for an array with `nrows` rows."""
+    if offsets.shape[0] < 1:
+        raise ValueError('offsets must have at least one entry')
+    if offsets[0] < 0 or offsets[offsets.shape[0] - 1] > nrows:
+        raise ValueError('offsets must be within the bounds of the data')
+    if np.any(np.diff(offsets) < 0):
+        raise ValueError('offsets must be non-decreasing')
 
-def hough_line(np.ndarray[np.double_t, ndim=2, mode='c'] xy, int nbins=500, int max_val=2000):
+
+cdef np.ndarray check_output(arr, Py_ssize_t nrows, dtype, str name):
+    """Make sure an output array given to `hough_clean` has the right length, type, and layout."""
+    if not isinstance(arr, np.ndarray) or arr.ndim != 1 or arr.shape[0] != nrows:
+        raise ValueError('Output arrays must have the same length as xyz')
+    if arr.dtype != dtype or not arr.flags['C_CONTIGUOUS']:
+        raise ValueError('{} must be a contiguous {} array'.format(name, np.dtype(dtype).name))
+    return arr
+
+
+def hough_line(np.ndarray[real_t, ndim=2, mode='c'] xy, int nbins=500, int max_val=2000):
     """Performs the linear Hough transform and returns the Hough space.
 
     The generated Hough space has the angle along dimension 0 and the radius along dimension 1. The radii range
@@ -27,7 +94,7 @@ def hough_line(np.ndarray[np.double_t, ndim=2, mode='c'] xy, int nbins=500, int
     ----------
     xy : ndarray
         An array with the positional data to transform. The dimensions should be (N, 2), and the data must
-        have C-style row-major ordering.
+        have C-style row-major ordering. This can be float64 or float32.
     nbins : int, optional
         The number of bins to use in each dimension of the Hough space accumulator. The default value is 500.
     max_val : int, optional
@@ -36,27 +103,96 @@ def hough_line(np.ndarray[np.double_t, ndim=2, mode='c'] xy, int nbins=500, int
     Returns
     -------
     accum : ndarray
-        The Hough space accumulator, a 2D array with dimension `(nbins, nbins)`.
+        The Hough space accumulator, a 2D array with dimension `(nbins, nbins)`. This is int32 if `xy` is
+        float32, and int64 otherwise.
 
     """
-    cdef np.ndarray[np.int64_t, ndim=2, mode='c'] accum = np.zeros((nbins, nbins), dtype=np.int64)
+    cdef np.ndarray accum = np.zeros((nbins, nbins), dtype=np.int32 if real_t is float else np.int64)
+    cdef void* xyPtr = <void*> xy.data
+    cdef void* accumPtr = <void*> accum.data
+    cdef int dim0 = xy.shape[0]
+    cdef int dim1 = xy.shape[1]
+
+    with nogil:
+        if real_t is float:
+            houghline_f32(<float*> xyPtr, dim0, dim1, <int32_t*> accumPtr, nbins, max_val)
+        else:
+            houghline(<double*> xyPtr, dim0, dim1, <int64_t*> accumPtr, nbins, max_val)
+
+    return accum
+
+
+def hough_line_refined(np.ndarray[np.double_t, ndim=2, mode='c'] xy, int nbins=500, int max_val=2000,
+                       int coarse_factor=10, int ntop=3, weights=None):
+    """Performs a weighted, coarse-to-fine linear Hough transform.
+
+    The Hough space is first found at a resolution of `nbins // coarse_factor` bins in each dimension. Then only
+    the angles near the `ntop` largest coarse bins are recomputed at full resolution. Since all of the lines
+    in a spiral are parallel in the R-phi plane, the full-resolution rows still contain every line. The
+    rows that are not refined are zero.
+
+    This only saves time. The result is still a full `(nbins, nbins)` array, and each refined angle covers the
+    whole range of radii.
+
+    Parameters
+    ----------
+    xy : ndarray
+        An array with the positional data to transform. The dimensions should be (N, 2), and the data must
+        have C-style row-major ordering.
+    nbins : int, optional
+        The number of bins to use in each dimension of the full-resolution accumulator. The default value is 500.
+    max_val : int, optional
+        The extreme value in the Hough radius dimension. The default value is 2000.
+    coarse_factor : int, optional
+        The ratio of the full resolution to the coarse resolution. If this is 1 or less, the full Hough space is
+        computed. The default value is 10.
+    ntop : int, optional
+        The number of coarse bins to refine. The default value is 3.
+    weights : array-like, optional
+        A weight for each point, such as the peak amplitude. The weights are scaled to have a mean of 1 so that the
+        accumulator values are comparable to the unweighted counts. If not provided, each point has weight 1.
+
+    Returns
+    -------
+    accum : ndarray
+        The Hough space accumulator, a 2D float64 array with dimension `(nbins, nbins)`.
+
+    """
+    cdef np.ndarray[np.double_t, ndim=1, mode='c'] weights_arr
+    cdef double* weightsPtr = NULL
+
+    if weights is not None:
+        weights_arr = np.array(weights, dtype=np.double, copy=True, order='C').ravel()
+        if weights_arr.shape[0] != xy.shape[0]:
+            raise ValueError('weights must have one entry per row of xy')
+        if weights_arr.shape[0] > 0 and weights_arr.mean() > 0:
+            weights_arr /= weights_arr.mean()
+        weightsPtr = <double*> weights_arr.data
+
+    cdef np.ndarray[np.double_t, ndim=2, mode='c'] accum = np.zeros((nbins, nbins), dtype=np.double)
     cdef double* xyPtr = <double*> xy.data
-    cdef int64_t* accumPtr = <int64_t*> accum.data
+    cdef double* accumPtr = <double*> accum.data
     cdef int dim0 = xy.shape[0]
     cdef int dim1 = xy.shape[1]
+    cdef int status
 
-    houghline(xyPtr, dim0, dim1, accumPtr, nbins, max_val)
+    with nogil:
+        status = houghline_refined(xyPtr, dim0, dim1, weightsPtr, accumPtr, nbins, max_val, coarse_factor, ntop)
+
+    if status != 0:
+        raise MemoryError('Failed to allocate memory for the Hough transform')
 
     return accum
 
 
-def hough_circle(np.ndarray[np.double_t, ndim=2, mode='c'] xy, int nbins=200, int max_val=500):
+def hough_circle(np.ndarray[real_t, ndim=2, mode='c'] xy, int nbins=200, int max_val=500):
     """Performs the Hough transform for circles to find the center of a spiral.
 
     Parameters
     ----------
     xy : ndarray
-        A 2D array of data with dimension `(N, 2)` and C-style row-major ordering.
+        A 2D array of data with dimension `(N, 2)` and C-style row-major ordering. This can be float64 or
+        float32. The center is found in double precision either way.
     nbins : int, optional
         The number of bins to use in each dimension of the Hough space accumulator. The default value is 200.
     max_val : int, optional
@@ -68,47 +204,278 @@ def hough_circle(np.ndarray[np.double_t, ndim=2, mode='c'] xy, int nbins=200, in
         The center of the spiral.
 
     """
-    cdef np.ndarray[np.int64_t, ndim=2, mode='c'] accum = np.zeros((nbins, nbins), dtype=np.int64)
-    cdef double* xyPtr = <double*> xy.data
-    cdef int64_t* accumPtr = <int64_t*> accum.data
+    cdef np.ndarray accum = np.zeros((nbins, nbins), dtype=np.int32 if real_t is float else np.int64)
+    cdef void* xyPtr = <void*> xy.data
+    cdef void* accumPtr = <void*> accum.data
     cdef int dim0 = xy.shape[0]
     cdef int dim1 = xy.shape[1]
 
-    houghcircle(xyPtr, dim0, dim1, accumPtr, nbins, max_val)
+    cdef double cx, cy
 
-    cdef int imax, jmax
-    imax, jmax = np.unravel_index(accum.argmax(), (nbins, nbins))
-    # convert max bin to theta, radius values
-    cdef double tRad = imax * M_PI / nbins
-    cdef double rRad = jmax * 2 * max_val / nbins - max_val
-
-    # convert theta, r to postions in xy space
-    cdef double cx = rRad * cos(tRad)
-    cdef double cy = rRad * sin(tRad)
+    with nogil:
+        if real_t is float:
+            houghcircle_f32(<float*> xyPtr, dim0, dim1, <int32_t*> accumPtr, nbins, max_val)
+            houghcircle_center_f32(<int32_t*> accumPtr, nbins, max_val, &cx, &cy)
+        else:
+            houghcircle(<double*> xyPtr, dim0, dim1, <int64_t*> accumPtr, nbins, max_val)
+            houghcircle_center(<int64_t*> accumPtr, nbins, max_val, &cx, &cy)
 
     return cx, cy
 
 
-def nearest_neighbor_count(np.ndarray[np.double_t, ndim=2, mode='c'] xyz, double radius):
+def nearest_neighbor_count(np.ndarray[real_t, ndim=2, mode='c'] xyz, double radius):
     """Count the number of neighbors each point has within a given radius.
 
+    The points are bucketed into a uniform grid with cells of size `radius`, so only the points in adjacent
+    cells need to be compared. The counts are identical to those from a brute-force search.
+
     Parameters
     ----------
     xyz : ndarray
-        An Nx3 set of (x, y, z) data with C-style row-major ordering.
+        An Nx3 set of (x, y, z) data with C-style row-major ordering. This can be float64 or float32.
     radius : float
         The neighborhood radius.
 
     Returns
     -------
     counts : ndarray
-        A one-dimensional array of length N containing the number of neighbors for each point in `xyz`.
+        A one-dimensional array of length N containing the number of neighbors for each point in `xyz`. This is
+        int32 if `xyz` is float32, and int64 otherwise.
 
     """
-    cdef np.ndarray[np.int64_t, ndim=1] counts = np.zeros(xyz.shape[0], dtype=np.int64)
+    cdef np.ndarray counts = np.zeros(xyz.shape[0], dtype=np.int32 if real_t is float else np.int64)
+
+    cdef void* xyzPtr = <void*> xyz.data
+    cdef void* countsPtr = <void*> counts.data
+
+    cdef int nrows = xyz.shape[0]
+    cdef int ncols = xyz.shape[1]
+
+    with nogil:
+        if real_t is float:
+            neighborcount_f32(<float*> xyzPtr, nrows, ncols, <int32_t*> countsPtr, radius)
+        else:
+            neighborcount(<double*> xyzPtr, nrows, ncols, <int64_t*> countsPtr, radius)
+
+    return counts
 
+
+def hough_line_batch(np.ndarray[np.double_t, ndim=2, mode='c'] xy, np.ndarray[np.int64_t, ndim=1, mode='c'] offsets,
+                     int nbins=500, int max_val=2000):
+    """Performs the linear Hough transform on a set of events at once.
+
+    The events are processed in parallel, with one thread per event. This is faster than calling :func:`hough_line`
+    for each event when the events are small.
+
+    Parameters
+    ----------
+    xy : ndarray
+        The positional data for all of the events, stacked one after another. The dimensions should be (N, 2),
+        and the data must have C-style row-major ordering.
+    offsets : ndarray
+        The row in `xy` where each event starts, followed by the total number of rows. The rows of event `i` are
+        `xy[offsets[i]:offsets[i + 1]]`. For a list of arrays `evts`, this could be found using
+        `np.concatenate(([0], np.cumsum([len(e) for e in evts])))`.
+    nbins : int, optional
+        The number of bins to use in each dimension of the Hough space accumulator. The default value is 500.
+    max_val : int, optional
+        The extreme value in the Hough radius dimension. The default value is 2000.
+
+    Returns
+    -------
+    accums : ndarray
+        The Hough space accumulators, a 3D array with dimension `(nevents, nbins, nbins)`.
+
+    """
+    check_offsets(offsets, xy.shape[0])
+
+    cdef int nevents = offsets.shape[0] - 1
+    cdef np.ndarray[np.int64_t, ndim=3, mode='c'] accums = np.zeros((nevents, nbins, nbins), dtype=np.int64)
+    cdef double* xyPtr = <double*> xy.data
+    cdef int64_t* offsetsPtr = <int64_t*> offsets.data
+    cdef int64_t* accumsPtr = <int64_t*> accums.data
+    cdef int ncols = xy.shape[1]
+
+    with nogil:
+        houghline_batch(xyPtr, ncols, offsetsPtr, nevents, accumsPtr, nbins, max_val)
+
+    return accums
+
+
+def hough_circle_batch(np.ndarray[np.double_t, ndim=2, mode='c'] xy, np.ndarray[np.int64_t, ndim=1, mode='c'] offsets,
+                       int nbins=200, int max_val=500):
+    """Finds the center of the spiral in a set of events at once using the circular Hough transform.
+
+    The events are processed in parallel, with one thread per event. Each thread reuses one accumulator for
+    all of its events.
+
+    Parameters
+    ----------
+    xy : ndarray
+        The data for all of the events, stacked one after another. The dimensions should be `(N, 2)`, and the
+        data must have C-style row-major ordering.
+    offsets : ndarray
+        The row in `xy` where each event starts, followed by the total number of rows. See :func:`hough_line_batch`.
+    nbins : int, optional
+        The number of bins to use in each dimension of the Hough space accumulator. The default value is 200.
+    max_val : int, optional
+        The extreme value in the Hough radius dimension. The default value is 500.
+
+    Returns
+    -------
+    centers : ndarray
+        The center of the spiral in each event, as an array with dimension `(nevents, 2)`.
+
+    """
+    check_offsets(offsets, xy.shape[0])
+
+    cdef int nevents = offsets.shape[0] - 1
+    cdef np.ndarray[np.double_t, ndim=2, mode='c'] centers = np.empty((nevents, 2), dtype=np.double)
+    cdef double* xyPtr = <double*> xy.data
+    cdef int64_t* offsetsPtr = <int64_t*> offsets.data
+    cdef double* centersPtr = <double*> centers.data
+    cdef int ncols = xy.shape[1]
+
+    with nogil:
+        houghcircle_batch(xyPtr, ncols, offsetsPtr, nevents, centersPtr, nbins, max_val)
+
+    return centers
+
+
+def nearest_neighbor_count_batch(np.ndarray[np.double_t, ndim=2, mode='c'] xyz, np.ndarray[np.int64_t, ndim=1, mode='c'] offsets,
+                                 double radius):
+    """Count the number of neighbors each point has within a given radius for a set of events at once.
+
+    Only points in the same event are counted as neighbors.
+
+    Parameters
+    ----------
+    xyz : ndarray
+        The (x, y, z) data for all of the events, stacked one after another, with C-style row-major ordering.
+    offsets : ndarray
+        The row in `xyz` where each event starts, followed by the total number of rows. See :func:`hough_line_batch`.
+    radius : float
+        The neighborhood radius.
+
+    Returns
+    -------
+    counts : ndarray
+        A one-dimensional array of length N containing the number of neighbors for each point in `xyz`. Rows that
+        are not part of any event are set to 0.
+
+    """
+    check_offsets(offsets, xyz.shape[0])
+
+    cdef int nevents = offsets.shape[0] - 1
+    cdef np.ndarray[np.int64_t, ndim=1] counts = np.zeros(xyz.shape[0], dtype=np.int64)
     cdef double* xyzPtr = <double*> xyz.data
+    cdef int64_t* offsetsPtr = <int64_t*> offsets.data
     cdef int64_t* countsPtr = <int64_t*> counts.data
+    cdef int ncols = xyz.shape[1]
+
+    with nogil:
+        neighborcount_batch(xyzPtr, ncols, offsetsPtr, nevents, countsPtr, radius)
 
-    neighborcount(xyzPtr, xyz.shape[0], xyz.shape[1], countsPtr, radius)
     return counts
+
+
+def hough_clean(np.ndarray[real_t, ndim=2, mode='c'] xyz, int peak_width, double linear_hough_max,
+                int linear_hough_nbins, double circle_hough_max, int circle_hough_nbins, int min_pts_per_line,
+                double neighbor_radius, labels=None, mindists=None, nn_counts=None, dict stats=None):
+    """Run the full Hough space cleaning algorithm on one event.
+
+    This gives the same results as :meth:`pytpc.cleaning.HoughCleaner.clean`, but the whole process is done in C
+    without creating any intermediate arrays in Python. The parameters have the same meanings as the attributes
+    of :class:`~pytpc.cleaning.HoughCleaner`.
+
+    Parameters
+    ----------
+    xyz : ndarray
+        The data, with first three columns (x, y, z), and with C-style row-major ordering. If this is float32,
+        the single precision version of the algorithm is used.
+    peak_width, linear_hough_max, linear_hough_nbins, circle_hough_max, circle_hough_nbins : number
+        The Hough transform parameters.
+    min_pts_per_line : int
+        The minimum number of points that constitutes a valid line.
+    neighbor_radius : float
+        The neighborhood radius for the nearest neighbor count.
+    labels, mindists, nn_counts : ndarray, optional
+        Arrays of length N to write the outputs into. These must be contiguous, and `labels` and `nn_counts` must
+        be int64 while `mindists` must be float64. For float32 data, they must be int32 and float32 instead. If
+        these are not provided, new arrays are created.
+    stats : dict, optional
+        If given, the counters and stage times from the C code are added to the values in this dict, so the same
+        dict can be passed for many events to get the totals. The keys are ``points``, ``center_points``,
+        ``lines_found``, ``labeled_points``, and the wall times in seconds ``neighbor_count_time``,
+        ``find_center_time``, ``linear_hough_time``, and ``classify_time``. The stages are only timed if this
+        is given.
+
+    Returns
+    -------
+    labels : ndarray
+        An integer label identifying which line each point is near. A value of -1 indicates that the point
+        is not matched to any line.
+    mindists : ndarray
+        The distance from each point to the nearest line.
+    nn_counts : ndarray
+        The number of neighbors each point has within distance `neighbor_radius`.
+    (cu, cv) : tuple of floats
+        The center of the event.
+
+    """
+    cdef Py_ssize_t nrows = xyz.shape[0]
+    int_dtype = np.int32 if real_t is float else np.int64
+    real_dtype = np.float32 if real_t is float else np.double
+
+    if labels is None:
+        labels = np.empty(nrows, dtype=int_dtype)
+    if mindists is None:
+        mindists = np.empty(nrows, dtype=real_dtype)
+    if nn_counts is None:
+        nn_counts = np.empty(nrows, dtype=int_dtype)
+
+    cdef np.ndarray labels_arr = check_output(labels, nrows, int_dtype, 'labels')
+    cdef np.ndarray mindists_arr = check_output(mindists, nrows, real_dtype, 'mindists')
+    cdef np.ndarray nn_counts_arr = check_output(nn_counts, nrows, int_dtype, 'nn_counts')
+
+    cdef HoughCleanConfig config
+    config.peak_width = peak_width
+    config.linear_hough_max = linear_hough_max
+    config.linear_hough_nbins = linear_hough_nbins
+    config.circle_hough_max = circle_hough_max
+    config.circle_hough_nbins = circle_hough_nbins
+    config.min_pts_per_line = min_pts_per_line
+    config.neighbor_radius = neighbor_radius
+
+    cdef double center[2]
+    cdef int status
+    cdef void* xyzPtr = <void*> xyz.data
+    cdef void* labelsPtr = <void*> labels_arr.data
+    cdef void* mindistsPtr = <void*> mindists_arr.data
+    cdef void* nnCountsPtr = <void*> nn_counts_arr.data
+    cdef int ncols = xyz.shape[1]
+    cdef int nrows_int = nrows
+    cdef HoughCleanStats cstats
+    cdef HoughCleanStats* statsPtr = &cstats if stats is not None else NULL
+
+    with nogil:
+        if real_t is float:
+            status = houghclean_f32(<float*> xyzPtr, nrows_int, ncols, &config, <int32_t*> labelsPtr,
+                                    <float*> mindistsPtr, <int32_t*> nnCountsPtr, center, statsPtr)
+        else:
+            status = houghclean(<double*> xyzPtr, nrows_int, ncols, &config, <int64_t*> labelsPtr,
+                                <double*> mindistsPtr, <int64_t*> nnCountsPtr, center, statsPtr)
+
+    if status != 0:
+        raise MemoryError('Failed to allocate memory for the Hough cleaning')
+
+    if stats is not None:
+        for key, value in (('points', cstats.num_points), ('center_points', cstats.num_center_points),
+                           ('lines_found', cstats.num_lines_found), ('labeled_points', cstats.num_labeled),
+                           ('neighbor_count_time', cstats.neighbor_count_time),
+                           ('find_center_time', cstats.find_center_time),
+                           ('linear_hough_time', cstats.linear_hough_time),
+                           ('classify_time', cstats.classify_time)):
+            stats[key] = stats.get(key, 0) + value
+
+    return labels, mindists, nn_counts, (center[0], center[1])
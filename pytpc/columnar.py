@@ -0,0 +1,368 @@
+"""Append-only columnar output in HDF5.
+
+Writing each event as its own dataset, or each fit result as its own row in SQLite, gets slow for large runs, and
+reading one quantity back for every event means visiting every event. The classes in this module store the results
+as columns instead. Each column is one chunked, resizable dataset, and rows are appended in batches, so a batch of
+events costs one write per column.
+
+A group written by :class:`ColumnarEventWriter` looks like this:
+
+    ``<group>/<column>``
+        One dataset per column of the per-event table, like ``evt_id``, ``x0``, or ``posChi2``.
+    ``<group>/points/<name>``
+        The variable-length arrays of all events (like the cleaned points), stacked into one dataset. The per-event
+        table has the columns ``<name>_offset`` and ``<name>_length`` that give the rows belonging to each event.
+    ``<group>/processed``
+        A bitmap with one bit per event ID, set once the event's rows have been written. This is used to continue
+        a run that was stopped.
+
+The number of complete rows is kept in an attribute that is only updated after all columns of a batch have been
+written, and the bitmap is updated after that. If the program is killed part way through a batch, the partial rows
+are dropped the next time the group is opened, and those events are processed again. The bitmap is also rebuilt
+from the ``evt_id`` column when the group is opened, so it matches the complete rows even if the program was killed
+between updating the row count and the bitmap.
+
+"""
+
+import numpy as np
+
+__all__ = ['EventBitmap', 'ColumnarTable', 'ColumnarEventWriter', 'ColumnarEventReader']
+
+
+class EventBitmap(object):
+    """A set of event IDs, stored as one bit per ID in an HDF5 dataset.
+
+    A run of a million events needs 125 kB for this. The bits are kept in memory as well, so checking for an ID
+    doesn't read the file.
+
+    Parameters
+    ----------
+    group : h5py.Group
+        The group that holds the bitmap.
+    name : str, optional
+        The name of the dataset. It is created if it doesn't exist.
+    """
+
+    def __init__(self, group, name='processed'):
+        if name in group:
+            self.dset = group[name]
+        else:
+            self.dset = group.create_dataset(name, shape=(0,), maxshape=(None,), dtype='uint8', chunks=(65536,))
+        self.bits = self.dset[:]
+
+    def add(self, evt_ids):
+        """Mark the given event IDs as processed and write the changed bytes to the file."""
+        evt_ids = np.asarray(evt_ids, dtype='int64').ravel()
+        if len(evt_ids) == 0:
+            return
+        if evt_ids.min() < 0:
+            raise ValueError('Event IDs must not be negative')
+
+        byte_idx = evt_ids >> 3
+        first, last = byte_idx.min(), byte_idx.max()
+        if last >= len(self.bits):
+            self.bits = np.concatenate((self.bits, np.zeros(last + 1 - len(self.bits), dtype='uint8')))
+            self.dset.resize((len(self.bits),))
+
+        np.bitwise_or.at(self.bits, byte_idx, (1 << (evt_ids & 7)).astype('uint8'))
+        self.dset[first:last + 1] = self.bits[first:last + 1]
+
+    def rebuild(self, evt_ids):
+        """Replace the contents of the set with the given event IDs, and rewrite the whole dataset."""
+        self.bits = np.zeros(0, dtype='uint8')
+        self.dset.resize((0,))
+        self.add(evt_ids)
+
+    def __contains__(self, evt_id):
+        byte_idx = evt_id >> 3
+        return byte_idx < len(self.bits) and bool(self.bits[byte_idx] & (1 << (evt_id & 7)))
+
+    def __len__(self):
+        return int(np.unpackbits(self.bits).sum())
+
+    def evt_ids(self):
+        """Get the IDs in the set, as a sorted array."""
+        return np.flatnonzero(np.unpackbits(self.bits, bitorder='little'))
+
+
+class ColumnarTable(object):
+    """A table stored as one resizable dataset per column.
+
+    The table is opened if the group already has one, and created with the given columns otherwise. Rows past the
+    last complete batch, left by a write that was interrupted, are removed when the table is opened.
+
+    Parameters
+    ----------
+    group : h5py.Group
+        The group that holds the columns.
+    columns : list of tuple, optional
+        The columns, as ``(name, dtype)`` or ``(name, dtype, shape)``, where `shape` is the shape of one row of that
+        column, like ``(7,)`` for the points of a track. This is only needed when creating the table.
+    chunk_rows : int, optional
+        The number of rows in each chunk of the datasets.
+    compression : str or None, optional
+        The compression filter to use for new datasets.
+    """
+
+    def __init__(self, group, columns=None, chunk_rows=4096, compression='gzip'):
+        self.group = group
+
+        if 'columns' in group.attrs:
+            names = [n.decode() if isinstance(n, bytes) else str(n) for n in group.attrs['columns']]
+            self.columns = [(n, group[n].dtype, group[n].shape[1:]) for n in names]
+            self.num_rows = int(group.attrs['num_rows'])
+            for name, _, shape in self.columns:
+                if group[name].shape[0] != self.num_rows:
+                    group[name].resize((self.num_rows,) + shape)
+        elif columns is not None:
+            self.columns = []
+            for col in columns:
+                name, dtype = col[:2]
+                shape = tuple(col[2]) if len(col) > 2 else ()
+                group.create_dataset(name, shape=(0,) + shape, maxshape=(None,) + shape, dtype=dtype,
+                                     chunks=(chunk_rows,) + shape, compression=compression,
+                                     shuffle=compression is not None)
+                self.columns.append((name, np.dtype(dtype), shape))
+            self.num_rows = 0
+            group.attrs['columns'] = np.array([n for n, _, _ in self.columns], dtype='S')
+            group.attrs['num_rows'] = 0
+        else:
+            raise ValueError('The group has no table, and no columns were given to create one')
+
+    @property
+    def column_names(self):
+        return [n for n, _, _ in self.columns]
+
+    def __len__(self):
+        return self.num_rows
+
+    def append(self, rows):
+        """Append rows to the table.
+
+        Parameters
+        ----------
+        rows : dict or list of dict
+            Either a dict of arrays with one entry per column, all the same length, or a list of dicts with one
+            value per column. In a list of dicts, missing values and None are filled with NaN for floating point
+            columns and -1 for integer columns, and extra keys are ignored.
+        """
+        if isinstance(rows, dict):
+            arrays = {name: np.asarray(rows[name], dtype=dtype) for name, dtype, _ in self.columns}
+            num_new = len(next(iter(arrays.values()))) if len(arrays) > 0 else 0
+        else:
+            num_new = len(rows)
+            arrays = {}
+            for name, dtype, shape in self.columns:
+                fill = np.nan if dtype.kind == 'f' else -1
+                values = [row.get(name) for row in rows]
+                values = [np.full(shape, fill) if v is None else v for v in values]
+                arrays[name] = np.array(values, dtype=dtype).reshape((num_new,) + shape)
+
+        if num_new == 0:
+            return
+
+        start, stop = self.num_rows, self.num_rows + num_new
+        for name, _, shape in self.columns:
+            if arrays[name].shape != (num_new,) + shape:
+                raise ValueError('Column {} has shape {}, but {} was expected'
+                                 .format(name, arrays[name].shape, (num_new,) + shape))
+
+        for name, _, shape in self.columns:
+            dset = self.group[name]
+            dset.resize((stop,) + shape)
+            dset[start:stop] = arrays[name]
+
+        self.num_rows = stop
+        self.group.attrs['num_rows'] = stop
+
+    def read(self, columns=None, rows=slice(None)):
+        """Read columns of the table.
+
+        Parameters
+        ----------
+        columns : list of str, optional
+            The columns to read. By default, all of them are read.
+        rows : slice or array-like, optional
+            The rows to read.
+
+        Returns
+        -------
+        dict
+            The arrays, by column name.
+        """
+        if columns is None:
+            columns = self.column_names
+        return {name: self.group[name][:self.num_rows][rows] for name in columns}
+
+    def to_dataframe(self):
+        """Read the one-dimensional columns into a pandas DataFrame."""
+        import pandas as pd
+        names = [n for n, _, shape in self.columns if shape == ()]
+        return pd.DataFrame(self.read(names), columns=names)
+
+
+class ColumnarEventWriter(object):
+    """Collects per-event results and appends them to a columnar group in batches.
+
+    This is meant to be used as the write function of a :class:`pytpc.pipeline.AsyncWriter`, which calls it from one
+    thread, or directly. Call :meth:`flush` or :meth:`close` at the end to write the last partial batch.
+
+    Parameters
+    ----------
+    group : h5py.Group
+        The output group.
+    columns : list of tuple
+        The columns of the per-event table, in the format used by :class:`ColumnarTable`. The column ``evt_id`` is
+        added if it isn't there.
+    arrays : list of tuple, optional
+        The variable-length per-event arrays, as ``(name, dtype, num_cols)``. Each is stored in ``points/<name>``.
+    batch_size : int, optional
+        The number of events to collect before writing them.
+    """
+
+    def __init__(self, group, columns, arrays=(), batch_size=100):
+        self.group = group
+        self.batch_size = batch_size
+
+        columns = list(columns)
+        if 'evt_id' not in [c[0] for c in columns]:
+            columns.insert(0, ('evt_id', 'int64'))
+
+        self.array_names = [name for name, _, _ in arrays]
+        for name in self.array_names:
+            columns += [(name + '_offset', 'int64'), (name + '_length', 'int64')]
+
+        self.table = ColumnarTable(group, columns)
+        self.array_tables = {}
+        if len(arrays) > 0:
+            points_group = group.require_group('points')
+            for name, dtype, num_cols in arrays:
+                self.array_tables[name] = ColumnarTable(points_group.require_group(name),
+                                                        [('values', dtype, (num_cols,))])
+
+        self._check_arrays()
+        self.processed = EventBitmap(group)
+        self._check_processed()
+        self._rows = []
+        self._pending_arrays = {name: [] for name in self.array_names}
+
+    def _check_arrays(self):
+        # Trim stacked arrays written after the last complete batch of the per-event table
+        if len(self.table) == 0:
+            for name, table in self.array_tables.items():
+                if len(table) > 0:
+                    table.group['values'].resize((0,) + table.columns[0][2])
+                    table.num_rows = 0
+                    table.group.attrs['num_rows'] = 0
+            return
+
+        last = len(self.table) - 1
+        for name, table in self.array_tables.items():
+            end = int(self.group[name + '_offset'][last] + self.group[name + '_length'][last])
+            if len(table) > end:
+                table.group['values'].resize((end,) + table.columns[0][2])
+                table.num_rows = end
+                table.group.attrs['num_rows'] = end
+
+    def _check_processed(self):
+        # The row count is committed before the bitmap, so a run killed in between leaves complete rows that aren't
+        # in the bitmap. The evt_id column is the record of what was written.
+        evt_ids = self.table.read(['evt_id'])['evt_id']
+        if not np.array_equal(self.processed.evt_ids(), np.unique(evt_ids)):
+            self.processed.rebuild(evt_ids)
+
+    def completed_events(self):
+        """Get the set of event IDs that have already been written, including ones from earlier runs."""
+        return set(self.processed.evt_ids().tolist())
+
+    def __call__(self, evt_id, row, arrays=None):
+        self.add(evt_id, row, arrays)
+
+    def add(self, evt_id, row, arrays=None):
+        """Add the results for one event, and write the batch if it is full.
+
+        Parameters
+        ----------
+        evt_id : int
+            The event ID.
+        row : dict
+            The values of the per-event columns.
+        arrays : dict, optional
+            The per-event arrays, by name. Each must have the number of columns given to the constructor.
+        """
+        row = dict(row, evt_id=evt_id)
+        for name in self.array_names:
+            values = np.asarray(arrays[name]) if arrays is not None and name in arrays else None
+            if values is None:
+                values = np.empty((0,) + self.array_tables[name].columns[0][2])
+            self._pending_arrays[name].append(values)
+            row[name + '_length'] = len(values)
+        self._rows.append(row)
+
+        if len(self._rows) >= self.batch_size:
+            self.flush()
+
+    def flush(self):
+        """Write the events that have been collected."""
+        if len(self._rows) == 0:
+            return
+
+        for name in self.array_names:
+            table = self.array_tables[name]
+            offset = len(table)
+            for row in self._rows:
+                row[name + '_offset'] = offset
+                offset += row[name + '_length']
+            table.append({'values': np.concatenate(self._pending_arrays[name])})
+            self._pending_arrays[name] = []
+
+        self.table.append(self._rows)
+        self.processed.add([row['evt_id'] for row in self._rows])
+        self._rows = []
+        self.group.file.flush()
+
+    def close(self):
+        """Write the last partial batch."""
+        self.flush()
+
+
+class ColumnarEventReader(object):
+    """Reads the events from a group written by :class:`ColumnarEventWriter`.
+
+    Parameters
+    ----------
+    group : h5py.Group
+        The group to read.
+    """
+
+    def __init__(self, group):
+        self.group = group
+        self.table = ColumnarTable(group)
+        evt_ids = self.table.read(['evt_id'])['evt_id']
+        self._index = {int(evt_id): i for i, evt_id in enumerate(evt_ids)}
+
+    def evt_ids(self):
+        """Get the event IDs in the group, sorted."""
+        return sorted(self._index.keys())
+
+    def read(self, evt_id, array_name='clean_xyz'):
+        """Read the per-event columns and one of the arrays for the given event.
+
+        Returns
+        -------
+        values : ndarray
+            The event's rows of the array.
+        row : dict
+            The event's values of the other columns.
+
+        Raises
+        ------
+        KeyError
+            If the event isn't in the group.
+        """
+        idx = self._index[evt_id]
+        row = {name: self.group[name][idx] for name in self.table.column_names}
+        start = int(row[array_name + '_offset'])
+        stop = start + int(row[array_name + '_length'])
+        values = self.group['points'][array_name]['values'][start:stop]
+        return values, row
@@ -4,27 +4,41 @@ datafile
 
 This module provides a base class for interacting with data files.
 
+Files can also be opened in a memory-mapped mode by passing ``use_mmap=True``. In this mode, the file is indexed
+with a native scan of the mapped region, and the index is kept in a compact binary sidecar file with the extension
+``.idx.npy``. Events are then parsed directly from the mapped region, and their raw bytes can be accessed without
+copying using :meth:`DataFile.read_raw_event_by_number`.
+
 """
 
 from __future__ import division, print_function
+import os
 import os.path
+import mmap
 import numpy as np
 
 
 class DataFile(object):
 
-    def __init__(self, filename=None, open_mode='r'):
+    #: The dtype of the binary index used in memory-mapped mode
+    index_dtype = np.dtype([('offset', '<i8'), ('evt_id', '<i8')])
+
+    def __init__(self, filename=None, open_mode='r', use_mmap=False):
 
         self.lookup = []
         self.evtids = []
 
         self.current_event = 0  #: The index of the current event
+        self.use_mmap = use_mmap  #: Whether files opened for reading are memory-mapped
+        self.map = None  #: The memory map of the file, in memory-mapped mode
 
         if filename is not None:
             self.open(filename, open_mode)
             if 'r' in open_mode:
                 ltfilename = filename + '.lookup'
-                if os.path.exists(ltfilename):
+                if self.map is not None:
+                    self.load_or_build_index()
+                elif os.path.exists(ltfilename):
                     self.load_lookup_table(ltfilename)
                 else:
                     self.make_lookup_table()
@@ -51,12 +65,22 @@ class DataFile(object):
         self.fp = open(filename, open_mode)
         self.is_open = True
 
+        self.map = None
+        if getattr(self, 'use_mmap', False) and open_mode == 'rb' and os.path.getsize(filename) > 0:
+            self.map = mmap.mmap(self.fp.fileno(), 0, access=mmap.ACCESS_READ)
+
         return
 
     def close(self):
         """Close an open file"""
 
         if self.is_open:
+            if self.map is not None:
+                try:
+                    self.map.close()
+                except BufferError:
+                    pass  # Views of the map still exist, so it will be closed when they are released
+                self.map = None
             self.fp.close()
             self.is_open = False
 
@@ -65,9 +89,90 @@ class DataFile(object):
     def _read(self):
         raise NotImplementedError()
 
+    def _parse_raw(self, raw):
+        """Parse the raw bytes of one event, as returned by :meth:`read_raw_event_by_number`."""
+        raise NotImplementedError()
+
+    def _raw_size(self, raw):
+        """Find the size of the event that begins at the start of `raw` from its header."""
+        raise NotImplementedError()
+
+    def _build_index(self):
+        """Find the offsets and event IDs of the events in the memory-mapped file. Returns two arrays."""
+        raise NotImplementedError()
+
     def make_lookup_table(self):
         raise NotImplementedError()
 
+    def load_or_build_index(self):
+        """Load the binary index of a memory-mapped file, or build it if necessary.
+
+        The index is read from the sidecar file ``<filename>.idx.npy`` if that exists and is newer than the data file.
+        Otherwise, it is built using :meth:`_build_index` and written to the sidecar file, if possible.
+
+        The offsets and event IDs are assigned to :attr:`lookup` and :attr:`evtids` as arrays.
+        """
+        idxfilename = self.fp.name + '.idx.npy'
+
+        index = None
+        if os.path.exists(idxfilename) and os.path.getmtime(idxfilename) >= os.path.getmtime(self.fp.name):
+            try:
+                index = np.load(idxfilename)
+            except (OSError, ValueError):
+                index = None
+            if index is not None and index.dtype != self.index_dtype:
+                index = None
+
+        if index is None:
+            try:
+                offsets, evtids = self._build_index()
+            except ValueError as err:
+                raise IOError(str(err)) from err
+            index = np.empty(len(offsets), dtype=self.index_dtype)
+            index['offset'] = offsets
+            index['evt_id'] = evtids
+
+            if getattr(self, 'max_len', None) is None:
+                # Write to a temporary file first so a partially written index is never read
+                tmpfilename = '{}.{:d}.tmp'.format(idxfilename, os.getpid())
+                try:
+                    with open(tmpfilename, 'wb') as f:
+                        np.save(f, index)
+                    os.replace(tmpfilename, idxfilename)
+                except OSError:
+                    if os.path.exists(tmpfilename):
+                        os.remove(tmpfilename)
+
+        self.lookup = index['offset'].copy()
+        self.evtids = index['evt_id'].copy()
+
+    def read_raw_event_by_number(self, num):
+        """Get the raw bytes of an event from a memory-mapped file without copying them.
+
+        Parameters
+        ----------
+        num : int
+            The event number to read. This should be an index in the bounds of :attr:`lookup`
+
+        Returns
+        -------
+        memoryview
+            A read-only view of the event's bytes in the mapped region. The file can't be fully closed until
+            all such views are released.
+
+        Raises
+        ------
+        ValueError
+            If the file is not memory-mapped.
+        """
+        if self.map is None:
+            raise ValueError('Raw event views are only available for memory-mapped files')
+        if not 0 <= num < len(self.lookup):
+            raise IndexError('The given event position was outside the range of the file')
+
+        view = memoryview(self.map)[int(self.lookup[num]):]
+        return view[:self._raw_size(view)]
+
     def load_lookup_table(self, filename):
         """Read a lookup table from a file.
 
@@ -113,6 +218,8 @@ class DataFile(object):
 
         if 0 <= num < len(self.lookup):
             self.current_event = num
+            if self.map is not None:
+                return self._parse_raw(self.read_raw_event_by_number(num))
             self.fp.seek(self.lookup[num])
             return self._read()
         else:
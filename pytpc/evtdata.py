@@ -47,6 +47,9 @@ except ImportError:
 from scipy.fftpack import ifftshift
 
 from pytpc.padplane import find_pad_coords, padcenter_dict
+from pytpc.unpack import decode_evt_traces, index_evt_file
+from pytpc.peaks_wrapper import event_peaks
+from pytpc.geometry import get_geometry
 from math import sin, cos
 
 
@@ -202,6 +205,10 @@ class EventFile (pytpc.datafile.DataFile):
     ----------
     filename : string, optional
         If provided, opens the file located at this path. Otherwise, a file can be opened using the `open` method.
+    open_mode : string, optional
+        The mode to open the file in.
+    use_mmap : bool, optional
+        If true, memory-map the file when reading. See :mod:`pytpc.datafile`.
 
     Attributes
     ----------
@@ -218,12 +225,12 @@ class EventFile (pytpc.datafile.DataFile):
         The file object itself
     """
 
-    def __init__(self, filename=None, open_mode='r'):
+    def __init__(self, filename=None, open_mode='r', use_mmap=False):
 
         self.evtids = None
         self.magic = 0x6e7ef11e  # The file's magic number
 
-        super().__init__(filename, open_mode)
+        super().__init__(filename, open_mode, use_mmap=use_mmap)
 
         if 'r' in open_mode:
             self.fp.seek(0)
@@ -363,16 +370,54 @@ class EventFile (pytpc.datafile.DataFile):
         num_traces = hdr[4]
 
         new_evt = Event(evt_id=event_id, timestamp=event_ts)
-        new_evt.traces = np.zeros((num_traces,), dtype=new_evt.dt)
 
-        # Read the traces
+        # Read the traces. These are normally decoded all at once, but if the event size in the header doesn't match
+        # the trace headers, fall back to reading the traces one at a time.
+        body_pos = self.fp.tell()
+        body = self.fp.read(max(event_size - 19, 0))
+        try:
+            new_evt.traces, num_bytes = decode_evt_traces(body, num_traces)
+        except ValueError:
+            self.fp.seek(body_pos)
+            new_evt.traces = self._read_traces(num_traces)
+        else:
+            self.fp.seek(body_pos + num_bytes)
+
+        return new_evt
+
+    def _raw_size(self, raw):
+        return struct.unpack_from('<I', raw, 1)[0]
+
+    def _build_index(self):
+        return index_evt_file(self.map, 4)
+
+    def _parse_raw(self, raw):
+        """Parse an event from its raw bytes in a memory-mapped file."""
+        hdr = struct.unpack_from('<BIIQH', raw)
+
+        if hdr[0] != 0xEE:
+            raise FilePosError(self.fp.name, "Event magic number was wrong.")
+
+        new_evt = Event(evt_id=hdr[2], timestamp=hdr[3])
+        try:
+            new_evt.traces, _ = decode_evt_traces(raw[19:], hdr[4])
+        except ValueError:
+            # The event size in the header doesn't match the trace headers, so read the event from the file
+            self.fp.seek(self.lookup[self.current_event])
+            return self._read()
+
+        return new_evt
+
+    def _read_traces(self, num_traces):
+        """Read `num_traces` traces one at a time, starting at the current file position."""
+        traces = np.zeros((num_traces,), dtype=Event().dt)
 
         for n in range(num_traces):
             # Read the trace header. The structure of this is:
             #    (size, cobo, asad, aget, ch, pad)
             th = struct.unpack('<IBBBBH', self.fp.read(10))
 
-            tr = new_evt.traces[n]
+            tr = traces[n]
 
             tr['cobo'] = th[1]
             tr['asad'] = th[2]
@@ -388,7 +433,7 @@ class EventFile (pytpc.datafile.DataFile):
 
             tr['data'][:] = self.unpack_samples(packed)
 
-        return new_evt
+        return traces
 
     def write(self, evt):
         evt_magic = 0xee
@@ -556,13 +601,13 @@ class Event:
         pads = self.traces['pad']
 
         flat_hits = np.zeros(10240)
-        for (p, h) in zip(pads, hits):
-            flat_hits[p] = h
+        flat_hits[pads] = hits
 
         return flat_hits
 
     def xyzs(self, drift_vel=None, clock=None, pads=None, peaks_only=False, return_pads=False,
-             cg_times=False, cg_level=0.7, cg_range=20, baseline_correction=False, fft_baseline_factor=20):
+             cg_times=False, cg_level=0.7, cg_range=20, baseline_correction=False, fft_baseline_factor=20,
+             geometry=None, dtype=None):
         """Find the scatter points of the event in space.
 
         If a drift velocity and write clock frequency are provided, then the result gives the z dimension in
@@ -593,6 +638,15 @@ class Event:
             If true, apply Fourier transform–based baseline correction before finding peaks.
         fft_baseline_factor : number, optional
             The scaling factor for the Fourier transform window function. (See the function `fftbaseline` in this file).
+        geometry : pytpc.geometry.DetectorGeometry, optional
+            A cached geometry to take the pad centers from. This is much faster than passing `pads`, since the pad
+            centers don't need to be found for each event. If the geometry has a drift velocity and clock, and
+            `drift_vel` and `clock` are not given, the result is calibrated using the geometry's coefficients. If
+            neither `pads` nor `geometry` is given, the shared default geometry from
+            :func:`pytpc.geometry.get_geometry` is used.
+        dtype : data-type, optional
+            If given, the result is converted to this type at the end. Use float32 to halve the size of the points.
+            The pad numbers and amplitudes are exact in float32.
 
         Returns
         -------
@@ -605,44 +659,44 @@ class Event:
         pytpc.simulation.drift_velocity_vector
         """
 
-        if pads is None:
-            pads = pytpc.generate_pad_plane()
-
-        pcenters = pads.mean(1)
-
-        if baseline_correction:
-            trdata = fix_baselines(self.traces['data'], fft_baseline_factor)  # returns a copy
+        if pads is not None:
+            pcenters = pads.mean(1)
         else:
-            trdata = self.traces['data']  # no copy
+            if geometry is None:
+                geometry = get_geometry()
+            pcenters = geometry.pad_centers
 
         if peaks_only:
-            maxlocs = np.argmax(trdata, axis=1)
-
-            base_data, _ = _get_data_chunk(trdata, chunk_start=(maxlocs - 15), chunk_width=5)
-            bases = base_data.mean(1)
-            cs = trdata.max(axis=1) - bases
-
-            xys = pcenters[self.traces['pad']]
+            # The native kernel does the baseline correction, peak finding, and CG times in one pass over each trace.
+            # It gives the same result as doing these with `fix_baselines`, `argmax`, and `find_cg_times`.
+            xyzs = event_peaks(self.traces, pcenters, return_pads=return_pads, cg_times=cg_times, cg_level=cg_level,
+                               cg_range=cg_range, baseline_correction=baseline_correction,
+                               fft_baseline_factor=fft_baseline_factor)
 
-            if cg_times:
-                zs = find_cg_times(trdata, cg_range=cg_range, cg_level=cg_level)
+        else:
+            if baseline_correction:
+                trdata = fix_baselines(self.traces['data'], fft_baseline_factor)  # returns a copy
             else:
-                zs = maxlocs
+                trdata = self.traces['data']  # no copy
 
-        else:
             nz = np.nonzero(trdata)
             xys = pcenters[self.traces[nz[0]]['pad']]
             cs = self.traces['data'][nz]
             zs = nz[1]
 
-        if return_pads:
-            padnums = self.traces['pad']
-            xyzs = np.column_stack((xys, zs, cs, padnums))
-        else:
-            xyzs = np.column_stack((xys, zs, cs))
+            if return_pads:
+                padnums = self.traces['pad']
+                xyzs = np.column_stack((xys, zs, cs, padnums))
+            else:
+                xyzs = np.column_stack((xys, zs, cs))
 
         if drift_vel is not None and clock is not None:
             xyzs = calibrate(xyzs, drift_vel, clock)
+        elif geometry is not None and geometry.drift_vel is not None:
+            xyzs = geometry.calibrate(xyzs)
+
+        if dtype is not None:
+            xyzs = xyzs.astype(dtype, copy=False)
 
         return xyzs
 
@@ -1,4 +1,4 @@
-from .mcopt_wrapper import PadPlane, EventGenerator, Tracker
+from .mcopt_wrapper import PadPlane, TiledPadPlane, EventGenerator, Tracker
 from . import mixins
 from .fitting import BadEventError
 from .montecarlo import MCFitter
@@ -2,6 +2,8 @@ cimport numpy as np
 
 cdef extern from "armadillo" namespace "arma":
 
+    ctypedef unsigned long long uword
+
     cdef cppclass mat:
         mat(double * aux_mem, int n_rows, int n_cols, bint copy_aux_mem, bint strict) except +
         mat(double * aux_mem, int n_rows, int n_cols) except +
@@ -12,6 +14,7 @@ cdef extern from "armadillo" namespace "arma":
         double* memptr()
         double& operator()(int, int)
         void set_size(int size) except +
+        void steal_mem(mat& X) except +
 
     cdef cppclass Mat[T]:
         Mat(T* aux_mem, int n_rows, int n_cols, bint copy_aux_mem, bint strict) except +
@@ -24,6 +27,12 @@ cdef extern from "armadillo" namespace "arma":
         double& operator()(int, int)
         void set_size(int size) except +
 
+    cdef cppclass Col[T]:
+        Col(int n_elem) except +
+        Col() except +
+        int n_elem
+        T* memptr()
+
     cdef cppclass vec:
         vec(double * aux_mem, int n_elem, bint copy_aux_mem, bint strict) except +
         vec(double * aux_mem, int n_elem) except +
@@ -33,9 +42,22 @@ cdef extern from "armadillo" namespace "arma":
         double* memptr()
         double& operator()(int)
         void set_size(int size) except +
+        void steal_mem(vec& X) except +
+
+    cdef cppclass uvec:
+        uvec(int n_elem) except +
+        uvec() except +
+        int n_elem
+        uword* memptr()
 
 cdef mat * np2mat(np.ndarray[np.double_t, ndim=2] arr)
 cdef Mat[unsigned short] * np2uint16mat(np.ndarray[np.uint16_t, ndim=2] arr)
 cdef vec * np2vec(np.ndarray[np.double_t, ndim=1] arr)
+cdef uvec * np2uvec(np.ndarray[np.int64_t, ndim=1] arr) except NULL
+cdef mat * np2mat_view(np.ndarray[np.double_t, ndim=2, mode='fortran'] arr) except NULL
+cdef Mat[float] * np2fmat_view(np.ndarray[np.float32_t, ndim=2, mode='fortran'] arr) except NULL
+cdef vec * np2vec_view(np.ndarray[np.double_t, ndim=1, mode='c'] arr) except NULL
 cdef np.ndarray[np.double_t, ndim=2] mat2np(const mat & armaArr)
 cdef np.ndarray[np.double_t, ndim=1] vec2np(const vec & armaArr)
+cdef np.ndarray mat2np_steal(mat & armaArr)
+cdef np.ndarray vec2np_steal(vec & armaArr)
@@ -4,11 +4,21 @@ This is a wrapper around the Armadillo C++ library. It provides functions to con
 NumPy and Armadillo objects. This is necessary since the C++ portion of the Monte Carlo code
 represents data using Armadillo vectors and matrices, while the Python part uses NumPy.
 
+The ``np2mat``/``np2vec`` and ``mat2np``/``vec2np`` functions copy the data. The ``*_view`` and ``*_steal``
+functions avoid the copy by sharing memory between the two libraries, and should be preferred for large arrays
+that are converted on every call.
+
 """
 
 cimport armadillo
 import numpy as np
 cimport numpy as np
+from cpython.pycapsule cimport PyCapsule_New, PyCapsule_GetPointer
+
+np.import_array()
+
+cdef const char* MAT_CAPSULE_NAME = "pytpc.fitting.armadillo.mat"
+cdef const char* VEC_CAPSULE_NAME = "pytpc.fitting.armadillo.vec"
 
 cdef mat * np2mat(np.ndarray[np.double_t, ndim=2] arr):
     """Convert a 2D numpy array to an armadillo matrix."""
@@ -55,6 +65,23 @@ cdef vec * np2vec(np.ndarray[np.double_t, ndim=1] arr):
 
     return armaArr
 
+cdef uvec * np2uvec(np.ndarray[np.int64_t, ndim=1] arr) except NULL:
+    """Convert a numpy vector of non-negative integers to an armadillo vector of unsigned integers."""
+    cdef int i
+    cdef int dim = arr.shape[0]
+
+    for i in range(dim):
+        if arr[i] < 0:
+            raise ValueError('Negative values cannot be converted to unsigned integers')
+
+    cdef uvec* armaArr = new uvec(dim)
+    cdef uword* armaMem = armaArr.memptr()
+
+    for i in range(dim):
+        armaMem[i] = <uword> arr[i]
+
+    return armaArr
+
 cdef np.ndarray[np.double_t, ndim=2] mat2np(const mat & armaArr):
     """Convert an armadillo matrix to a 2D numpy array."""
     cdef np.ndarray[np.double_t, ndim=2] arr = np.empty((armaArr.n_rows, armaArr.n_cols), dtype=np.double, order='F')
@@ -73,3 +100,75 @@ cdef np.ndarray[np.double_t, ndim=1] vec2np(const vec & armaArr):
         arr[i] = armaArr(i)
 
     return arr
+
+
+cdef mat * np2mat_view(np.ndarray[np.double_t, ndim=2, mode='fortran'] arr) except NULL:
+    """Make an armadillo matrix that uses the memory of a Fortran-ordered 2D numpy array without copying it.
+
+    The matrix does not own the memory, so the array must outlive it. The matrix has a fixed size.
+    """
+    return new mat(<double*> np.PyArray_DATA(arr), arr.shape[0], arr.shape[1], False, True)
+
+cdef Mat[float] * np2fmat_view(np.ndarray[np.float32_t, ndim=2, mode='fortran'] arr) except NULL:
+    """Make a single precision armadillo matrix that uses the memory of a Fortran-ordered float32 array.
+
+    Like :func:`np2mat_view`, the array must outlive the matrix.
+    """
+    return new Mat[float](<float*> np.PyArray_DATA(arr), arr.shape[0], arr.shape[1], False, True)
+
+cdef vec * np2vec_view(np.ndarray[np.double_t, ndim=1, mode='c'] arr) except NULL:
+    """Make an armadillo vector that uses the memory of a contiguous numpy vector without copying it.
+
+    The vector does not own the memory, so the array must outlive it. The vector has a fixed size.
+    """
+    return new vec(<double*> np.PyArray_DATA(arr), arr.shape[0], False, True)
+
+cdef void free_capsule_mat(object capsule) noexcept:
+    del <mat*> PyCapsule_GetPointer(capsule, MAT_CAPSULE_NAME)
+
+cdef void free_capsule_vec(object capsule) noexcept:
+    del <vec*> PyCapsule_GetPointer(capsule, VEC_CAPSULE_NAME)
+
+cdef np.ndarray mat2np_steal(mat & armaArr):
+    """Convert an armadillo matrix to a Fortran-ordered 2D numpy array by taking its memory.
+
+    The memory is moved to a new matrix that is owned by a capsule, which is set as the base of the returned array.
+    The original matrix is left empty.
+    """
+    cdef mat* owner = new mat()
+    owner.steal_mem(armaArr)
+    try:
+        capsule = PyCapsule_New(owner, MAT_CAPSULE_NAME, free_capsule_mat)
+    except:
+        del owner
+        raise
+
+    cdef np.npy_intp dims[2]
+    dims[0] = owner.n_rows
+    dims[1] = owner.n_cols
+    cdef np.ndarray arr = np.PyArray_New(np.ndarray, 2, dims, np.NPY_DOUBLE, NULL, owner.memptr(), 0,
+                                         np.NPY_ARRAY_FARRAY, None)
+    np.set_array_base(arr, capsule)
+
+    return arr
+
+cdef np.ndarray vec2np_steal(vec & armaArr):
+    """Convert an armadillo vector to a numpy array by taking its memory.
+
+    The memory is moved to a new vector that is owned by a capsule, which is set as the base of the returned array.
+    The original vector is left empty.
+    """
+    cdef vec* owner = new vec()
+    owner.steal_mem(armaArr)
+    try:
+        capsule = PyCapsule_New(owner, VEC_CAPSULE_NAME, free_capsule_vec)
+    except:
+        del owner
+        raise
+
+    cdef np.npy_intp dims[1]
+    dims[0] = owner.n_elem
+    cdef np.ndarray arr = np.PyArray_SimpleNewFromData(1, dims, np.NPY_DOUBLE, owner.memptr())
+    np.set_array_base(arr, capsule)
+
+    return arr
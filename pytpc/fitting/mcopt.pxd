@@ -1,8 +1,9 @@
 from libcpp.vector cimport vector as cppvec
 from libcpp.map cimport map as cppmap
+from libcpp.string cimport string as cppstring
 cimport armadillo as arma
 
-cdef extern from "mcopt/mcopt.h" namespace "mcopt":
+cdef extern from "mcopt/mcopt.h" namespace "mcopt" nogil:
     ctypedef unsigned short pad_t
 
 
@@ -23,6 +24,7 @@ cdef extern from "mcopt/mcopt.h" namespace "mcopt":
     cdef cppclass Tracker:
         Tracker(unsigned massNum, unsigned chargeNum, const Gas* gas,
                 arma.vec& efield, arma.vec& bfield) except+
+        Tracker(const Tracker& other) except+
         Track trackParticle(const double x0, const double y0, const double z0,
                             const double enu0,  const double azi0, const double pol0) except+
         unsigned int getMassNum()
@@ -45,6 +47,7 @@ cdef extern from "mcopt/mcopt.h" namespace "mcopt":
         EventGenerator(const PadPlane* pads, const arma.vec& vd, const double clock, const double shape,
                        const unsigned massNum, const double ioniz, const double micromegasGain,
                        const double electronicsGain, const double tilt, const double diffSigma) except+
+        EventGenerator(const EventGenerator& other) except+
 
         cppmap[pad_t, arma.vec] makeEvent(const arma.mat& pos, const arma.vec& en) except+
         arma.mat makePeaksTableFromSimulation(const arma.mat& pos, const arma.vec& en) except+
@@ -101,3 +104,90 @@ cdef extern from "mcopt/mcopt.h" namespace "mcopt":
         unsigned numIters
         unsigned numPts
         double redFactor
+
+
+cdef extern from "mcopt_parallel.h" namespace "pytpc" nogil:
+    cdef cppclass ParallelMinimizer:
+        ParallelMinimizer(const MCminimizer& proto, const Tracker& tracker, const EventGenerator& evtgen,
+                          const unsigned numThreads) except+
+        arma.mat runTracks(const arma.mat& params, const arma.mat& expPos, const arma.vec& expHits) except+
+        MCminimizeResult minimize(const arma.vec& ctr0, const arma.vec& sigma0, const arma.mat& expPos,
+                                  const arma.vec& expHits) except+
+        arma.mat minimizeBatch(const arma.mat& ctr0s, const arma.vec& sigma0, const arma.mat& expPos,
+                               const arma.uvec& pads, const arma.vec& amps, const arma.uvec& offsets,
+                               const arma.uword numPads) except+
+        unsigned numThreads()
+
+        arma.vec mins
+        arma.vec maxes
+
+        double chi2Tolerance
+        unsigned stallIters
+        double spreadTolerance
+        double spreadFraction
+        unsigned minIters
+        unsigned minPts
+        bint converged
+        size_t numEventsConverged
+
+        cppvec[double] iterationTimes
+        size_t numTracksEvaluated
+
+
+cdef extern from "padlut.h" namespace "pytpc" nogil:
+    cdef cppclass TiledPadLUT:
+        TiledPadLUT(const arma.Mat[pad_t]& lut, const double xLB, const double xDelta, const double yLB,
+                    const double yDelta, const double rotAngle, const unsigned tileSize) except+
+        TiledPadLUT(const cppstring& path, const double rotAngle) except+
+        pad_t getPadNumberFromCoordinates(const double x, const double y) except+
+        arma.Col[pad_t] getPadNumbers(const arma.mat& xy, const pad_t invalid) except+
+        arma.Col[pad_t] getPadNumbers(const arma.Mat[float]& xy, const pad_t invalid) except+
+        arma.Mat[pad_t] toMatrix() except+
+        void save(const cppstring& path) except+
+        unsigned getTileSize()
+        bint isMapped()
+        double xLowerBound()
+        double xDelta()
+        double yLowerBound()
+        double yDelta()
+
+
+cdef extern from "ukf_native.h" namespace "pytpc" nogil:
+    cdef cppclass FilterResult:
+        FilterResult() except+
+        arma.mat means
+        arma.mat covars
+        arma.vec times
+        bint success
+
+    cdef cppclass TrackKalmanFilter:
+        TrackKalmanFilter(const unsigned massNum, const unsigned chargeNum, const Gas* gas,
+                          const arma.vec& efield, const arma.vec& bfield) except+
+        arma.vec propagate(const arma.vec& state, const double dt) except+
+        FilterResult batchFilter(const arma.mat& zs, const arma.vec& dpos, const arma.vec& x0,
+                                 const arma.mat& P0) except+
+        void smooth(FilterResult& res) except+
+        cppvec[FilterResult] filterTracks(const cppvec[arma.mat]& zs, const cppvec[arma.vec]& dpos,
+                                          const arma.mat& x0s, const arma.mat& P0, const bint doSmooth,
+                                          const unsigned numThreads) except+
+
+        arma.mat Q
+        arma.mat R
+        double kappa
+        double maxTimeStep
+
+
+cdef extern from "prefit.h" namespace "pytpc" nogil:
+    cdef cppclass LinearPrefitResult:
+        double scatAngle
+        double beamIntercept
+        double chi2
+        double radCurv
+        double brho
+        double curvEn
+        double params[6]
+
+    LinearPrefitResult linearPrefit(const double* uvw, const size_t numPts, const Py_ssize_t rowStride,
+                                    const Py_ssize_t colStride, const double cx, const double cy,
+                                    const double bfieldMag, const unsigned massNum,
+                                    const unsigned chargeNum) except+
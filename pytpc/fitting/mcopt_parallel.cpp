@@ -0,0 +1,331 @@
+#include "mcopt_parallel.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace pytpc {
+
+ParallelMinimizer::ParallelMinimizer(const mcopt::MCminimizer& proto, const mcopt::Tracker& tracker,
+                                     const mcopt::EventGenerator& evtgen, const unsigned numThreads)
+{
+    const unsigned nthr = numThreads > 0 ? numThreads : 1;
+
+    for (unsigned i = 0; i < nthr; i++) {
+        trackers.emplace_back(new mcopt::Tracker(tracker));
+        evtgens.emplace_back(new mcopt::EventGenerator(evtgen));
+
+        std::unique_ptr<mcopt::MCminimizer> worker (
+            new mcopt::MCminimizer(trackers.back().get(), evtgens.back().get(),
+                                   proto.numIters, proto.numPts, proto.redFactor));
+        worker->posChi2Enabled = proto.posChi2Enabled;
+        worker->enChi2Enabled = proto.enChi2Enabled;
+        worker->vertChi2Enabled = proto.vertChi2Enabled;
+        worker->posChi2Norm = proto.posChi2Norm;
+        worker->enChi2NormFraction = proto.enChi2NormFraction;
+        worker->vertChi2Norm = proto.vertChi2Norm;
+        workers.push_back(std::move(worker));
+    }
+}
+
+arma::mat ParallelMinimizer::splitTracks(const arma::mat& params, const arma::mat& expPos, const arma::vec& expHits)
+{
+    const arma::uword numRows = params.n_rows;
+    const int nthr = static_cast<int>(workers.size());
+    arma::mat chis (numRows, 3, arma::fill::zeros);
+
+    // Exceptions can't cross the edge of the parallel region, so save the first one and rethrow it afterwards
+    std::exception_ptr error = nullptr;
+
+    #pragma omp parallel for schedule(static, 1) num_threads(nthr)
+    for (int thr = 0; thr < nthr; thr++) {
+        const arma::uword first = numRows * thr / nthr;
+        const arma::uword last = numRows * (thr + 1) / nthr;
+        if (first == last) continue;
+
+        try {
+            const arma::mat chunk = params.rows(first, last - 1);
+            chis.rows(first, last - 1) = workers[thr]->runTracks(chunk, expPos, expHits);
+        }
+        catch (...) {
+            #pragma omp critical
+            {
+                if (!error) error = std::current_exception();
+            }
+        }
+    }
+
+    if (error) std::rethrow_exception(error);
+
+    return chis;
+}
+
+arma::mat ParallelMinimizer::runTracks(const arma::mat& params, const arma::mat& expPos, const arma::vec& expHits)
+{
+    arma::mat chis = splitTracks(params, expPos, expHits);
+    numTracksEvaluated += params.n_rows;
+    return chis;
+}
+
+double ParallelMinimizer::parameterSpread(const arma::mat& params, const arma::mat& chis,
+                                         const arma::vec& sigma0) const
+{
+    const arma::uword numBest = std::max<arma::uword>(
+        2, static_cast<arma::uword>(std::ceil(spreadFraction * params.n_rows)));
+    if (params.n_rows < numBest) return std::numeric_limits<double>::infinity();
+
+    const arma::uvec order = arma::sort_index(arma::sum(chis, 1));
+    const arma::mat best = params.rows(order.head(numBest));
+    const arma::rowvec spread = arma::stddev(best, 0, 0);
+
+    double maxSpread = 0;
+    for (arma::uword i = 0; i < spread.n_elem; i++) {
+        if (sigma0(i) > 0) maxSpread = std::max(maxSpread, spread(i) / sigma0(i));
+    }
+    return maxSpread;
+}
+
+mcopt::MCminimizeResult ParallelMinimizer::minimizeWith(
+    mcopt::MCminimizer& worker, const std::function<arma::mat(const arma::mat&)>& evalTracks,
+    const arma::vec& ctr0, const arma::vec& sigma0, RunInfo& info) const
+{
+    const unsigned numIters = worker.numIters;
+    const unsigned numPts = worker.numPts;
+    const arma::uword numParams = ctr0.n_elem;
+    const double inf = std::numeric_limits<double>::infinity();
+
+    if (numIters == 0 || numPts == 0) {
+        throw std::invalid_argument("numIters and numPts must be greater than 0");
+    }
+
+    const arma::vec lowerBounds = mins.n_elem == numParams ? mins : arma::vec(numParams).fill(-inf);
+    const arma::vec upperBounds = maxes.n_elem == numParams ? maxes : arma::vec(numParams).fill(inf);
+
+    const bool adaptPts = minPts > 0 && minPts < numPts;
+
+    arma::vec ctr = ctr0;
+    arma::vec sigma = sigma0;
+
+    mcopt::MCminimizeResult result;
+    result.allParams.set_size(numIters * numPts, numParams + 3);
+    result.minChis.set_size(numIters, 3);
+    result.goodParamIdx.set_size(numIters);
+
+    info = RunInfo();
+
+    arma::uword firstRow = 0;
+    unsigned iter = 0;
+    unsigned pts = numPts;
+    unsigned numStalled = 0;
+    double bestChi = inf;
+
+    while (iter < numIters) {
+        const auto iterStart = std::chrono::steady_clock::now();
+
+        const arma::mat params = worker.makeParams(ctr, sigma, pts, lowerBounds, upperBounds);
+        const arma::mat chis = evalTracks(params);
+        info.numTracks += pts;
+
+        const arma::vec totalChis = arma::sum(chis, 1);
+        const arma::uword minIdx = totalChis.index_min();
+        ctr = params.row(minIdx).t();
+
+        result.allParams.submat(firstRow, 0, firstRow + pts - 1, numParams - 1) = params;
+        result.allParams.submat(firstRow, numParams, firstRow + pts - 1, numParams + 2) = chis;
+        result.minChis.row(iter) = chis.row(minIdx);
+        result.goodParamIdx(iter) = firstRow + minIdx;
+
+        firstRow += pts;
+        iter++;
+        sigma *= worker.redFactor;
+
+        // Check for convergence. The first iteration always counts as an improvement.
+        const double minChi = totalChis(minIdx);
+        const bool improved = minChi < bestChi
+                              && (bestChi == inf || (bestChi - minChi) >= chi2Tolerance * bestChi);
+        bestChi = std::min(bestChi, minChi);
+
+        if (improved) {
+            numStalled = 0;
+        }
+        else if (pts == numPts) {
+            numStalled++;
+        }
+
+        bool stop = false;
+        if (iter >= minIters && iter < numIters) {
+            if (chi2Tolerance > 0 && numStalled >= std::max(1u, stallIters)) {
+                stop = true;
+            }
+            if (spreadTolerance > 0 && parameterSpread(params, chis, sigma0) < spreadTolerance) {
+                stop = true;
+            }
+        }
+
+        if (adaptPts) {
+            pts = improved ? std::max(minPts, pts / 2) : numPts;
+        }
+
+        const std::chrono::duration<double> iterTime = std::chrono::steady_clock::now() - iterStart;
+        info.iterationTimes.push_back(iterTime.count());
+
+        if (stop) {
+            info.converged = true;
+            break;
+        }
+    }
+
+    // Drop the rows for the iterations and points that weren't used. This keeps the existing values.
+    result.allParams.resize(firstRow, numParams + 3);
+    result.minChis.resize(iter, 3);
+    result.goodParamIdx.resize(iter);
+
+    result.ctr = ctr;
+
+    return result;
+}
+
+mcopt::MCminimizeResult ParallelMinimizer::minimize(const arma::vec& ctr0, const arma::vec& sigma0,
+                                                    const arma::mat& expPos, const arma::vec& expHits)
+{
+    iterationTimes.clear();
+    numTracksEvaluated = 0;
+    converged = false;
+
+    auto evalTracks = [&](const arma::mat& params) { return splitTracks(params, expPos, expHits); };
+
+    RunInfo info;
+    mcopt::MCminimizeResult result = minimizeWith(*workers.front(), evalTracks, ctr0, sigma0, info);
+
+    iterationTimes = std::move(info.iterationTimes);
+    numTracksEvaluated = info.numTracks;
+    converged = info.converged;
+
+    return result;
+}
+
+arma::mat ParallelMinimizer::minimizeBatch(const arma::mat& ctr0s, const arma::vec& sigma0, const arma::mat& expPos,
+                                           const arma::uvec& pads, const arma::vec& amps,
+                                           const arma::uvec& offsets, const arma::uword numPads)
+{
+    const arma::uword numEvents = ctr0s.n_rows;
+    const arma::uword numParams = ctr0s.n_cols;
+
+    if (sigma0.n_elem != numParams) {
+        throw std::invalid_argument("sigma0 must have one element per parameter");
+    }
+    if (expPos.n_cols != 3) {
+        throw std::invalid_argument("The experimental positions must have 3 columns");
+    }
+    if (pads.n_elem != expPos.n_rows || amps.n_elem != expPos.n_rows) {
+        throw std::invalid_argument("There must be one pad and one amplitude per experimental point");
+    }
+    if (offsets.n_elem != numEvents + 1 || offsets(0) != 0 || offsets(numEvents) != expPos.n_rows) {
+        throw std::invalid_argument("The offsets must start at 0, end at the number of points, and have one more "
+                                    "element than the number of events");
+    }
+    for (arma::uword i = 0; i < numEvents; i++) {
+        if (offsets(i + 1) < offsets(i)) throw std::invalid_argument("The offsets must not decrease");
+    }
+    if (pads.n_elem > 0 && pads.max() >= numPads) {
+        throw std::invalid_argument("A pad number is out of range");
+    }
+
+    const int nthr = static_cast<int>(workers.size());
+    const unsigned numIters = workers.front()->numIters;
+
+    arma::mat results (numEvents, numParams + 5);
+    results.fill(arma::datum::nan);
+
+    iterationTimes.assign(numIters, 0);
+    numTracksEvaluated = 0;
+    size_t numConverged = 0;
+
+    // Exceptions can't cross the edge of the parallel region, so save the first one and rethrow it afterwards
+    std::exception_ptr error = nullptr;
+
+    #pragma omp parallel num_threads(nthr)
+    {
+        #ifdef _OPENMP
+        mcopt::MCminimizer& worker = *workers[omp_get_thread_num()];
+        #else
+        mcopt::MCminimizer& worker = *workers.front();
+        #endif
+
+        std::vector<double> threadTimes (numIters, 0);
+        size_t threadTracks = 0;
+        size_t threadConverged = 0;
+        arma::vec expHits (numPads);
+
+        #pragma omp for schedule(dynamic)
+        for (long evt = 0; evt < static_cast<long>(numEvents); evt++) {
+            const arma::uword first = offsets(evt);
+            const arma::uword last = offsets(evt + 1);
+
+            try {
+                if (first == last) throw std::runtime_error("The event has no points");
+
+                const arma::mat evtPos = expPos.rows(first, last - 1);
+
+                // The last amplitude for each pad wins. MCFitter.process_events passes the pads in the same order
+                // that MCFitter.process_event builds its hit pattern from.
+                expHits.zeros();
+                for (arma::uword i = first; i < last; i++) {
+                    expHits(pads(i)) = amps(i);
+                }
+
+                auto evalTracks = [&](const arma::mat& params) { return worker.runTracks(params, evtPos, expHits); };
+
+                RunInfo info;
+                const mcopt::MCminimizeResult res = minimizeWith(worker, evalTracks, ctr0s.row(evt).t(), sigma0,
+                                                                 info);
+
+                const arma::uword lastIter = res.minChis.n_rows - 1;
+                results.submat(evt, 0, evt, numParams - 1) = res.ctr.t();
+                results.submat(evt, numParams, evt, numParams + 2) = res.minChis.row(lastIter);
+                results(evt, numParams + 3) = res.minChis.n_rows;
+                results(evt, numParams + 4) = 1;
+
+                for (size_t i = 0; i < info.iterationTimes.size(); i++) {
+                    threadTimes[i] += info.iterationTimes[i];
+                }
+                threadTracks += info.numTracks;
+                if (info.converged) threadConverged++;
+            }
+            catch (const std::exception&) {
+                // Leave the parameters and chi2 as NaN to mark the failed event
+                results(evt, numParams + 4) = 0;
+            }
+            catch (...) {
+                #pragma omp critical
+                {
+                    if (!error) error = std::current_exception();
+                }
+            }
+        }
+
+        #pragma omp critical
+        {
+            for (unsigned i = 0; i < numIters; i++) {
+                iterationTimes[i] += threadTimes[i];
+            }
+            numTracksEvaluated += threadTracks;
+            numConverged += threadConverged;
+        }
+    }
+
+    if (error) std::rethrow_exception(error);
+
+    numEventsConverged = numConverged;
+
+    return results;
+}
+
+}
@@ -0,0 +1,126 @@
+/* mcopt_parallel.h
+   Multithreaded versions of the MCminimizer functions for the Python bindings. Each thread gets its own copy of the
+   Tracker, EventGenerator, and MCminimizer, so no state is shared between threads while the tracks are evaluated.
+   The gas and pad plane lookup tables are read-only, so the copies all point to the same ones.
+ */
+
+#ifndef MCOPT_PARALLEL_H
+#define MCOPT_PARALLEL_H
+
+#include <mcopt/mcopt.h>
+#include <armadillo>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace pytpc {
+
+class ParallelMinimizer
+{
+public:
+    /* Make a set of `numThreads` workers that are copies of the given objects. The settings of `proto` (the number
+       of iterations, the chi2 components that are enabled, etc.) are copied to each worker, so this should be
+       constructed again if they change.
+     */
+    ParallelMinimizer(const mcopt::MCminimizer& proto, const mcopt::Tracker& tracker,
+                      const mcopt::EventGenerator& evtgen, const unsigned numThreads);
+
+    /* Equivalent to `MCminimizer::runTracks`, but the rows of `params` are split between the threads. */
+    arma::mat runTracks(const arma::mat& params, const arma::mat& expPos, const arma::vec& expHits);
+
+    /* Equivalent to `MCminimizer::minimize`, but each iteration's tracks are evaluated with `runTracks` above.
+
+       The parameter sets are drawn with `makeParams` using the bounds `mins` and `maxes`. The result's `allParams`
+       has the parameter columns followed by the three chi2 columns.
+
+       If any of the convergence settings below are enabled, this may stop before `numIters` iterations and use
+       fewer than `numPts` points in some iterations. The result then only has rows for the iterations and points
+       that were actually used.
+     */
+    mcopt::MCminimizeResult minimize(const arma::vec& ctr0, const arma::vec& sigma0, const arma::mat& expPos,
+                                     const arma::vec& expHits);
+
+    /* Minimize many events at once. The events are split between the threads, and each thread minimizes its events
+       one at a time with its own worker, so there is no synchronization between the iterations of an event.
+
+       Row i of `ctr0s` is the initial guess for event i, and every event uses `sigma0`. The experimental points of
+       all events are packed into `expPos`, `pads`, and `amps`, and event i has rows `offsets(i)` to
+       `offsets(i + 1) - 1`. The hit pattern of each event, with `numPads` elements, is built from its pads and
+       amplitudes in order, so if a pad appears more than once, its last amplitude is used. The pads and amplitudes
+       of an event don't have to be in the same order as its positions.
+
+       Each row of the result has the fitted parameters, the three chi2 components from the last iteration, the
+       number of iterations that were run, and 1 if the minimization succeeded or 0 if it failed. The parameters and
+       chi2 values are NaN for failed events, and the other events are unaffected.
+     */
+    arma::mat minimizeBatch(const arma::mat& ctr0s, const arma::vec& sigma0, const arma::mat& expPos,
+                            const arma::uvec& pads, const arma::vec& amps, const arma::uvec& offsets,
+                            const arma::uword numPads);
+
+    unsigned numThreads() const { return static_cast<unsigned>(workers.size()); }
+
+    arma::vec mins;
+    arma::vec maxes;
+
+    /* Settings for stopping `minimize` once it has converged. The defaults disable all of them, so every iteration
+       is run with `numPts` points.
+
+       An iteration has stalled if it reduces the smallest total chi2 seen so far by less than `chi2Tolerance`, as a
+       fraction of that chi2. The minimizer stops after `stallIters` stalled iterations in a row. It also stops if
+       the standard deviation of the best `spreadFraction` of the parameter sets in an iteration, divided by
+       `sigma0`, is less than `spreadTolerance` in every dimension. Neither rule applies before `minIters`
+       iterations have run.
+
+       If `minPts` is between 0 and `numPts`, the number of points is halved after each iteration that improves the
+       chi2, down to `minPts`, and is reset to `numPts` after one that stalls. A stall only counts toward
+       `stallIters` if it happened with all `numPts` points.
+     */
+    double chi2Tolerance = 0;
+    unsigned stallIters = 1;
+    double spreadTolerance = 0;
+    double spreadFraction = 0.1;
+    unsigned minIters = 1;
+    unsigned minPts = 0;
+
+    /* True if the last call to `minimize` stopped before running all `numIters` iterations, and the number of
+       events for which that happened in the last call to `minimizeBatch`.
+     */
+    bool converged = false;
+    size_t numEventsConverged = 0;
+
+    /* Counters for instrumentation. `numTracksEvaluated` is the number of tracks simulated, and `iterationTimes`
+       has the wall time, in seconds, of each iteration of the last call to `minimize`, or the total over all events
+       for `minimizeBatch`. Both are reset at the start of each call to `minimize` or `minimizeBatch`.
+     */
+    std::vector<double> iterationTimes;
+    size_t numTracksEvaluated = 0;
+
+private:
+    /* The counters from one minimization. */
+    struct RunInfo
+    {
+        std::vector<double> iterationTimes;
+        size_t numTracks = 0;
+        bool converged = false;
+    };
+
+    /* The Monte Carlo loop shared by `minimize` and `minimizeBatch`. `evalTracks` finds the chi2 values for a set of
+       parameters, and `worker` is used to draw the parameter sets.
+     */
+    mcopt::MCminimizeResult minimizeWith(mcopt::MCminimizer& worker,
+                                         const std::function<arma::mat(const arma::mat&)>& evalTracks,
+                                         const arma::vec& ctr0, const arma::vec& sigma0, RunInfo& info) const;
+
+    /* Split the tracks between the workers, like `runTracks`, but without counting them. */
+    arma::mat splitTracks(const arma::mat& params, const arma::mat& expPos, const arma::vec& expHits);
+
+    double parameterSpread(const arma::mat& params, const arma::mat& chis, const arma::vec& sigma0) const;
+
+    std::vector<std::unique_ptr<mcopt::Tracker>> trackers;
+    std::vector<std::unique_ptr<mcopt::EventGenerator>> evtgens;
+    std::vector<std::unique_ptr<mcopt::MCminimizer>> workers;
+};
+
+}
+
+#endif /* end of include guard: MCOPT_PARALLEL_H */
@@ -19,18 +19,46 @@ cdef class Gas:
 cdef class Tracker:
     cdef mcopt.Tracker *thisptr
     cdef Gas gas
+    cdef unsigned long version
 
 
 cdef class PadPlane:
     cdef mcopt.PadPlane *thisptr
 
 
+cdef class TiledPadPlane:
+    cdef mcopt.TiledPadLUT *thisptr
+
+
 cdef class EventGenerator:
     cdef mcopt.EventGenerator *thisptr
     cdef PadPlane pyPadPlane
+    cdef unsigned long version
 
 
 cdef class Minimizer:
     cdef mcopt.MCminimizer *thisptr
     cdef Tracker pyTracker
     cdef EventGenerator pyEvtGen
+    cdef unsigned numThreads
+    cdef object paramMins
+    cdef object paramMaxes
+    cdef double chi2Tolerance
+    cdef unsigned stallIters
+    cdef double spreadTolerance
+    cdef double spreadFraction
+    cdef unsigned minIters
+    cdef unsigned minPts
+    cdef mcopt.ParallelMinimizer *parallel
+    cdef bint parallelStale
+    cdef unsigned long trackerVersion
+    cdef unsigned long evtgenVersion
+    cdef bint earlyStopping(self)
+    cdef bint useParallel(self)
+    cdef mcopt.ParallelMinimizer* get_parallel(self) except NULL
+
+
+cdef class KalmanFilter:
+    cdef mcopt.TrackKalmanFilter *thisptr
+    cdef Tracker pyTracker
+    cdef unsigned numThreads
@@ -7,7 +7,12 @@ import numpy as np
 cimport numpy as np
 from cython.operator cimport dereference as deref, preincrement as preinc
 from libc.stdio cimport printf
+from libc.string cimport memcpy
+from libcpp.string cimport string as cppstring
+from libc.math cimport sqrt, sin, cos
 from ..utilities import find_vertex_energy
+from ..ukf import find_step_distances
+from ..constants import amuToMeV
 
 
 cdef cppvec[double] np2cppvec(np.ndarray[np.double_t, ndim=1] v):
@@ -114,6 +119,7 @@ cdef class Tracker:
             self.thisptr.setEfield(deref(efieldVec))
         finally:
             del efieldVec
+        self.version += 1
 
     @property
     def bfield(self):
@@ -132,6 +138,7 @@ cdef class Tracker:
             self.thisptr.setBfield(deref(bfieldVec))
         finally:
             del bfieldVec
+        self.version += 1
 
     def track_particle(self, double x0, double y0, double z0, double enu0, double azi0, double pol0):
         """Simulate the trajectory of a particle.
@@ -154,7 +161,7 @@ cdef class Tracker:
         """
         cdef mcopt.Track tr = self.thisptr.trackParticle(x0, y0, z0, enu0, azi0, pol0)
         cdef arma.mat trmat = tr.getMatrix()
-        return arma.mat2np(trmat)
+        return arma.mat2np_steal(trmat)
 
 
 cdef class PadPlane:
@@ -240,6 +247,167 @@ cdef class PadPlane:
         return a
 
 
+cdef class TiledPadPlane:
+    """A pad lookup table that is stored in tiles, for faster lookups of nearby points.
+
+    This gives the same results as :class:`PadPlane`, but each square tile of the table is contiguous in memory, so
+    looking up the points along a track touches much less memory. It also has :meth:`get_pad_numbers` to look up
+    many points at once, and it can be saved to a file with :meth:`save` and mapped back into memory with
+    :meth:`from_file`. All of the processes that map the same file share one copy of the table.
+
+    Parameters
+    ----------
+    lut : ndarray
+        An array of pad number as a function of x (columns) and y (rows), like for :class:`PadPlane`.
+    x_lower_bound, x_delta, y_lower_bound, y_delta : float
+        The position of the first cell and the step between cells, like for :class:`PadPlane`.
+    rot_angle : float, optional
+        An angle, in radians, through which to rotate the pad plane.
+    tile_size : unsigned int, optional
+        The number of cells on each side of a tile. This must be a power of 2.
+    path : str, optional
+        If given, map the table from this file instead of using `lut`. The file must have been written by
+        :meth:`save`. Use :meth:`from_file` instead of this.
+    """
+    def __cinit__(self, np.ndarray[np.uint16_t, ndim=2] lut=None, double xLB=0, double xDelta=0, double yLB=0,
+                  double yDelta=0, double rotAngle=0, unsigned tileSize=32, path=None):
+        cdef arma.Mat[mcopt.pad_t] *lutMat = NULL
+        cdef cppstring cpath
+
+        if path is not None:
+            cpath = str(path).encode()
+            self.thisptr = new mcopt.TiledPadLUT(cpath, rotAngle)
+        elif lut is None:
+            raise ValueError('Either a lookup table or a path must be given')
+        else:
+            try:
+                lutMat = arma.np2uint16mat(lut)
+                self.thisptr = new mcopt.TiledPadLUT(deref(lutMat), xLB, xDelta, yLB, yDelta, rotAngle, tileSize)
+            finally:
+                del lutMat
+
+    def __dealloc__(self):
+        del self.thisptr
+
+    @staticmethod
+    def from_file(path, double rot_angle=0):
+        """Map a table that was written by :meth:`save` into memory.
+
+        Parameters
+        ----------
+        path : str
+            The path to the file.
+        rot_angle : float, optional
+            An angle, in radians, through which to rotate the pad plane. This isn't stored in the file.
+
+        Returns
+        -------
+        TiledPadPlane
+            The table. Its memory is a read-only mapping of the file.
+
+        Raises
+        ------
+        RuntimeError
+            If the file could not be mapped or is not a tiled lookup table.
+        """
+        return TiledPadPlane(rotAngle=rot_angle, path=path)
+
+    def save(self, path):
+        """Write the table to a file that can be loaded with :meth:`from_file`.
+
+        The file is written to a temporary path and then renamed, so it is safe to do this while other processes
+        might be loading the same file.
+        """
+        cdef cppstring cpath = str(path).encode()
+        self.thisptr.save(cpath)
+
+    def get_pad_number_from_coordinates(self, double x, double y):
+        """Look up the pad number under the given point, like :meth:`PadPlane.get_pad_number_from_coordinates`.
+
+        Raises
+        ------
+        IndexError
+            If the point was outside of the lookup table.
+        """
+        return self.thisptr.getPadNumberFromCoordinates(x, y)
+
+    def get_pad_numbers(self, xy, mcopt.pad_t invalid=0xFFFF):
+        """Look up the pad numbers under many points at once.
+
+        Parameters
+        ----------
+        xy : ndarray
+            The points, with x in the first column and y in the second. Any other columns are ignored. If this
+            is float32, it is used without converting it to float64.
+        invalid : int, optional
+            The value to return for points that are outside of the lookup table.
+
+        Returns
+        -------
+        ndarray
+            The pad number under each point, as uint16.
+        """
+        cdef arma.mat *xyMat = NULL
+        cdef arma.Mat[float] *fxyMat = NULL
+        cdef arma.Col[mcopt.pad_t] padVec
+        cdef np.ndarray[np.uint16_t, ndim=1] pads
+
+        xy = np.asarray(xy)
+        if xy.ndim != 2:
+            raise ValueError('xy must be a 2D array')
+
+        try:
+            if xy.dtype == np.float32:
+                xy = np.asfortranarray(xy)
+                fxyMat = arma.np2fmat_view(xy)
+                with nogil:
+                    padVec = self.thisptr.getPadNumbers(deref(fxyMat), invalid)
+            else:
+                xy = np.asfortranarray(xy, dtype=np.double)
+                xyMat = arma.np2mat_view(xy)
+                with nogil:
+                    padVec = self.thisptr.getPadNumbers(deref(xyMat), invalid)
+        finally:
+            del xyMat
+            del fxyMat
+
+        pads = np.empty(padVec.n_elem, dtype=np.uint16)
+        if padVec.n_elem > 0:
+            memcpy(&pads[0], padVec.memptr(), padVec.n_elem * sizeof(mcopt.pad_t))
+        return pads
+
+    def to_array(self):
+        """Get the table as an array in the layout used by :class:`PadPlane`.
+
+        Returns
+        -------
+        ndarray
+            The table, as uint16, with x along the columns and y along the rows.
+        """
+        cdef arma.Mat[mcopt.pad_t] lutMat = self.thisptr.toMatrix()
+        cdef np.ndarray[np.uint16_t, ndim=2] lut = np.empty((lutMat.n_rows, lutMat.n_cols), dtype=np.uint16,
+                                                            order='F')
+        if lutMat.n_rows > 0 and lutMat.n_cols > 0:
+            memcpy(&lut[0, 0], lutMat.memptr(), lutMat.n_rows * lutMat.n_cols * sizeof(mcopt.pad_t))
+        return lut
+
+    @property
+    def bounds(self):
+        """The position of the first cell and the step between cells, as ``(x_lower_bound, x_delta,
+        y_lower_bound, y_delta)``."""
+        return (self.thisptr.xLowerBound(), self.thisptr.xDelta(), self.thisptr.yLowerBound(),
+                self.thisptr.yDelta())
+
+    @property
+    def tile_size(self):
+        return self.thisptr.getTileSize()
+
+    @property
+    def is_mapped(self):
+        """True if the table is a mapping of a file."""
+        return self.thisptr.isMapped()
+
+
 cdef class EventGenerator:
     """A GET event generator. This can be used to generate events from simulated tracks.
 
@@ -287,6 +455,7 @@ cdef class EventGenerator:
     @mass_num.setter
     def mass_num(self, int newval):
         self.thisptr.massNum = newval
+        self.version += 1
 
     @property
     def ioniz(self):
@@ -295,6 +464,7 @@ cdef class EventGenerator:
     @ioniz.setter
     def ioniz(self, double newval):
         self.thisptr.ioniz = newval
+        self.version += 1
 
     @property
     def micromegas_gain(self):
@@ -303,6 +473,7 @@ cdef class EventGenerator:
     @micromegas_gain.setter
     def micromegas_gain(self, double newval):
         self.thisptr.micromegasGain = newval
+        self.version += 1
 
     @property
     def electronics_gain(self):
@@ -312,6 +483,7 @@ cdef class EventGenerator:
     @electronics_gain.setter
     def electronics_gain(self, newval):
         self.thisptr.electronicsGain = newval
+        self.version += 1
 
     @property
     def tilt(self):
@@ -320,6 +492,7 @@ cdef class EventGenerator:
     @tilt.setter
     def tilt(self, double newval):
         self.thisptr.tilt = newval
+        self.version += 1
 
     @property
     def clock(self):
@@ -327,7 +500,8 @@ cdef class EventGenerator:
         return self.thisptr.clock * 1e-6
     @clock.setter
     def clock(self, double newval):
-         self.thisptr.clock = newval * 1e6
+        self.thisptr.clock = newval * 1e6
+        self.version += 1
 
     @property
     def shape(self):
@@ -337,6 +511,7 @@ cdef class EventGenerator:
     @shape.setter
     def shape(self, double newval):
         self.thisptr.shape = newval
+        self.version += 1
 
     @property
     def vd(self):
@@ -354,6 +529,7 @@ cdef class EventGenerator:
             self.thisptr.vd = deref(vdVec)
         finally:
             del vdVec
+        self.version += 1
 
     def make_event(self, np.ndarray[np.double_t, ndim=2] pos, np.ndarray[np.double_t, ndim=1] en):
         """Make the electronics signals from the given track matrix.
@@ -376,14 +552,17 @@ cdef class EventGenerator:
         RuntimeError
             If the process fails for some reason.
         """
-        cdef arma.mat *posMat
-        cdef arma.vec *enVec
+        cdef arma.mat *posMat = NULL
+        cdef arma.vec *enVec = NULL
         cdef cppmap[mcopt.pad_t, arma.vec] evtmap
         res = {}
 
+        pos = np.asfortranarray(pos)
+        en = np.ascontiguousarray(en)
+
         try:
-            posMat = arma.np2mat(pos)
-            enVec = arma.np2vec(en)
+            posMat = arma.np2mat_view(pos)
+            enVec = arma.np2vec_view(en)
             evtmap = self.thisptr.makeEvent(deref(posMat), deref(enVec))
         finally:
             del posMat, enVec
@@ -391,11 +570,71 @@ cdef class EventGenerator:
         cdef cppmap[mcopt.pad_t, arma.vec].iterator iter = evtmap.begin()
 
         while iter != evtmap.end():
-            res[deref(iter).first] = arma.vec2np(deref(iter).second)
+            res[deref(iter).first] = arma.vec2np_steal(deref(iter).second)
             preinc(iter)
 
         return res
 
+    def make_event_dense(self, np.ndarray[np.double_t, ndim=2] pos, np.ndarray[np.double_t, ndim=1] en):
+        """Make the electronics signals from the given track matrix, as one contiguous block.
+
+        This is equivalent to :meth:`make_event`, but it returns the signals in a single 2D array instead of
+        building a dict of separate arrays.
+
+        Parameters
+        ----------
+        pos : ndarray
+            The simulated track positions, as (x, y, z) triples. The units should be compatible with the
+            pad plane's units (probably meters).
+        en : ndarray
+            The energy of the simulated particle at each time step, in MeV/u.
+
+        Returns
+        -------
+        pads : ndarray
+            The hit pad numbers in increasing order, as uint16.
+        traces : ndarray
+            The generated signals, as a C-contiguous array with shape ``(len(pads), 512)``. Row ``i`` is the
+            signal on pad ``pads[i]``.
+
+        Raises
+        ------
+        RuntimeError
+            If the process fails for some reason.
+        """
+        cdef arma.mat *posMat = NULL
+        cdef arma.vec *enVec = NULL
+        cdef cppmap[mcopt.pad_t, arma.vec] evtmap
+
+        pos = np.asfortranarray(pos)
+        en = np.ascontiguousarray(en)
+
+        try:
+            posMat = arma.np2mat_view(pos)
+            enVec = arma.np2vec_view(en)
+            evtmap = self.thisptr.makeEvent(deref(posMat), deref(enVec))
+        finally:
+            del posMat, enVec
+
+        cdef cppmap[mcopt.pad_t, arma.vec].iterator iter = evtmap.begin()
+        cdef Py_ssize_t numPads = evtmap.size()
+        cdef Py_ssize_t numSamples = deref(iter).second.n_elem if numPads > 0 else 512
+        cdef Py_ssize_t i = 0
+
+        cdef np.ndarray[np.uint16_t, ndim=1] pads = np.empty(numPads, dtype=np.uint16)
+        cdef np.ndarray[np.double_t, ndim=2, mode='c'] traces = np.empty((numPads, numSamples), dtype=np.double)
+
+        while iter != evtmap.end():
+            if deref(iter).second.n_elem != numSamples:
+                raise RuntimeError('Generated signals have different lengths')
+            pads[i] = deref(iter).first
+            if numSamples > 0:
+                memcpy(&traces[i, 0], deref(iter).second.memptr(), numSamples * sizeof(double))
+            i += 1
+            preinc(iter)
+
+        return pads, traces
+
     def make_peaks(self, np.ndarray[np.double_t, ndim=2] pos, np.ndarray[np.double_t, ndim=1] en):
         """Make the peaks table (x, y, time_bucket, amplitude, pad_number) from the simulated data.
 
@@ -412,15 +651,19 @@ cdef class EventGenerator:
         ndarray
             The peaks, as described above.
         """
-        cdef arma.mat *posMat
-        cdef arma.vec *enVec
+        cdef arma.mat *posMat = NULL
+        cdef arma.vec *enVec = NULL
         cdef arma.mat peaks
         cdef np.ndarray[np.double_t, ndim=2] res
+
+        pos = np.asfortranarray(pos)
+        en = np.ascontiguousarray(en)
+
         try:
-            posMat = arma.np2mat(pos)
-            enVec = arma.np2vec(en)
+            posMat = arma.np2mat_view(pos)
+            enVec = arma.np2vec_view(en)
             peaks = self.thisptr.makePeaksTableFromSimulation(deref(posMat), deref(enVec))
-            res = arma.mat2np(peaks)
+            res = arma.mat2np_steal(peaks)
         finally:
             del posMat, enVec
 
@@ -442,15 +685,19 @@ cdef class EventGenerator:
         ndarray
             The simulated mesh signal. The shape is (512,).
         """
-        cdef arma.mat *posMat
-        cdef arma.vec *enVec
+        cdef arma.mat *posMat = NULL
+        cdef arma.vec *enVec = NULL
         cdef arma.vec mesh
         cdef np.ndarray[np.double_t, ndim=1] res
+
+        pos = np.asfortranarray(pos)
+        en = np.ascontiguousarray(en)
+
         try:
-            posMat = arma.np2mat(pos)
-            enVec = arma.np2vec(en)
+            posMat = arma.np2mat_view(pos)
+            enVec = arma.np2vec_view(en)
             mesh = self.thisptr.makeMeshSignal(deref(posMat), deref(enVec))
-            res = arma.vec2np(mesh)
+            res = arma.vec2np_steal(mesh)
         finally:
             del posMat, enVec
 
@@ -474,21 +721,39 @@ cdef class EventGenerator:
         ndarray
             The hit pattern, indexed by pad number.
         """
-        cdef arma.mat *posMat
-        cdef arma.vec *enVec
+        cdef arma.mat *posMat = NULL
+        cdef arma.vec *enVec = NULL
         cdef arma.vec mesh
         cdef np.ndarray[np.double_t, ndim=1] res
+
+        pos = np.asfortranarray(pos)
+        en = np.ascontiguousarray(en)
+
         try:
-            posMat = arma.np2mat(pos)
-            enVec = arma.np2vec(en)
+            posMat = arma.np2mat_view(pos)
+            enVec = arma.np2vec_view(en)
             mesh = self.thisptr.makeHitPattern(deref(posMat), deref(enVec))
-            res = arma.vec2np(mesh)
+            res = arma.vec2np_steal(mesh)
         finally:
             del posMat, enVec
 
         return res
 
 
+def _add_minimize_stats(dict stats, iterations, tracks, iteration_times, converged):
+    """Add the counters from one minimization to the `stats` dict given to :meth:`Minimizer.minimize`."""
+    stats['iterations'] = stats.get('iterations', 0) + iterations
+    stats['tracks_evaluated'] = stats.get('tracks_evaluated', 0) + tracks
+    stats['converged'] = stats.get('converged', 0) + int(converged)
+    if iteration_times is not None:
+        totals = stats.setdefault('iteration_times', [])
+        for i, t in enumerate(iteration_times):
+            if i < len(totals):
+                totals[i] += t
+            else:
+                totals.append(t)
+
+
 cdef class Minimizer:
     """A Monte Carlo minimizer for particle tracks
 
@@ -504,19 +769,93 @@ cdef class Minimizer:
         The number of points to simulate per iteration.
     redFactor : float
         The amount to shrink the parameter space by on each iteration. Should be less than 1.
+    numThreads : unsigned int, optional
+        The number of threads to use to evaluate the tracks in :meth:`minimize` and :meth:`run_tracks`. If this is
+        greater than 1, each thread gets its own copy of the tracker and event generator. The default is 1.
+
+    Notes
+    -----
+    By default, :meth:`minimize` always runs `numIters` iterations of `numPts` points. Setting
+    :attr:`chi2_tolerance`, :attr:`spread_tolerance`, or :attr:`min_pts` lets it stop once the fit has converged
+    and use fewer points while the chi^2 is still improving quickly.
+
+    The per-thread copies of the tracker, event generator, and minimizer settings are made the first time they're
+    needed and kept until one of those settings changes, so a Minimizer shouldn't be used by more than one Python
+    thread at a time.
 
     """
-    def __cinit__(self, Tracker tr, EventGenerator evtgen, unsigned numIters, unsigned numPts, double redFactor):
+    def __cinit__(self, Tracker tr, EventGenerator evtgen, unsigned numIters, unsigned numPts, double redFactor,
+                  unsigned numThreads=1):
         self.pyTracker = tr
         self.pyEvtGen = evtgen
         self.thisptr = new mcopt.MCminimizer(self.pyTracker.thisptr, self.pyEvtGen.thisptr,
                                              numIters, numPts, redFactor)
+        self.numThreads = numThreads
+        self.paramMins = None
+        self.paramMaxes = None
+        self.chi2Tolerance = 0
+        self.stallIters = 1
+        self.spreadTolerance = 0
+        self.spreadFraction = 0.1
+        self.minIters = 1
+        self.minPts = 0
+        self.parallel = NULL
+        self.parallelStale = True
 
     def __dealloc__(self):
+        del self.parallel
         del self.thisptr
 
+    cdef bint earlyStopping(self):
+        """True if any of the convergence settings are enabled."""
+        return self.chi2Tolerance > 0 or self.spreadTolerance > 0 or 0 < self.minPts < self.thisptr.numPts
+
+    cdef bint useParallel(self):
+        """True if :meth:`minimize` should use the native loop in `ParallelMinimizer` instead of mcopt's."""
+        return (self.numThreads > 1 or self.earlyStopping() or self.paramMins is not None
+                or self.paramMaxes is not None)
+
+    cdef mcopt.ParallelMinimizer* get_parallel(self) except NULL:
+        """Get the per-thread workers, making them again if the settings they were copied from have changed."""
+        if (self.parallel == NULL or self.parallelStale or self.trackerVersion != self.pyTracker.version
+                or self.evtgenVersion != self.pyEvtGen.version):
+            del self.parallel
+            self.parallel = NULL
+            self.parallel = new mcopt.ParallelMinimizer(
+                deref(self.thisptr), deref(self.pyTracker.thisptr), deref(self.pyEvtGen.thisptr), self.numThreads)
+            self.parallelStale = False
+            self.trackerVersion = self.pyTracker.version
+            self.evtgenVersion = self.pyEvtGen.version
+
+        cdef mcopt.ParallelMinimizer* par = self.parallel
+
+        # These are only read by the loop, so they're set again each time instead of invalidating the workers
+        cdef arma.vec *boundVec
+        if self.paramMins is not None:
+            boundVec = arma.np2vec(np.asarray(self.paramMins, dtype=np.double))
+            par.mins = deref(boundVec)
+            del boundVec
+        else:
+            par.mins.set_size(0)
+        if self.paramMaxes is not None:
+            boundVec = arma.np2vec(np.asarray(self.paramMaxes, dtype=np.double))
+            par.maxes = deref(boundVec)
+            del boundVec
+        else:
+            par.maxes.set_size(0)
+
+        par.chi2Tolerance = self.chi2Tolerance
+        par.stallIters = self.stallIters
+        par.spreadTolerance = self.spreadTolerance
+        par.spreadFraction = self.spreadFraction
+        par.minIters = self.minIters
+        par.minPts = self.minPts
+
+        return par
+
     def minimize(self, np.ndarray[np.double_t, ndim=1] ctr0, np.ndarray[np.double_t, ndim=1] sigma0,
-                 np.ndarray[np.double_t, ndim=2] expPos, np.ndarray[np.double_t, ndim=1] expHits, bint details=False):
+                 np.ndarray[np.double_t, ndim=2] expPos, np.ndarray[np.double_t, ndim=1] expHits, bint details=False,
+                 dict stats=None):
         """Perform chi^2 minimization for the track.
 
         Parameters
@@ -533,6 +872,12 @@ cdef class Minimizer:
         details : bool
             Controls the amount of detail returned. If true, return the things listed below. If False, return just
             the center and the last chi^2 value.
+        stats : dict, optional
+            If given, counters from the minimization are added to the values in this dict, so the same dict can be
+            passed for many events to get the totals. The keys are ``iterations``, ``tracks_evaluated``,
+            ``converged``, and, if ``num_threads`` is greater than 1 or early stopping is enabled,
+            ``iteration_times``. That is a list of the wall time of each iteration in seconds, added element by
+            element. ``converged`` is the number of minimizations that stopped before `numIters` iterations.
 
         Returns
         -------
@@ -542,7 +887,8 @@ cdef class Minimizer:
             The minimum chi^2 values at the end of each iteration. Each column corresponds to one chi^2 variable. Columns are
             (position chi2, hit pattern chi2, vertex position chi2).
         allParams : ndarray
-            The parameters from all generated tracks. There will be `numIters * numPts` rows.
+            The parameters from all generated tracks. There will be `numIters * numPts` rows, unless early stopping
+            is enabled.
         goodParamIdx : ndarray
             The row numbers in `allParams` corresponding to the best points from each iteration, i.e. the ones whose
             chi^2 values are in `minChis`.
@@ -551,26 +897,61 @@ cdef class Minimizer:
         ------
         RuntimeError
             If tracking fails for some reason.
+
+        Notes
+        -----
+        The GIL is released while the minimization runs. If ``num_threads`` is greater than 1, the tracks in each
+        iteration are split between that many threads.
+
+        If ``num_threads`` is greater than 1, early stopping is enabled, or ``param_mins`` or ``param_maxes`` is
+        set, the minimization loop in this module is used instead of mcopt's. It draws the parameter sets within
+        ``param_mins`` and ``param_maxes``, and the columns of `allParams` are the parameters followed by the three
+        chi^2 components. This is the same for any number of threads, so setting the bounds makes one thread and
+        many threads sample the same space. The number of iterations that were used is the number of rows in
+        `minChis`, or the ``iterations`` value in `stats`.
+
+        Otherwise, mcopt's `MCminimizer::minimize` is used, and the bounds and the layout of `allParams` are
+        whatever that version of mcopt uses.
         """
-        cdef arma.vec *ctr0Arr
-        cdef arma.vec *sigma0Arr
-        cdef arma.vec *expHitsArr
-        cdef arma.mat *expPosArr
+        cdef arma.vec *ctr0Arr = NULL
+        cdef arma.vec *sigma0Arr = NULL
+        cdef arma.vec *expHitsArr = NULL
+        cdef arma.mat *expPosArr = NULL
+        cdef mcopt.ParallelMinimizer *par = NULL
         cdef mcopt.MCminimizeResult minres
 
         if len(ctr0) != len(sigma0):
             raise ValueError("Length of ctr0 and sigma0 arrays must be equal")
 
+        ctr0 = np.ascontiguousarray(ctr0)
+        sigma0 = np.ascontiguousarray(sigma0)
+        expPos = np.asfortranarray(expPos)
+        expHits = np.ascontiguousarray(expHits)
+
         try:
-            ctr0Arr = arma.np2vec(ctr0)
-            sigma0Arr = arma.np2vec(sigma0)
-            expPosArr = arma.np2mat(expPos)
-            expHitsArr = arma.np2vec(expHits)
-            minres = self.thisptr.minimize(deref(ctr0Arr), deref(sigma0Arr), deref(expPosArr), deref(expHitsArr))
+            ctr0Arr = arma.np2vec_view(ctr0)
+            sigma0Arr = arma.np2vec_view(sigma0)
+            expPosArr = arma.np2mat_view(expPos)
+            expHitsArr = arma.np2vec_view(expHits)
+            if self.useParallel():
+                par = self.get_parallel()
+                with nogil:
+                    minres = par.minimize(deref(ctr0Arr), deref(sigma0Arr), deref(expPosArr), deref(expHitsArr))
+                if stats is not None:
+                    _add_minimize_stats(stats, par.iterationTimes.size(), par.numTracksEvaluated,
+                                        list(par.iterationTimes), par.converged)
+            else:
+                with nogil:
+                    minres = self.thisptr.minimize(deref(ctr0Arr), deref(sigma0Arr), deref(expPosArr),
+                                                   deref(expHitsArr))
+                if stats is not None:
+                    # The serial minimizer doesn't time its iterations, but every iteration simulates numPts tracks
+                    _add_minimize_stats(stats, minres.minChis.n_rows, minres.minChis.n_rows * self.thisptr.numPts,
+                                        None, False)
         finally:
             del ctr0Arr, sigma0Arr, expPosArr, expHitsArr
 
-        cdef np.ndarray[np.double_t, ndim=1] ctr = arma.vec2np(minres.ctr)
+        cdef np.ndarray[np.double_t, ndim=1] ctr = arma.vec2np_steal(minres.ctr)
 
         cdef np.ndarray[np.double_t, ndim=2] allParams
         cdef np.ndarray[np.double_t, ndim=2] minChis
@@ -581,9 +962,9 @@ cdef class Minimizer:
         cdef double lastVertChi
 
         if details:
-            allParams = arma.mat2np(minres.allParams)
-            minChis = arma.mat2np(minres.minChis)
-            goodParamIdx = arma.vec2np(minres.goodParamIdx)
+            allParams = arma.mat2np_steal(minres.allParams)
+            minChis = arma.mat2np_steal(minres.minChis)
+            goodParamIdx = arma.vec2np_steal(minres.goodParamIdx)
             return ctr, minChis, allParams, goodParamIdx
 
         else:
@@ -592,6 +973,97 @@ cdef class Minimizer:
             lastVertChi = minres.minChis(minres.minChis.n_rows - 1, 2)
             return ctr, lastPosChi, lastEnChi, lastVertChi
 
+    def minimize_batch(self, np.ndarray[np.double_t, ndim=2] ctr0s, np.ndarray[np.double_t, ndim=1] sigma0,
+                       np.ndarray[np.double_t, ndim=2] expPos, expPads, np.ndarray[np.double_t, ndim=1] expAmps,
+                       offsets, unsigned numPads=10240, dict stats=None):
+        """Perform chi^2 minimization for many events at once.
+
+        The events are split between ``num_threads`` threads, and each thread minimizes one event at a time. This
+        avoids the overhead of calling :meth:`minimize` from Python for each event, which dominates for small
+        events.
+
+        Parameters
+        ----------
+        ctr0s : ndarray
+            The initial guess for each event's parameters, with one event per row.
+        sigma0 : ndarray
+            The initial width of the parameter space in each dimension. This is the same for all events.
+        expPos : ndarray
+            The experimental data points of all events, as (x, y, z) triples, one after the other.
+        expPads, expAmps : ndarray
+            The pad number and amplitude of each point, packed like `expPos`. These are only used to build the hit
+            pattern of each event, so within an event they don't have to be in the same order as `expPos`. If a pad
+            appears more than once in an event, the last amplitude is used.
+        offsets : array-like
+            The index of the first row of each event in `expPos`, followed by the total number of rows. Event ``i``
+            has rows ``offsets[i]`` to ``offsets[i+1] - 1``.
+        numPads : unsigned int, optional
+            The number of pads in the hit pattern.
+        stats : dict, optional
+            If given, counters are added to this dict like in :meth:`minimize`. The ``iteration_times`` are summed
+            over all events.
+
+        Returns
+        -------
+        ndarray
+            One row per event. The columns are the fitted parameters, the position, hit pattern, and vertex chi^2
+            from the last iteration, the number of iterations that were run, and 1 if the minimization succeeded
+            (or 0 if it failed). The parameters and chi^2 values are NaN for failed events.
+
+        Raises
+        ------
+        ValueError
+            If the packed arrays are inconsistent.
+
+        Notes
+        -----
+        The GIL is released while the events are minimized. The parameter sets are bounded by ``param_mins`` and
+        ``param_maxes``, and the early stopping settings are applied to each event.
+        """
+        cdef arma.mat *ctr0sMat = NULL
+        cdef arma.vec *sigma0Vec = NULL
+        cdef arma.mat *expPosMat = NULL
+        cdef arma.uvec *padsVec = NULL
+        cdef arma.vec *ampsVec = NULL
+        cdef arma.uvec *offsetsVec = NULL
+        cdef mcopt.ParallelMinimizer *par = NULL
+        cdef arma.mat resMat
+        cdef np.ndarray[np.double_t, ndim=2] resArr
+
+        if ctr0s.shape[1] != sigma0.shape[0]:
+            raise ValueError("ctr0s must have one column per element of sigma0")
+
+        ctr0s = np.asfortranarray(ctr0s)
+        sigma0 = np.ascontiguousarray(sigma0)
+        expPos = np.asfortranarray(expPos)
+        expAmps = np.ascontiguousarray(expAmps)
+        cdef np.ndarray[np.int64_t, ndim=1] padsArr = np.ascontiguousarray(expPads, dtype=np.int64)
+        cdef np.ndarray[np.int64_t, ndim=1] offsetsArr = np.ascontiguousarray(offsets, dtype=np.int64)
+
+        try:
+            ctr0sMat = arma.np2mat_view(ctr0s)
+            sigma0Vec = arma.np2vec_view(sigma0)
+            expPosMat = arma.np2mat_view(expPos)
+            ampsVec = arma.np2vec_view(expAmps)
+            padsVec = arma.np2uvec(padsArr)
+            offsetsVec = arma.np2uvec(offsetsArr)
+
+            par = self.get_parallel()
+            with nogil:
+                resMat = par.minimizeBatch(deref(ctr0sMat), deref(sigma0Vec), deref(expPosMat), deref(padsVec),
+                                           deref(ampsVec), deref(offsetsVec), numPads)
+            resArr = arma.mat2np_steal(resMat)
+
+            if stats is not None:
+                _add_minimize_stats(stats, int(np.nansum(resArr[:, -2])), par.numTracksEvaluated,
+                                    list(par.iterationTimes), 0)
+                stats['converged'] += par.numEventsConverged
+
+        finally:
+            del ctr0sMat, sigma0Vec, expPosMat, padsVec, ampsVec, offsetsVec
+
+        return resArr
+
     def find_position_deviations(self, np.ndarray[np.double_t, ndim=2] simArr, np.ndarray[np.double_t, ndim=2] expArr):
         """Find the deviations in position between two tracks.
 
@@ -607,16 +1079,19 @@ cdef class Minimizer:
         devArr : ndarray
             The array of differences (or deviations).
         """
-        cdef arma.mat *simMat
-        cdef arma.mat *expMat
+        cdef arma.mat *simMat = NULL
+        cdef arma.mat *expMat = NULL
         cdef arma.mat devMat
         cdef np.ndarray[np.double_t, ndim=2] devArr
 
+        simArr = np.asfortranarray(simArr)
+        expArr = np.asfortranarray(expArr)
+
         try:
-            simMat = arma.np2mat(simArr)
-            expMat = arma.np2mat(expArr)
+            simMat = arma.np2mat_view(simArr)
+            expMat = arma.np2mat_view(expArr)
             devMat = self.thisptr.findPositionDeviations(deref(simMat), deref(expMat))
-            devArr = arma.mat2np(devMat)
+            devArr = arma.mat2np_steal(devMat)
 
         finally:
             del simMat, expMat
@@ -643,19 +1118,23 @@ cdef class Minimizer:
         ndarray
             The deviation between the two hit patterns, as seen by the minimizer.
         """
-        cdef arma.mat *simPosMat
-        cdef arma.vec *simEnVec
-        cdef arma.vec *expHitsVec
+        cdef arma.mat *simPosMat = NULL
+        cdef arma.vec *simEnVec = NULL
+        cdef arma.vec *expHitsVec = NULL
         cdef arma.vec hitsDevVec
         cdef np.ndarray[np.double_t, ndim=1] hitsDev
 
+        simPos = np.asfortranarray(simPos)
+        simEn = np.ascontiguousarray(simEn)
+        expHits = np.ascontiguousarray(expHits)
+
         try:
-            simPosMat = arma.np2mat(simPos)
-            simEnVec = arma.np2vec(simEn)
-            expHitsVec = arma.np2vec(expHits)
+            simPosMat = arma.np2mat_view(simPos)
+            simEnVec = arma.np2vec_view(simEn)
+            expHitsVec = arma.np2vec_view(expHits)
 
             hitsDevVec = self.thisptr.findHitPatternDeviation(deref(simPosMat), deref(simEnVec), deref(expHitsVec))
-            hitsDev = arma.vec2np(hitsDevVec)
+            hitsDev = arma.vec2np_steal(hitsDevVec)
 
         finally:
             del simPosMat, simEnVec, expHitsVec
@@ -681,16 +1160,20 @@ cdef class Minimizer:
             The position and energy chi-squared values.
 
         """
-        cdef arma.vec *paramsVec
-        cdef arma.mat *expPosMat
-        cdef arma.vec *expHitsVec
+        cdef arma.vec *paramsVec = NULL
+        cdef arma.mat *expPosMat = NULL
+        cdef arma.vec *expHitsVec = NULL
 
         cdef mcopt.Chi2Set chiset
 
+        params = np.ascontiguousarray(params)
+        expPos = np.asfortranarray(expPos)
+        expHits = np.ascontiguousarray(expHits)
+
         try:
-            paramsVec = arma.np2vec(params)
-            expPosMat = arma.np2mat(expPos)
-            expHitsVec = arma.np2vec(expHits)
+            paramsVec = arma.np2vec_view(params)
+            expPosMat = arma.np2mat_view(expPos)
+            expHitsVec = arma.np2vec_view(expHits)
 
             chiset = self.thisptr.runTrack(deref(paramsVec), deref(expPosMat), deref(expHitsVec))
 
@@ -719,27 +1202,131 @@ cdef class Minimizer:
             A matrix of objective function values. The rows correspond to the rows of ``params``, and the
             columns are the position, energy, and vertex components of the objective function.
 
+        Notes
+        -----
+        The GIL is released while the tracks are evaluated. If ``num_threads`` is greater than 1, the rows of
+        ``params`` are split between that many threads.
+
         """
-        cdef arma.mat *paramsMat
-        cdef arma.mat *expPosMat
-        cdef arma.vec *expHitsVec
+        cdef arma.mat *paramsMat = NULL
+        cdef arma.mat *expPosMat = NULL
+        cdef arma.vec *expHitsVec = NULL
+        cdef mcopt.ParallelMinimizer *par = NULL
 
         cdef arma.mat chiMat
         cdef np.ndarray[np.double_t, ndim=2] chiArr
 
-        try:
-            paramsMat = arma.np2mat(params)
-            expPosMat = arma.np2mat(expPos)
-            expHitsVec = arma.np2vec(expHits)
+        params = np.asfortranarray(params)
+        expPos = np.asfortranarray(expPos)
+        expHits = np.ascontiguousarray(expHits)
 
-            chiMat = self.thisptr.runTracks(deref(paramsMat), deref(expPosMat), deref(expHitsVec))
-            chiArr = arma.mat2np(chiMat)
+        try:
+            paramsMat = arma.np2mat_view(params)
+            expPosMat = arma.np2mat_view(expPos)
+            expHitsVec = arma.np2vec_view(expHits)
+
+            if self.numThreads > 1:
+                par = self.get_parallel()
+                with nogil:
+                    chiMat = par.runTracks(deref(paramsMat), deref(expPosMat), deref(expHitsVec))
+            else:
+                with nogil:
+                    chiMat = self.thisptr.runTracks(deref(paramsMat), deref(expPosMat), deref(expHitsVec))
+            chiArr = arma.mat2np_steal(chiMat)
 
         finally:
             del paramsMat, expPosMat, expHitsVec
 
         return chiArr
 
+    @property
+    def num_threads(self):
+        """The number of threads used to evaluate tracks in :meth:`minimize` and :meth:`run_tracks`."""
+        return self.numThreads
+
+    @num_threads.setter
+    def num_threads(self, unsigned newval):
+        if newval != self.numThreads:
+            self.parallelStale = True
+        self.numThreads = newval
+
+    @property
+    def param_mins(self):
+        """Lower bounds on the parameters drawn in each iteration, or None for no bounds. See :meth:`minimize`."""
+        return self.paramMins
+
+    @param_mins.setter
+    def param_mins(self, newval):
+        self.paramMins = newval
+
+    @property
+    def param_maxes(self):
+        """Upper bounds on the parameters drawn in each iteration, or None for no bounds. See :meth:`minimize`."""
+        return self.paramMaxes
+
+    @param_maxes.setter
+    def param_maxes(self, newval):
+        self.paramMaxes = newval
+
+    @property
+    def chi2_tolerance(self):
+        """Stop :meth:`minimize` once the best total chi^2 improves by less than this fraction for
+        :attr:`stall_iters` iterations in a row. The default is 0, which disables this rule."""
+        return self.chi2Tolerance
+
+    @chi2_tolerance.setter
+    def chi2_tolerance(self, double newval):
+        self.chi2Tolerance = newval
+
+    @property
+    def stall_iters(self):
+        """The number of stalled iterations in a row needed to stop with :attr:`chi2_tolerance`. The default is 1."""
+        return self.stallIters
+
+    @stall_iters.setter
+    def stall_iters(self, unsigned newval):
+        self.stallIters = newval
+
+    @property
+    def spread_tolerance(self):
+        """Stop :meth:`minimize` once the standard deviation of the best :attr:`spread_fraction` of an iteration's
+        parameter sets, divided by `sigma0`, is less than this in every dimension. The default is 0, which disables
+        this rule."""
+        return self.spreadTolerance
+
+    @spread_tolerance.setter
+    def spread_tolerance(self, double newval):
+        self.spreadTolerance = newval
+
+    @property
+    def spread_fraction(self):
+        """The fraction of each iteration's parameter sets used for :attr:`spread_tolerance`. The default is 0.1."""
+        return self.spreadFraction
+
+    @spread_fraction.setter
+    def spread_fraction(self, double newval):
+        self.spreadFraction = newval
+
+    @property
+    def min_iters(self):
+        """The number of iterations to run before either stopping rule applies. The default is 1."""
+        return self.minIters
+
+    @min_iters.setter
+    def min_iters(self, unsigned newval):
+        self.minIters = newval
+
+    @property
+    def min_pts(self):
+        """The smallest number of points per iteration. If this is between 0 and :attr:`num_pts`, the number of points
+        is halved after each iteration that improves the chi^2, down to this, and reset to :attr:`num_pts` after one
+        that doesn't. The default is 0, which always uses :attr:`num_pts` points."""
+        return self.minPts
+
+    @min_pts.setter
+    def min_pts(self, unsigned newval):
+        self.minPts = newval
+
     @property
     def num_iters(self):
         return self.thisptr.numIters
@@ -747,6 +1334,7 @@ cdef class Minimizer:
     @num_iters.setter
     def num_iters(self, newval):
         self.thisptr.numIters = newval
+        self.parallelStale = True
 
     @property
     def num_pts(self):
@@ -755,6 +1343,7 @@ cdef class Minimizer:
     @num_pts.setter
     def num_pts(self, newval):
         self.thisptr.numPts = newval
+        self.parallelStale = True
 
     @property
     def red_factor(self):
@@ -763,6 +1352,7 @@ cdef class Minimizer:
     @red_factor.setter
     def red_factor(self, newval):
         self.thisptr.redFactor = newval
+        self.parallelStale = True
 
     @property
     def posChi2Enabled(self):
@@ -771,6 +1361,7 @@ cdef class Minimizer:
     @posChi2Enabled.setter
     def posChi2Enabled(self, newval):
         self.thisptr.posChi2Enabled = newval
+        self.parallelStale = True
 
     @property
     def enChi2Enabled(self):
@@ -779,6 +1370,7 @@ cdef class Minimizer:
     @enChi2Enabled.setter
     def enChi2Enabled(self, newval):
         self.thisptr.enChi2Enabled = newval
+        self.parallelStale = True
 
     @property
     def vertChi2Enabled(self):
@@ -787,6 +1379,7 @@ cdef class Minimizer:
     @vertChi2Enabled.setter
     def vertChi2Enabled(self, newval):
         self.thisptr.vertChi2Enabled = newval
+        self.parallelStale = True
 
     @property
     def posChi2Norm(self):
@@ -795,6 +1388,7 @@ cdef class Minimizer:
     @posChi2Norm.setter
     def posChi2Norm(self, newval):
         self.thisptr.posChi2Norm = newval
+        self.parallelStale = True
 
     @property
     def enChi2NormFraction(self):
@@ -803,6 +1397,7 @@ cdef class Minimizer:
     @enChi2NormFraction.setter
     def enChi2NormFraction(self, newval):
         self.thisptr.enChi2NormFraction = newval
+        self.parallelStale = True
 
     @property
     def vertChi2Norm(self):
@@ -811,3 +1406,406 @@ cdef class Minimizer:
     @vertChi2Norm.setter
     def vertChi2Norm(self, newval):
         self.thisptr.vertChi2Norm = newval
+        self.parallelStale = True
+
+
+cdef object _covar_columns_to_np(arma.mat& covars):
+    """Convert the covariance matrices from the C++ filter, one flattened matrix per column, to an (N, 6, 6) array."""
+    cdef np.ndarray cols = arma.mat2np_steal(covars)
+    # Each column is one matrix in column-major order, so each row of the transpose is the transpose of a matrix
+    return cols.T.reshape(-1, 6, 6).transpose(0, 2, 1)
+
+
+def _covars_to_columns(covars):
+    """Convert an (N, 6, 6) array of covariance matrices to the column layout used by the C++ filter."""
+    covars = np.asarray(covars, dtype=np.double)
+    return np.asfortranarray(covars.transpose(0, 2, 1).reshape(-1, 36).T)
+
+
+cdef class KalmanFilter:
+    """An unscented Kalman filter for particle tracks, implemented in C++.
+
+    This does the same thing as :meth:`pytpc.ukf.UnscentedKalmanFilter.batch_filter` and
+    :meth:`~pytpc.ukf.UnscentedKalmanFilter.smooth`, but the state is propagated natively using the equations of
+    motion of the tracker: the Lorentz force from the tracker's fields and the energy loss from its gas table.
+    The state vector is (x, y, z, px, py, pz), with the position in meters and the momentum in MeV/c. The measured
+    points are (x, y, z) positions in meters.
+
+    The particle's mass and charge and the fields are copied from the tracker when the filter is made, so changing
+    the tracker's fields afterwards doesn't affect the filter.
+
+    Parameters
+    ----------
+    tracker : Tracker
+        The tracker to take the particle properties, fields, and gas from.
+    num_threads : unsigned int, optional
+        The number of threads to use in :meth:`filter_tracks`.
+    """
+    def __cinit__(self, Tracker tracker, unsigned num_threads=1):
+        self.pyTracker = tracker
+        self.numThreads = num_threads
+        self.thisptr = new mcopt.TrackKalmanFilter(tracker.thisptr.getMassNum(), tracker.thisptr.getChargeNum(),
+                                                   tracker.gas.thisptr, tracker.thisptr.getEfield(),
+                                                   tracker.thisptr.getBfield())
+
+    def __dealloc__(self):
+        del self.thisptr
+
+    @property
+    def Q(self):
+        """The process noise matrix, with dimensions (6, 6)."""
+        return arma.mat2np(self.thisptr.Q)
+
+    @Q.setter
+    def Q(self, value):
+        value = np.asarray(value, dtype=np.double)
+        if value.shape != (6, 6):
+            raise ValueError('Q must have dimensions (6, 6)')
+
+        cdef arma.mat *qMat
+        try:
+            qMat = arma.np2mat(value)
+            self.thisptr.Q = deref(qMat)
+        finally:
+            del qMat
+
+    @property
+    def R(self):
+        """The measurement noise matrix, with dimensions (3, 3)."""
+        return arma.mat2np(self.thisptr.R)
+
+    @R.setter
+    def R(self, value):
+        value = np.asarray(value, dtype=np.double)
+        if value.shape != (3, 3):
+            raise ValueError('R must have dimensions (3, 3)')
+
+        cdef arma.mat *rMat
+        try:
+            rMat = arma.np2mat(value)
+            self.thisptr.R = deref(rMat)
+        finally:
+            del rMat
+
+    @property
+    def kappa(self):
+        """The tuning parameter for the sigma points. The default is -3, like in :mod:`pytpc.ukf`."""
+        return self.thisptr.kappa
+
+    @kappa.setter
+    def kappa(self, double newval):
+        self.thisptr.kappa = newval
+
+    @property
+    def max_time_step(self):
+        """The longest integration step used to propagate the state, in seconds."""
+        return self.thisptr.maxTimeStep
+
+    @max_time_step.setter
+    def max_time_step(self, double newval):
+        if newval <= 0:
+            raise ValueError('max_time_step must be positive')
+        self.thisptr.maxTimeStep = newval
+
+    @property
+    def num_threads(self):
+        """The number of threads used in :meth:`filter_tracks`."""
+        return self.numThreads
+
+    @num_threads.setter
+    def num_threads(self, unsigned newval):
+        self.numThreads = newval
+
+    def initial_state(self, double x0, double y0, double z0, double enu0, double azi0, double pol0):
+        """Make a state vector from the same parameters as :meth:`Tracker.track_particle`.
+
+        Parameters
+        ----------
+        x0, y0, z0, enu0, azi0, pol0 : float
+            The position (m), energy per nucleon (MeV/u), and azimuthal and polar angles (rad).
+
+        Returns
+        -------
+        ndarray
+            The state vector (x, y, z, px, py, pz).
+        """
+        cdef unsigned mass_num = self.pyTracker.thisptr.getMassNum()
+        cdef double mass = mass_num * amuToMeV
+        cdef double en = enu0 * mass_num
+        cdef double p = sqrt(en * (en + 2 * mass))
+        return np.array([x0, y0, z0,
+                         p * sin(pol0) * cos(azi0), p * sin(pol0) * sin(azi0), p * cos(pol0)])
+
+    def state_params(self, state):
+        """Find the track parameters for a state vector. This is the inverse of :meth:`initial_state`.
+
+        Parameters
+        ----------
+        state : array-like
+            The state vector (x, y, z, px, py, pz).
+
+        Returns
+        -------
+        ndarray
+            The parameters (x, y, z, enu, azi, pol), in the same units as :meth:`Tracker.track_particle`.
+        """
+        cdef unsigned mass_num = self.pyTracker.thisptr.getMassNum()
+        cdef double mass = mass_num * amuToMeV
+        x, y, z, px, py, pz = np.asarray(state, dtype=np.double)
+        p = np.sqrt(px**2 + py**2 + pz**2)
+        enu = (np.sqrt(p**2 + mass**2) - mass) / mass_num
+        azi = np.arctan2(py, px)
+        pol = np.arccos(pz / p) if p > 0 else 0.0
+        return np.array([x, y, z, enu, azi, pol])
+
+    def propagate(self, np.ndarray[np.double_t, ndim=1] state, double dt):
+        """Propagate a state vector forward in time using the tracker's equations of motion.
+
+        Parameters
+        ----------
+        state : ndarray
+            The state vector (x, y, z, px, py, pz).
+        dt : float
+            The time step, in seconds.
+
+        Returns
+        -------
+        ndarray
+            The new state vector. If the particle stopped during the step, its momentum is zero.
+        """
+        cdef arma.vec *stateVec = NULL
+        cdef arma.vec res
+
+        state = np.ascontiguousarray(state)
+
+        try:
+            stateVec = arma.np2vec_view(state)
+            res = self.thisptr.propagate(deref(stateVec), dt)
+        finally:
+            del stateVec
+
+        return arma.vec2np_steal(res)
+
+    def batch_filter(self, zs, np.ndarray[np.double_t, ndim=1] x0, np.ndarray[np.double_t, ndim=2] P0):
+        """Apply the filter to the measured points from one track.
+
+        Parameters
+        ----------
+        zs : array-like
+            The measured (x, y, z) points, in meters, sorted in the order the particle passed them. Other columns
+            are ignored.
+        x0 : ndarray
+            The initial state vector. See :meth:`initial_state`.
+        P0 : ndarray
+            The initial covariance matrix, with dimensions (6, 6).
+
+        Returns
+        -------
+        means : ndarray
+            The filtered state at each point.
+        covars : ndarray
+            The covariance matrix at each point, with dimensions (N, 6, 6).
+        times : ndarray
+            The time at each point, in seconds.
+
+        Raises
+        ------
+        ValueError
+            If the inputs have the wrong dimensions.
+        RuntimeError
+            If the filter fails, e.g. because a covariance matrix stopped being positive definite.
+        """
+        cdef np.ndarray[np.double_t, ndim=2] pos = np.asfortranarray(np.asarray(zs, dtype=np.double)[:, :3])
+        cdef np.ndarray[np.double_t, ndim=1] dpos = np.ascontiguousarray(find_step_distances(pos))
+        cdef arma.mat *posMat = NULL
+        cdef arma.vec *dposVec = NULL
+        cdef arma.vec *x0Vec = NULL
+        cdef arma.mat *P0Mat = NULL
+        cdef mcopt.FilterResult res
+
+        x0 = np.ascontiguousarray(x0)
+        P0 = np.asfortranarray(P0)
+
+        try:
+            posMat = arma.np2mat_view(pos)
+            dposVec = arma.np2vec_view(dpos)
+            x0Vec = arma.np2vec_view(x0)
+            P0Mat = arma.np2mat_view(P0)
+            with nogil:
+                res = self.thisptr.batchFilter(deref(posMat), deref(dposVec), deref(x0Vec), deref(P0Mat))
+        finally:
+            del posMat, dposVec, x0Vec, P0Mat
+
+        return arma.mat2np_steal(res.means), _covar_columns_to_np(res.covars), arma.vec2np_steal(res.times)
+
+    def smooth(self, means, covars, times):
+        """Apply the Rauch-Tung-Striebel smoother to the output of :meth:`batch_filter`.
+
+        Parameters
+        ----------
+        means, covars, times : ndarray
+            The results from :meth:`batch_filter`.
+
+        Returns
+        -------
+        means : ndarray
+            The smoothed states.
+        covars : ndarray
+            The smoothed covariance matrices.
+        """
+        cdef mcopt.FilterResult res
+        cdef arma.mat *meansMat = NULL
+        cdef arma.mat *covarsMat = NULL
+        cdef arma.vec *timesVec = NULL
+
+        means = np.asfortranarray(means, dtype=np.double)
+        covars = _covars_to_columns(covars)
+        times = np.ascontiguousarray(times, dtype=np.double)
+
+        try:
+            meansMat = arma.np2mat_view(means)
+            covarsMat = arma.np2mat_view(covars)
+            timesVec = arma.np2vec_view(times)
+            res.means = deref(meansMat)
+            res.covars = deref(covarsMat)
+            res.times = deref(timesVec)
+        finally:
+            del meansMat, covarsMat, timesVec
+
+        with nogil:
+            self.thisptr.smooth(res)
+
+        return arma.mat2np_steal(res.means), _covar_columns_to_np(res.covars)
+
+    def filter_tracks(self, tracks, x0s, np.ndarray[np.double_t, ndim=2] P0, bint smooth=True):
+        """Filter many tracks in parallel, and optionally smooth them.
+
+        This is equivalent to calling :meth:`batch_filter` (and :meth:`smooth`) for each track, but the tracks are
+        split between ``num_threads`` threads and the GIL is released while they are filtered.
+
+        Parameters
+        ----------
+        tracks : sequence of array-like
+            The measured points for each track. See :meth:`batch_filter`.
+        x0s : array-like
+            The initial state vector for each track, with dimensions (len(tracks), 6).
+        P0 : ndarray
+            The initial covariance matrix, used for every track.
+        smooth : bool, optional
+            If True, smooth each track after filtering it.
+
+        Returns
+        -------
+        list
+            A ``(means, covars, times)`` tuple for each track. If the filter failed for a track, its entry is None.
+
+        Raises
+        ------
+        ValueError
+            If the inputs have the wrong dimensions.
+        """
+        cdef cppvec[arma.mat] posVecs
+        cdef cppvec[arma.vec] dposVecs
+        cdef cppvec[mcopt.FilterResult] results
+        cdef arma.mat *posMat = NULL
+        cdef arma.vec *dposVec = NULL
+        cdef arma.mat *x0sMat = NULL
+        cdef arma.mat *P0Mat = NULL
+        cdef size_t i
+
+        x0s = np.asarray(x0s, dtype=np.double)
+        if x0s.ndim != 2 or x0s.shape[0] != len(tracks) or x0s.shape[1] != 6:
+            raise ValueError('x0s must have one row of 6 elements for each track')
+        x0s = np.asfortranarray(x0s.T)
+        P0 = np.asfortranarray(P0)
+
+        for track in tracks:
+            pos = np.asfortranarray(np.asarray(track, dtype=np.double)[:, :3])
+            dpos = np.ascontiguousarray(find_step_distances(pos))
+            try:
+                posMat = arma.np2mat_view(pos)
+                dposVec = arma.np2vec_view(dpos)
+                posVecs.push_back(deref(posMat))
+                dposVecs.push_back(deref(dposVec))
+            finally:
+                del posMat, dposVec
+                posMat = NULL
+                dposVec = NULL
+
+        try:
+            x0sMat = arma.np2mat_view(x0s)
+            P0Mat = arma.np2mat_view(P0)
+            with nogil:
+                results = self.thisptr.filterTracks(posVecs, dposVecs, deref(x0sMat), deref(P0Mat), smooth,
+                                                    self.numThreads)
+        finally:
+            del x0sMat, P0Mat
+
+        out = []
+        for i in range(results.size()):
+            if results[i].success:
+                out.append((arma.mat2np_steal(results[i].means), _covar_columns_to_np(results[i].covars),
+                            arma.vec2np_steal(results[i].times)))
+            else:
+                out.append(None)
+
+        return out
+
+
+def linear_prefit(uvw, double cx, double cy, double bfield_mag, unsigned mass_num, unsigned charge_num):
+    """Run the linear prefit on an array of points, in C++.
+
+    This gives the same results as the scipy ODR fit in
+    :meth:`~pytpc.fitting.mixins.LinearPrefitMixin.linear_prefit_odr`, but the orthogonal line is found in closed
+    form in one pass over the points, and the array is read in place.
+
+    Parameters
+    ----------
+    uvw : ndarray
+        The points, with (u, v, w) in mm in the first three columns, in the beam coordinate system. They should be
+        sorted by w. Any other columns are ignored.
+    cx, cy : float
+        The center of curvature, in mm.
+    bfield_mag : float
+        The magnitude of the magnetic field, in T.
+    mass_num, charge_num : unsigned int
+        The mass and charge numbers of the particle.
+
+    Returns
+    -------
+    res : dict
+        The results, with the same keys as :meth:`~pytpc.fitting.mixins.LinearPrefitMixin.linear_prefit`.
+    params : ndarray
+        The initial guess for the Monte Carlo, like the result of
+        :meth:`~pytpc.fitting.mixins.LinearPrefitMixin.guess_parameters`.
+
+    Raises
+    ------
+    RuntimeError
+        If the points don't determine a line.
+    """
+    cdef np.ndarray[np.double_t, ndim=2] arr = np.asarray(uvw, dtype=np.double)
+    if arr.shape[1] < 3:
+        raise ValueError('The points must have (u, v, w) columns')
+    if arr.strides[0] % sizeof(double) != 0 or arr.strides[1] % sizeof(double) != 0:
+        arr = np.ascontiguousarray(arr)
+
+    cdef const double* uvwPtr = <const double*> arr.data
+    cdef size_t numPts = arr.shape[0]
+    cdef Py_ssize_t rowStride = arr.strides[0] // <Py_ssize_t> sizeof(double)
+    cdef Py_ssize_t colStride = arr.strides[1] // <Py_ssize_t> sizeof(double)
+    cdef mcopt.LinearPrefitResult res
+
+    with nogil:
+        res = mcopt.linearPrefit(uvwPtr, numPts, rowStride, colStride, cx, cy, bfield_mag, mass_num, charge_num)
+
+    res_dict = {'lin_scat_ang': res.scatAngle,
+                'lin_beam_int': res.beamIntercept,
+                'lin_chi2': res.chi2,
+                'rad_curv': res.radCurv,
+                'brho': res.brho,
+                'curv_en': res.curvEn,
+                'curv_ctr_x': cx,
+                'curv_ctr_y': cy}
+
+    return res_dict, np.array([res.params[i] for i in range(6)], dtype=np.double)
@@ -1,12 +1,17 @@
-from . import Tracker, EventGenerator, PadPlane
+from . import Tracker, EventGenerator, PadPlane, TiledPadPlane, mcopt_wrapper
 import numpy as np
 import pandas as pd
 from scipy import odr
-from pytpc.evtdata import calibrate
-from pytpc.gases import InterpolatedGas
+from pytpc.gases import InterpolatedGas, load_tabulated_gas
 from pytpc.constants import degrees, pi, e_chg, p_kg
-from pytpc.utilities import rot_matrix, tilt_matrix, Base
+from pytpc.utilities import rot_matrix, Base
+from pytpc.geometry import get_geometry
 import h5py
+import os
+
+#: The position of the first cell of the pad lookup table at `lut_path`, and the step between cells, in meters, as
+#: ``(x_lower_bound, x_delta, y_lower_bound, y_delta)``.
+LUT_BOUNDS = (-0.280, 0.0001, -0.280, 0.0001)
 
 
 class TrackerMixin(Base):
@@ -16,7 +21,10 @@ class TrackerMixin(Base):
 
     """
     def __init__(self, config):
-        self.gas = InterpolatedGas(config['gas_name'], config['gas_pressure'])  #: The detector gas
+        if config.get('tabulate_gas', False):
+            self.gas = load_tabulated_gas(config['gas_name'], config['gas_pressure'])  #: The detector gas
+        else:
+            self.gas = InterpolatedGas(config['gas_name'], config['gas_pressure'])
         self._efield = np.array(config['efield'])
         self._bfield = np.array(config['bfield'])
         self.mass_num = config['mass_num']  #: The mass number of the tracked particle
@@ -67,7 +75,14 @@ class TrackerMixin(Base):
 class EventGeneratorMixin(Base):
     """Provides an event generator to the inheriting class.
 
-    This adds an EventGenerator object as `self.evtgen`, with some other associated attributes.
+    This adds an EventGenerator object as `self.evtgen`, with some other associated attributes. It also provides a
+    :class:`TiledPadPlane` as `self.pad_lookup`, which can look up many pad numbers at once.
+
+    If the config has the optional key `lut_cache_path`, the tiled lookup table is mapped from that file, which is
+    made from the table at `lut_path` the first time it's needed, and made again if `lut_path` is newer. This is
+    faster than reading the HDF5 file, and every process that uses the same cache shares one copy of the tiled table.
+    Otherwise, `self.pad_lookup` is only made the first time it's used, so the event generator doesn't keep a second
+    copy of the table that nothing reads.
 
     """
     def __init__(self, config):
@@ -83,15 +98,55 @@ class EventGeneratorMixin(Base):
         self._tilt = config['tilt'] * degrees
         self.diff_sigma = config['diffusion_sigma']
 
-        with h5py.File(config['lut_path'], 'r') as hf:
-            lut = hf['LUT'][:]
-        self.padplane = PadPlane(lut, -0.280, 0.0001, -0.280, 0.0001, self.pad_rot_angle)
+        self._lut_path = config['lut_path']
+        self._pad_lookup = None
+
+        lut_cache_path = config.get('lut_cache_path')
+        if lut_cache_path is not None:
+            self._pad_lookup = self._load_pad_lookup(self._lut_path, lut_cache_path)
+            lut, lut_bounds = self._pad_lookup.to_array(), self._pad_lookup.bounds
+        else:
+            lut, lut_bounds = self._read_lut(self._lut_path), LUT_BOUNDS
+
+        # The event generator's table is a copy, so the array read here isn't kept
+        self.padplane = PadPlane(lut, *lut_bounds, rotAngle=self.pad_rot_angle)
+        del lut
+
         self.evtgen = EventGenerator(self.padplane, self.vd, self.clock, self.shape, self.mass_num,
                                      self.ioniz, self.micromegas_gain, self.electronics_gain,
                                      self.tilt, self.diff_sigma)
 
         super().__init__(config)
 
+    @staticmethod
+    def _read_lut(lut_path):
+        """Read the dense pad lookup table from the HDF5 file at `lut_path`."""
+        with h5py.File(lut_path, 'r') as hf:
+            return hf['LUT'][:]
+
+    def _load_pad_lookup(self, lut_path, cache_path=None):
+        """Load the pad lookup table as a `TiledPadPlane`, using the mapped cache file if there is one. The cache
+        is made again if it's older than the table at `lut_path`."""
+        if (cache_path is not None and os.path.exists(cache_path)
+                and os.path.getmtime(cache_path) >= os.path.getmtime(lut_path)):
+            return TiledPadPlane.from_file(cache_path, self.pad_rot_angle)
+
+        pad_lookup = TiledPadPlane(self._read_lut(lut_path), *LUT_BOUNDS, self.pad_rot_angle)
+
+        if cache_path is not None:
+            pad_lookup.save(cache_path)
+            pad_lookup = TiledPadPlane.from_file(cache_path, self.pad_rot_angle)
+
+        return pad_lookup
+
+    @property
+    def pad_lookup(self):
+        """The tiled pad lookup table, for finding many pad numbers at once. This is read from `lut_path` the first
+        time it's used, unless `lut_cache_path` was given."""
+        if self._pad_lookup is None:
+            self._pad_lookup = self._load_pad_lookup(self._lut_path)
+        return self._pad_lookup
+
     @property
     def vd(self):
         return self._vd
@@ -163,13 +218,71 @@ class LinearPrefitMixin(Base):
     1) `linear_prefit` -- This calculates r-phi and performs the linear fit.
     2) `guess_parameters` -- This uses the results of the linear fit to guess the starting point for the Monte Carlo.
 
+    The fit is done in C++ by :func:`pytpc.fitting.mcopt_wrapper.linear_prefit`. The original version using scipy
+    ODR is kept as `linear_prefit_odr`.
+
     """
     def linear_prefit(self, xyz, cx, cy):
         """Performs the linear prefit.
 
-        The linear fit is performed using the SciPy ODR library, which does orthogonal distance regression. This means
-        that the minimized quantity is the orthogonal distance between the line and each data point, rather than the
-        distance along one of the coordinate directions.
+        The arc length of each point around the center of curvature is fit against z with a line. The fit minimizes
+        the orthogonal distance between the line and each data point, rather than the distance along one of the
+        coordinate directions, and each point is weighted by z^2. This is the same fit as in
+        :meth:`linear_prefit_odr`, but it is found in closed form in C++ without creating any new columns.
+
+        Parameters
+        ----------
+        xyz : pandas.DataFrame or ndarray
+            The data to be fit, sorted by w. A DataFrame must have columns (u, v, w) corresponding to the (x, y, z)
+            positions in the *beam* reference frame. (I.e. after calibration and untilting.) For an array, these
+            must be the first three columns. The data is not modified.
+        cx, cy : number
+            The position of the center of curvature, perhaps from a Hough space calculation.
+
+        Returns
+        -------
+        res : dict
+            The results of the fit. The dictionary has entries giving the fit parameters, chi^2, radius of curvature,
+            B-rho, energy from radius of curvature, and center of curvature.
+
+        Raises
+        ------
+        RuntimeError
+            If the points don't determine a line.
+
+        """
+        res, _ = self.linear_prefit_with_guess(xyz, cx, cy)
+        return res
+
+    def linear_prefit_with_guess(self, xyz, cx, cy):
+        """Performs the linear prefit and guesses the initial Monte Carlo parameters in one step.
+
+        This is the same as calling :meth:`linear_prefit` and then :meth:`guess_parameters`.
+
+        Parameters
+        ----------
+        xyz : pandas.DataFrame or ndarray
+            The data to be fit, as for :meth:`linear_prefit`.
+        cx, cy : number
+            The position of the center of curvature.
+
+        Returns
+        -------
+        res : dict
+            The results of the fit, as for :meth:`linear_prefit`.
+        ndarray
+            The initial parameters (x0, y0, z0, enu0, azi0, pol0).
+
+        """
+        if isinstance(xyz, pd.DataFrame):
+            xyz = xyz[['u', 'v', 'w']].values
+        return mcopt_wrapper.linear_prefit(xyz, cx, cy, self.bfield_mag, self.mass_num, self.charge_num)
+
+    def linear_prefit_odr(self, xyz, cx, cy):
+        """Performs the linear prefit using scipy ODR.
+
+        This is the original Python version of :meth:`linear_prefit`. The linear fit is performed using the SciPy ODR
+        library, which does orthogonal distance regression.
 
         Parameters
         ----------
@@ -258,6 +371,14 @@ class PreprocessMixin(Base):
         self.micromegas_tb = config['micromegas_tb']
         super().__init__(config)
 
+    @property
+    def geometry(self):
+        """The shared `pytpc.geometry.DetectorGeometry` for this object's pad rotation, tilt, drift velocity, and clock.
+
+        This is looked up in the process-wide cache each time, so it stays correct if those attributes change.
+        """
+        return get_geometry(self.pad_rot_angle, self.tilt, self.vd, self.clock)
+
     def preprocess(self, raw_xyz, center=None, rotate_pads=False, last_tb=None, drop_beampads=True):
         """Preprocesses data by calibrating it and un-tilting it.
 
@@ -305,15 +426,16 @@ class PreprocessMixin(Base):
         else:
             good_data = raw_xyz
 
-        xyz = pd.DataFrame(calibrate(good_data, self.vd, self.clock), columns=('x', 'y', 'z', 'a', 'pad'))
+        geometry = self.geometry
+        xyz = pd.DataFrame(geometry.calibrate(good_data), columns=('x', 'y', 'z', 'a', 'pad'))
 
         # Find the untilted coordinates
-        tmat = tilt_matrix(-self.tilt)
+        tmat = geometry.tilt_mat
         xyz['u'], xyz['v'], xyz['w'] = np.inner(tmat, xyz[['x', 'y', 'z']])
         xyz['v'] += np.tan(self.tilt) * 1000.  # Corrects for rotating around umegas instead of cathode
 
         if center is not None:
-            center_uvw = calibrate(np.array([[center[0], center[1], 0]]), self.vd, self.clock).ravel()
+            center_uvw = geometry.calibrate(np.array([[center[0], center[1], 0]])).ravel()
             center_uvw = tmat @ center_uvw
             center_uvw[1] += np.tan(self.tilt) * 1000.  # Corrects for rotating around umegas instead of cathode
 
@@ -5,7 +5,8 @@ This module contains the main Python class for fitting data with the Monte Carlo
 """
 
 import numpy as np
-from ..constants import degrees
+from ..constants import degrees, pi
+from ..instrumentation import StageTimer
 from .mixins import TrackerMixin, EventGeneratorMixin, PreprocessMixin, LinearPrefitMixin
 from . import BadEventError
 from .mcopt_wrapper import Minimizer
@@ -39,14 +40,35 @@ class MCFitter(PreprocessMixin, LinearPrefitMixin, TrackerMixin, EventGeneratorM
         num_iters = config['num_iters']
         num_pts = config['num_pts']
         red_factor = config['red_factor']
+        num_threads = config.get('num_threads', 1)
 
-        self.minimizer = Minimizer(self.tracker, self.evtgen, num_iters, num_pts, red_factor)
+        self.minimizer = Minimizer(self.tracker, self.evtgen, num_iters, num_pts, red_factor, num_threads)
+
+        # Optionally keep the parameter sets physical: the vertex is inside the active volume (275 mm is the
+        # Micromegas radius), the energy is within the tracker's energy table, and the angles are within one turn.
+        # Setting the bounds also makes the minimizer use the same loop for any number of threads. This is off by
+        # default, so mcopt's own minimizer is used unless threads or early stopping are configured.
+        if config.get('bound_params', False):
+            self.minimizer.param_mins = np.array([-0.275, -0.275, 0, 0, -2 * pi, 0])
+            self.minimizer.param_maxes = np.array([0.275, 0.275, 1, self.max_en / self.mass_num, 2 * pi, pi])
+
+        # Optional settings for stopping the minimizer early once it converges. See `Minimizer` for details.
+        self.minimizer.chi2_tolerance = config.get('chi2_tolerance', 0)
+        self.minimizer.stall_iters = config.get('stall_iters', 1)
+        self.minimizer.spread_tolerance = config.get('spread_tolerance', 0)
+        self.minimizer.min_iters = config.get('min_iters', 1)
+        self.minimizer.min_pts = config.get('min_pts', 0)
+
+        #: Timers and counters for the stages of the fit. This is enabled by the top-level config key
+        #: `enable_timing`, which is optional and defaults to False.
+        self.timer = StageTimer(enabled=config.get('enable_timing', False))
 
     def process_event(self, xyz, cu, cv, exp_hits=None, return_details=False):
         """Fit the given dataset using the Monte Carlo algorithm.
 
         The details of the fit are governed by the Monte Carlo parameters ``num_iters``, ``num_pts``, and
-        ``red_factor``, which can be adjusted by setting the corresponding properties on this class.
+        ``red_factor``, which can be adjusted by setting the corresponding properties on this class. If early
+        stopping is enabled in the config, fewer iterations may be run.
 
         Parameters
         ----------
@@ -64,38 +86,53 @@ class MCFitter(PreprocessMixin, LinearPrefitMixin, TrackerMixin, EventGeneratorM
         -------
         result : dict
             The fit result. Has keys for the 6 track parameters, the 3 objective function components,
-            and some information about the prefit results.
+            the number of Monte Carlo iterations that were run (``num_iters_used``), and some information about the
+            prefit results.
         min_chis : np.ndarray
             The minimum total chi2 value for each iteration. Only returned if ``return_details == True``.
         all_params : np.ndarray
-            The parameters from all generated tracks. There will be `num_iters * num_pts` rows.
-            Only returned if ``return_details == True``.
+            The parameters from all generated tracks, followed by their three chi2 components. There will be
+            `num_iters * num_pts` rows, unless early stopping is enabled. Only returned if ``return_details == True``.
         good_param_idx : np.ndarray
             The row numbers in ``all_params`` corresponding to the best points from each iteration, i.e. the ones whose
             chi2 values are in ``min_chis``. Only returned if ``return_details == True``.
 
         """
         if exp_hits is None:
+            # If a pad appears more than once, the last amplitude is used
             exp_hits = np.zeros(10240)
-            for a, p in xyz[['a', 'pad']].values:
-                exp_hits[int(p)] = a
+            exp_hits[xyz['pad'].values.astype('int')] = xyz['a'].values
+
+        timer = self.timer
+        timer.count('events')
 
-        xyz_sorted = xyz.sort_values(by='w', ascending=True)
-        prefit_data = xyz_sorted.iloc[-len(xyz_sorted) // 4:].copy()
+        # The prefit uses the last quarter of the points by w, and reads them in place from the sorted array
+        uvw = xyz[['u', 'v', 'w']].values
+        uvw_sorted = uvw[np.argsort(uvw[:, 2])]
+        prefit_data = uvw_sorted[-len(uvw_sorted) // 4:]
 
-        prefit_res = self.linear_prefit(prefit_data, cu, cv)
+        with timer.stage('linear_prefit', len(prefit_data)):
+            prefit_res, ctr0 = self.linear_prefit_with_guess(prefit_data, cu, cv)
 
-        exp_pos = xyz_sorted[['u', 'v', 'w']].values.copy() / 1000
+        exp_pos = uvw_sorted / 1000
 
-        ctr0 = self.guess_parameters(prefit_res)
+        min_stats = {}
+        with timer.stage('minimize', len(exp_pos)):
+            minres = self.minimizer.minimize(
+                ctr0,
+                self.sigma,
+                exp_pos,
+                exp_hits,
+                details=return_details,
+                stats=min_stats,
+            )
 
-        minres = self.minimizer.minimize(
-            ctr0,
-            self.sigma,
-            exp_pos,
-            exp_hits,
-            details=return_details
-        )
+        if timer.enabled:
+            timer.count('mc_iterations', min_stats['iterations'])
+            timer.count('mc_tracks_evaluated', min_stats['tracks_evaluated'])
+            timer.count('mc_converged', min_stats['converged'])
+            for i, iter_time in enumerate(min_stats.get('iteration_times', [])):
+                timer.add_time('minimize.iter_{:02d}'.format(i), iter_time)
 
         if return_details:
             ctr, min_chis, all_params, good_param_idx = minres
@@ -110,6 +147,7 @@ class MCFitter(PreprocessMixin, LinearPrefitMixin, TrackerMixin, EventGeneratorM
         result['posChi2'] = float(posChi)
         result['enChi2'] = float(enChi)
         result['vertChi2'] = float(vertChi)
+        result['num_iters_used'] = int(min_stats['iterations'])
 
         result.update(prefit_res)  # put the linear pre-fit results into result
 
@@ -118,6 +156,96 @@ class MCFitter(PreprocessMixin, LinearPrefitMixin, TrackerMixin, EventGeneratorM
         else:
             return result
 
+    def process_events(self, events):
+        """Fit many events at once using :meth:`Minimizer.minimize_batch`.
+
+        The linear prefit is still done for one event at a time, but the Monte Carlo minimization of all of the
+        events is done in one call, split between ``num_threads`` threads. This is much faster than calling
+        :meth:`process_event` for each event when the events are small.
+
+        Parameters
+        ----------
+        events : iterable
+            A sequence of ``(xyz, cu, cv)`` tuples, with the same meaning as the arguments of :meth:`process_event`.
+
+        Returns
+        -------
+        list
+            The fit result for each event, like the result of :meth:`process_event`, or None if the fit failed for
+            that event. The reason for each failure is logged.
+        """
+        timer = self.timer
+
+        results = []
+        ctr0s = []
+        prefits = []
+        exp_pos = []
+        exp_pads = []
+        exp_amps = []
+        offsets = [0]
+
+        for i, (xyz, cu, cv) in enumerate(events):
+            results.append(None)
+            timer.count('events')
+
+            uvw = xyz[['u', 'v', 'w']].values
+            order = np.argsort(uvw[:, 2])
+            uvw_sorted = uvw[order]
+            prefit_data = uvw_sorted[-len(uvw_sorted) // 4:]
+
+            try:
+                with timer.stage('linear_prefit', len(prefit_data)):
+                    prefit_res, ctr0 = self.linear_prefit_with_guess(prefit_data, cu, cv)
+            except Exception as err:
+                logger.warning('Linear prefit failed for event %d in batch: %s', i, err)
+                continue
+
+            prefits.append((i, prefit_res))
+            ctr0s.append(ctr0)
+            # The hit pattern is built in the original order of the points, like in `process_event`, so the
+            # last amplitude is used for a pad that appears more than once
+            exp_pos.append(uvw_sorted / 1000)
+            exp_pads.append(xyz['pad'].values.astype('int64'))
+            exp_amps.append(xyz['a'].values.astype('float64'))
+            offsets.append(offsets[-1] + len(uvw_sorted))
+
+        if len(prefits) == 0:
+            return results
+
+        min_stats = {}
+        with timer.stage('minimize', offsets[-1]):
+            minres = self.minimizer.minimize_batch(
+                np.array(ctr0s, dtype='float64'),
+                self.sigma,
+                np.concatenate(exp_pos),
+                np.concatenate(exp_pads),
+                np.concatenate(exp_amps),
+                np.array(offsets, dtype='int64'),
+                stats=min_stats,
+            )
+
+        if timer.enabled:
+            timer.count('mc_iterations', min_stats['iterations'])
+            timer.count('mc_tracks_evaluated', min_stats['tracks_evaluated'])
+            timer.count('mc_converged', min_stats['converged'])
+
+        num_params = len(self.sigma)
+        for (i, prefit_res), row in zip(prefits, minres):
+            if row[-1] == 0:
+                logger.warning('Minimization failed for event %d in batch', i)
+                continue
+
+            result = dict(zip(['x0', 'y0', 'z0', 'enu0', 'azi0', 'pol0'],
+                              [float(v) for v in row[:num_params]]))
+            result['posChi2'] = float(row[num_params])
+            result['enChi2'] = float(row[num_params + 1])
+            result['vertChi2'] = float(row[num_params + 2])
+            result['num_iters_used'] = int(row[num_params + 3])
+            result.update(prefit_res)
+            results[i] = result
+
+        return results
+
     @property
     def num_iters(self):
         return self.minimizer.num_iters
@@ -141,3 +269,11 @@ class MCFitter(PreprocessMixin, LinearPrefitMixin, TrackerMixin, EventGeneratorM
     @red_factor.setter
     def red_factor(self, value):
         self.minimizer.red_factor = value
+
+    @property
+    def num_threads(self):
+        return self.minimizer.num_threads
+
+    @num_threads.setter
+    def num_threads(self, value):
+        self.minimizer.num_threads = value
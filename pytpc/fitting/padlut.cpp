@@ -0,0 +1,242 @@
+#include "padlut.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pytpc {
+
+namespace {
+    const char FILE_MAGIC[8] = {'P', 'Y', 'T', 'P', 'C', 'L', 'U', 'T'};
+    const uint32_t FILE_VERSION = 1;
+
+    // The header of a saved table. The tiles follow it directly.
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t tileSize;
+        uint64_t numRows;
+        uint64_t numCols;
+        double xLB;
+        double xDelta;
+        double yLB;
+        double yDelta;
+    };
+
+    unsigned log2Exact(const unsigned value)
+    {
+        if (value == 0 || (value & (value - 1)) != 0) {
+            throw std::invalid_argument("The tile size must be a power of 2");
+        }
+        unsigned shift = 0;
+        while ((1u << shift) != value) shift++;
+        return shift;
+    }
+}
+
+TiledPadLUT::TiledPadLUT(const arma::Mat<mcopt::pad_t>& lut, const double xLB_, const double xDelta_,
+                         const double yLB_, const double yDelta_, const double rotAngle, const unsigned tileSize_)
+    : nRows(lut.n_rows), nCols(lut.n_cols), tileSize(tileSize_), tileShift(log2Exact(tileSize_)),
+      tileMask(tileSize_ - 1), xLB(xLB_), xStep(xDelta_), yLB(yLB_), yStep(yDelta_)
+{
+    if (!(xStep > 0 && yStep > 0)) {
+        throw std::invalid_argument("The lookup table steps must be positive");
+    }
+
+    numTileRows = (nRows + tileSize - 1) / tileSize;
+    numTileCols = (nCols + tileSize - 1) / tileSize;
+    storage.assign(numTileRows * numTileCols * tileSize * tileSize, 0);
+
+    // Go through the source in column order, since that's how it's stored
+    for (arma::uword col = 0; col < nCols; col++) {
+        for (arma::uword row = 0; row < nRows; row++) {
+            const arma::uword tile = (row >> tileShift) * numTileCols + (col >> tileShift);
+            storage[(tile << (2 * tileShift)) + ((row & tileMask) << tileShift) + (col & tileMask)] = lut(row, col);
+        }
+    }
+    data = storage.data();
+
+    setRotation(rotAngle);
+}
+
+TiledPadLUT::TiledPadLUT(const std::string& path, const double rotAngle)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open the lookup table file " + path);
+    }
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(FileHeader)) {
+        ::close(fd);
+        throw std::runtime_error("The lookup table file " + path + " is too short");
+    }
+
+    mappingSize = static_cast<size_t>(info.st_size);
+    void* ptr = ::mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);  // The mapping stays valid after the file is closed
+    if (ptr == MAP_FAILED) {
+        throw std::runtime_error("Could not map the lookup table file " + path);
+    }
+    mapping = ptr;
+
+    FileHeader header;
+    std::memcpy(&header, mapping, sizeof(header));
+
+    try {
+        if (std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header.version != FILE_VERSION) {
+            throw std::runtime_error("The file " + path + " is not a tiled lookup table");
+        }
+
+        tileSize = header.tileSize;
+        tileShift = log2Exact(tileSize);
+        tileMask = tileSize - 1;
+        nRows = header.numRows;
+        nCols = header.numCols;
+        numTileRows = (nRows + tileSize - 1) / tileSize;
+        numTileCols = (nCols + tileSize - 1) / tileSize;
+        xLB = header.xLB;
+        xStep = header.xDelta;
+        yLB = header.yLB;
+        yStep = header.yDelta;
+
+        const size_t dataSize = numTileRows * numTileCols * tileSize * tileSize * sizeof(mcopt::pad_t);
+        if (mappingSize != sizeof(FileHeader) + dataSize) {
+            throw std::runtime_error("The size of the lookup table file " + path + " doesn't match its header");
+        }
+    }
+    catch (...) {
+        ::munmap(mapping, mappingSize);
+        mapping = nullptr;
+        throw;
+    }
+
+    data = reinterpret_cast<const mcopt::pad_t*>(static_cast<const char*>(mapping) + sizeof(FileHeader));
+
+    setRotation(rotAngle);
+}
+
+TiledPadLUT::~TiledPadLUT()
+{
+    if (mapping != nullptr) {
+        ::munmap(mapping, mappingSize);
+    }
+}
+
+void TiledPadLUT::setRotation(const double rotAngle)
+{
+    rotated = rotAngle != 0;
+    cosRot = std::cos(rotAngle);
+    sinRot = std::sin(rotAngle);
+}
+
+bool TiledPadLUT::findCell(const double x, const double y, arma::uword& row, arma::uword& col) const
+{
+    double xr = x;
+    double yr = y;
+    if (rotated) {
+        xr = cosRot * x + sinRot * y;
+        yr = -sinRot * x + cosRot * y;
+    }
+
+    const double c = std::round((xr - xLB) / xStep);
+    const double r = std::round((yr - yLB) / yStep);
+
+    // This is written so that NaN is also out of range
+    if (!(c >= 0 && r >= 0 && c < nCols && r < nRows)) return false;
+
+    row = static_cast<arma::uword>(r);
+    col = static_cast<arma::uword>(c);
+    return true;
+}
+
+mcopt::pad_t TiledPadLUT::getPadNumberFromCoordinates(const double x, const double y) const
+{
+    arma::uword row, col;
+    if (!findCell(x, y, row, col)) {
+        throw std::out_of_range("The point is outside of the lookup table");
+    }
+    return at(row, col);
+}
+
+template <typename T>
+arma::Col<mcopt::pad_t> TiledPadLUT::lookupPoints(const arma::Mat<T>& xy, const mcopt::pad_t invalid) const
+{
+    if (xy.n_cols < 2) {
+        throw std::invalid_argument("The points must have x and y columns");
+    }
+
+    arma::Col<mcopt::pad_t> pads (xy.n_rows);
+    const T* xs = xy.colptr(0);
+    const T* ys = xy.colptr(1);
+
+    for (arma::uword i = 0; i < xy.n_rows; i++) {
+        arma::uword row, col;
+        pads(i) = findCell(xs[i], ys[i], row, col) ? at(row, col) : invalid;
+    }
+
+    return pads;
+}
+
+arma::Col<mcopt::pad_t> TiledPadLUT::getPadNumbers(const arma::mat& xy, const mcopt::pad_t invalid) const
+{
+    return lookupPoints(xy, invalid);
+}
+
+arma::Col<mcopt::pad_t> TiledPadLUT::getPadNumbers(const arma::fmat& xy, const mcopt::pad_t invalid) const
+{
+    return lookupPoints(xy, invalid);
+}
+
+arma::Mat<mcopt::pad_t> TiledPadLUT::toMatrix() const
+{
+    arma::Mat<mcopt::pad_t> lut (nRows, nCols);
+    for (arma::uword col = 0; col < nCols; col++) {
+        for (arma::uword row = 0; row < nRows; row++) {
+            lut(row, col) = at(row, col);
+        }
+    }
+    return lut;
+}
+
+void TiledPadLUT::save(const std::string& path) const
+{
+    FileHeader header;
+    std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.tileSize = tileSize;
+    header.numRows = nRows;
+    header.numCols = nCols;
+    header.xLB = xLB;
+    header.xDelta = xStep;
+    header.yLB = yLB;
+    header.yDelta = yStep;
+
+    const size_t dataSize = numTileRows * numTileCols * tileSize * tileSize * sizeof(mcopt::pad_t);
+    const std::string tmpPath = path + ".tmp" + std::to_string(::getpid());
+
+    {
+        std::ofstream out (tmpPath, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(data), dataSize);
+        if (!out) {
+            std::remove(tmpPath.c_str());
+            throw std::runtime_error("Failed to write the lookup table file " + path);
+        }
+    }
+
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        throw std::runtime_error("Failed to write the lookup table file " + path);
+    }
+}
+
+}
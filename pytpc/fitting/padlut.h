@@ -0,0 +1,110 @@
+/* padlut.h
+   A pad lookup table stored in square tiles. The mcopt PadPlane keeps the whole table as one column-major matrix,
+   so points that are close together in y are far apart in memory. Here, each tile of `tileSize` x `tileSize` cells
+   is contiguous, so the lookups for the points along a track mostly hit the same few tiles.
+
+   The table can be saved to a file and mapped back into memory, so that every process that loads the same file
+   shares one copy of it through the page cache.
+ */
+
+#ifndef PADLUT_H
+#define PADLUT_H
+
+#include <mcopt/mcopt.h>
+#include <armadillo>
+#include <string>
+#include <vector>
+
+namespace pytpc {
+
+class TiledPadLUT
+{
+public:
+    /* Tile a lookup table with the same layout as the one given to mcopt::PadPlane: the rows are y and the columns
+       are x, starting at `yLB` and `xLB` with steps of `yDelta` and `xDelta`. The tile size must be a power of 2.
+     */
+    TiledPadLUT(const arma::Mat<mcopt::pad_t>& lut, const double xLB, const double xDelta, const double yLB,
+                const double yDelta, const double rotAngle = 0, const unsigned tileSize = 32);
+
+    /* Map a table that was written by `save` into memory. The mapping is read-only and shared with every other
+       process that maps the same file.
+     */
+    explicit TiledPadLUT(const std::string& path, const double rotAngle = 0);
+
+    ~TiledPadLUT();
+
+    TiledPadLUT(const TiledPadLUT&) = delete;
+    TiledPadLUT& operator=(const TiledPadLUT&) = delete;
+
+    /* Equivalent to `PadPlane::getPadNumberFromCoordinates`. The point is rotated by `-rotAngle` and then
+       looked up in the nearest cell. This throws std::out_of_range if the point is outside of the table.
+     */
+    mcopt::pad_t getPadNumberFromCoordinates(const double x, const double y) const;
+
+    /* Look up the pad under each row of `xy`, which must have x in the first column and y in the second. Points
+       outside of the table get the value `invalid`.
+     */
+    arma::Col<mcopt::pad_t> getPadNumbers(const arma::mat& xy, const mcopt::pad_t invalid) const;
+
+    /* The same, for single precision points. The rotation and rounding are still done in double precision, so
+       this gives the same pads as the double version of the same (float) values.
+     */
+    arma::Col<mcopt::pad_t> getPadNumbers(const arma::fmat& xy, const mcopt::pad_t invalid) const;
+
+    /* Get the table back in the column-major layout used by mcopt::PadPlane. */
+    arma::Mat<mcopt::pad_t> toMatrix() const;
+
+    /* Write the tiled table to a file that can be mapped with the constructor above. The file is written to a
+       temporary path and then renamed, so other processes never see a partial file.
+     */
+    void save(const std::string& path) const;
+
+    arma::uword numRows() const { return nRows; }
+    arma::uword numCols() const { return nCols; }
+    unsigned getTileSize() const { return tileSize; }
+    bool isMapped() const { return mapping != nullptr; }
+
+    double xLowerBound() const { return xLB; }
+    double xDelta() const { return xStep; }
+    double yLowerBound() const { return yLB; }
+    double yDelta() const { return yStep; }
+
+private:
+    void setRotation(const double rotAngle);
+    bool findCell(const double x, const double y, arma::uword& row, arma::uword& col) const;
+
+    template <typename T>
+    arma::Col<mcopt::pad_t> lookupPoints(const arma::Mat<T>& xy, const mcopt::pad_t invalid) const;
+
+    mcopt::pad_t at(const arma::uword row, const arma::uword col) const
+    {
+        const arma::uword tile = (row >> tileShift) * numTileCols + (col >> tileShift);
+        return data[(tile << (2 * tileShift)) + ((row & tileMask) << tileShift) + (col & tileMask)];
+    }
+
+    arma::uword nRows = 0;
+    arma::uword nCols = 0;
+    unsigned tileSize = 0;
+    unsigned tileShift = 0;
+    arma::uword tileMask = 0;
+    arma::uword numTileCols = 0;
+    arma::uword numTileRows = 0;
+
+    double xLB = 0;
+    double xStep = 0;
+    double yLB = 0;
+    double yStep = 0;
+
+    bool rotated = false;
+    double cosRot = 1;
+    double sinRot = 0;
+
+    std::vector<mcopt::pad_t> storage;  // Used if the table isn't mapped from a file
+    const mcopt::pad_t* data = nullptr;
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+};
+
+}
+
+#endif /* end of include guard: PADLUT_H */
@@ -0,0 +1,151 @@
+#include "prefit.h"
+#include <cmath>
+#include <stdexcept>
+
+namespace pytpc {
+
+namespace {
+    const double PI = 3.14159265358979323846;
+    const double E_CHG = 1.602176634e-19;   // C
+    const double P_KG = 1.67262192369e-27;  // kg
+
+    // Jumps in angle larger than this between consecutive points are taken to be wrapping, like in
+    // `np.unwrap(..., discont=1.8 * pi)`
+    const double UNWRAP_DISCONT = 1.8 * PI;
+
+    // If the smallest unwrapped angle is within this of 2 pi, all of the angles are shifted down by 2 pi
+    const double WRAP_TOLERANCE = 5 * PI / 180;
+
+    // The floored modulus, like the % operator in Python
+    double floorMod(const double x, const double m)
+    {
+        const double r = std::fmod(x, m);
+        return r < 0 ? r + m : r;
+    }
+
+    // Sums of the weighted moments of the (arclength, z) points
+    struct Moments
+    {
+        double n = 0;
+        double s = 0;
+        double w = 0;
+        double ss = 0;
+        double ww = 0;
+        double sw = 0;
+
+        void add(const double sv, const double wv, const double weight)
+        {
+            n += weight;
+            s += weight * sv;
+            w += weight * wv;
+            ss += weight * sv * sv;
+            ww += weight * wv * wv;
+            sw += weight * sv * wv;
+        }
+    };
+}
+
+LinearPrefitResult linearPrefit(const double* uvw, const size_t numPts, const std::ptrdiff_t rowStride,
+                                const std::ptrdiff_t colStride, const double cx, const double cy,
+                                const double bfieldMag, const unsigned massNum, const unsigned chargeNum)
+{
+    if (numPts < 2) {
+        throw std::runtime_error("The linear prefit needs at least 2 points");
+    }
+
+    const double refAngle = std::atan2(-cy, -cx);
+
+    // Whether the angles get shifted by 2 pi depends on their minimum, which isn't known until the end. Since the
+    // shift is the same for every point, the moments are found both with and without it.
+    Moments weighted, weightedShifted, plain, plainShifted;
+    double radSum = 0;
+    double minAngle = INFINITY;
+    double prevAngle = 0;
+    double unwrap = 0;
+
+    for (size_t i = 0; i < numPts; i++) {
+        const double* pt = uvw + static_cast<std::ptrdiff_t>(i) * rowStride;
+        const double du = pt[0] - cx;
+        const double dv = pt[colStride] - cy;
+        const double w = pt[2 * colStride];
+
+        const double rad = std::hypot(du, dv);
+        const double angle = floorMod(refAngle - std::atan2(dv, du), 2 * PI);
+
+        if (i > 0) {
+            const double diff = angle - prevAngle;
+            if (std::abs(diff) >= UNWRAP_DISCONT) {
+                double diffMod = floorMod(diff + PI, 2 * PI) - PI;
+                if (diffMod == -PI && diff > 0) diffMod = PI;
+                unwrap += diffMod - diff;
+            }
+        }
+        prevAngle = angle;
+
+        const double cth = angle + unwrap;
+        if (cth < minAngle) minAngle = cth;
+
+        const double s = rad * cth;
+        const double sShifted = rad * (cth - 2 * PI);
+        const double weight = w * w;
+
+        weighted.add(s, w, weight);
+        weightedShifted.add(sShifted, w, weight);
+        plain.add(s, w, 1);
+        plainShifted.add(sShifted, w, 1);
+        radSum += rad;
+    }
+
+    const bool shift = std::abs(minAngle - 2 * PI) < WRAP_TOLERANCE;
+    const Moments& wm = shift ? weightedShifted : weighted;
+    const Moments& pm = shift ? plainShifted : plain;
+
+    // The orthogonal line through the weighted means, along the major axis of the weighted scatter matrix
+    if (!(wm.n > 0)) {
+        throw std::runtime_error("The linear prefit failed: the total weight of the points is zero");
+    }
+    const double meanS = wm.s / wm.n;
+    const double meanW = wm.w / wm.n;
+    const double varS = wm.ss / wm.n - meanS * meanS;
+    const double varW = wm.ww / wm.n - meanW * meanW;
+    const double covSW = wm.sw / wm.n - meanS * meanW;
+
+    double slope;
+    if (covSW != 0) {
+        slope = (varW - varS + std::sqrt((varW - varS) * (varW - varS) + 4 * covSW * covSW)) / (2 * covSW);
+    }
+    else if (varS >= varW) {
+        slope = 0;
+    }
+    else {
+        throw std::runtime_error("The linear prefit failed: the points are on a line of constant arc length");
+    }
+    const double intercept = meanW - slope * meanS;
+    if (!std::isfinite(slope) || !std::isfinite(intercept)) {
+        throw std::runtime_error("The linear prefit failed: the line is not finite");
+    }
+
+    // The chi^2 is the unweighted sum of squared residuals in z, expanded in terms of the moments
+    double sqResid = pm.ww - 2 * slope * pm.sw - 2 * intercept * pm.w + slope * slope * pm.ss
+                     + 2 * slope * intercept * pm.s + intercept * intercept * pm.n;
+    if (sqResid < 0) sqResid = 0;
+
+    LinearPrefitResult res;
+    res.scatAngle = PI / 2 + std::atan(slope);
+    res.beamIntercept = intercept;
+    res.chi2 = sqResid / (static_cast<double>(numPts) - 3);
+    res.radCurv = radSum / numPts;
+    res.brho = res.radCurv / std::sin(res.scatAngle) * bfieldMag / 1e3;
+    res.curvEn = (res.brho * res.brho * chargeNum * chargeNum * E_CHG * E_CHG / (2 * massNum * P_KG)) / E_CHG * 1e-6;
+
+    res.params[0] = 0;
+    res.params[1] = 0;
+    res.params[2] = res.beamIntercept / 1000;
+    res.params[3] = res.curvEn / massNum;
+    res.params[4] = refAngle - PI / 2;
+    res.params[5] = PI - res.scatAngle;
+
+    return res;
+}
+
+}
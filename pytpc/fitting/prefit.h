@@ -0,0 +1,45 @@
+/* prefit.h
+   A compiled version of the linear prefit in `LinearPrefitMixin`. The arc length of each point around the center of
+   curvature is found and fit against z with a weighted orthogonal (total least squares) line, like the scipy ODR fit
+   in the Python version. For a straight line with the same weight on both coordinates, the orthogonal fit has a
+   closed form, so the whole prefit is one pass over the points with no allocations.
+ */
+
+#ifndef PREFIT_H
+#define PREFIT_H
+
+#include <cstddef>
+
+namespace pytpc {
+
+/* The results of the prefit. The members have the same meanings as the keys of the dict returned by
+   `LinearPrefitMixin.linear_prefit`, and `params` is the initial guess (x0, y0, z0, enu0, azi0, pol0) from
+   `LinearPrefitMixin.guess_parameters`.
+ */
+struct LinearPrefitResult
+{
+    double scatAngle = 0;
+    double beamIntercept = 0;
+    double chi2 = 0;
+    double radCurv = 0;
+    double brho = 0;
+    double curvEn = 0;
+    double params[6] = {0, 0, 0, 0, 0, 0};
+};
+
+/* Run the prefit on `numPts` points with positions (u, v, w) in mm. Point i's u coordinate is at
+   `uvw[i * rowStride]`, and its v and w coordinates follow it at steps of `colStride`, so a numpy array can be
+   used in place in either order. The points should be sorted by w, since the angles are unwrapped in order.
+
+   `cx` and `cy` are the center of curvature in mm, `bfieldMag` is the magnetic field in T, and `massNum` and
+   `chargeNum` describe the tracked particle.
+
+   Throws std::runtime_error if the points don't determine a line, e.g. if there are fewer than 2 of them.
+ */
+LinearPrefitResult linearPrefit(const double* uvw, const size_t numPts, const std::ptrdiff_t rowStride,
+                                const std::ptrdiff_t colStride, const double cx, const double cy,
+                                const double bfieldMag, const unsigned massNum, const unsigned chargeNum);
+
+}
+
+#endif /* end of include guard: PREFIT_H */
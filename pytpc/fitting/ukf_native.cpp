@@ -0,0 +1,288 @@
+#include "ukf_native.h"
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <stdexcept>
+
+namespace pytpc {
+
+namespace {
+    const unsigned DIM_X = 6;
+    const unsigned DIM_Z = 3;
+
+    const double C_LGT = 299792458;  // m/s
+    const double AMU_TO_MEV = 931.494;
+
+    // Below this kinetic energy, in MeV, the particle is considered to have stopped
+    const double MIN_ENERGY = 1e-3;
+
+    // The largest number of RK4 steps that `propagate` will take at once
+    const double MAX_STEPS = 1e6;
+}
+
+TrackKalmanFilter::TrackKalmanFilter(const unsigned massNum, const unsigned chargeNum, const mcopt::Gas* gas_,
+                                     const arma::vec& efield_, const arma::vec& bfield_)
+    : Q(arma::eye<arma::mat>(DIM_X, DIM_X)), R(arma::eye<arma::mat>(DIM_Z, DIM_Z)), kappa(3.0 - DIM_X),
+      maxTimeStep(1e-10), mass(massNum * AMU_TO_MEV), charge(chargeNum), gas(gas_), efield(efield_),
+      bfield(bfield_)
+{
+    if (efield.n_elem != 3 || bfield.n_elem != 3) {
+        throw std::invalid_argument("The E and B fields must have 3 components");
+    }
+}
+
+arma::vec TrackKalmanFilter::derivatives(const arma::vec& state) const
+{
+    const arma::vec3 mom = state.subvec(3, 5);
+    const double p = arma::norm(mom);
+    const double etot = std::sqrt(p*p + mass*mass);
+    const double en = etot - mass;
+    const arma::vec3 vel = mom / etot * C_LGT;
+
+    // With the momentum in MeV/c, a force of F newtons changes it by F * c / (1e6 e) per second. This makes the
+    // Lorentz force Z (E + v x B) c / 1e6, and the stopping force (dE/dx in MeV/m) c.
+    arma::vec3 force = charge * 1e-6 * C_LGT * (efield + arma::cross(vel, bfield));
+    if (p > 0 && en > MIN_ENERGY) {
+        force -= gas->energyLoss(en) * C_LGT * mom / p;
+    }
+
+    arma::vec res (DIM_X);
+    res.subvec(0, 2) = vel;
+    res.subvec(3, 5) = force;
+    return res;
+}
+
+arma::vec TrackKalmanFilter::propagate(const arma::vec& state, const double dt) const
+{
+    if (state.n_elem != DIM_X) {
+        throw std::invalid_argument("The state vector must have 6 elements");
+    }
+
+    if (!(dt >= 0)) {
+        throw std::invalid_argument("The time step must be a non-negative number");
+    }
+
+    // A very long step means the particle has almost stopped, so give up on this state instead of looping forever
+    const double steps = std::ceil(dt / maxTimeStep);
+    if (steps > MAX_STEPS) {
+        throw std::runtime_error("The time step is too long to propagate");
+    }
+    const unsigned numSteps = std::max(1u, static_cast<unsigned>(steps));
+    const double h = dt / numSteps;
+
+    arma::vec st = state;
+    for (unsigned i = 0; i < numSteps; i++) {
+        const arma::vec3 oldMom = st.subvec(3, 5);
+        if (arma::norm(oldMom) == 0) break;
+
+        const arma::vec k1 = derivatives(st);
+        const arma::vec k2 = derivatives(st + h/2 * k1);
+        const arma::vec k3 = derivatives(st + h/2 * k2);
+        const arma::vec k4 = derivatives(st + h * k3);
+        arma::vec next = st + h/6 * (k1 + 2*k2 + 2*k3 + k4);
+
+        // The energy loss can reverse the momentum in the last step, instead of just stopping it
+        const arma::vec3 newMom = next.subvec(3, 5);
+        const double p = arma::norm(newMom);
+        if (arma::dot(oldMom, newMom) <= 0 || std::sqrt(p*p + mass*mass) - mass < MIN_ENERGY) {
+            next.subvec(3, 5).zeros();
+        }
+
+        st = next;
+    }
+
+    return st;
+}
+
+arma::vec TrackKalmanFilter::weights() const
+{
+    arma::vec w (2*DIM_X + 1);
+    w.fill(0.5 / (DIM_X + kappa));
+    w(0) = kappa / (DIM_X + kappa);
+    return w;
+}
+
+arma::mat TrackKalmanFilter::sigmaPoints(const arma::vec& x, const arma::mat& P) const
+{
+    // This is the upper triangular factor, so its rows are the columns of the lower factor used in ukf.py
+    arma::mat u;
+    if (!arma::chol(u, (DIM_X + kappa) * P)) {
+        throw std::runtime_error("The covariance matrix is not positive definite");
+    }
+
+    arma::mat sigmas (DIM_X, 2*DIM_X + 1);
+    sigmas.col(0) = x;
+    for (unsigned i = 0; i < DIM_X; i++) {
+        sigmas.col(i + 1) = x + u.row(i).t();
+        sigmas.col(i + 1 + DIM_X) = x - u.row(i).t();
+    }
+    return sigmas;
+}
+
+double TrackKalmanFilter::timeStep(const arma::vec& state, const double dpos) const
+{
+    const double p = arma::norm(state.subvec(3, 5));
+    if (p == 0) return 0;
+    const double speed = p / std::sqrt(p*p + mass*mass) * C_LGT;
+    return dpos / speed;
+}
+
+void TrackKalmanFilter::checkTrack(const arma::mat& zs, const arma::vec& dpos, const arma::vec& x0,
+                                   const arma::mat& P0) const
+{
+    if (zs.n_cols != DIM_Z) throw std::invalid_argument("The measured points must have 3 columns");
+    if (dpos.n_elem != zs.n_rows) throw std::invalid_argument("There must be one distance per measured point");
+    if (x0.n_elem != DIM_X) throw std::invalid_argument("The initial state must have 6 elements");
+    if (P0.n_rows != DIM_X || P0.n_cols != DIM_X) throw std::invalid_argument("P0 must be 6 x 6");
+    if (Q.n_rows != DIM_X || Q.n_cols != DIM_X) throw std::invalid_argument("Q must be 6 x 6");
+    if (R.n_rows != DIM_Z || R.n_cols != DIM_Z) throw std::invalid_argument("R must be 3 x 3");
+    if (!(maxTimeStep > 0)) throw std::invalid_argument("maxTimeStep must be positive");
+}
+
+FilterResult TrackKalmanFilter::batchFilter(const arma::mat& zs, const arma::vec& dpos, const arma::vec& x0,
+                                            const arma::mat& P0) const
+{
+    checkTrack(zs, dpos, x0, P0);
+
+    const arma::uword n = zs.n_rows;
+    const arma::vec w = weights();
+
+    FilterResult res;
+    res.means.set_size(n, DIM_X);
+    res.covars.set_size(DIM_X * DIM_X, n);
+    res.times.set_size(n);
+
+    arma::vec x = x0;
+    arma::mat P = P0;
+    arma::mat sigmasF (DIM_X, 2*DIM_X + 1);
+    double currentTime = 0;
+
+    for (arma::uword i = 0; i < n; i++) {
+        const double dt = timeStep(x, dpos(i));
+
+        // Predict
+        const arma::mat sigmas = sigmaPoints(x, P);
+        for (arma::uword j = 0; j < sigmas.n_cols; j++) {
+            sigmasF.col(j) = propagate(sigmas.col(j), dt);
+        }
+        x = sigmasF * w;
+        const arma::mat dx = sigmasF.each_col() - x;
+        P = dx * arma::diagmat(w) * dx.t() + Q;
+
+        // Update. The measurement function just takes the position from the state vector.
+        const arma::mat sigmasH = sigmasF.rows(0, DIM_Z - 1);
+        const arma::vec zp = sigmasH * w;
+        const arma::mat dz = sigmasH.each_col() - zp;
+        const arma::mat Pz = dz * arma::diagmat(w) * dz.t() + R;
+        const arma::mat Pxz = dx * arma::diagmat(w) * dz.t();
+
+        // K = Pxz inv(Pz), and Pz is symmetric
+        arma::mat Kt;
+        if (!arma::solve(Kt, Pz, Pxz.t())) {
+            throw std::runtime_error("The innovation covariance matrix is singular");
+        }
+        const arma::mat K = Kt.t();
+
+        x += K * (zs.row(i).t() - zp);
+        P -= K * Pz * Kt;
+
+        currentTime += dt;
+        res.means.row(i) = x.t();
+        res.covars.col(i) = arma::vectorise(P);
+        res.times(i) = currentTime;
+    }
+
+    res.success = true;
+    return res;
+}
+
+void TrackKalmanFilter::smooth(FilterResult& res) const
+{
+    const arma::uword n = res.means.n_rows;
+    if (res.covars.n_rows != DIM_X * DIM_X || res.covars.n_cols != n || res.times.n_elem != n
+        || res.means.n_cols != DIM_X) {
+        throw std::invalid_argument("The means, covariance matrices, and times must be for the same points");
+    }
+    if (n < 2) return;
+
+    const arma::vec w = weights();
+    const arma::mat filtMeans = res.means;
+    arma::mat sigmasF (DIM_X, 2*DIM_X + 1);
+
+    for (arma::uword k = n - 1; k-- > 0;) {
+        const double dt = res.times(k + 1) - res.times(k);
+        const arma::vec xk = res.means.row(k).t();
+        const arma::mat Pk = arma::reshape(res.covars.col(k), DIM_X, DIM_X);
+
+        const arma::mat sigmas = sigmaPoints(xk, Pk);
+        for (arma::uword j = 0; j < sigmas.n_cols; j++) {
+            sigmasF.col(j) = propagate(sigmas.col(j), dt);
+        }
+
+        // The prior state and covariance at k+1, and the cross covariance between k and k+1
+        const arma::vec xb = sigmasF * w;
+        const arma::mat dxb = sigmasF.each_col() - xb;
+        const arma::mat Pb = dxb * arma::diagmat(w) * dxb.t() + Q;
+        const arma::mat dxk = sigmas.each_col() - filtMeans.row(k).t();
+        const arma::mat Pxb = dxk * arma::diagmat(w) * dxb.t();
+
+        // K = Pxb inv(Pb), and Pb is symmetric
+        arma::mat Kt;
+        if (!arma::solve(Kt, Pb, Pxb.t())) {
+            throw std::runtime_error("The predicted covariance matrix is singular");
+        }
+        const arma::mat K = Kt.t();
+
+        const arma::vec xnext = res.means.row(k + 1).t();
+        const arma::mat Pnext = arma::reshape(res.covars.col(k + 1), DIM_X, DIM_X);
+
+        res.means.row(k) = (xk + K * (xnext - xb)).t();
+        res.covars.col(k) = arma::vectorise(Pk + K * (Pnext - Pb) * Kt);
+    }
+}
+
+std::vector<FilterResult> TrackKalmanFilter::filterTracks(const std::vector<arma::mat>& zs,
+                                                          const std::vector<arma::vec>& dpos,
+                                                          const arma::mat& x0s, const arma::mat& P0,
+                                                          const bool doSmooth, const unsigned numThreads) const
+{
+    const size_t numTracks = zs.size();
+    if (dpos.size() != numTracks || x0s.n_cols != numTracks) {
+        throw std::invalid_argument("There must be one set of distances and one initial state per track");
+    }
+
+    // Check the inputs here so that these errors are raised instead of being counted as failed tracks
+    for (size_t i = 0; i < numTracks; i++) {
+        checkTrack(zs[i], dpos[i], x0s.col(i), P0);
+    }
+
+    std::vector<FilterResult> results (numTracks);
+    const int nthr = numThreads > 0 ? static_cast<int>(numThreads) : 1;
+
+    // Exceptions can't cross the edge of the parallel region, so save the first one and rethrow it afterwards
+    std::exception_ptr error = nullptr;
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nthr)
+    for (long i = 0; i < static_cast<long>(numTracks); i++) {
+        try {
+            FilterResult res = batchFilter(zs[i], dpos[i], x0s.col(i), P0);
+            if (doSmooth) smooth(res);
+            results[i] = std::move(res);
+        }
+        catch (const std::exception&) {
+            results[i] = FilterResult();
+        }
+        catch (...) {
+            #pragma omp critical
+            {
+                if (!error) error = std::current_exception();
+            }
+        }
+    }
+
+    if (error) std::rethrow_exception(error);
+
+    return results;
+}
+
+}
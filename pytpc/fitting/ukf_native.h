@@ -0,0 +1,86 @@
+/* ukf_native.h
+   A compiled version of the unscented Kalman filter in `pytpc/ukf.py`, specialized for tracking a particle through
+   the detector. The state is propagated natively with the same physics as the mcopt Tracker (the Lorentz force plus
+   the energy loss from the Tracker's gas table), so there are no Python callbacks while a track is filtered.
+
+   The state vector is (x, y, z, px, py, pz), with the position in meters and the momentum in MeV/c. The
+   measurements are (x, y, z) positions in meters.
+ */
+
+#ifndef UKF_NATIVE_H
+#define UKF_NATIVE_H
+
+#include <mcopt/mcopt.h>
+#include <armadillo>
+#include <vector>
+
+namespace pytpc {
+
+/* The results of filtering one track. The rows of `means` are the filtered states, and each column of `covars` is
+   the corresponding covariance matrix flattened in column-major order. The times are the elapsed time, in seconds,
+   at each point. If `success` is false, the filter failed for this track and the other members are empty.
+ */
+struct FilterResult
+{
+    arma::mat means;
+    arma::mat covars;
+    arma::vec times;
+    bool success = false;
+};
+
+class TrackKalmanFilter
+{
+public:
+    /* The fields and particle properties are copied, but the gas is not, so it must outlive this object. The gas's
+       lookup tables are read-only, so one filter can be used from many threads.
+     */
+    TrackKalmanFilter(const unsigned massNum, const unsigned chargeNum, const mcopt::Gas* gas,
+                      const arma::vec& efield, const arma::vec& bfield);
+
+    /* Propagate a state vector forward by `dt` seconds using RK4 steps no longer than `maxTimeStep`. A particle
+       that stops during the step is left at rest where it stopped.
+     */
+    arma::vec propagate(const arma::vec& state, const double dt) const;
+
+    /* Filter one track, like `UnscentedKalmanFilter.batch_filter`. `zs` has one measured (x, y, z) point per row,
+       and `dpos[i]` is the distance the particle travels to reach point i. This is used with the current speed to
+       find the time step.
+     */
+    FilterResult batchFilter(const arma::mat& zs, const arma::vec& dpos, const arma::vec& x0,
+                             const arma::mat& P0) const;
+
+    /* Apply the Rauch-Tung-Striebel smoother to the result of `batchFilter`, in place. */
+    void smooth(FilterResult& res) const;
+
+    /* Filter many tracks, optionally smoothing each one. The tracks are split between `numThreads` threads. Each
+       column of `x0s` is the initial state for one track, and every track starts with the covariance `P0`.
+
+       If the filter fails for a track (e.g. if a covariance matrix stops being positive definite), that track's
+       result has `success == false` and the other tracks are unaffected.
+     */
+    std::vector<FilterResult> filterTracks(const std::vector<arma::mat>& zs, const std::vector<arma::vec>& dpos,
+                                           const arma::mat& x0s, const arma::mat& P0, const bool doSmooth,
+                                           const unsigned numThreads) const;
+
+    arma::mat Q;   // The process noise, 6 x 6
+    arma::mat R;   // The measurement noise, 3 x 3
+    double kappa;  // The sigma point tuning parameter. The default is 3 - 6, like in ukf.py.
+    double maxTimeStep;  // The longest RK4 step in `propagate`, in seconds
+
+private:
+    arma::vec derivatives(const arma::vec& state) const;
+    arma::mat sigmaPoints(const arma::vec& x, const arma::mat& P) const;
+    arma::vec weights() const;
+    double timeStep(const arma::vec& state, const double dpos) const;
+    void checkTrack(const arma::mat& zs, const arma::vec& dpos, const arma::vec& x0, const arma::mat& P0) const;
+
+    double mass;      // The particle mass, in MeV/c^2
+    double charge;    // The charge number
+    const mcopt::Gas* gas;
+    arma::vec efield;
+    arma::vec bfield;
+};
+
+}
+
+#endif /* end of include guard: UKF_NATIVE_H */
@@ -9,10 +9,13 @@ import pandas as pd
 import sqlite3
 
 import os
+import logging
 from functools import reduce
 
 import pkg_resources
 
+logger = logging.getLogger(__name__)
+
 
 class Gas(object):
     """Base class that describes a gas in the detector.
@@ -201,6 +204,266 @@ class InterpolatedGas(Gas):
                                                                                          self.name))
 
 
+class TabulatedGas(Gas):
+    r"""A gas that looks up its stopping power and range in precomputed tables.
+
+    The tables are sampled from another gas at points that are uniformly spaced in log(energy). A lookup is then
+    just an index calculation and a linear interpolation between two neighboring entries, which is much faster
+    than evaluating the splines of an :class:`InterpolatedGas`. Energies outside of the table are clamped to its
+    first or last entry.
+
+    The tables can be saved to disk with :meth:`save`, so they only need to be built once for each gas and
+    pressure. See :func:`load_tabulated_gas`.
+
+    Parameters
+    ----------
+    molar_mass : number
+        Provided in g/mol
+    pressure : float
+        The gas pressure in Torr
+    log_en_min : float
+        The natural log of the energy of the first table entry, with the energy in MeV.
+    log_en_step : float
+        The spacing between the table entries in log(energy).
+    dedx_tables, range_tables : dict
+        Dictionaries mapping ``(proj_mass, proj_charge)`` to arrays of the stopping power, in MeV/m, and the range,
+        in m, at each table energy. All of the arrays must have the same length.
+    name : str, optional
+        The name of the gas.
+
+    See Also
+    --------
+    InterpolatedGas
+    load_tabulated_gas
+    """
+
+    def __init__(self, molar_mass, pressure, log_en_min, log_en_step, dedx_tables, range_tables, name=None):
+        Gas.__init__(self, molar_mass, pressure)
+
+        self.name = name
+        self.log_en_min = float(log_en_min)
+        self.log_en_step = float(log_en_step)
+        self.dedx_tables = {k: np.asarray(v, dtype='float64') for k, v in dedx_tables.items()}
+        self.range_tables = {k: np.asarray(v, dtype='float64') for k, v in range_tables.items()}
+        self.known_projectiles = set(self.dedx_tables.keys())
+
+        num_pts = {len(v) for v in self.dedx_tables.values()} | {len(v) for v in self.range_tables.values()}
+        if len(num_pts) != 1 or self.known_projectiles != set(self.range_tables.keys()):
+            raise ValueError('All tables must have the same length and cover the same projectiles')
+
+        self.num_pts = num_pts.pop()
+        if self.num_pts < 2:
+            raise ValueError('Tables must have at least 2 entries')
+
+        #: The energy of each table entry, in MeV
+        self.energies = exp(self.log_en_min + self.log_en_step * np.arange(self.num_pts))
+
+    @classmethod
+    def from_gas(cls, gas, en_min=1e-3, en_max=1e3, num_pts=8192):
+        """Build the tables by sampling another gas.
+
+        Parameters
+        ----------
+        gas : Gas
+            The gas to sample. This must provide `known_projectiles`, `energy_loss`, and `range`, like
+            :class:`InterpolatedGas` does.
+        en_min, en_max : float, optional
+            The energies of the first and last table entries, in MeV.
+        num_pts : int, optional
+            The number of table entries.
+
+        Returns
+        -------
+        TabulatedGas
+            The tabulated gas.
+        """
+        log_ens = np.linspace(log(en_min), log(en_max), num_pts)
+        ens = exp(log_ens)
+
+        dedx_tables = {}
+        range_tables = {}
+        for mass, charge in gas.known_projectiles:
+            dedx_tables[mass, charge] = gas.energy_loss(ens, mass, charge)
+            range_tables[mass, charge] = gas.range(ens, mass, charge)
+
+        return cls(gas.molar_mass, gas.pressure, log_ens[0], log_ens[1] - log_ens[0], dedx_tables, range_tables,
+                   name=getattr(gas, 'name', None))
+
+    def _get_table(self, tables, proj_mass, proj_charge):
+        try:
+            return tables[proj_mass, proj_charge]
+        except KeyError:
+            raise NotImplementedError('Projectile {} not implemented for {} gas.'.format((proj_charge, proj_mass),
+                                                                                         self.name))
+
+    def _lookup(self, table, en):
+        """Linearly interpolate in `table` at energy `en`, without branching on the value of `en`."""
+        pos = (log(np.maximum(en, 1e-300)) - self.log_en_min) / self.log_en_step
+        pos = np.clip(pos, 0, self.num_pts - 1)
+        idx = np.minimum(pos.astype(np.int64), self.num_pts - 2)
+        frac = pos - idx
+        return table[idx] + frac * (table[idx + 1] - table[idx])
+
+    def energy_loss(self, en, proj_mass, proj_charge):
+        """Looks up the energy loss of a projectile in the gas.
+
+        Parameters
+        ----------
+        en : float or array-like
+            The projectile's kinetic energy in MeV
+        proj_mass : int
+            The mass number of the projectile
+        proj_charge : int
+            The charge number of the projectile
+
+        Returns
+        -------
+        float or ndarray
+            The stopping power of the gas, in MeV/m
+
+        """
+        return self._lookup(self._get_table(self.dedx_tables, proj_mass, proj_charge), en)
+
+    def range(self, en, proj_mass, proj_charge):
+        """Looks up the range of a projectile in the gas.
+
+        Parameters
+        ----------
+        en : float or array-like
+            The projectile's kinetic energy in MeV
+        proj_mass : int
+            The mass number of the projectile
+        proj_charge : int
+            The charge number of the projectile
+
+        Returns
+        -------
+        float or ndarray
+            The range of the particle in the gas, in m
+
+        """
+        return self._lookup(self._get_table(self.range_tables, proj_mass, proj_charge), en)
+
+    def inverse_range(self, range_, proj_mass, proj_charge):
+        """Calculates the energy of a projectile based on its range by interpolating in the range table.
+
+        Parameters
+        ----------
+        range_ : float or array-like
+            The projectile's range in meters
+        proj_mass : int
+            The mass number of the projectile
+        proj_charge : int
+            The charge number of the projectile
+
+        Returns
+        -------
+        float or ndarray
+            The initial energy of the particle, in MeV
+
+        """
+        return np.interp(range_, self._get_table(self.range_tables, proj_mass, proj_charge), self.energies)
+
+    def save(self, path):
+        """Save the tables to an ``.npz`` file at `path`."""
+        projectiles = sorted(self.known_projectiles)
+        np.savez(path,
+                 version=TabulatedGas.file_version,
+                 name=str(self.name),
+                 molar_mass=self.molar_mass,
+                 pressure=self.pressure,
+                 log_en_min=self.log_en_min,
+                 log_en_step=self.log_en_step,
+                 projectiles=np.array(projectiles, dtype='int64').reshape(-1, 2),
+                 dedx=np.array([self.dedx_tables[p] for p in projectiles]).reshape(-1, self.num_pts),
+                 range=np.array([self.range_tables[p] for p in projectiles]).reshape(-1, self.num_pts))
+
+    @classmethod
+    def load(cls, path):
+        """Load tables that were written by :meth:`save`."""
+        with np.load(path) as data:
+            if int(data['version']) != cls.file_version:
+                raise ValueError('Gas table file {} has an unsupported version'.format(path))
+
+            projectiles = [tuple(int(v) for v in p) for p in data['projectiles']]
+            dedx_tables = dict(zip(projectiles, data['dedx']))
+            range_tables = dict(zip(projectiles, data['range']))
+
+            return cls(float(data['molar_mass']), float(data['pressure']), float(data['log_en_min']),
+                       float(data['log_en_step']), dedx_tables, range_tables, name=str(data['name']))
+
+    #: The version of the file format written by :meth:`save`
+    file_version = 1
+
+
+def default_gas_table_dir():
+    """Find the directory where :func:`load_tabulated_gas` caches its tables by default.
+
+    This is the gas data directory in the package if it is writable. Otherwise, it is ``~/.cache/pytpc/gases``.
+    """
+    data_dir = pkg_resources.resource_filename('pytpc', os.path.join('data', 'gases'))
+    if os.access(data_dir, os.W_OK):
+        return data_dir
+    else:
+        return os.path.join(os.path.expanduser('~'), '.cache', 'pytpc', 'gases')
+
+
+def load_tabulated_gas(name, pressure, cache_dir=None, en_min=1e-3, en_max=1e3, num_pts=8192):
+    """Get a :class:`TabulatedGas` for the named gas, using tables cached on disk if possible.
+
+    The tables are built from an :class:`InterpolatedGas` the first time this is called for a gas and pressure.
+    They are then saved in `cache_dir` and reused by later calls. The cached tables are rebuilt if the gas
+    database has been modified since they were written, or if they were made with different table parameters.
+
+    Parameters
+    ----------
+    name : string
+        The name of the gas. This must be a gas in the gas database.
+    pressure : float
+        The gas pressure in Torr
+    cache_dir : string, optional
+        The directory for the cached tables. The default is given by :func:`default_gas_table_dir`.
+    en_min, en_max, num_pts : optional
+        The table parameters. See :meth:`TabulatedGas.from_gas`.
+
+    Returns
+    -------
+    TabulatedGas
+        The tabulated gas.
+    """
+    if cache_dir is None:
+        cache_dir = default_gas_table_dir()
+
+    gasdb_path = pkg_resources.resource_filename('pytpc', os.path.join('data', 'gases', 'gasdata.db'))
+    cache_path = os.path.join(cache_dir, '{}_{:g}torr_table.npz'.format(name, pressure))
+
+    if os.path.isfile(cache_path) and os.path.getmtime(cache_path) >= os.path.getmtime(gasdb_path):
+        try:
+            gas = TabulatedGas.load(cache_path)
+        except (OSError, KeyError, ValueError) as err:
+            logger.warning('Failed to read cached gas table %s: %s', cache_path, err)
+        else:
+            if (gas.num_pts == num_pts and np.isclose(gas.energies[0], en_min)
+                    and np.isclose(gas.energies[-1], en_max)):
+                return gas
+
+    gas = TabulatedGas.from_gas(InterpolatedGas(name, pressure), en_min=en_min, en_max=en_max, num_pts=num_pts)
+
+    # Write to a temporary file first so another process never reads a partially written table
+    tmp_path = '{}.{:d}.tmp'.format(cache_path, os.getpid())
+    try:
+        os.makedirs(cache_dir, exist_ok=True)
+        with open(tmp_path, 'wb') as f:
+            gas.save(f)
+        os.replace(tmp_path, cache_path)
+    except OSError as err:
+        logger.warning('Failed to cache gas table in %s: %s', cache_dir, err)
+        if os.path.exists(tmp_path):
+            os.remove(tmp_path)
+
+    return gas
+
+
 class GenericGas(Gas):
     """Represents a gas whose energy loss is determined using the Bethe formula.
 
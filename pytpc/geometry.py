@@ -0,0 +1,149 @@
+"""
+geometry
+========
+
+A cache of the detector geometry that is needed to process each event.
+
+Generating the pad plane takes much longer than finding the peaks in a small event, so the geometry should be made
+once and reused. Use :func:`get_geometry` to get a shared :class:`DetectorGeometry` for a given set of parameters.
+The first call builds it, and later calls in the same process return the same object.
+
+"""
+
+from functools import lru_cache
+import numpy as np
+
+from .padplane import generate_pad_plane
+from .utilities import rot_matrix, tilt_matrix
+
+
+def _readonly(a):
+    a = np.ascontiguousarray(a)
+    a.flags.writeable = False
+    return a
+
+
+class DetectorGeometry(object):
+    """The pad plane, transformation matrices, and calibration coefficients for one detector configuration.
+
+    The arrays in this object are read-only since the object is shared by everything that uses the same
+    configuration. Use :func:`get_geometry` instead of creating these directly.
+
+    Parameters
+    ----------
+    pad_rot_angle : float, optional
+        The pad plane rotation angle, in radians.
+    tilt : float, optional
+        The detector tilt angle, in radians.
+    drift_vel : number or array-like, optional
+        The drift velocity, in cm/us. This can be a scalar or a vector, like in :func:`pytpc.evtdata.calibrate`.
+    clock : number, optional
+        The CoBo write clock frequency, in MHz. This must be given with `drift_vel` to use :meth:`calibrate`.
+
+    Attributes
+    ----------
+    pads : ndarray
+        The pad vertices, from :func:`pytpc.padplane.generate_pad_plane`.
+    pad_centers : ndarray
+        The center of each pad, as an array with dimensions (10240, 2).
+    padrotmat : ndarray
+        The pad plane rotation matrix, from :func:`pytpc.utilities.rot_matrix`.
+    untilt_mat : ndarray
+        The matrix that transforms from beam to detector coordinates, ``tilt_matrix(tilt)``.
+    tilt_mat : ndarray
+        The matrix that transforms from detector to beam coordinates, ``tilt_matrix(-tilt)``.
+    """
+
+    def __init__(self, pad_rot_angle=0, tilt=0, drift_vel=None, clock=None):
+        self.pad_rot_angle = pad_rot_angle
+        self.tilt = tilt
+
+        self.pads = _readonly(generate_pad_plane(pad_rot_angle if pad_rot_angle != 0 else None))
+        self.pad_centers = _readonly(self.pads.mean(1))
+
+        self.padrotmat = _readonly(rot_matrix(pad_rot_angle))
+        self.untilt_mat = _readonly(tilt_matrix(tilt))
+        self.tilt_mat = _readonly(tilt_matrix(-tilt))
+
+        if drift_vel is not None and clock is not None:
+            self.drift_vel = drift_vel if np.isscalar(drift_vel) else _readonly(np.asarray(drift_vel, dtype='float64'))
+            self.clock = clock
+
+            # These are the factors from `pytpc.evtdata.calibrate`: 1 cm/(us.MHz) = 1 cm = 10 mm
+            if np.isscalar(drift_vel):
+                self._z_factor = drift_vel / clock * 10
+                self._calib_vec = None
+            else:
+                assert self.drift_vel.shape == (3,), 'vector drift velocity must have 3 dimensions'
+                self._z_factor = None
+                self._calib_vec = _readonly(-self.drift_vel / clock * 10)
+        else:
+            self.drift_vel = None
+            self.clock = None
+
+    def calibrate(self, data):
+        """Calibrate the data using the drift velocity and clock of this geometry.
+
+        This does the same thing as :func:`pytpc.evtdata.calibrate`, but with the transformation computed in advance.
+
+        Parameters
+        ----------
+        data : ndarray
+            The uncalibrated data, in the form [x, y, z, ...]
+
+        Returns
+        -------
+        ndarray
+            The calibrated data.
+
+        Raises
+        ------
+        ValueError
+            If this geometry was made without a drift velocity and clock.
+        """
+        if self.drift_vel is None:
+            raise ValueError('This geometry has no drift velocity and clock, so it cannot calibrate data')
+
+        new_data = np.array(data, dtype='float64')
+
+        if self._calib_vec is None:
+            new_data[:, 2] *= self._z_factor
+        else:
+            new_data[:, 2] = 0.0  # This prevents adding the time buckets to the last dimension
+            new_data[:, 0:3] += np.outer(data[:, 2], self._calib_vec)
+
+        return new_data
+
+
+def _geometry_key(value):
+    """Convert a parameter to a hashable value for the cache."""
+    if value is None or np.isscalar(value):
+        return value
+    else:
+        return tuple(np.asarray(value, dtype='float64').ravel().tolist())
+
+
+@lru_cache(maxsize=16)
+def _cached_geometry(pad_rot_angle, tilt, drift_vel, clock):
+    if drift_vel is not None and not np.isscalar(drift_vel):
+        drift_vel = np.array(drift_vel)
+    return DetectorGeometry(pad_rot_angle, tilt, drift_vel, clock)
+
+
+def get_geometry(pad_rot_angle=0, tilt=0, drift_vel=None, clock=None):
+    """Get the shared `DetectorGeometry` for the given parameters.
+
+    The geometry is built the first time this is called with each set of parameters, and the same object is returned
+    after that.
+
+    Parameters
+    ----------
+    pad_rot_angle, tilt, drift_vel, clock
+        See `DetectorGeometry`.
+
+    Returns
+    -------
+    DetectorGeometry
+        The geometry. Its arrays are read-only.
+    """
+    return _cached_geometry(float(pad_rot_angle), float(tilt), _geometry_key(drift_vel), clock)
@@ -1,9 +1,12 @@
 from __future__ import division, print_function
 import os
 import struct
+import threading
+import queue
 import numpy as np
 import pytpc.evtdata
 import pytpc.datafile
+from pytpc.unpack import decode_graw_partial_readout, decode_graw_full_readout, index_graw_file
 import logging
 
 logger = logging.getLogger(__name__)
@@ -19,17 +22,20 @@ class GRAWFile(pytpc.datafile.DataFile):
     max_len : number
         The maximum number of events to read from the file. Set this to a reasonable value to make the files open
         more quickly.
+    use_mmap : bool, optional
+        If true, memory-map the file when reading. The file is then indexed natively, which is much faster for
+        large files. See :mod:`pytpc.datafile`.
 
     """
     full_readout_frame_type = 2
     partial_readout_frame_type = 1
 
-    def __init__(self, filename, open_mode='r', max_len=None):
+    def __init__(self, filename, open_mode='r', max_len=None, use_mmap=False):
 
         self.evtids = None
         self.max_len = max_len
 
-        super().__init__(filename, open_mode)
+        super().__init__(filename, open_mode, use_mmap=use_mmap)
 
         return
 
@@ -76,6 +82,15 @@ class GRAWFile(pytpc.datafile.DataFile):
                 ltfile.write(str(i) + ',' + str(e) + '\n')
             ltfile.close()
 
+    def _raw_size(self, raw):
+        return self._bsmerge(raw[1:4]) * 256
+
+    def _build_index(self):
+        return index_graw_file(self.map, self.max_len)
+
+    def _parse_raw(self, raw):
+        return self._parse(raw)
+
     @staticmethod
     def _bsmerge(a):
         """Byte-swap and concatenate the bytes in the given iterable.
@@ -179,68 +194,21 @@ class GRAWFile(pytpc.datafile.DataFile):
         logger.debug('Frame header: metatype %d, type %d, revision %d, with %d items',
                      header['metatype'], header['frame_type'], header['revision'], header['num_items'])
 
-        datatype = np.dtype([('cobo', 'u1'), ('asad', 'u1'), ('aget', 'u1'), ('channel', 'u1'),
-                             ('pad', 'u2'), ('data', '512i2')])
-
         datamin = header['header_size'] * 256
+        data = memoryview(rawframe)[datamin:]
 
         log_frameid = '{evt_id}:{cobo}/{asad}'.format(**header)
 
+        # The AGET, time bucket, and sample fields are too narrow to hold invalid values, so only the channels
+        # need to be checked.
         if header['frame_type'] == GRAWFile.partial_readout_frame_type:
-            raw = np.frombuffer(rawframe[datamin:], dtype='>u4', count=header['num_items'])
-            agets, channels, tbs, samples = GRAWFile._unpack_data_partial_readout(raw)
-
-            if agets.min() < 0 or agets.max() > 3:
-                logger.warn('(%s) Invalid AGET indices present: min=%d, max=%d', log_frameid, agets.min(), agets.max())
-            if channels.min() < 0 or channels.max() > 67:
-                logger.warn('(%s) Invalid channels present: min=%d, max=%d', log_frameid, channels.min(),
-                            channels.max())
-            if tbs.min() < 0 or tbs.max() > 511:
-                logger.warn('(%s) Invalid time buckets present: min=%d, max=%d', log_frameid, tbs.min(), tbs.max())
-            if samples.min() < 0 or samples.max() > 4095:
-                logger.warn('(%s) Invalid samples present: min=%d, max=%d', log_frameid, samples.min(), samples.max())
-
-            ach = np.column_stack((agets, channels))
-            pairs = np.unique(ach.view(dtype=[('f0', 'u4'), ('f1', 'u4')])).view(dtype='u4').reshape(-1, 2)
-
-            res = np.zeros(len(pairs), dtype=datatype)
-
-            for i, (aget, ch) in enumerate(pairs):
-                idx = np.where(np.logical_and(agets == aget, channels == ch))
-                t = tbs[idx]
-                s = samples[idx]
-
-                assert len(t) == len(s), 'samples and tbs don\'t have same lengths'
-
-                res['cobo'][i] = header['cobo']
-                res['asad'][i] = header['asad']
-                res['aget'][i] = aget
-                res['channel'][i] = ch
-                try:
-                    res['data'][i, t] = s
-                except IndexError:
-                    logger.error('(%s) Indexing samples array failed. len(s)=%d, min(t)=%d, max(t)=%d',
-                                 log_frameid, len(s), t.min(), t.max())
+            res, min_ch, max_ch = decode_graw_partial_readout(data, header['num_items'], header['cobo'],
+                                                              header['asad'])
+            if max_ch > 67:
+                logger.warn('(%s) Invalid channels present: min=%d, max=%d', log_frameid, min_ch, max_ch)
 
         elif header['frame_type'] == GRAWFile.full_readout_frame_type:
-            raw = np.frombuffer(rawframe[datamin:], dtype='>u2', count=header['num_items'])
-            agets, samples = GRAWFile._unpack_data_full_readout(raw)
-
-            if agets.min() < 0 or agets.max() > 3:
-                logger.warn('(%s) Invalid AGET indices present: min=%d, max=%d', log_frameid, agets.min(), agets.max())
-            if samples.min() < 0 or samples.max() > 4095:
-                logger.warn('(%s) Invalid samples present: min=%d, max=%d', log_frameid, samples.min(), samples.max())
-
-            res = np.zeros(68*4, dtype=datatype)
-
-            for aget in np.unique(agets):
-                s = samples[np.where(agets == aget)].reshape((512, 68)).T
-                idx = slice(aget*68, (aget+1)*68)
-                res['cobo'][idx] = header['cobo']
-                res['asad'][idx] = header['asad']
-                res['aget'][idx] = aget
-                res['channel'][idx] = np.arange(68)
-                res['data'][idx] = s
+            res = decode_graw_full_readout(data, header['num_items'], header['cobo'], header['asad'])
 
         else:
             raise IOError('Invalid frame type: %d' % header['frame_type'])
@@ -287,8 +255,11 @@ class GRAWFile(pytpc.datafile.DataFile):
         idx = np.where(self.evtids == evtid)[0]
         res = []
         for i in idx:
-            self.fp.seek(self.lookup[i])
-            res.append(self._read_raw())
+            if self.map is not None:
+                res.append(self.read_raw_event_by_number(i))  # A view of the mapped file
+            else:
+                self.fp.seek(self.lookup[i])
+                res.append(self._read_raw())
         return res
 
 
@@ -320,3 +291,120 @@ def merge_frames(files, evtid):
     evt.traces = np.concatenate(frames)
 
     return evt
+
+
+class _FrameReader(threading.Thread):
+    """A thread that reads the frames for a sequence of event IDs from one GRAW file.
+
+    For each event ID in `evtids`, the list of frames from the file with that ID is put in `out_queue`. The list is
+    empty if the file has no frames for that event. After the last event, or if an exception is raised while
+    reading, the exception (or None) is put in the queue and the thread exits.
+
+    Each reader must have its own file since the file's cursor is moved while reading.
+    """
+
+    def __init__(self, gfile, evtids, out_queue, stop_flag):
+        super().__init__(name='FrameReader({})'.format(gfile.fp.name), daemon=True)
+        self.gfile = gfile
+        self.evtids = evtids
+        self.out_queue = out_queue
+        self.stop_flag = stop_flag
+
+    def _put(self, item):
+        # Time out regularly to check if the merge was stopped, so this thread won't block forever on a full queue
+        while not self.stop_flag.is_set():
+            try:
+                self.out_queue.put(item, timeout=0.1)
+                return True
+            except queue.Full:
+                continue
+        return False
+
+    def run(self):
+        try:
+            # Group the frame indices by event ID once, instead of searching the whole index for every event
+            file_evtids = np.asarray(self.gfile.evtids)
+            order = np.argsort(file_evtids, kind='mergesort')
+            sorted_evtids = file_evtids[order]
+            firsts = np.searchsorted(sorted_evtids, self.evtids, side='left')
+            lasts = np.searchsorted(sorted_evtids, self.evtids, side='right')
+
+            for first, last in zip(firsts, lasts):
+                frames = [self.gfile[i] for i in np.sort(order[first:last])]
+                if not self._put(frames):
+                    return
+
+        except Exception as err:
+            self._put(err)
+
+        else:
+            self._put(None)
+
+
+def merge_files(files, hfile, evtids=None, max_queued=16):
+    """Merge the frames from a set of GRAW files and write the resulting events to an HDF5 file.
+
+    This does the same thing as calling :func:`merge_frames` for each event ID, but the files are read concurrently,
+    with one reader thread per file. Each reader decodes the frames for each event in turn and passes them to this
+    function through a bounded queue. The frames are then merged in order of event ID and written using
+    :meth:`pytpc.hdfdata.HDFDataFile.write_get_event`.
+
+    Parameters
+    ----------
+    files : list of GRAWFile
+        The open GRAW files, usually one per CoBo or AsAd. These should not be used by anything else until this
+        function returns.
+    hfile : pytpc.hdfdata.HDFDataFile
+        The output file. This must be open in a writable mode.
+    evtids : iterable of integers, optional
+        The event IDs to merge. By default, every event ID found in any of the files is merged.
+    max_queued : int, optional
+        The maximum number of events each reader can decode before they are written. This bounds the memory used
+        if the output is slower than the inputs.
+
+    Returns
+    -------
+    num_written : int
+        The number of events written to the output file.
+
+    Raises
+    ------
+    Exception
+        Any exception raised while reading a file is re-raised here after the readers are stopped.
+    """
+    if evtids is None:
+        evtids = np.unique(np.concatenate([np.asarray(f.evtids) for f in files]))
+    else:
+        evtids = np.asarray(evtids)
+
+    stop_flag = threading.Event()
+    queues = [queue.Queue(maxsize=max_queued) for _ in files]
+    readers = [_FrameReader(f, evtids, q, stop_flag) for f, q in zip(files, queues)]
+    for r in readers:
+        r.start()
+
+    num_written = 0
+    try:
+        for evtid in evtids:
+            frames = []
+            for q in queues:
+                item = q.get()
+                if isinstance(item, Exception):
+                    raise item
+                frames += item
+
+            if len(frames) == 0:
+                logger.warn('No frames found for event %d', evtid)
+                continue
+
+            evt = pytpc.evtdata.Event(evtid)
+            evt.traces = np.concatenate(frames)
+            hfile.write_get_event(evt)
+            num_written += 1
+
+    finally:
+        stop_flag.set()
+        for r in readers:
+            r.join()
+
+    return num_written
@@ -1,7 +1,14 @@
+from collections import OrderedDict
+import threading
 import h5py
 import numpy as np
 from .evtdata import Event
 
+try:
+    import hdf5plugin  # Registers the LZ4 and Blosc filters with HDF5
+except ImportError:
+    hdf5plugin = None
+
 
 class HDFDataFile(object):
     """Interface class to AT-TPC data stored in HDF5 files.
@@ -39,6 +46,23 @@ class HDFDataFile(object):
     Then again, if you use this class, you won't really need to worry about those details since it's all taken care of
     already!
 
+    Files with many events can instead be written in a *stacked* layout by passing ``layout='stacked'`` when creating
+    the file. In this layout, the rows from every event are appended to one chunked N x 517 dataset at
+    `get_group_name`/traces, and the events are described by three more datasets in the same group:
+
+    ``offsets``
+        The first row of each event in the traces table. This has one extra entry at the end with the total number of
+        rows, so event `k` is in rows ``offsets[k]:offsets[k+1]``.
+    ``evt_id``
+        The event ID of each event.
+    ``timestamp``
+        The timestamp of each event.
+
+    This avoids the per-dataset overhead of the default layout, and lets a range of events be read in a single call
+    with :meth:`read_get_events`. Events written to a stacked file are buffered and written in blocks, so the file
+    must be closed (or :meth:`flush` must be called) to make sure that every event is saved. The layout of an existing
+    file is detected automatically, and the other methods of this class work the same way for both layouts.
+
     Parameters
     ----------
     fp : string
@@ -50,15 +74,40 @@ class HDFDataFile(object):
         The name of the group in the HDF5 file containing GET events. Usually just keep the default value of '/get'.
     canonical_evtid_path : str, optional
         Path to an HDF5 file containing a table mapping a canonical event ID to the event ID for each CoBo. This
-        can be used to correct for CoBos that dropped triggers.
+        can be used to correct for CoBos that dropped triggers. When this is given, the CoBo column of each event
+        named in the table is read once when the file is opened to find the rows belonging to each CoBo.
     canonical_evtid_key : str, optional
         The key to read in the canonical event ID file. The default value is 'canonical_evtids'.
+    layout : str, optional
+        The layout to use when writing events to a new file: either 'per_event' for one dataset per event, or
+        'stacked' for the stacked layout described above. By default, the layout of an existing file is used, and new
+        files are given the 'per_event' layout.
+    compression : str or None, optional
+        The compression filter for new datasets. This can be any filter supported by h5py, like 'gzip' or 'lzf', or
+        'lz4' or 'blosc' to use these filters from the `hdf5plugin` package. The 'lz4', 'blosc', and 'lzf' filters
+        are much faster than 'gzip' to read and write, at the cost of slightly larger files.
+    chunk_rows : int, optional
+        The number of rows in each chunk of the traces table in the stacked layout. Writes to that table are buffered
+        until this many rows are waiting.
+
+    Raises
+    ------
+    ValueError
+        If the requested layout doesn't match the layout of the events already in the file.
     """
 
+    #: The number of events read at once when iterating over a file in the stacked layout
+    iter_batch_size = 256
+
+    #: The number of stored events shared by several canonical events to keep in memory
+    canonical_cache_size = 32
+
     def __init__(self, fp, open_mode='r', get_group_name='/get', canonical_evtid_path=None,
-                 canonical_evtid_key='canonical_evtids'):
+                 canonical_evtid_key='canonical_evtids', layout=None, compression='gzip', chunk_rows=1024):
         self.fp = h5py.File(fp, mode=open_mode)
         self.get_group_name = get_group_name
+        self.compression = compression
+        self.chunk_rows = chunk_rows
 
         if canonical_evtid_path is not None:
             with h5py.File(canonical_evtid_path, 'r') as hf:
@@ -66,15 +115,107 @@ class HDFDataFile(object):
         else:
             self.canonical_evtid_table = None
 
-        self.fp.require_group(self.get_group_name)
+        gp = self.fp.require_group(self.get_group_name)
+
+        file_layout = gp.attrs.get('layout', None)
+        if isinstance(file_layout, bytes):
+            file_layout = file_layout.decode('ascii')
+
+        if file_layout is None and len(gp) > 0:
+            file_layout = 'per_event'
+
+        if layout is None:
+            layout = file_layout if file_layout is not None else 'per_event'
+        elif layout not in ('per_event', 'stacked'):
+            raise ValueError('Invalid layout: {}'.format(layout))
+        elif file_layout is not None and layout != file_layout:
+            raise ValueError('Requested layout {} does not match the {} layout of the file'.format(layout, file_layout))
+
+        self.layout = layout
+        self._pending = []
+        self._pending_rows = 0
+
+        if self.layout == 'stacked':
+            if file_layout is None:
+                self._create_stacked_datasets(gp)
+
+            self._offsets = gp['offsets'][:]
+            self._evtid_array = gp['evt_id'][:]
+            self._timestamps = gp['timestamp'][:]
+            self._evtid_index = {int(e): k for k, e in enumerate(self._evtid_array)}
+
+        if self.canonical_evtid_table is not None:
+            self._build_cobo_row_index()
 
     def close(self):
-        """Close the file if it is open."""
+        """Close the file if it is open.
+
+        Any events waiting to be written to a file in the stacked layout are written first.
+        """
         try:
+            self._write_pending()
             self.fp.close()
         except ValueError:
             pass
 
+    def flush(self):
+        """Write any buffered events and flush the file to disk."""
+        self._write_pending()
+        self.fp.flush()
+
+    def _compression_args(self):
+        """Get the keyword arguments for `create_dataset` that set up the compression filters."""
+        if self.compression is None:
+            return {}
+        elif self.compression in ('lz4', 'blosc'):
+            if hdf5plugin is None:
+                raise ImportError('The hdf5plugin package is needed for {} compression'.format(self.compression))
+            if self.compression == 'lz4':
+                return dict(shuffle=True, **hdf5plugin.LZ4())
+            else:
+                return dict(hdf5plugin.Blosc(cname='lz4', clevel=5, shuffle=hdf5plugin.Blosc.SHUFFLE))
+        else:
+            return dict(compression=self.compression, shuffle=True)
+
+    def _create_stacked_datasets(self, gp):
+        """Create the empty, resizable datasets for the stacked layout in the given group."""
+        gp.attrs['layout'] = 'stacked'
+        gp.create_dataset('traces', shape=(0, 517), maxshape=(None, 517), dtype='int16',
+                          chunks=(self.chunk_rows, 517), **self._compression_args())
+        gp.create_dataset('offsets', data=np.zeros(1, dtype='int64'), maxshape=(None,), chunks=(4096,))
+        gp.create_dataset('evt_id', shape=(0,), maxshape=(None,), dtype='int64', chunks=(4096,))
+        gp.create_dataset('timestamp', shape=(0,), maxshape=(None,), dtype='uint64', chunks=(4096,))
+
+    @staticmethod
+    def _append(ds, values):
+        """Append the given values along the first axis of a resizable dataset."""
+        start = ds.shape[0]
+        ds.resize(start + len(values), axis=0)
+        ds[start:] = values
+
+    def _write_pending(self):
+        """Append the buffered events to the datasets of a file in the stacked layout."""
+        if len(self._pending) == 0:
+            return
+
+        gp = self.fp[self.get_group_name]
+        evtids = np.array([e for e, _, _ in self._pending], dtype='int64')
+        timestamps = np.array([t for _, t, _ in self._pending], dtype='uint64')
+        lengths = np.array([len(p) for _, _, p in self._pending], dtype='int64')
+        offsets = self._offsets[-1] + np.cumsum(lengths)
+
+        self._append(gp['traces'], np.concatenate([p for _, _, p in self._pending]))
+        self._append(gp['offsets'], offsets)
+        self._append(gp['evt_id'], evtids)
+        self._append(gp['timestamp'], timestamps)
+
+        self._offsets = np.concatenate((self._offsets, offsets))
+        self._evtid_array = np.concatenate((self._evtid_array, evtids))
+        self._timestamps = np.concatenate((self._timestamps, timestamps))
+
+        self._pending = []
+        self._pending_rows = 0
+
     @staticmethod
     def _unpack_get_event(evtid, timestamp, data):
         """Unpack the data table from the HDF file, and create an Event object.
@@ -156,20 +297,17 @@ class HDFDataFile(object):
             If there is no dataset called `i` in the HDF5 group `self.get_group_name` (i.e. the event ID provided was
             not valid).
         """
-        gp = self.fp[self.get_group_name]
-
         if self.canonical_evtid_table is not None:
             # Use the canonical event ID table to correct for a dropped trigger
             # in some CoBo. Read fragments of each required CoBo event, and then
             # reconstruct the full event.
             cobo_evt_ids = self.canonical_evtid_table[i]
-            cobo_evts = {n: gp[str(n)][:] for n in np.unique(cobo_evt_ids)}
 
-            evt_chunks = []
-            for cobo_id, cobo_evt_id in enumerate(cobo_evt_ids):
-                cobo_evt = cobo_evts[cobo_evt_id]
-                chunk = cobo_evt[np.where(cobo_evt[:, 0] == cobo_id)]
-                evt_chunks.append(chunk)
+            evt_chunks = [None] * len(cobo_evt_ids)
+            for n in np.unique(cobo_evt_ids):
+                cobos = np.where(cobo_evt_ids == n)[0]
+                for cobo_id, chunk in zip(cobos, self._read_cobo_rows(int(n), cobos)):
+                    evt_chunks[cobo_id] = chunk
 
             rawevt = np.concatenate(evt_chunks, axis=0)
             evt_id = i
@@ -177,13 +315,169 @@ class HDFDataFile(object):
 
         else:
             # There is no canonical event ID table, so just read the event.
-            ds = gp[str(i)]
-            evt_id = ds.attrs.get('evt_id', 0)
-            timestamp = ds.attrs.get('timestamp', 0)
-            rawevt = ds[:]
+            evt_id, timestamp, rawevt = self._read_raw_event(i)
 
         return self._unpack_get_event(evt_id, timestamp, rawevt)
 
+    def _read_raw_event(self, evtid):
+        """Read the packed table for an event, along with its event ID and timestamp.
+
+        Raises
+        ------
+        KeyError
+            If the event is not in the file.
+        """
+        gp = self.fp[self.get_group_name]
+
+        if self.layout == 'stacked':
+            self._write_pending()
+            try:
+                k = self._evtid_index[int(evtid)]
+            except (ValueError, TypeError):
+                raise KeyError(evtid)
+            rawevt = gp['traces'][self._offsets[k]:self._offsets[k + 1]]
+            return int(self._evtid_array[k]), int(self._timestamps[k]), rawevt
+
+        else:
+            ds = gp[str(evtid)]
+            return ds.attrs.get('evt_id', 0), ds.attrs.get('timestamp', 0), ds[:]
+
+    def _read_raw_rows(self, evtid, start, stop):
+        """Read rows `start:stop` of the packed table for an event."""
+        gp = self.fp[self.get_group_name]
+
+        if self.layout == 'stacked':
+            self._write_pending()
+            first = self._offsets[self._evtid_index[evtid]]
+            return gp['traces'][first + start:first + stop]
+        else:
+            return gp[str(evtid)][start:stop]
+
+    def _build_cobo_row_index(self):
+        """Find the rows that belong to each CoBo in every event named in the canonical event ID table.
+
+        The index maps each stored event ID to a tuple `(bounds, order)`. The rows from CoBo `c` are rows
+        ``order[bounds[c]:bounds[c+1]]`` of the event, or just ``bounds[c]:bounds[c+1]`` if `order` is None. The latter
+        is the usual case since merged events are normally sorted by CoBo.
+
+        The number of canonical events that use each stored event is also counted, so that events shared by several
+        canonical events can be cached instead of being read again.
+        """
+        table = self.canonical_evtid_table
+        num_cobos = table.shape[1]
+
+        # Count each stored event once per canonical event that uses it
+        sorted_table = np.sort(table, axis=1)
+        is_first = np.ones(sorted_table.shape, dtype=bool)
+        is_first[:, 1:] = sorted_table[:, 1:] != sorted_table[:, :-1]
+        stored_evtids, use_counts = np.unique(sorted_table[is_first], return_counts=True)
+
+        if self.layout == 'stacked':
+            self._write_pending()
+            all_cobos = self.fp[self.get_group_name]['traces'][:, 0]
+
+        self._cobo_row_index = {}
+        for n in stored_evtids:
+            n = int(n)
+            try:
+                if self.layout == 'stacked':
+                    k = self._evtid_index[n]
+                    cobos = all_cobos[self._offsets[k]:self._offsets[k + 1]]
+                else:
+                    cobos = self.fp[self.get_group_name][str(n)][:, 0]
+            except KeyError:
+                continue  # This will raise a KeyError again if an event that needs it is read
+
+            if np.all(cobos[1:] >= cobos[:-1]):
+                order = None
+                sorted_cobos = cobos
+            else:
+                order = np.argsort(cobos, kind='mergesort')
+                sorted_cobos = cobos[order]
+
+            bounds = np.searchsorted(sorted_cobos, np.arange(num_cobos + 1), side='left')
+            self._cobo_row_index[n] = (bounds, order)
+
+        self._shared_evtids = set(int(n) for n in stored_evtids[use_counts > 1])
+        self._shared_cache = OrderedDict()
+        self._shared_cache_lock = threading.Lock()
+
+    def _read_cobo_rows(self, evtid, cobos):
+        """Read the rows from each of the given CoBos in a stored event, using the CoBo row index.
+
+        Stored events that are used by more than one canonical event are read in full and cached. Otherwise, only
+        the block of rows containing the requested CoBos is read.
+
+        Returns
+        -------
+        list of ndarray
+            The rows for each CoBo in `cobos`, in the same order.
+        """
+        bounds, order = self._cobo_row_index[evtid]
+
+        if evtid in self._shared_evtids or order is not None:
+            # The cache is locked since events may be read from several threads (see pytpc.pipeline)
+            with self._shared_cache_lock:
+                rawevt = self._shared_cache.get(evtid, None)
+                if rawevt is not None:
+                    self._shared_cache.move_to_end(evtid)
+
+            if rawevt is None:
+                rawevt = self._read_raw_event(evtid)[2]
+                if evtid in self._shared_evtids:
+                    with self._shared_cache_lock:
+                        self._shared_cache[evtid] = rawevt
+                        if len(self._shared_cache) > self.canonical_cache_size:
+                            self._shared_cache.popitem(last=False)
+
+            if order is not None:
+                return [rawevt[order[bounds[c]:bounds[c + 1]]] for c in cobos]
+            else:
+                return [rawevt[bounds[c]:bounds[c + 1]] for c in cobos]
+
+        else:
+            first = bounds[min(cobos)]
+            rows = self._read_raw_rows(evtid, first, bounds[max(cobos) + 1])
+            return [rows[bounds[c] - first:bounds[c + 1] - first] for c in cobos]
+
+    def read_get_events(self, start, stop):
+        """Read a range of events from the file.
+
+        The events are identified by their position in the file rather than by event ID. In the stacked layout, this
+        is the order in which the events were written, and the traces for the whole range are read from the file in
+        one call. In the default layout, the events are sorted by event ID and read one at a time. If a canonical
+        event ID table was given, the positions are the canonical event IDs.
+
+        Parameters
+        ----------
+        start, stop : int
+            The range of positions to read, like the bounds of a slice.
+
+        Returns
+        -------
+        list of pytpc.Event
+            The events that were read.
+        """
+        if self.canonical_evtid_table is not None:
+            start, stop, _ = slice(start, stop).indices(len(self.canonical_evtid_table))
+            return [self.read_get_event(i) for i in range(start, stop)]
+
+        elif self.layout == 'stacked':
+            self._write_pending()
+            start, stop, _ = slice(start, stop).indices(len(self._evtid_array))
+            if stop <= start:
+                return []
+
+            offsets = self._offsets[start:stop + 1] - self._offsets[start]
+            rawevts = self.fp[self.get_group_name]['traces'][self._offsets[start]:self._offsets[stop]]
+
+            return [self._unpack_get_event(int(self._evtid_array[k]), int(self._timestamps[k]),
+                                           rawevts[offsets[j]:offsets[j + 1]])
+                    for j, k in enumerate(range(start, stop))]
+
+        else:
+            return [self.read_get_event(n) for n in sorted(self.evtids())[start:stop]]
+
     def write_get_event(self, evt):
         """Write the given Event object to the file.
 
@@ -193,8 +487,12 @@ class HDFDataFile(object):
         The generated dataset will be placed in the HDF5 file at `/get/evt_id` where `/get` is the `get_group_name`
         property of the `HDFDataFile` object and `evt_id` is the event ID property of the given Event object.
 
-        The data is written with gzip compression and the HDF5 shuffle filter turned on. These filters are described
-        in the HDF5 documentation. The format of the dataset is described in this class's documentation.
+        The data is written with gzip compression (or the filter given by `compression`) and the HDF5 shuffle filter
+        turned on. These filters are described in the HDF5 documentation. The format of the dataset is described in
+        this class's documentation.
+
+        In the stacked layout, the event is instead buffered and appended to the traces table once `chunk_rows` rows
+        are waiting to be written.
 
         Parameters
         ----------
@@ -209,20 +507,38 @@ class HDFDataFile(object):
         """
         evt_id = evt.evt_id
         ts = evt.timestamp
-        gp = self.fp[self.get_group_name]
         flat = self._pack_get_event(evt)
-        ds = gp.create_dataset(str(evt_id), data=flat, compression='gzip', shuffle=True)
-        ds.attrs['evt_id'] = evt_id
-        ds.attrs['timestamp'] = ts
-        self.fp.flush()
+
+        if self.layout == 'stacked':
+            if int(evt_id) in self._evtid_index:
+                raise RuntimeError('Event {} is already in the file'.format(evt_id))
+            self._evtid_index[int(evt_id)] = len(self._evtid_array) + len(self._pending)
+            self._pending.append((evt_id, ts, flat))
+            self._pending_rows += len(flat)
+            if self._pending_rows >= self.chunk_rows:
+                self._write_pending()
+
+        else:
+            gp = self.fp[self.get_group_name]
+            ds = gp.create_dataset(str(evt_id), data=flat, **self._compression_args())
+            ds.attrs['evt_id'] = evt_id
+            ds.attrs['timestamp'] = ts
+            self.fp.flush()
 
     def evtids(self):
         """Returns an iterator over the set of event IDs in the file, as integers.
         """
-        return (int(key) for key in self.fp[self.get_group_name])
+        if self.layout == 'stacked':
+            self._write_pending()
+            return (int(e) for e in self._evtid_array)
+        else:
+            return (int(key) for key in self.fp[self.get_group_name])
 
     def __len__(self):
-        return len(self.fp[self.get_group_name])
+        if self.layout == 'stacked':
+            return len(self._evtid_array) + len(self._pending)
+        else:
+            return len(self.fp[self.get_group_name])
 
     def __enter__(self):
         return self
@@ -231,7 +547,15 @@ class HDFDataFile(object):
         self.close()
 
     def __iter__(self):
-        return (self.read_get_event(n) for n in self.fp[self.get_group_name])
+        if self.layout == 'stacked':
+            return self._iter_stacked()
+        else:
+            return (self.read_get_event(n) for n in self.fp[self.get_group_name])
+
+    def _iter_stacked(self):
+        for start in range(0, len(self), self.iter_batch_size):
+            for evt in self.read_get_events(start, start + self.iter_batch_size):
+                yield evt
 
     def __getitem__(self, i):
         return self.read_get_event(i)
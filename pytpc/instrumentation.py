@@ -0,0 +1,197 @@
+"""
+instrumentation
+===============
+
+Timers and counters for finding out where the time goes while events are processed.
+
+A :class:`StageTimer` accumulates the wall time, CPU time, number of calls, and number of points for each named
+stage of the processing, along with arbitrary counters. It is disabled by default, and a disabled timer does almost
+nothing, so the timing calls can be left in the processing code. The timers from several workers can be combined
+with :meth:`StageTimer.merge`.
+
+"""
+
+import threading
+import time
+from collections import OrderedDict
+
+
+class StageStats(object):
+    """The accumulated statistics for one stage.
+
+    Attributes
+    ----------
+    calls : int
+        The number of times the stage was run.
+    wall_time : float
+        The total wall time, in seconds.
+    cpu_time : float
+        The total CPU time of the process, in seconds. This includes the time used by native threads. It is zero
+        for stages timed in native code, which only report wall times.
+    num_points : int
+        The total number of points (or traces) processed by the stage.
+    """
+    __slots__ = ('calls', 'wall_time', 'cpu_time', 'num_points')
+
+    def __init__(self, calls=0, wall_time=0.0, cpu_time=0.0, num_points=0):
+        self.calls = calls
+        self.wall_time = wall_time
+        self.cpu_time = cpu_time
+        self.num_points = num_points
+
+    def as_dict(self):
+        return {'calls': self.calls, 'wall_time': self.wall_time, 'cpu_time': self.cpu_time,
+                'num_points': self.num_points}
+
+
+class _NullStage(object):
+    """The context manager returned by a disabled timer."""
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        return False
+
+
+_NULL_STAGE = _NullStage()
+
+
+class _Stage(object):
+    def __init__(self, timer, name, num_points):
+        self.timer = timer
+        self.name = name
+        self.num_points = num_points
+
+    def __enter__(self):
+        self.wall_start = time.perf_counter()
+        self.cpu_start = time.process_time()
+        return self
+
+    def __exit__(self, *exc):
+        self.timer.add_time(self.name, time.perf_counter() - self.wall_start, time.process_time() - self.cpu_start,
+                            num_points=self.num_points)
+        return False
+
+
+class StageTimer(object):
+    """Accumulates timers and counters for the stages of processing an event.
+
+    Use it like this::
+
+        timer = StageTimer(enabled=True)
+        with timer.stage('preprocess', num_points=len(xyz)):
+            ...
+        timer.count('mc_iterations', 10)
+
+    The stage is timed even if the block raises an exception.
+
+    Parameters
+    ----------
+    enabled : bool, optional
+        If False, :meth:`stage`, :meth:`add_time`, and :meth:`count` do nothing.
+
+    Attributes
+    ----------
+    stages : OrderedDict
+        A :class:`StageStats` for each stage, in the order they were first seen.
+    counters : OrderedDict
+        The value of each counter.
+    """
+
+    def __init__(self, enabled=False):
+        self.enabled = enabled
+        self.stages = OrderedDict()
+        self.counters = OrderedDict()
+        self._lock = threading.Lock()
+
+    def stage(self, name, num_points=0):
+        """Get a context manager that times a stage.
+
+        Parameters
+        ----------
+        name : str
+            The name of the stage.
+        num_points : int, optional
+            The number of points processed in this call to the stage.
+        """
+        if not self.enabled:
+            return _NULL_STAGE
+        return _Stage(self, name, num_points)
+
+    def add_time(self, name, wall_time, cpu_time=0.0, calls=1, num_points=0):
+        """Add a time measured elsewhere, like in native code, to a stage."""
+        if not self.enabled:
+            return
+        with self._lock:
+            stats = self.stages.get(name)
+            if stats is None:
+                stats = self.stages[name] = StageStats()
+            stats.calls += calls
+            stats.wall_time += wall_time
+            stats.cpu_time += cpu_time
+            stats.num_points += num_points
+
+    def count(self, name, value=1):
+        """Add `value` to a counter."""
+        if not self.enabled:
+            return
+        with self._lock:
+            self.counters[name] = self.counters.get(name, 0) + value
+
+    def merge(self, other):
+        """Add the stages and counters from another timer to this one.
+
+        Parameters
+        ----------
+        other : StageTimer or dict
+            Another timer, or the output of its :meth:`as_dict`. This is merged even if this timer is disabled.
+        """
+        if isinstance(other, StageTimer):
+            other = other.as_dict()
+
+        with self._lock:
+            for name, values in other['stages'].items():
+                stats = self.stages.get(name)
+                if stats is None:
+                    stats = self.stages[name] = StageStats()
+                stats.calls += values['calls']
+                stats.wall_time += values['wall_time']
+                stats.cpu_time += values['cpu_time']
+                stats.num_points += values['num_points']
+            for name, value in other['counters'].items():
+                self.counters[name] = self.counters.get(name, 0) + value
+
+    def reset(self):
+        """Clear all of the stages and counters."""
+        with self._lock:
+            self.stages.clear()
+            self.counters.clear()
+
+    def as_dict(self):
+        """Get the stages and counters as plain dicts, e.g. to send them to another process."""
+        with self._lock:
+            return {'stages': OrderedDict((name, stats.as_dict()) for name, stats in self.stages.items()),
+                    'counters': OrderedDict(self.counters)}
+
+    def records(self):
+        """Get the stages and counters as a list of flat dicts, e.g. to write them to a table.
+
+        Each stage has the keys ``name``, ``calls``, ``wall_time``, ``cpu_time``, and ``num_points``. Each counter
+        has the keys ``name`` and ``value``, and the other keys are None.
+        """
+        info = self.as_dict()
+        recs = [dict(name=name, value=None, **values) for name, values in info['stages'].items()]
+        recs += [dict(name=name, value=value, calls=None, wall_time=None, cpu_time=None, num_points=None)
+                 for name, value in info['counters'].items()]
+        return recs
+
+    def summary(self):
+        """Format the stages and counters as a table for logging."""
+        info = self.as_dict()
+        lines = ['{:32s} {:>10s} {:>12s} {:>12s} {:>12s}'.format('stage', 'calls', 'wall (s)', 'cpu (s)', 'points')]
+        for name, v in info['stages'].items():
+            lines.append('{:32s} {:>10d} {:>12.3f} {:>12.3f} {:>12d}'.format(
+                name, v['calls'], v['wall_time'], v['cpu_time'], v['num_points']))
+        for name, value in info['counters'].items():
+            lines.append('{:32s} {:>10}'.format(name, value))
+        return '\n'.join(lines)
@@ -0,0 +1,215 @@
+#include "peaks.h"
+
+#define NUM_TBS 512
+
+// The first sample used to find the peak's baseline is this far before the peak, and the baseline is the mean
+// of this many samples. These match `Event.xyzs`.
+#define PEAK_BASE_OFFSET 15
+#define PEAK_BASE_WIDTH 5
+
+static inline int clip_tb(const int tb)
+{
+    return tb < 0 ? 0 : (tb > NUM_TBS - 1 ? NUM_TBS - 1 : tb);
+}
+
+/* The tables needed for the FFT baseline correction. The filter is the same window function as in `fftbaseline`,
+   in FFT order.
+ */
+typedef struct {
+    double cos_table[NUM_TBS / 2];
+    double sin_table[NUM_TBS / 2];
+    int bitrev[NUM_TBS];
+    double filter[NUM_TBS];
+} BaselineTables;
+
+static void baseline_tables_init(BaselineTables *tables, const double factor)
+{
+    for (int k = 0; k < NUM_TBS / 2; k++) {
+        tables->cos_table[k] = cos(2 * M_PI * k / NUM_TBS);
+        tables->sin_table[k] = sin(2 * M_PI * k / NUM_TBS);
+    }
+
+    for (int i = 0; i < NUM_TBS; i++) {
+        int rev = 0;
+        for (int bit = 1, rbit = NUM_TBS / 2; bit < NUM_TBS; bit <<= 1, rbit >>= 1) {
+            if (i & bit) rev |= rbit;
+        }
+        tables->bitrev[i] = rev;
+    }
+
+    for (int k = 0; k < NUM_TBS; k++) {
+        // The frequency of bin k is k for the first half of the FFT and k - NUM_TBS for the second half
+        const double x = (k < NUM_TBS / 2 ? k : k - NUM_TBS) / factor;
+        tables->filter[k] = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+    }
+}
+
+/* An in-place radix-2 FFT of length NUM_TBS. The inverse transform is not normalized. */
+static void fft_tbs(double *restrict re, double *restrict im, const BaselineTables *tables, const int inverse)
+{
+    for (int i = 0; i < NUM_TBS; i++) {
+        const int j = tables->bitrev[i];
+        if (j > i) {
+            double tmp = re[i]; re[i] = re[j]; re[j] = tmp;
+            tmp = im[i]; im[i] = im[j]; im[j] = tmp;
+        }
+    }
+
+    const double sign = inverse ? 1 : -1;
+
+    for (int size = 2; size <= NUM_TBS; size *= 2) {
+        const int half = size / 2;
+        const int step = NUM_TBS / size;
+        for (int start = 0; start < NUM_TBS; start += size) {
+            for (int k = 0; k < half; k++) {
+                const double wr = tables->cos_table[k * step];
+                const double wi = sign * tables->sin_table[k * step];
+                const int i = start + k;
+                const int j = i + half;
+                const double tr = re[j] * wr - im[j] * wi;
+                const double ti = re[j] * wi + im[j] * wr;
+                re[j] = re[i] - tr;
+                im[j] = im[i] - ti;
+                re[i] += tr;
+                im[i] += ti;
+            }
+        }
+    }
+}
+
+/* Replace the large values in a trace with the mean of the rest of the trace, like the first step of `fftbaseline`.
+   The replacement value is truncated to an integer since `fftbaseline` does this in an int16 copy of the data.
+ */
+static void clip_trace(const int16_t *restrict raw, double *restrict clipped)
+{
+    double sum = 0;
+    for (int i = 0; i < NUM_TBS; i++) sum += raw[i];
+    const double mean = sum / NUM_TBS;
+
+    double sqsum = 0;
+    for (int i = 0; i < NUM_TBS; i++) sqsum += (raw[i] - mean) * (raw[i] - mean);
+    const double thresh = sqrt(sqsum / NUM_TBS) * 1.5;
+
+    double keep_sum = 0;
+    int keep_count = 0;
+    for (int i = 0; i < NUM_TBS; i++) {
+        if (!(raw[i] - mean > thresh)) {
+            keep_sum += raw[i];
+            keep_count++;
+        }
+    }
+    const double fill = (double) (int16_t) (keep_sum / keep_count);
+
+    for (int i = 0; i < NUM_TBS; i++) {
+        clipped[i] = raw[i] - mean > thresh ? fill : raw[i];
+    }
+}
+
+/* Find the baseline-corrected data for two traces at once. Since the filter is real and symmetric, the baseline of
+   `raw_a` comes out in the real part of the filtered transform of (a + ib), and the baseline of `raw_b` comes out in
+   the imaginary part. `raw_b` may be NULL if there is only one trace left.
+ */
+static void fix_baseline_pair(const int16_t *restrict raw_a, const int16_t *restrict raw_b,
+                              const BaselineTables *tables, double *restrict out_a, double *restrict out_b)
+{
+    double re[NUM_TBS];
+    double im[NUM_TBS];
+
+    clip_trace(raw_a, re);
+    if (raw_b) clip_trace(raw_b, im);
+    else memset(im, 0, sizeof(im));
+
+    fft_tbs(re, im, tables, 0);
+    for (int k = 0; k < NUM_TBS; k++) {
+        re[k] *= tables->filter[k];
+        im[k] *= tables->filter[k];
+    }
+    fft_tbs(re, im, tables, 1);
+
+    for (int i = 0; i < NUM_TBS; i++) {
+        out_a[i] = raw_a[i] - re[i] / NUM_TBS;
+        if (raw_b) out_b[i] = raw_b[i] - im[i] / NUM_TBS;
+    }
+}
+
+/* Find the peak of one trace and write its row of the output. */
+static void trace_peak(const double *restrict trace, const double *restrict center, const uint16_t pad,
+                       const PeakConfig *config, double *restrict row, const int ncols)
+{
+    int maxloc = 0;
+    for (int i = 1; i < NUM_TBS; i++) {
+        if (trace[i] > trace[maxloc]) maxloc = i;
+    }
+    const double maxval = trace[maxloc];
+
+    double base = 0;
+    for (int k = 0; k < PEAK_BASE_WIDTH; k++) {
+        base += trace[clip_tb(maxloc - PEAK_BASE_OFFSET + k)];
+    }
+    base /= PEAK_BASE_WIDTH;
+
+    double z;
+    if (config->cg_times) {
+        // Like `find_cg_times`, the window is clipped at the edges, so the edge bins can be counted more than once
+        const double level = config->cg_level * maxval;
+        double numer = 0;
+        double denom = 0;
+        for (int k = 0; k < 2 * config->cg_range; k++) {
+            const int tb = clip_tb(maxloc - config->cg_range + k);
+            const double val = trace[tb] < level ? 0 : trace[tb];
+            numer += val * tb;
+            denom += val;
+        }
+        z = numer / denom;
+    }
+    else {
+        z = maxloc;
+    }
+
+    row[0] = center[0];
+    row[1] = center[1];
+    row[2] = z;
+    row[3] = maxval - base;
+    if (ncols > 4) row[4] = pad;
+}
+
+int find_peaks(const int16_t *restrict data, const ptrdiff_t data_stride, const uint16_t *restrict pads,
+               const ptrdiff_t pad_stride, const int ntraces, const double *restrict pad_centers, const int npads,
+               const PeakConfig *config, double *restrict out, const int ncols)
+{
+    for (int i = 0; i < ntraces; i++) {
+        if (pads[i * pad_stride] >= npads) return -1;
+    }
+
+    BaselineTables tables;
+    if (config->baseline_correction) baseline_tables_init(&tables, config->fft_baseline_factor);
+
+    // Each iteration handles two traces so that their baselines can be found with one complex FFT
+    const int npairs = (ntraces + 1) / 2;
+
+    #pragma omp parallel for schedule(static)
+    for (int pair_idx = 0; pair_idx < npairs; pair_idx++) {
+        double traces[2][NUM_TBS];
+        const int first = 2 * pair_idx;
+        const int count = ntraces - first < 2 ? ntraces - first : 2;
+
+        const int16_t *raw_a = data + first * data_stride;
+        const int16_t *raw_b = count > 1 ? raw_a + data_stride : NULL;
+
+        if (config->baseline_correction) {
+            fix_baseline_pair(raw_a, raw_b, &tables, traces[0], traces[1]);
+        }
+        else {
+            for (int t = 0; t < count; t++) {
+                for (int i = 0; i < NUM_TBS; i++) traces[t][i] = data[(first + t) * data_stride + i];
+            }
+        }
+
+        for (int t = 0; t < count; t++) {
+            const uint16_t pad = pads[(first + t) * pad_stride];
+            trace_peak(traces[t], pad_centers + 2 * pad, pad, config, out + (first + t) * ncols, ncols);
+        }
+    }
+
+    return 0;
+}
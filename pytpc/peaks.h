@@ -0,0 +1,45 @@
+/* peaks.h
+   A native version of the peak finding in `Event.xyzs`. This does the baseline correction, peak finding, and
+   center of gravity calculation for each trace in one pass, and it uses OpenMP to process the traces in parallel.
+ */
+
+#ifndef PEAKS_H
+#define PEAKS_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* The parameters for `find_peaks`. These have the same meanings as the arguments of `Event.xyzs`. */
+typedef struct {
+    int baseline_correction;
+    double fft_baseline_factor;
+    int cg_times;
+    double cg_level;
+    int cg_range;
+} PeakConfig;
+
+/* Find the peak of each trace, and write one row (x, y, z, amplitude[, pad]) to `out` for each.
+
+   Parameters:
+   - data: The trace data, with 512 time buckets per trace. Consecutive traces are `data_stride` elements apart.
+   - pads: The pad number of each trace. Consecutive pad numbers are `pad_stride` elements apart.
+   - ntraces: The number of traces.
+   - pad_centers: The (x, y) center of each pad, as an array with dimensions npads x 2.
+   - config: The peak finding parameters.
+   - out: The output array, with dimensions ntraces x ncols. If ncols is 5, the pad number is put in the last
+     column. The z values are in time buckets.
+
+   Returns 0 on success, or -1 if a pad number is not less than `npads`. Nothing is written in that case.
+ */
+int find_peaks(const int16_t *restrict data, const ptrdiff_t data_stride, const uint16_t *restrict pads,
+               const ptrdiff_t pad_stride, const int ntraces, const double *restrict pad_centers, const int npads,
+               const PeakConfig *config, double *restrict out, const int ncols);
+
+#endif /* end of include guard: PEAKS_H */
@@ -0,0 +1,100 @@
+"""peaks_wrapper.pyx
+
+A Cython wrapper around `peaks.c`, which finds the peak of each trace in an event for :meth:`pytpc.evtdata.Event.xyzs`.
+
+"""
+
+import numpy as np
+cimport numpy as np
+import cython
+from libc.stdint cimport int16_t, uint16_t
+
+np.import_array()
+
+
+cdef extern from "peaks.h" nogil:
+    ctypedef struct PeakConfig:
+        int baseline_correction
+        double fft_baseline_factor
+        int cg_times
+        double cg_level
+        int cg_range
+
+    int find_peaks(const int16_t *data, const Py_ssize_t data_stride, const uint16_t *pads,
+                   const Py_ssize_t pad_stride, const int ntraces, const double *pad_centers, const int npads,
+                   const PeakConfig *config, double *out, const int ncols)
+
+
+def event_peaks(traces, pad_centers, bint return_pads=False, bint cg_times=False, double cg_level=0.7,
+                int cg_range=20, bint baseline_correction=False, double fft_baseline_factor=20):
+    """Find the peak of each trace in an event, and return the peaks as points.
+
+    This gives the same result as ``Event.xyzs(peaks_only=True, ...)`` before calibration. The baseline correction,
+    peak finding, and center of gravity calculation are done together for each trace, and the traces are processed
+    in parallel. The GIL is released while this runs.
+
+    Parameters
+    ----------
+    traces : ndarray
+        The traces from the event, with the dtype :attr:`pytpc.evtdata.Event.dt`.
+    pad_centers : ndarray
+        The (x, y) center of each pad, as an array with dimensions (N, 2).
+    return_pads, cg_times, cg_level, cg_range, baseline_correction, fft_baseline_factor
+        See :meth:`pytpc.evtdata.Event.xyzs`.
+
+    Returns
+    -------
+    ndarray
+        The points (x, y, tb, amplitude), plus the pad number if `return_pads` is True. The z dimension is in
+        time buckets.
+
+    Raises
+    ------
+    ValueError
+        If the traces don't have 512 time buckets, or if `pad_centers` has the wrong shape.
+    IndexError
+        If a pad number is too large for `pad_centers`.
+    """
+    data = traces['data']
+    pads = traces['pad']
+
+    # The fields of a structured array are strided views, so they can be used directly as long as they're aligned
+    if data.ndim != 2 or data.shape[1] != 512:
+        raise ValueError('The traces must have 512 time buckets')
+    if data.dtype != np.int16 or data.strides[1] != 2 or data.strides[0] % 2 != 0:
+        data = np.ascontiguousarray(data, dtype=np.int16)
+    if pads.dtype != np.uint16 or pads.strides[0] % 2 != 0:
+        pads = np.ascontiguousarray(pads, dtype=np.uint16)
+
+    cdef np.ndarray[np.double_t, ndim=2, mode='c'] centers = np.ascontiguousarray(pad_centers, dtype=np.double)
+    if centers.shape[1] != 2:
+        raise ValueError('pad_centers must have dimensions (N, 2)')
+
+    cdef int ntraces = data.shape[0]
+    cdef int ncols = 5 if return_pads else 4
+    cdef np.ndarray[np.double_t, ndim=2, mode='c'] out = np.empty((ntraces, ncols), dtype=np.double)
+
+    cdef const int16_t *data_ptr = <const int16_t*> np.PyArray_DATA(<np.ndarray> data)
+    cdef const uint16_t *pads_ptr = <const uint16_t*> np.PyArray_DATA(<np.ndarray> pads)
+    cdef Py_ssize_t data_stride = data.strides[0] // 2 if ntraces > 0 else 0
+    cdef Py_ssize_t pad_stride = pads.strides[0] // 2 if ntraces > 0 else 0
+    cdef int npads = centers.shape[0]
+    cdef const double *centers_ptr = <const double*> centers.data
+    cdef double *out_ptr = <double*> out.data
+
+    cdef PeakConfig config
+    config.baseline_correction = baseline_correction
+    config.fft_baseline_factor = fft_baseline_factor
+    config.cg_times = cg_times
+    config.cg_level = cg_level
+    config.cg_range = cg_range
+
+    cdef int res
+    with nogil:
+        res = find_peaks(data_ptr, data_stride, pads_ptr, pad_stride, ntraces, centers_ptr, npads, &config,
+                         out_ptr, ncols)
+
+    if res != 0:
+        raise IndexError('A pad number in the event is out of range for pad_centers')
+
+    return out
@@ -0,0 +1,202 @@
+"""Overlap reading and writing events with processing them.
+
+The scripts that process a run alternate between reading an event, processing it, and writing the result. The classes
+in this module let the reading and decoding happen in background threads ahead of the processing, and let the
+writing happen in another thread behind it. Threads are enough for this since the expensive parts of the processing
+(the Hough transforms and the Monte Carlo fitter) release the GIL, so the I/O can run while they are busy.
+
+A typical loop looks like this::
+
+    with AsyncWriter(write_result) as writer:
+        for evt_id, evt, error in PrefetchingReader(hfile.read_get_event, evtids):
+            if error is not None:
+                continue  # Failed to read this event
+            writer.put(evt_id, process(evt))
+
+Use :func:`prefetch_events` to make a reader that works with any of the event file classes.
+"""
+
+from concurrent.futures import ThreadPoolExecutor
+from collections import deque
+import threading
+import queue
+import logging
+
+from .hdfdata import HDFDataFile
+
+logger = logging.getLogger(__name__)
+
+
+class PrefetchingReader(object):
+    """An iterator that calls a read function on a sequence of keys in a thread pool, ahead of the consumer.
+
+    The results are produced in the same order as the keys. At most `depth` reads are queued or finished but not yet
+    consumed, which limits the memory used if the consumer is slower than the reads.
+
+    Iterating over this yields a tuple ``(key, value, error)`` for each key. If the read function raised an
+    exception, `value` is None and `error` is the exception. Otherwise, `error` is None.
+
+    Parameters
+    ----------
+    read_func : callable
+        The function to call on each key, like ``HDFDataFile.read_get_event``. This must be safe to call from several
+        threads at once if `num_threads` is more than 1.
+    keys : iterable
+        The keys to read. This is only consumed as the reads are queued.
+    depth : int, optional
+        The maximum number of reads to run ahead of the consumer.
+    num_threads : int, optional
+        The number of threads used to run the reads.
+    """
+
+    def __init__(self, read_func, keys, depth=8, num_threads=2):
+        if depth < 1:
+            raise ValueError('Prefetch depth must be at least 1')
+
+        self.read_func = read_func
+        self.keys = iter(keys)
+        self.depth = depth
+        self.num_threads = num_threads
+
+    def __iter__(self):
+        pending = deque()
+
+        with ThreadPoolExecutor(max_workers=self.num_threads) as executor:
+            try:
+                for key in self.keys:
+                    pending.append((key, executor.submit(self.read_func, key)))
+                    if len(pending) >= self.depth:
+                        yield self._result(*pending.popleft())
+
+                while len(pending) > 0:
+                    yield self._result(*pending.popleft())
+
+            finally:
+                # If the consumer stops early, don't wait for reads that will never be used
+                for _, future in pending:
+                    future.cancel()
+
+    @staticmethod
+    def _result(key, future):
+        try:
+            return key, future.result(), None
+        except Exception as err:
+            return key, None, err
+
+
+class AsyncWriter(object):
+    """Calls a write function on a background thread for each item that is put into it.
+
+    The items are written one at a time in the order they were given, so the write function does not need to be
+    thread-safe itself. The writer should be used as a context manager, or :meth:`close` must be called to write
+    the remaining items and stop the thread.
+
+    If the write function raises an exception, the writer stops, and the exception is raised again by the next call
+    to :meth:`put` or :meth:`close`. Catch exceptions inside the write function to log them and continue instead.
+
+    Parameters
+    ----------
+    write_func : callable
+        The function to call for each item. It is called as ``write_func(*args)`` with the arguments given to
+        :meth:`put`.
+    max_queued : int, optional
+        The maximum number of items waiting to be written. :meth:`put` blocks if the queue is full.
+    """
+
+    def __init__(self, write_func, max_queued=64):
+        self.write_func = write_func
+        self._queue = queue.Queue(maxsize=max_queued)
+        self._error = None
+        self._thread = threading.Thread(target=self._run, name='AsyncWriter', daemon=True)
+        self._thread.start()
+
+    def _run(self):
+        while True:
+            args = self._queue.get()
+            if args is None:
+                break
+            if self._error is not None:
+                continue  # Drain the queue after an error so put() doesn't block
+
+            try:
+                self.write_func(*args)
+            except Exception as err:
+                logger.exception('Write failed in background writer')
+                self._error = err
+
+    def _check_error(self):
+        if self._error is not None:
+            raise RuntimeError('A write failed in the background writer') from self._error
+
+    def put(self, *args):
+        """Queue a call to the write function with the given arguments.
+
+        Raises
+        ------
+        RuntimeError
+            If an earlier write failed. The original exception is the cause.
+        """
+        self._check_error()
+        self._queue.put(args)
+
+    def close(self):
+        """Write the remaining items and stop the writer thread.
+
+        Raises
+        ------
+        RuntimeError
+            If any write failed. The original exception is the cause.
+        """
+        if self._thread.is_alive():
+            self._queue.put(None)
+            self._thread.join()
+        self._check_error()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+
+def prefetch_events(datafile, keys=None, depth=8, num_threads=2):
+    """Make a `PrefetchingReader` that reads events from an event file.
+
+    Parameters
+    ----------
+    datafile : HDFDataFile or pytpc.datafile.DataFile
+        The file to read from. For an HDF5 file, the keys are event IDs. For the other file types, they are event
+        numbers (indices in the file's lookup table).
+    keys : iterable, optional
+        The keys to read. By default, every event in the file is read.
+    depth, num_threads : int, optional
+        See `PrefetchingReader`.
+
+    Returns
+    -------
+    PrefetchingReader
+        The reader.
+    """
+    if isinstance(datafile, HDFDataFile):
+        # h5py serializes access to the file internally, so this is safe to call from several threads
+        read_func = datafile.read_get_event
+        if keys is None:
+            keys = list(datafile.evtids())
+
+    elif datafile.map is not None:
+        # The raw events are views of the mapped file, so only the decoding needs to happen in the threads
+        def read_func(i):
+            return datafile._parse_raw(datafile.read_raw_event_by_number(i))
+
+    else:
+        # The file cursor is shared, so only one thread can read at a time
+        lock = threading.Lock()
+
+        def read_func(i):
+            with lock:
+                return datafile.read_event_by_number(i)
+
+    if keys is None:
+        keys = range(len(datafile.lookup))
+
+    return PrefetchingReader(read_func, keys, depth=depth, num_threads=num_threads)
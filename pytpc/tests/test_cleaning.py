@@ -0,0 +1,260 @@
+import unittest
+import numpy as np
+import numpy.testing as nptest
+
+import pytpc
+from pytpc.cleaning import (nearest_neighbor_count, hough_line, hough_line_refined, hough_circle, nearest_neighbor_count_batch,
+                            hough_line_batch, hough_circle_batch, hough_clean, HoughCleaner, EventCleaner,
+                            compare_precision)
+
+
+def brute_force_neighbor_count(xyz, radius):
+    diffs = xyz[:, np.newaxis, :3] - xyz[np.newaxis, :, :3]
+    dist2 = np.sum(diffs**2, axis=-1)
+    return np.sum(dist2 < radius**2, axis=1) - 1
+
+
+class TestNearestNeighborCount(unittest.TestCase):
+    def setUp(self):
+        rng = np.random.RandomState(42)
+        self.xyz = np.ascontiguousarray(rng.uniform(-250, 250, size=(1000, 4)))
+
+    def test_matches_brute_force(self):
+        for radius in (1, 15, 40, 1000):
+            counts = nearest_neighbor_count(self.xyz, radius)
+            nptest.assert_equal(counts, brute_force_neighbor_count(self.xyz, radius))
+
+    def test_duplicate_points(self):
+        xyz = np.ascontiguousarray(np.repeat(self.xyz[:10], 3, axis=0))
+        counts = nearest_neighbor_count(xyz, 1e-3)
+        nptest.assert_equal(counts, np.full(xyz.shape[0], 2))
+
+    def test_non_finite_values(self):
+        xyz = self.xyz.copy()
+        xyz[5, 0] = np.nan
+        counts = nearest_neighbor_count(xyz, 40)
+        nptest.assert_equal(counts, brute_force_neighbor_count(xyz, 40))
+
+
+class TestBatchFunctions(unittest.TestCase):
+    def setUp(self):
+        rng = np.random.RandomState(12)
+        self.events = [rng.uniform(-250, 250, size=(n, 3)) for n in (50, 0, 300, 7, 1000)]
+        self.xyz = np.ascontiguousarray(np.concatenate(self.events))
+        self.offsets = np.concatenate(([0], np.cumsum([len(e) for e in self.events]))).astype('int64')
+
+    def test_hough_line_batch(self):
+        accums = hough_line_batch(self.xyz, self.offsets, nbins=100, max_val=500)
+        self.assertEqual(accums.shape, (len(self.events), 100, 100))
+        for evt, accum in zip(self.events, accums):
+            nptest.assert_equal(accum, hough_line(np.ascontiguousarray(evt), nbins=100, max_val=500))
+
+    def test_hough_circle_batch(self):
+        centers = hough_circle_batch(self.xyz, self.offsets, nbins=100, max_val=500)
+        self.assertEqual(centers.shape, (len(self.events), 2))
+        for evt, ctr in zip(self.events, centers):
+            nptest.assert_equal(ctr, hough_circle(np.ascontiguousarray(evt), nbins=100, max_val=500))
+
+    def test_nearest_neighbor_count_batch(self):
+        counts = nearest_neighbor_count_batch(self.xyz, self.offsets, 40)
+        expected = np.concatenate([brute_force_neighbor_count(evt, 40) for evt in self.events])
+        nptest.assert_equal(counts, expected)
+
+    def test_bad_offsets(self):
+        with self.assertRaises(ValueError):
+            hough_line_batch(self.xyz, np.array([0, 10, 5], dtype='int64'))
+        with self.assertRaises(ValueError):
+            hough_line_batch(self.xyz, np.array([0, self.xyz.shape[0] + 1], dtype='int64'))
+
+
+class TestHoughLineRefined(unittest.TestCase):
+    def setUp(self):
+        # Three parallel lines plus some noise
+        rng = np.random.RandomState(3)
+        xs = np.linspace(0, 1000, 3000)
+        ys = (np.arange(3000) % 3) * 150 - 0.5 * xs + rng.normal(0, 1, 3000)
+        ys[::7] = rng.uniform(-500, 500, ys[::7].shape)
+        self.xy = np.ascontiguousarray(np.column_stack((xs, ys)))
+
+    def test_full_resolution(self):
+        accum = hough_line_refined(self.xy, coarse_factor=1)
+        nptest.assert_equal(accum, hough_line(self.xy))
+
+    def test_refined_max(self):
+        accum = hough_line_refined(self.xy, coarse_factor=10, ntop=3)
+        full = hough_line(self.xy)
+        self.assertEqual(accum.argmax(), full.argmax())
+        refined_rows = np.flatnonzero(accum.sum(1))
+        nptest.assert_equal(accum[refined_rows], full[refined_rows])
+
+    def test_uniform_weights(self):
+        accum = hough_line_refined(self.xy, coarse_factor=1, weights=np.full(self.xy.shape[0], 4.0))
+        nptest.assert_allclose(accum, hough_line(self.xy))
+
+
+class TestNativeClean(unittest.TestCase):
+    def setUp(self):
+        self.config = {
+            'cleaning_config': {
+                'native_clean': True,
+                'peak_width': 4,
+                'linear_hough_max': 2000,
+                'linear_hough_nbins': 500,
+                'circle_hough_max': 500,
+                'circle_hough_nbins': 200,
+                'min_pts_per_line': 10,
+                'neighbor_radius': 15,
+            },
+        }
+
+        # A spiral around (30, -20) with some uniform noise mixed in
+        rng = np.random.RandomState(7)
+        t = np.linspace(0, 30, 3000)
+        r = 200 * np.exp(-0.05 * t)
+        xyz = np.column_stack((r * np.cos(t) + 30, r * np.sin(t) - 20, t * 30))
+        noise = rng.uniform(-250, 250, size=(300, 3))
+        noise[:, 2] += 500
+        self.xyz = np.ascontiguousarray(np.concatenate((xyz, noise)))
+
+    def test_default_off(self):
+        del self.config['cleaning_config']['native_clean']
+        self.assertFalse(HoughCleaner(self.config).native_clean)
+
+    def test_matches_python(self):
+        native_cleaner = HoughCleaner(self.config)
+        self.config['cleaning_config']['native_clean'] = False
+        python_cleaner = HoughCleaner(self.config)
+
+        labels, mindists, nn_counts, (cu, cv) = native_cleaner.clean(self.xyz)
+        exp_labels, exp_mindists, exp_nn_counts, (exp_cu, exp_cv) = python_cleaner.clean(self.xyz)
+
+        self.assertAlmostEqual(cu, exp_cu)
+        self.assertAlmostEqual(cv, exp_cv)
+        nptest.assert_equal(nn_counts, exp_nn_counts)
+        nptest.assert_equal(labels, exp_labels)
+        nptest.assert_allclose(mindists, exp_mindists)
+
+
+class TestSinglePrecision(unittest.TestCase):
+    def setUp(self):
+        self.config = {
+            'cleaning_config': {
+                'peak_width': 4,
+                'linear_hough_max': 2000,
+                'linear_hough_nbins': 500,
+                'circle_hough_max': 500,
+                'circle_hough_nbins': 200,
+                'min_pts_per_line': 10,
+                'neighbor_radius': 15,
+            },
+        }
+
+        rng = np.random.RandomState(7)
+        t = np.linspace(0, 30, 3000)
+        r = 200 * np.exp(-0.05 * t)
+        xyz = np.column_stack((r * np.cos(t) + 30, r * np.sin(t) - 20, t * 30))
+        noise = rng.uniform(-250, 250, size=(300, 3))
+        noise[:, 2] += 500
+        self.xyz = np.ascontiguousarray(np.concatenate((xyz, noise)))
+        self.xyz32 = self.xyz.astype('float32')
+
+    def test_hough_line(self):
+        accum = hough_line(self.xyz[:, :2].copy())
+        accum32 = hough_line(self.xyz32[:, :2].copy())
+        self.assertEqual(accum32.dtype, np.int32)
+        self.assertEqual(accum32.sum(), accum.sum())
+        self.assertLess(np.abs(accum32 - accum).sum(), 0.001 * accum.sum())
+
+    def test_hough_circle(self):
+        cu, cv = hough_circle(self.xyz)
+        cu32, cv32 = hough_circle(self.xyz32)
+        self.assertAlmostEqual(cu32, cu, delta=5)
+        self.assertAlmostEqual(cv32, cv, delta=5)
+
+    def test_nearest_neighbor_count(self):
+        counts = nearest_neighbor_count(self.xyz32, 15)
+        self.assertEqual(counts.dtype, np.int32)
+        expected = brute_force_neighbor_count(self.xyz32.astype('float64'), 15)
+        self.assertLessEqual(np.count_nonzero(counts != expected), 3)
+
+    def test_hough_clean_types(self):
+        labels, mindists, nn_counts, _ = hough_clean(self.xyz32, 4, 2000, 500, 500, 200, 10, 15)
+        self.assertEqual(labels.dtype, np.int32)
+        self.assertEqual(mindists.dtype, np.float32)
+        self.assertEqual(nn_counts.dtype, np.int32)
+
+        with self.assertRaises(ValueError):
+            hough_clean(self.xyz32, 4, 2000, 500, 500, 200, 10, 15, labels=np.empty(len(self.xyz32), dtype='int64'))
+
+    def test_compare_precision(self):
+        cleaner = HoughCleaner(self.config)
+        result = compare_precision(cleaner, [self.xyz, self.xyz[::2].copy()])
+        self.assertFalse(cleaner.single_precision)
+        self.assertEqual(len(result), 2)
+        nptest.assert_equal(result['num_points'], [len(self.xyz), len(self.xyz[::2])])
+        self.assertLess(result['label_mismatches'].max(), 0.01 * len(self.xyz))
+        self.assertLess(result['center_diff'].max(), 5)
+        self.assertLess(result['max_mindist_diff'].max(), 1)
+
+    def test_python_path(self):
+        self.config['cleaning_config']['single_precision'] = True
+        self.config['cleaning_config']['native_clean'] = False
+        labels, mindists, nn_counts, _ = HoughCleaner(self.config).clean(self.xyz)
+        self.config['cleaning_config']['native_clean'] = True
+        exp_labels, exp_mindists, exp_nn_counts, _ = HoughCleaner(self.config).clean(self.xyz)
+        nptest.assert_equal(nn_counts, exp_nn_counts)
+        self.assertLess(np.count_nonzero(labels != exp_labels), 0.01 * len(self.xyz))
+
+
+class TestEventCleaner(unittest.TestCase):
+    def setUp(self):
+        self.config = {
+            'tilt': 6,
+            'vd': [-0.1, 0.2, -5.2],
+            'clock': 12.5,
+            'pad_rot_angle': -108,
+            'micromegas_tb': 30,
+            'cleaning_config': {
+                'peak_width': 4,
+                'linear_hough_max': 2000,
+                'linear_hough_nbins': 500,
+                'circle_hough_max': 500,
+                'circle_hough_nbins': 200,
+                'min_pts_per_line': 10,
+                'neighbor_radius': 15,
+                'last_tb': 400,
+            },
+        }
+        self.cleaner = EventCleaner(self.config)
+
+        rng = np.random.RandomState(3)
+        num_traces = 300
+        self.evt = pytpc.Event(1, 2)
+        self.evt.traces = np.zeros(num_traces, dtype=self.evt.dt)
+        self.evt.traces['pad'] = rng.choice(10240, num_traces, replace=False)
+        tbs = np.arange(512)
+        peak_tbs = rng.uniform(40, 480, num_traces)
+        self.evt.traces['data'] = 200 * np.exp(-(tbs[np.newaxis, :] - peak_tbs[:, np.newaxis])**2 / 18)
+
+    def test_same_as_pads(self):
+        """The result should match what's found if the points are read with the pad plane and calibrated once."""
+        clean_xyz, (cx, cy) = self.cleaner.process_event(self.evt)
+
+        raw_xyz = self.evt.xyzs(pads=self.cleaner.pads, peaks_only=True, return_pads=True, cg_times=True,
+                                baseline_correction=True)
+        xyz = self.cleaner.preprocess(raw_xyz, rotate_pads=False, last_tb=self.cleaner.last_tb)
+        labels, mindists, nn_counts, (cu, cv) = self.cleaner.clean(xyz[['u', 'v', 'w', 'a']].values)
+        exp_xyz = np.column_stack((raw_xyz[raw_xyz[:, 2] < self.cleaner.last_tb], nn_counts, mindists))
+
+        self.assertGreater(len(exp_xyz), 0)
+        self.assertLess(clean_xyz[:, 2].max(), self.cleaner.last_tb)
+        nptest.assert_allclose(clean_xyz, exp_xyz)
+
+        center = np.array([cu, cv - np.tan(self.cleaner.tilt) * 1000., 0])
+        exp_cx, exp_cy, _ = self.cleaner.untilt_mat @ center
+        self.assertAlmostEqual(cx, exp_cx)
+        self.assertAlmostEqual(cy, exp_cy)
+
+
+if __name__ == '__main__':
+    unittest.main()
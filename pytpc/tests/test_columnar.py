@@ -0,0 +1,147 @@
+import unittest
+import numpy as np
+import numpy.testing as nptest
+import h5py
+
+from pytpc.columnar import EventBitmap, ColumnarTable, ColumnarEventWriter, ColumnarEventReader
+
+
+def make_file():
+    return h5py.File('test_columnar.h5', 'w', driver='core', backing_store=False)
+
+
+class TestEventBitmap(unittest.TestCase):
+
+    def setUp(self):
+        self.file = make_file()
+
+    def tearDown(self):
+        self.file.close()
+
+    def test_add(self):
+        bitmap = EventBitmap(self.file)
+        evt_ids = [0, 3, 7, 8, 100, 4000]
+        bitmap.add(evt_ids)
+        nptest.assert_equal(bitmap.evt_ids(), evt_ids)
+        self.assertEqual(len(bitmap), len(evt_ids))
+        self.assertIn(100, bitmap)
+        self.assertNotIn(101, bitmap)
+        self.assertNotIn(100000, bitmap)
+
+    def test_reopen(self):
+        EventBitmap(self.file).add([5, 9, 2])
+        EventBitmap(self.file).add([1])
+        nptest.assert_equal(EventBitmap(self.file).evt_ids(), [1, 2, 5, 9])
+
+    def test_negative(self):
+        with self.assertRaises(ValueError):
+            EventBitmap(self.file).add([-1])
+
+
+class TestColumnarTable(unittest.TestCase):
+
+    def setUp(self):
+        self.file = make_file()
+        self.columns = [('evt_id', 'int64'), ('chi2', 'float64'), ('center', 'float64', (2,))]
+
+    def tearDown(self):
+        self.file.close()
+
+    def test_append_dicts(self):
+        table = ColumnarTable(self.file.create_group('t'), self.columns, chunk_rows=4)
+        table.append([{'evt_id': i, 'chi2': i * 0.5, 'center': (i, -i)} for i in range(10)])
+        table.append([{'evt_id': 10, 'extra': 1}])
+
+        self.assertEqual(len(table), 11)
+        res = table.read()
+        nptest.assert_equal(res['evt_id'], np.arange(11))
+        nptest.assert_equal(res['chi2'][:10], np.arange(10) * 0.5)
+        self.assertTrue(np.isnan(res['chi2'][10]))
+        nptest.assert_equal(res['center'][3], [3, -3])
+
+    def test_append_arrays(self):
+        table = ColumnarTable(self.file.create_group('t'), self.columns)
+        table.append({'evt_id': [1, 2], 'chi2': [0.1, 0.2], 'center': np.zeros((2, 2))})
+        nptest.assert_equal(table.read(['evt_id'])['evt_id'], [1, 2])
+
+    def test_bad_shape(self):
+        table = ColumnarTable(self.file.create_group('t'), self.columns)
+        with self.assertRaises(ValueError):
+            table.append({'evt_id': [1, 2], 'chi2': [0.1, 0.2], 'center': np.zeros((2, 3))})
+
+    def test_partial_rows_dropped(self):
+        gp = self.file.create_group('t')
+        table = ColumnarTable(gp, self.columns)
+        table.append({'evt_id': [1, 2], 'chi2': [0.1, 0.2], 'center': np.zeros((2, 2))})
+
+        # As if the program was killed after resizing one column
+        gp['chi2'].resize((5,))
+
+        reopened = ColumnarTable(gp)
+        self.assertEqual(len(reopened), 2)
+        self.assertEqual(gp['chi2'].shape, (2,))
+
+
+class TestColumnarEventWriter(unittest.TestCase):
+
+    def setUp(self):
+        self.file = make_file()
+        self.gp = self.file.create_group('clean_table')
+        rng = np.random.RandomState(0)
+        self.points = {evt_id: rng.normal(size=(rng.randint(0, 20), 3)) for evt_id in range(0, 50, 2)}
+
+    def tearDown(self):
+        self.file.close()
+
+    def make_writer(self, batch_size=4):
+        return ColumnarEventWriter(self.gp, [('center', 'float64', (2,))], [('xyz', 'float64', 3)],
+                                   batch_size=batch_size)
+
+    def test_round_trip(self):
+        writer = self.make_writer()
+        for evt_id, pts in self.points.items():
+            writer.add(evt_id, {'center': (evt_id, 1)}, {'xyz': pts})
+        writer.close()
+
+        reader = ColumnarEventReader(self.gp)
+        self.assertEqual(reader.evt_ids(), sorted(self.points.keys()))
+        for evt_id, pts in self.points.items():
+            values, row = reader.read(evt_id, 'xyz')
+            nptest.assert_equal(values, pts)
+            nptest.assert_equal(row['center'], [evt_id, 1])
+
+    def test_resume(self):
+        writer = self.make_writer(batch_size=3)
+        for evt_id in [0, 2, 4, 6]:
+            writer.add(evt_id, {'center': (0, 0)}, {'xyz': self.points[evt_id]})
+        # Event 6 is still in the batch, so it isn't written
+
+        writer = self.make_writer()
+        self.assertEqual(writer.completed_events(), {0, 2, 4})
+
+    def test_bitmap_rebuilt(self):
+        writer = self.make_writer(batch_size=2)
+        for evt_id in [0, 2, 4, 6]:
+            writer.add(evt_id, {'center': (0, 0)}, {'xyz': self.points[evt_id]})
+
+        # As if the program was killed after committing the rows of the last batch but before updating the bitmap
+        writer.processed.rebuild([0, 2])
+
+        writer = self.make_writer()
+        self.assertEqual(writer.completed_events(), {0, 2, 4, 6})
+        self.assertEqual(EventBitmap(self.gp).evt_ids().tolist(), [0, 2, 4, 6])
+
+    def test_stacked_rows_trimmed(self):
+        writer = self.make_writer(batch_size=1)
+        writer.add(0, {'center': (0, 0)}, {'xyz': np.ones((4, 3))})
+
+        # As if the program was killed after writing the points of the next batch
+        writer.array_tables['xyz'].append({'values': np.zeros((6, 3))})
+
+        writer = self.make_writer(batch_size=1)
+        self.assertEqual(len(writer.array_tables['xyz']), 4)
+        writer.add(2, {'center': (0, 0)}, {'xyz': np.full((2, 3), 2.0)})
+
+        values, row = ColumnarEventReader(self.gp).read(2, 'xyz')
+        self.assertEqual(row['xyz_offset'], 4)
+        nptest.assert_equal(values, np.full((2, 3), 2.0))
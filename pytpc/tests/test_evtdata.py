@@ -1,5 +1,8 @@
 import unittest
+import os
+import tempfile
 import pytpc
+from pytpc.unpack import decode_evt_traces
 import numpy as np
 import numpy.testing as nptest
 
@@ -48,6 +51,135 @@ class TestUnpacking(unittest.TestCase):
         nptest.assert_equal(samples, unpacked_samples)
 
 
+class TestEventFileReading(unittest.TestCase):
+    """Tests reading events with the native decoder"""
+
+    def setUp(self):
+        rng = np.random.RandomState(3)
+        self.evt = pytpc.Event(12, 3456)
+        self.evt.traces = np.zeros(50, dtype=self.evt.dt)
+        self.evt.traces['cobo'] = rng.randint(0, 10, 50)
+        self.evt.traces['asad'] = rng.randint(0, 4, 50)
+        self.evt.traces['aget'] = rng.randint(0, 4, 50)
+        self.evt.traces['channel'] = rng.randint(0, 68, 50)
+        self.evt.traces['pad'] = rng.choice(10240, 50, replace=False)
+        data = rng.randint(-4095, 4096, size=(50, 512))
+        data[rng.uniform(size=data.shape) < 0.7] = 0
+        self.evt.traces['data'] = data
+
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.path = os.path.join(self.tmpdir.name, 'test.evt')
+        ef = pytpc.EventFile(self.path, 'w')
+        ef.write(self.evt)
+        ef.write(self.evt)
+        ef.close()
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def test_roundtrip(self):
+        ef = pytpc.EventFile(self.path, 'r')
+        for evt in (ef[0], ef[1]):
+            self.assertEqual(evt.evt_id, self.evt.evt_id)
+            self.assertEqual(evt.timestamp, self.evt.timestamp)
+            nptest.assert_equal(evt.traces, self.evt.traces)
+        ef.close()
+
+    def test_matches_python_reader(self):
+        ef = pytpc.EventFile(self.path, 'r')
+        ef.fp.seek(ef.lookup[0] + 19)
+        traces = ef._read_traces(len(self.evt.traces))
+        nptest.assert_equal(ef[0].traces, traces)
+        ef.close()
+
+    def test_mmap(self):
+        ef = pytpc.EventFile(self.path, 'r', use_mmap=True)
+        self.assertTrue(os.path.exists(self.path + '.idx.npy'))
+        nptest.assert_equal(ef.evtids, [self.evt.evt_id] * 2)
+        for i in range(2):
+            evt = ef[i]
+            nptest.assert_equal(evt.traces, self.evt.traces)
+            raw = ef.read_raw_event_by_number(i)
+            self.assertEqual(raw[0], 0xEE)
+            self.assertEqual(len(raw), 19 + 50 * 10 + np.count_nonzero(self.evt.traces['data']) * 3)
+            del raw
+        ef.close()
+
+        # Now the index should be read from the sidecar file
+        ef = pytpc.EventFile(self.path, 'r', use_mmap=True)
+        nptest.assert_equal(ef.lookup, pytpc.EventFile(self.path, 'r').lookup)
+        nptest.assert_equal(ef[1].traces, self.evt.traces)
+        ef.close()
+
+    def test_index_truncated(self):
+        with open(self.path, 'rb') as f:
+            buf = f.read()
+        offsets, evtids = pytpc.unpack.index_evt_file(buf)
+        nptest.assert_equal(offsets, [4, 4 + (len(buf) - 4) // 2])
+        nptest.assert_equal(evtids, [self.evt.evt_id] * 2)
+
+        self.assertRaises(ValueError, pytpc.unpack.index_evt_file, buf[:-10])
+
+    def test_truncated(self):
+        with open(self.path, 'rb') as f:
+            f.seek(4 + 19)
+            body = f.read(1000)
+        self.assertRaises(ValueError, decode_evt_traces, body, len(self.evt.traces))
+
+
+def reference_peaks(evt, pcenters, cg_times, baseline_correction):
+    """The NumPy implementation of Event.xyzs with peaks_only=True."""
+    if baseline_correction:
+        trdata = pytpc.evtdata.fix_baselines(evt.traces['data'], 20)
+    else:
+        trdata = evt.traces['data']
+
+    maxlocs = np.argmax(trdata, axis=1)
+    base_data, _ = pytpc.evtdata._get_data_chunk(trdata, chunk_start=(maxlocs - 15), chunk_width=5)
+    cs = trdata.max(axis=1) - base_data.mean(1)
+    if cg_times:
+        zs = pytpc.evtdata.find_cg_times(trdata, cg_range=20, cg_level=0.7)
+    else:
+        zs = maxlocs
+
+    return np.column_stack((pcenters[evt.traces['pad']], zs, cs, evt.traces['pad']))
+
+
+class TestPeakFinding(unittest.TestCase):
+    """Tests the native peak finding in Event.xyzs"""
+
+    def setUp(self):
+        rng = np.random.RandomState(9)
+        self.evt = pytpc.Event(1, 2)
+        self.evt.traces = np.zeros(31, dtype=self.evt.dt)
+        self.evt.traces['pad'] = rng.choice(10240, 31, replace=False)
+
+        tbs = np.arange(512)
+        peaks = rng.randint(0, 512, 31)
+        peaks[:2] = [3, 509]  # Make sure the edges are covered
+        data = 300 * np.exp(-((tbs - peaks[:, np.newaxis]) / 5)**2) + rng.normal(40, 3, (31, 512))
+        self.evt.traces['data'] = data
+
+        self.pads = pytpc.generate_pad_plane()
+        self.pcenters = self.pads.mean(1)
+
+    def test_xyzs(self):
+        for cg_times in (False, True):
+            for baseline_correction in (False, True):
+                res = self.evt.xyzs(pads=self.pads, peaks_only=True, return_pads=True, cg_times=cg_times,
+                                    baseline_correction=baseline_correction)
+                exp = reference_peaks(self.evt, self.pcenters, cg_times, baseline_correction)
+                nptest.assert_allclose(res, exp, rtol=1e-10, atol=1e-9)
+
+    def test_no_pads(self):
+        res = self.evt.xyzs(pads=self.pads, peaks_only=True, cg_times=True)
+        self.assertEqual(res.shape, (31, 4))
+
+    def test_empty(self):
+        evt = pytpc.Event()
+        self.assertEqual(evt.xyzs(pads=self.pads, peaks_only=True).shape, (0, 4))
+
+
 class TestCalibration(unittest.TestCase):
     """Tests for calibrate and uncalibrate_z"""
 
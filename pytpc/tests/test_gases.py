@@ -1,4 +1,7 @@
 import unittest
+import os
+import tempfile
+import numpy as np
 import pytpc.gases
 import pytpc.relativity as rel
 from pytpc.constants import *
@@ -71,6 +74,60 @@ class TestInterpolatedGasMixture(unittest.TestCase):
         self.assertAlmostEqual(comps, total)
 
 
+class TestTabulatedGas(unittest.TestCase):
+
+    def setUp(self):
+        self.interp = pytpc.gases.InterpolatedGas('helium', 200)
+        self.gas = pytpc.gases.TabulatedGas.from_gas(self.interp)
+        self.ens = np.linspace(0.1, 10, 100)
+
+    def test_energy_loss(self):
+        res = self.gas.energy_loss(self.ens, 4, 2)
+        exp = self.interp.energy_loss(self.ens, 4, 2)
+        np.testing.assert_allclose(res, exp, rtol=1e-3)
+
+    def test_range(self):
+        res = self.gas.range(self.ens, 4, 2)
+        exp = self.interp.range(self.ens, 4, 2)
+        np.testing.assert_allclose(res, exp, rtol=1e-3)
+
+    def test_inverse_range(self):
+        ranges = self.gas.range(self.ens, 4, 2)
+        res = self.gas.inverse_range(ranges, 4, 2)
+        np.testing.assert_allclose(res, self.ens, rtol=1e-3)
+
+    def test_scalar(self):
+        self.assertAlmostEqual(self.gas.energy_loss(1.0, 4, 2), self.gas.energy_loss(np.array([1.0]), 4, 2)[0])
+
+    def test_clamped(self):
+        self.assertEqual(self.gas.energy_loss(0, 4, 2), self.gas.dedx_tables[4, 2][0])
+        self.assertEqual(self.gas.energy_loss(1e6, 4, 2), self.gas.dedx_tables[4, 2][-1])
+
+    def test_bad_proj(self):
+        self.assertRaises(NotImplementedError, self.gas.energy_loss, 1.0, 100, 100)
+
+    def test_save_load(self):
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'table.npz')
+            self.gas.save(path)
+            loaded = pytpc.gases.TabulatedGas.load(path)
+
+        self.assertEqual(loaded.known_projectiles, self.gas.known_projectiles)
+        self.assertEqual(loaded.molar_mass, self.gas.molar_mass)
+        self.assertEqual(loaded.pressure, self.gas.pressure)
+        np.testing.assert_array_equal(loaded.energy_loss(self.ens, 4, 2), self.gas.energy_loss(self.ens, 4, 2))
+
+    def test_load_tabulated_gas(self):
+        with tempfile.TemporaryDirectory() as tmpdir:
+            res = pytpc.gases.load_tabulated_gas('helium', 200, cache_dir=tmpdir)
+            self.assertEqual(os.listdir(tmpdir), ['helium_200torr_table.npz'])
+
+            cached = pytpc.gases.load_tabulated_gas('helium', 200, cache_dir=tmpdir)
+
+        np.testing.assert_array_equal(res.energy_loss(self.ens, 4, 2), self.gas.energy_loss(self.ens, 4, 2))
+        np.testing.assert_array_equal(cached.energy_loss(self.ens, 4, 2), self.gas.energy_loss(self.ens, 4, 2))
+
+
 class TestBethe(unittest.TestCase):
     """Tests for pytpc.gases.bethe function"""
 
@@ -0,0 +1,57 @@
+import unittest
+import numpy as np
+import numpy.testing as nptest
+
+import pytpc
+from pytpc.geometry import get_geometry
+from pytpc.evtdata import calibrate
+from pytpc.utilities import rot_matrix, tilt_matrix
+
+
+class TestGeometry(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.RandomState(4)
+        self.data = rng.uniform(-100, 500, size=(50, 5))
+        self.rot = -108 * np.pi / 180
+        self.tilt = 6 * np.pi / 180
+
+    def test_cache(self):
+        vd = np.array([0.1, -0.2, -5.2])
+        geom = get_geometry(self.rot, self.tilt, vd, 12.5)
+        self.assertIs(get_geometry(self.rot, self.tilt, vd.copy(), 12.5), geom)
+        self.assertIsNot(get_geometry(self.rot, self.tilt, vd * 2, 12.5), geom)
+        self.assertIs(get_geometry(), get_geometry(0, 0))
+
+    def test_arrays(self):
+        geom = get_geometry(self.rot, self.tilt)
+        pads = pytpc.generate_pad_plane(self.rot)
+        nptest.assert_equal(geom.pads, pads)
+        nptest.assert_equal(geom.pad_centers, pads.mean(1))
+        nptest.assert_equal(geom.padrotmat, rot_matrix(self.rot))
+        nptest.assert_equal(geom.untilt_mat, tilt_matrix(self.tilt))
+        nptest.assert_equal(geom.tilt_mat, tilt_matrix(-self.tilt))
+        self.assertFalse(geom.pad_centers.flags.writeable)
+
+    def test_calibrate(self):
+        for vd in (5.2, np.array([0.1, -0.2, -5.2])):
+            geom = get_geometry(drift_vel=vd, clock=12.5)
+            nptest.assert_allclose(geom.calibrate(self.data), calibrate(self.data, vd, 12.5))
+
+        self.assertRaises(ValueError, get_geometry().calibrate, self.data)
+
+    def test_xyzs(self):
+        evt = pytpc.Event()
+        evt.traces = np.zeros(20, dtype=evt.dt)
+        evt.traces['pad'] = np.arange(20) * 500
+        evt.traces['data'][:, 100] = np.arange(20) + 10
+
+        vd = np.array([0.1, -0.2, -5.2])
+        pads = pytpc.generate_pad_plane(self.rot)
+        geom = get_geometry(self.rot, drift_vel=vd, clock=12.5)
+
+        exp = evt.xyzs(pads=pads, peaks_only=True, return_pads=True, drift_vel=vd, clock=12.5)
+        res = evt.xyzs(geometry=geom, peaks_only=True, return_pads=True)
+        nptest.assert_allclose(res, exp)
+
+        nptest.assert_equal(evt.xyzs(peaks_only=True), evt.xyzs(pads=pytpc.generate_pad_plane(), peaks_only=True))
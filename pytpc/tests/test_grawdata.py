@@ -1,8 +1,10 @@
 import unittest
+from types import SimpleNamespace
 import numpy as np
 import numpy.testing as nptest
 
 import pytpc.grawdata
+import pytpc.unpack
 
 class TestDataUnpacking(unittest.TestCase):
 
@@ -14,3 +16,127 @@ class TestDataUnpacking(unittest.TestCase):
         self.assertEqual(ch, 67, msg='invalid channel')  # This is intentional since this is the width of 7 bits
         self.assertEqual(tb, 511, msg='invalid tb')
         self.assertEqual(samp, 4095, msg='invalid sample')
+
+
+def reference_partial_readout(raw, cobo, asad):
+    agets, channels, tbs, samples = pytpc.grawdata.GRAWFile._unpack_data_partial_readout(raw)
+    pairs = sorted(set(zip(agets, channels)))
+    res = np.zeros(len(pairs), dtype=pytpc.unpack.trace_dtype)
+    for i, (aget, ch) in enumerate(pairs):
+        idx = np.where(np.logical_and(agets == aget, channels == ch))
+        res['cobo'][i] = cobo
+        res['asad'][i] = asad
+        res['aget'][i] = aget
+        res['channel'][i] = ch
+        res['data'][i, tbs[idx]] = samples[idx]
+    return res
+
+
+class TestNativeDecoding(unittest.TestCase):
+
+    def setUp(self):
+        self.rng = np.random.RandomState(5)
+
+    def test_partial_readout(self):
+        num = 5000
+        agets = self.rng.randint(0, 4, num).astype('u4')
+        channels = self.rng.randint(0, 68, num).astype('u4')
+        tbs = self.rng.randint(0, 512, num).astype('u4')
+        samples = self.rng.randint(0, 4096, num).astype('u4')
+        raw = ((agets << 30) | (channels << 23) | (tbs << 14) | samples).astype('>u4')
+
+        res, min_ch, max_ch = pytpc.unpack.decode_graw_partial_readout(raw.tobytes(), num, 3, 2)
+        nptest.assert_equal(res, reference_partial_readout(raw, 3, 2))
+        self.assertEqual(min_ch, channels.min())
+        self.assertEqual(max_ch, channels.max())
+
+    def test_full_readout(self):
+        samples = self.rng.randint(0, 4096, (2, 512, 68)).astype('u2')
+        raw = np.concatenate([(np.uint16(aget) << 14) | samples[i].ravel() for i, aget in enumerate((0, 2))])
+        raw = raw.astype('>u2')
+
+        res = pytpc.unpack.decode_graw_full_readout(raw.tobytes(), len(raw), 3, 2)
+        self.assertEqual(len(res), 4 * 68)
+        nptest.assert_equal(res['data'][0:68], samples[0].T)
+        nptest.assert_equal(res['data'][136:204], samples[1].T)
+        nptest.assert_equal(res['data'][68:136], 0)
+        nptest.assert_equal(res['channel'][136:204], np.arange(68))
+        nptest.assert_equal(res['aget'][136:204], 2)
+
+    def test_full_readout_incomplete(self):
+        raw = np.zeros(100, dtype='>u2')
+        self.assertRaises(ValueError, pytpc.unpack.decode_graw_full_readout, raw.tobytes(), len(raw), 0, 0)
+
+    def test_index_graw_file(self):
+        sizes = [2, 1, 3, 2]
+        evtids = [7, 7, 8, 100000]
+        frames = []
+        for size, evtid in zip(sizes, evtids):
+            frame = bytearray(size * 256)
+            frame[0] = 8
+            frame[1:4] = size.to_bytes(3, 'big')
+            frame[22:26] = evtid.to_bytes(4, 'big')
+            frames.append(bytes(frame))
+        buf = b''.join(frames)
+
+        offsets, res_evtids = pytpc.unpack.index_graw_file(buf)
+        nptest.assert_equal(offsets, np.cumsum([0] + sizes[:-1]) * 256)
+        nptest.assert_equal(res_evtids, evtids)
+
+        offsets, res_evtids = pytpc.unpack.index_graw_file(buf, max_len=2)
+        nptest.assert_equal(res_evtids, evtids[:2])
+
+        self.assertRaises(ValueError, pytpc.unpack.index_graw_file, buf[:-10])
+
+
+class FakeGRAWFile(object):
+    """Stands in for a GRAWFile, with one frame per entry in `evtids`. Each frame's data is its index."""
+
+    def __init__(self, name, evtids, fail_at=None):
+        self.fp = SimpleNamespace(name=name)
+        self.evtids = np.array(evtids)
+        self.fail_at = fail_at
+
+    def __getitem__(self, i):
+        if i == self.fail_at:
+            raise IOError('Read failed')
+        frame = np.zeros(1, dtype=pytpc.unpack.trace_dtype)
+        frame['data'] = i
+        frame['asad'] = self.evtids[i]
+        return frame
+
+
+class FakeHDFFile(object):
+    def __init__(self):
+        self.evts = []
+
+    def write_get_event(self, evt):
+        self.evts.append(evt)
+
+
+class TestMergeFiles(unittest.TestCase):
+
+    def setUp(self):
+        self.files = [FakeGRAWFile('a', [1, 1, 2, 4]), FakeGRAWFile('b', [2, 1, 3, 4]), FakeGRAWFile('c', [])]
+
+    def test_merge(self):
+        hfile = FakeHDFFile()
+        num = pytpc.grawdata.merge_files(self.files, hfile, max_queued=1)
+        self.assertEqual(num, 4)
+        self.assertEqual([e.evt_id for e in hfile.evts], [1, 2, 3, 4])
+        for evt in hfile.evts:
+            nptest.assert_equal(evt.traces['asad'], evt.evt_id)
+        nptest.assert_equal(hfile.evts[0].traces['data'][:, 0], [0, 1, 1])
+        nptest.assert_equal(hfile.evts[1].traces['data'][:, 0], [2, 0])
+
+    def test_selected_evtids(self):
+        hfile = FakeHDFFile()
+        num = pytpc.grawdata.merge_files(self.files, hfile, evtids=[4, 5, 2])
+        self.assertEqual(num, 2)
+        self.assertEqual([e.evt_id for e in hfile.evts], [4, 2])
+
+    def test_read_error(self):
+        self.files[1].fail_at = 2
+        hfile = FakeHDFFile()
+        self.assertRaises(IOError, pytpc.grawdata.merge_files, self.files, hfile, max_queued=1)
+        self.assertEqual([e.evt_id for e in hfile.evts], [1, 2])
@@ -128,3 +128,143 @@ class TestContextManager(unittest.TestCase):
                 hfile.write_get_event(self.evt)
 
             self.assertRaises(Exception, hfile.read_get_event, self.evt.evt_id)
+
+
+class TestStackedLayout(unittest.TestCase):
+
+    def setUp(self):
+        _, _, traces = make_test_data()
+        self.evts = []
+        for i, num_traces in enumerate([10, 64, 0, 33, 5, 64, 1]):
+            evt = Event(100 + 2 * i, 1000 * i)
+            evt.traces = traces[:num_traces]
+            self.evts.append(evt)
+
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.filename = os.path.join(self.tmpdir.name, 'test.h5')
+        with hdfdata.HDFDataFile(self.filename, 'w', layout='stacked', compression='lzf', chunk_rows=50) as hfile:
+            for evt in self.evts:
+                hfile.write_get_event(evt)
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def assertEventsEqual(self, a, b):
+        self.assertEqual(a.evt_id, b.evt_id)
+        self.assertEqual(a.timestamp, b.timestamp)
+        nptest.assert_equal(a.traces, b.traces)
+
+    def test_layout(self):
+        with h5py.File(self.filename, 'r') as h5file:
+            gp = h5file['/get']
+            self.assertEqual(gp['traces'].shape, (sum(len(e.traces) for e in self.evts), 517))
+            self.assertEqual(gp['traces'].compression, 'lzf')
+            nptest.assert_equal(gp['offsets'][:], np.cumsum([0] + [len(e.traces) for e in self.evts]))
+            nptest.assert_equal(gp['evt_id'][:], [e.evt_id for e in self.evts])
+            nptest.assert_equal(gp['timestamp'][:], [e.timestamp for e in self.evts])
+
+    def test_read_get_event(self):
+        with hdfdata.HDFDataFile(self.filename, 'r') as hfile:
+            self.assertEqual(hfile.layout, 'stacked')
+            self.assertEqual(len(hfile), len(self.evts))
+            self.assertEqual(list(hfile.evtids()), [e.evt_id for e in self.evts])
+            for evt in self.evts:
+                self.assertEventsEqual(hfile[evt.evt_id], evt)
+            self.assertRaises(KeyError, hfile.read_get_event, 101)
+
+    def test_read_get_events(self):
+        with hdfdata.HDFDataFile(self.filename, 'r') as hfile:
+            for start, stop in [(0, 7), (2, 5), (6, 10), (4, 4), (-3, None)]:
+                res = hfile.read_get_events(start, stop)
+                exp = self.evts[start:stop]
+                self.assertEqual(len(res), len(exp))
+                for a, b in zip(res, exp):
+                    self.assertEventsEqual(a, b)
+
+    def test_iter(self):
+        with hdfdata.HDFDataFile(self.filename, 'r') as hfile:
+            hfile.iter_batch_size = 3
+            res = list(hfile)
+        self.assertEqual(len(res), len(self.evts))
+        for a, b in zip(res, self.evts):
+            self.assertEventsEqual(a, b)
+
+    def test_append(self):
+        evt = Event(1, 2)
+        evt.traces = self.evts[1].traces
+        with hdfdata.HDFDataFile(self.filename, 'a') as hfile:
+            self.assertRaises(RuntimeError, hfile.write_get_event, self.evts[0])
+            hfile.write_get_event(evt)
+            self.assertEqual(len(hfile), len(self.evts) + 1)
+            self.assertEventsEqual(hfile[1], evt)
+
+        with hdfdata.HDFDataFile(self.filename, 'r') as hfile:
+            self.assertEventsEqual(hfile.read_get_events(-1, None)[0], evt)
+
+    def test_layout_mismatch(self):
+        self.assertRaises(ValueError, hdfdata.HDFDataFile, self.filename, 'r', layout='per_event')
+
+    def test_per_event_read_get_events(self):
+        filename = os.path.join(self.tmpdir.name, 'per_event.h5')
+        with hdfdata.HDFDataFile(filename, 'w') as hfile:
+            for evt in reversed(self.evts):
+                hfile.write_get_event(evt)
+
+        with hdfdata.HDFDataFile(filename, 'r') as hfile:
+            self.assertEqual(hfile.layout, 'per_event')
+            for a, b in zip(hfile.read_get_events(1, 4), self.evts[1:4]):
+                self.assertEventsEqual(a, b)
+
+
+class TestCanonicalEvtids(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.RandomState(11)
+        _, _, traces = make_test_data()
+
+        self.stored = {}
+        for n in range(8):
+            evt = Event(n, 0)
+            evt.traces = traces.copy()
+            evt.traces['cobo'] = np.sort(rng.randint(0, 4, len(traces)))
+            evt.traces['data'] += n
+            if n == 5:
+                rng.shuffle(evt.traces)  # Not sorted by CoBo
+            self.stored[n] = evt
+
+        # CoBo 2 dropped a trigger at canonical event 3, and CoBo 3 dropped one at event 5
+        self.table = np.array([[n, n, n if n < 3 else n + 1, n if n < 5 else n + 1] for n in range(7)])
+
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.canon_path = os.path.join(self.tmpdir.name, 'canon.h5')
+        with h5py.File(self.canon_path, 'w') as hf:
+            hf['canonical_evtids'] = self.table
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def expected_traces(self, i):
+        chunks = []
+        for cobo_id, n in enumerate(self.table[i]):
+            t = self.stored[n].traces
+            chunks.append(t[t['cobo'] == cobo_id])
+        return np.concatenate(chunks)
+
+    def check_file(self, layout):
+        filename = os.path.join(self.tmpdir.name, layout + '.h5')
+        with hdfdata.HDFDataFile(filename, 'w', layout=layout) as hfile:
+            for evt in self.stored.values():
+                hfile.write_get_event(evt)
+
+        with hdfdata.HDFDataFile(filename, 'r', canonical_evtid_path=self.canon_path) as hfile:
+            hfile.canonical_cache_size = 1
+            for i in list(range(len(self.table))) + [4, 3]:
+                evt = hfile.read_get_event(i)
+                self.assertEqual(evt.evt_id, i)
+                nptest.assert_equal(evt.traces, self.expected_traces(i))
+
+    def test_per_event(self):
+        self.check_file('per_event')
+
+    def test_stacked(self):
+        self.check_file('stacked')
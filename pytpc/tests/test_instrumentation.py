@@ -0,0 +1,84 @@
+import unittest
+
+from pytpc.instrumentation import StageTimer
+
+
+class TestStageTimer(unittest.TestCase):
+
+    def test_disabled(self):
+        timer = StageTimer()
+        with timer.stage('a', 10):
+            pass
+        timer.add_time('b', 1.0)
+        timer.count('c')
+        self.assertEqual(len(timer.stages), 0)
+        self.assertEqual(len(timer.counters), 0)
+        self.assertEqual(timer.records(), [])
+
+    def test_stage(self):
+        timer = StageTimer(enabled=True)
+        for i in range(3):
+            with timer.stage('a', 10):
+                pass
+        stats = timer.stages['a']
+        self.assertEqual(stats.calls, 3)
+        self.assertEqual(stats.num_points, 30)
+        self.assertGreaterEqual(stats.wall_time, 0)
+        self.assertGreaterEqual(stats.cpu_time, 0)
+
+    def test_stage_with_exception(self):
+        timer = StageTimer(enabled=True)
+        with self.assertRaises(ValueError):
+            with timer.stage('a'):
+                raise ValueError()
+        self.assertEqual(timer.stages['a'].calls, 1)
+
+    def test_count(self):
+        timer = StageTimer(enabled=True)
+        timer.count('events')
+        timer.count('events')
+        timer.count('tracks', 500)
+        self.assertEqual(timer.counters['events'], 2)
+        self.assertEqual(timer.counters['tracks'], 500)
+
+    def test_merge(self):
+        a = StageTimer(enabled=True)
+        a.add_time('x', 1.0, 0.5, num_points=3)
+        a.count('events', 2)
+
+        b = StageTimer(enabled=True)
+        b.add_time('x', 2.0, 1.0, num_points=4)
+        b.add_time('y', 1.0)
+        b.count('events', 3)
+
+        total = StageTimer()
+        total.merge(a)
+        total.merge(b.as_dict())
+
+        self.assertEqual(total.stages['x'].calls, 2)
+        self.assertAlmostEqual(total.stages['x'].wall_time, 3.0)
+        self.assertAlmostEqual(total.stages['x'].cpu_time, 1.5)
+        self.assertEqual(total.stages['x'].num_points, 7)
+        self.assertEqual(total.stages['y'].calls, 1)
+        self.assertEqual(total.counters['events'], 5)
+
+    def test_records(self):
+        timer = StageTimer(enabled=True)
+        timer.add_time('x', 1.0, num_points=3)
+        timer.count('events', 2)
+        recs = timer.records()
+        self.assertEqual(len(recs), 2)
+        self.assertEqual(recs[0]['name'], 'x')
+        self.assertEqual(recs[0]['calls'], 1)
+        self.assertIsNone(recs[0]['value'])
+        self.assertEqual(recs[1]['name'], 'events')
+        self.assertEqual(recs[1]['value'], 2)
+        self.assertIsNone(recs[1]['wall_time'])
+
+    def test_reset(self):
+        timer = StageTimer(enabled=True)
+        timer.add_time('x', 1.0)
+        timer.count('events')
+        timer.reset()
+        self.assertEqual(len(timer.stages), 0)
+        self.assertEqual(len(timer.counters), 0)
@@ -0,0 +1,234 @@
+import unittest
+import numpy as np
+import numpy.testing as nptest
+import pandas as pd
+
+from pytpc.gases import InterpolatedGas
+from pytpc.fitting import MCFitter, PadPlane, EventGenerator, Tracker
+from pytpc.fitting.mcopt_wrapper import Minimizer
+from pytpc.instrumentation import StageTimer
+
+params0 = np.array([0.0, 0.0, 0.5, 2.0, 0.0, 1.5])
+sigma = np.array([0.01, 0.01, 0.01, 0.5, 0.1, 0.1])
+
+
+def make_minimizer(num_iters=5, num_pts=40, num_threads=2):
+    gas = InterpolatedGas('helium', 200)
+    tracker = Tracker(4, 2, 2.0, 4, 2, gas, np.array([0., 0., 9e3]), np.array([0., 0., 1.75]), 20)
+
+    # A coarse lookup table with 1 cm square pads
+    ys, xs = np.mgrid[0:560, 0:560]
+    lut = np.asfortranarray((ys // 10) * 56 + xs // 10, dtype='uint16')
+    pads = PadPlane(lut, -0.280, 0.001, -0.280, 0.001)
+    evtgen = EventGenerator(pads, np.array([0., 0., -5.2]), 12.5, 280e-9, 4, 23.0, 500, 120e-15, 0, 0)
+
+    return Minimizer(tracker, evtgen, num_iters, num_pts, 0.8, num_threads), tracker
+
+
+def make_event(tracker, params, rng):
+    """Make an event from a track, as a DataFrame like the one used by MCFitter. The pads are repeated and out of
+    order, so the order the hit pattern is built in matters."""
+    track = tracker.track_particle(*params)
+    pos = track[::max(1, len(track) // 80), :3] * 1000
+    pads = rng.randint(0, 200, len(pos))
+    amps = rng.uniform(10, 1000, len(pos))
+    return pd.DataFrame({'u': pos[:, 0], 'v': pos[:, 1], 'w': pos[:, 2], 'a': amps, 'pad': pads}).sample(
+        frac=1, random_state=rng)
+
+
+def hit_pattern(xyz):
+    """The hit pattern as built in MCFitter.process_event."""
+    exp_hits = np.zeros(10240)
+    exp_hits[xyz['pad'].values.astype('int')] = xyz['a'].values
+    return exp_hits
+
+
+def find_center(xyz):
+    """Find the center of curvature with an algebraic circle fit."""
+    u, v = xyz['u'].values, xyz['v'].values
+    (a, b, _), *_ = np.linalg.lstsq(np.column_stack((u, v, np.ones_like(u))), u**2 + v**2, rcond=None)
+    return a / 2, b / 2
+
+
+class FakeFitter(MCFitter):
+    """An MCFitter with just enough set up to call process_event and process_events."""
+    def __init__(self, minimizer):
+        self.minimizer = minimizer
+        self.sigma = sigma
+        self.timer = StageTimer(enabled=False)
+        self.mass_num = 4
+        self.charge_num = 2
+        self._bfield = np.array([0., 0., 1.75])
+
+
+class TestMinimizeBatch(unittest.TestCase):
+    def setUp(self):
+        self.minimizer, self.tracker = make_minimizer()
+        rng = np.random.RandomState(4)
+        self.events = [make_event(self.tracker, params0 + [0, 0, dz, den, 0, 0], rng)
+                       for dz, den in ((0, 0), (0.1, 0.5), (-0.1, -0.3))]
+
+    def pack(self, events):
+        exp_pos = np.concatenate([e[['u', 'v', 'w']].values / 1000 for e in events])
+        pads = np.concatenate([e['pad'].values for e in events]).astype('int64')
+        amps = np.concatenate([e['a'].values for e in events]).astype('float64')
+        offsets = np.cumsum([0] + [len(e) for e in events])
+        ctr0s = np.tile(params0, (len(events), 1))
+        return ctr0s, exp_pos, pads, amps, offsets
+
+    def test_same_hit_pattern(self):
+        ctr0s, exp_pos, pads, amps, offsets = self.pack(self.events)
+        res = self.minimizer.minimize_batch(ctr0s, sigma, exp_pos, pads, amps, offsets)
+        self.assertEqual(res.shape, (len(self.events), len(params0) + 5))
+        nptest.assert_equal(res[:, -1], 1)
+
+        # The chi2 of the result should be what the single-event functions find with process_event's hit pattern
+        for evt, row in zip(self.events, res):
+            pos_chi, en_chi = self.minimizer.run_track(row[:6].copy(), evt[['u', 'v', 'w']].values / 1000,
+                                                       hit_pattern(evt))
+            self.assertAlmostEqual(pos_chi, row[6])
+            self.assertAlmostEqual(en_chi, row[7])
+
+    def test_bad_offsets(self):
+        ctr0s, exp_pos, pads, amps, offsets = self.pack(self.events)
+        bad_offsets = [
+            offsets[:-1],  # Too short
+            offsets + 1,  # Doesn't start at 0
+            np.append(offsets[:-1], len(exp_pos) - 1),  # Doesn't end at the number of points
+            offsets[[0, 2, 1, 3]],  # Decreasing
+        ]
+        for bad in bad_offsets:
+            with self.assertRaises(ValueError):
+                self.minimizer.minimize_batch(ctr0s, sigma, exp_pos, pads, amps, bad)
+
+        with self.assertRaises(ValueError):
+            self.minimizer.minimize_batch(ctr0s, sigma, exp_pos, pads[:-1], amps, offsets)
+
+        bad_pads = pads.copy()
+        bad_pads[0] = 10240
+        with self.assertRaises(ValueError):
+            self.minimizer.minimize_batch(ctr0s, sigma, exp_pos, bad_pads, amps, offsets)
+
+    def test_failed_event(self):
+        ctr0s, exp_pos, pads, amps, offsets = self.pack(self.events)
+
+        # The middle event has no points, so it fails without affecting the others
+        ctr0s = np.insert(ctr0s, 1, params0, axis=0)
+        offsets = np.insert(offsets, 1, offsets[1])
+
+        res = self.minimizer.minimize_batch(ctr0s, sigma, exp_pos, pads, amps, offsets)
+        nptest.assert_equal(res[:, -1], [1, 0, 1, 1])
+        self.assertTrue(np.all(np.isnan(res[1, :9])))
+        self.assertFalse(np.any(np.isnan(res[[0, 2, 3]])))
+
+
+class TestProcessEvents(unittest.TestCase):
+    def setUp(self):
+        minimizer, tracker = make_minimizer()
+        self.fitter = FakeFitter(minimizer)
+        rng = np.random.RandomState(5)
+        self.events = []
+        for dz in (0, 0.1):
+            xyz = make_event(tracker, params0 + [0, 0, dz, 0, 0, 0], rng)
+            self.events.append((xyz,) + find_center(xyz))
+
+    def test_same_as_process_event(self):
+        results = self.fitter.process_events(self.events)
+        self.assertEqual(len(results), len(self.events))
+
+        for (xyz, cu, cv), res in zip(self.events, results):
+            exp = self.fitter.process_event(xyz, cu, cv)
+            self.assertEqual(res.keys(), exp.keys())
+            for key in ('lin_scat_ang', 'lin_beam_int', 'curv_en'):
+                self.assertEqual(res[key], exp[key])
+
+            # The minimizer is random, but the chi2 should match the hit pattern that process_event would use
+            params = np.array([res[k] for k in ('x0', 'y0', 'z0', 'enu0', 'azi0', 'pol0')])
+            uvw = xyz[['u', 'v', 'w']].values
+            pos_chi, en_chi = self.fitter.minimizer.run_track(params, uvw[np.argsort(uvw[:, 2])] / 1000,
+                                                              hit_pattern(xyz))
+            self.assertAlmostEqual(pos_chi, res['posChi2'])
+            self.assertAlmostEqual(en_chi, res['enChi2'])
+
+
+class TestEarlyStopping(unittest.TestCase):
+    def setUp(self):
+        self.num_iters = 10
+        self.num_pts = 40
+        self.minimizer, self.tracker = make_minimizer(self.num_iters, self.num_pts, num_threads=1)
+        xyz = make_event(self.tracker, params0, np.random.RandomState(6))
+        self.exp_pos = xyz[['u', 'v', 'w']].values / 1000
+        self.exp_hits = hit_pattern(xyz)
+
+    def minimize(self):
+        stats = {}
+        ctr, min_chis, all_params, good_param_idx = self.minimizer.minimize(
+            params0.copy(), sigma, self.exp_pos, self.exp_hits, details=True, stats=stats)
+
+        # The results should only have rows for what was run, and the best rows should match the chi2 values
+        num_iters = len(min_chis)
+        self.assertEqual(min_chis.shape, (num_iters, 3))
+        self.assertEqual(all_params.shape, (stats['tracks_evaluated'], len(params0) + 3))
+        self.assertEqual(len(good_param_idx), num_iters)
+        self.assertEqual(stats['iterations'], num_iters)
+        nptest.assert_equal(all_params[good_param_idx.astype('int'), len(params0):], min_chis)
+        nptest.assert_equal(all_params[int(good_param_idx[-1]), :len(params0)], ctr)
+
+        return min_chis, all_params, stats
+
+    def test_no_stopping(self):
+        self.minimizer.param_mins = np.full(6, -np.inf)  # This uses the native loop without stopping rules
+        min_chis, all_params, stats = self.minimize()
+        self.assertEqual(len(min_chis), self.num_iters)
+        self.assertEqual(len(all_params), self.num_iters * self.num_pts)
+        self.assertEqual(stats['converged'], 0)
+
+    def test_stall(self):
+        # With a huge tolerance, every iteration after the first stalls
+        self.minimizer.chi2_tolerance = 1e10
+        self.minimizer.stall_iters = 2
+        min_chis, all_params, stats = self.minimize()
+        self.assertEqual(len(min_chis), 3)
+        self.assertEqual(len(all_params), 3 * self.num_pts)
+        self.assertEqual(stats['converged'], 1)
+
+        self.minimizer.stall_iters = 1
+        self.minimizer.min_iters = 5
+        min_chis, _, _ = self.minimize()
+        self.assertEqual(len(min_chis), 5)
+
+    def test_spread(self):
+        self.minimizer.spread_tolerance = 1e10
+        self.minimizer.min_iters = 2
+        min_chis, all_params, stats = self.minimize()
+        self.assertEqual(len(min_chis), 2)
+        self.assertEqual(len(all_params), 2 * self.num_pts)
+        self.assertEqual(stats['converged'], 1)
+
+        self.minimizer.spread_tolerance = 1e-20
+        min_chis, _, stats = self.minimize()
+        self.assertEqual(len(min_chis), self.num_iters)
+        self.assertEqual(stats['converged'], 0)
+
+    def test_min_pts(self):
+        self.minimizer.min_pts = 10
+        min_chis, all_params, stats = self.minimize()
+        self.assertEqual(len(min_chis), self.num_iters)
+        self.assertEqual(stats['converged'], 0)
+
+        # The first iteration always improves, so the second one uses half as many points
+        self.assertLess(len(all_params), self.num_iters * self.num_pts)
+        self.assertGreaterEqual(len(all_params), self.num_pts + (self.num_iters - 1) * 10)
+
+    def test_num_iters_used(self):
+        fitter = FakeFitter(self.minimizer)
+        self.minimizer.chi2_tolerance = 1e10
+        self.minimizer.stall_iters = 2
+        xyz = make_event(self.tracker, params0, np.random.RandomState(7))
+        res, min_chis, all_params, good_param_idx = fitter.process_event(xyz, *find_center(xyz), return_details=True)
+        self.assertEqual(res['num_iters_used'], len(min_chis))
+        self.assertEqual(res['num_iters_used'], 3)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,88 @@
+import unittest
+import os
+import tempfile
+import numpy as np
+import numpy.testing as nptest
+
+from pytpc.fitting import PadPlane, TiledPadPlane
+
+
+class TestTiledPadPlane(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.RandomState(0)
+        self.lut = rng.randint(0, 10240, size=(150, 100)).astype('uint16')
+        self.bounds = (-0.05, 0.001, -0.075, 0.001)
+
+        # Points near the centers of the cells, so that rounding is not an issue
+        rows, cols = np.meshgrid(np.arange(self.lut.shape[0]), np.arange(self.lut.shape[1]), indexing='ij')
+        self.rows = rows.ravel()
+        self.cols = cols.ravel()
+        offsets = rng.uniform(-0.3, 0.3, size=(len(self.rows), 2)) * 0.001
+        self.xy = np.column_stack((self.bounds[0] + self.cols * self.bounds[1],
+                                   self.bounds[2] + self.rows * self.bounds[3])) + offsets
+
+    def test_same_as_padplane(self):
+        padplane = PadPlane(self.lut, *self.bounds)
+        tiled = TiledPadPlane(self.lut, *self.bounds, tileSize=16)
+        for x, y in self.xy[::37]:
+            self.assertEqual(tiled.get_pad_number_from_coordinates(x, y),
+                             padplane.get_pad_number_from_coordinates(x, y))
+
+    def test_batch(self):
+        tiled = TiledPadPlane(self.lut, *self.bounds)
+        pads = tiled.get_pad_numbers(self.xy)
+        nptest.assert_equal(pads, self.lut[self.rows, self.cols])
+
+    def test_batch_float32(self):
+        tiled = TiledPadPlane(self.lut, *self.bounds)
+        xy32 = self.xy.astype('float32')
+        nptest.assert_equal(tiled.get_pad_numbers(xy32), tiled.get_pad_numbers(xy32.astype('float64')))
+
+    def test_batch_out_of_range(self):
+        tiled = TiledPadPlane(self.lut, *self.bounds)
+        xy = np.array([[1.0, 0.0], [0.0, -1.0], [np.nan, 0.0], [self.bounds[0], self.bounds[2]]])
+        pads = tiled.get_pad_numbers(xy, invalid=20000)
+        nptest.assert_equal(pads, [20000, 20000, 20000, self.lut[0, 0]])
+
+    def test_out_of_range(self):
+        tiled = TiledPadPlane(self.lut, *self.bounds)
+        with self.assertRaises(IndexError):
+            tiled.get_pad_number_from_coordinates(1.0, 0.0)
+
+    def test_rotation(self):
+        angle = 0.3
+        tiled = TiledPadPlane(self.lut, *self.bounds, rotAngle=angle)
+        c, s = np.cos(angle), np.sin(angle)
+        rotated = self.xy @ np.array([[c, s], [-s, c]])  # Rotate by +angle, which the lookup undoes
+        nptest.assert_equal(tiled.get_pad_numbers(rotated), self.lut[self.rows, self.cols])
+
+    def test_to_array(self):
+        tiled = TiledPadPlane(self.lut, *self.bounds, tileSize=64)
+        nptest.assert_equal(tiled.to_array(), self.lut)
+
+    def test_bad_tile_size(self):
+        with self.assertRaises(ValueError):
+            TiledPadPlane(self.lut, *self.bounds, tileSize=24)
+
+    def test_save_and_map(self):
+        tiled = TiledPadPlane(self.lut, *self.bounds)
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'lut.tiled')
+            tiled.save(path)
+            mapped = TiledPadPlane.from_file(path)
+
+            self.assertTrue(mapped.is_mapped)
+            self.assertFalse(tiled.is_mapped)
+            self.assertEqual(mapped.tile_size, tiled.tile_size)
+            nptest.assert_allclose(mapped.bounds, self.bounds)
+            nptest.assert_equal(mapped.get_pad_numbers(self.xy), self.lut[self.rows, self.cols])
+            del mapped
+
+    def test_map_bad_file(self):
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'lut.tiled')
+            with open(path, 'wb') as f:
+                f.write(b'x' * 100)
+            with self.assertRaises(RuntimeError):
+                TiledPadPlane.from_file(path)
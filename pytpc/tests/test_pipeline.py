@@ -0,0 +1,71 @@
+import unittest
+import threading
+import time
+
+from pytpc.pipeline import PrefetchingReader, AsyncWriter
+
+
+class TestPrefetchingReader(unittest.TestCase):
+
+    def test_order(self):
+        def read(i):
+            time.sleep(0.001 * (i % 3))
+            return i * 2
+
+        res = list(PrefetchingReader(read, range(50), depth=5, num_threads=4))
+        self.assertEqual(res, [(i, i * 2, None) for i in range(50)])
+
+    def test_errors(self):
+        def read(i):
+            if i == 3:
+                raise KeyError(i)
+            return i
+
+        res = list(PrefetchingReader(read, range(5)))
+        self.assertEqual([k for k, _, _ in res], list(range(5)))
+        self.assertIsInstance(res[3][2], KeyError)
+        self.assertIsNone(res[3][1])
+        self.assertTrue(all(err is None for k, _, err in res if k != 3))
+
+    def test_depth(self):
+        lock = threading.Lock()
+        started = []
+
+        def read(i):
+            with lock:
+                started.append(i)
+            return i
+
+        reader = iter(PrefetchingReader(read, range(100), depth=4, num_threads=2))
+        for i in range(10):
+            next(reader)
+            time.sleep(0.01)
+            with lock:
+                self.assertLessEqual(len(started), i + 1 + 4)
+        reader.close()
+
+    def test_invalid_depth(self):
+        self.assertRaises(ValueError, PrefetchingReader, lambda i: i, range(5), depth=0)
+
+
+class TestAsyncWriter(unittest.TestCase):
+
+    def test_order(self):
+        written = []
+        with AsyncWriter(lambda a, b: written.append((a, b)), max_queued=2) as writer:
+            for i in range(20):
+                writer.put(i, -i)
+        self.assertEqual(written, [(i, -i) for i in range(20)])
+
+    def test_error(self):
+        def write(i):
+            if i == 2:
+                raise IOError('Write failed')
+
+        writer = AsyncWriter(write)
+        for i in range(3):
+            writer.put(i)
+        with self.assertRaises(RuntimeError) as cm:
+            writer.close()
+        self.assertIsInstance(cm.exception.__cause__, IOError)
+        self.assertRaises(RuntimeError, writer.put, 4)
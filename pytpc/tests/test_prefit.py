@@ -0,0 +1,68 @@
+import unittest
+import numpy as np
+import numpy.testing as nptest
+import pandas as pd
+
+from pytpc.fitting.mixins import LinearPrefitMixin
+from pytpc.fitting.mcopt_wrapper import linear_prefit
+
+
+class Prefitter(LinearPrefitMixin):
+    bfield_mag = 1.75
+    mass_num = 4
+    charge_num = 2
+
+
+def make_arc(rng, cx, cy, dtheta, num_pts=80):
+    """Make points along an arc around (cx, cy), sorted by w."""
+    ws = np.sort(rng.uniform(400, 1000, num_pts))
+    thetas = rng.uniform(0, 2 * np.pi) + dtheta * (ws - 400) / 600
+    rads = 150 * (1 - 0.1 * (ws - 400) / 600)
+    us = cx + rads * np.cos(thetas) + rng.normal(0, 1, num_pts)
+    vs = cy + rads * np.sin(thetas) + rng.normal(0, 1, num_pts)
+    return pd.DataFrame({'u': us, 'v': vs, 'w': ws})
+
+
+class TestLinearPrefit(unittest.TestCase):
+
+    def setUp(self):
+        self.rng = np.random.RandomState(0)
+        self.prefitter = Prefitter()
+
+    def test_same_as_odr(self):
+        for dtheta in (-4.5, -1, 0.7, 3, 5.5):
+            cx, cy = self.rng.uniform(-50, 50, 2)
+            xyz = make_arc(self.rng, cx, cy, dtheta)
+
+            res = self.prefitter.linear_prefit(xyz, cx, cy)
+            exp = self.prefitter.linear_prefit_odr(xyz.copy(), cx, cy)
+
+            self.assertEqual(res.keys(), exp.keys())
+            for key in exp:
+                self.assertAlmostEqual(res[key], exp[key], delta=1e-5 * max(abs(exp[key]), 1), msg=key)
+
+    def test_guess(self):
+        cx, cy = 10, -20
+        xyz = make_arc(self.rng, cx, cy, 2)
+        res, params = self.prefitter.linear_prefit_with_guess(xyz, cx, cy)
+        nptest.assert_allclose(params, self.prefitter.guess_parameters(res))
+
+    def test_layouts(self):
+        xyz = make_arc(self.rng, 5, 5, 2)
+        uvw = np.column_stack((xyz.values, np.ones(len(xyz))))
+        res_c, _ = linear_prefit(np.ascontiguousarray(uvw), 5, 5, 1.75, 4, 2)
+        res_f, _ = linear_prefit(np.asfortranarray(uvw), 5, 5, 1.75, 4, 2)
+        res_view, _ = linear_prefit(np.ascontiguousarray(uvw)[:, :3], 5, 5, 1.75, 4, 2)
+        self.assertEqual(res_c, res_f)
+        self.assertEqual(res_c, res_view)
+
+    def test_data_not_modified(self):
+        xyz = make_arc(self.rng, 0, 0, 1)
+        self.prefitter.linear_prefit(xyz, 0, 0)
+        self.assertEqual(list(xyz.columns), ['u', 'v', 'w'])
+
+    def test_too_few_points(self):
+        with self.assertRaises(RuntimeError):
+            linear_prefit(np.zeros((1, 3)), 0, 0, 1.75, 4, 2)
+        with self.assertRaises(ValueError):
+            linear_prefit(np.zeros((5, 2)), 0, 0, 1.75, 4, 2)
@@ -0,0 +1,96 @@
+import unittest
+import numpy as np
+import numpy.testing as nptest
+
+from pytpc.trigger.multiplicity import MultiplicityTrigger
+
+
+def reference_trigger_signals(trigger, padmap, evt):
+    result = np.zeros((10, 512))
+    hitmask = np.zeros(10240, dtype=np.int8)
+    for pad, sig in evt.items():
+        trig = np.zeros(512)
+        tb = 0
+        while tb < 512:
+            if sig[tb] > trigger.pad_threshold:
+                trig[tb:min(tb + trigger.trigger_width, 512)] += trigger.trigger_height
+                tb += trigger.trigger_width
+            else:
+                tb += 1
+        if np.any(trig > 0):
+            result[padmap[pad][0]] += trig
+            hitmask[pad] = True
+    return result, hitmask
+
+
+def reference_multiplicity_signals(trigger, trig):
+    result = np.zeros_like(trig)
+    factor = trigger.read_clock / trigger.write_clock
+    for j in range(trig.shape[1]):
+        result[:, j] = trig[:, max(0, j - trigger.multiplicity_window):j].sum(1) * factor
+    return result
+
+
+class TestMultiplicityTrigger(unittest.TestCase):
+    def setUp(self):
+        self.config = {
+            'clock': 12.5,
+            'pad_thresh_MSB': 1,
+            'pad_thresh_LSB': 2,
+            'trigger_signal_width': 235e-9,
+            'multiplicity_threshold': 20000,
+            'multiplicity_window': 300,
+            'trigger_discriminator_fraction': 0.175,
+        }
+        self.padmap = {pad: (pad // 1024, 0, 0, 0) for pad in range(10240)}
+        self.trigger = MultiplicityTrigger(self.config, self.padmap)
+
+        rng = np.random.RandomState(7)
+        self.pads = rng.choice(10240, size=200, replace=False)
+        self.traces = rng.uniform(0, 2 * self.trigger.pad_threshold, size=(200, 512))
+        self.evt = dict(zip(self.pads, self.traces))
+
+    def test_trigger_signals(self):
+        exp_trig, exp_hits = reference_trigger_signals(self.trigger, self.padmap, self.evt)
+
+        trig, hits = self.trigger.find_trigger_signals(self.evt)
+        nptest.assert_equal(trig, exp_trig)
+        nptest.assert_equal(hits, exp_hits)
+
+        trig, hits = self.trigger.find_trigger_signals_dense(self.pads, self.traces)
+        nptest.assert_equal(trig, exp_trig)
+        nptest.assert_equal(hits, exp_hits)
+
+    def test_pedestals(self):
+        peds = np.full(len(self.pads), 10.0)
+        exp = self.trigger.find_trigger_signals_dense(self.pads, self.traces - peds[:, np.newaxis])
+        res = self.trigger.find_trigger_signals_dense(self.pads, self.traces, peds)
+        nptest.assert_equal(res[0], exp[0])
+        nptest.assert_equal(res[1], exp[1])
+
+    def test_multiplicity_signals(self):
+        trig, _ = self.trigger.find_trigger_signals_dense(self.pads, self.traces)
+        res = self.trigger.find_multiplicity_signals(trig)
+        nptest.assert_allclose(res, reference_multiplicity_signals(self.trigger, trig))
+
+    def test_process_event(self):
+        for scale in (0.5, 1, 2, 10):
+            traces = self.traces[:int(20 * scale)]
+            pads = self.pads[:int(20 * scale)]
+            trig, exp_hits = self.trigger.find_trigger_signals_dense(pads, traces)
+            exp_did_trig = self.trigger.did_trigger(self.trigger.find_multiplicity_signals(trig))
+
+            did_trig, hits = self.trigger.process_event(pads, traces)
+            self.assertEqual(bool(did_trig), bool(exp_did_trig))
+            nptest.assert_equal(hits, exp_hits)
+
+    def test_empty_event(self):
+        did_trig, hits = self.trigger.process_event(np.zeros(0, dtype=np.int64), np.zeros((0, 512)))
+        self.assertFalse(did_trig)
+        self.assertEqual(np.count_nonzero(hits), 0)
+
+    def test_unknown_pad(self):
+        padmap = {k: v for k, v in self.padmap.items() if k != self.pads[0]}
+        trigger = MultiplicityTrigger(self.config, padmap)
+        traces = np.full((1, 512), 2 * self.trigger.pad_threshold)
+        self.assertRaises(KeyError, trigger.find_trigger_signals_dense, self.pads[:1], traces)
@@ -3,6 +3,11 @@ import pytpc.ukf
 import numpy.testing as npt
 import numpy as np
 
+from pytpc.constants import amuToMeV
+from pytpc.gases import InterpolatedGas
+from pytpc.fitting import Tracker
+from pytpc.fitting.mcopt_wrapper import KalmanFilter
+
 
 def predict_func(x):
     pass
@@ -48,5 +53,107 @@ class TestUnscentedKalmanFilter(unittest.TestCase):
                 npt.assert_allclose(w[1:], wi_exp)
 
 
+class TestFindStepDistances(unittest.TestCase):
+    def test_line(self):
+        zs = np.arange(20, dtype='float64')
+        pts = np.column_stack((2 * zs, -zs, zs))
+        dpos = pytpc.ukf.find_step_distances(pts)
+        self.assertEqual(len(dpos), len(pts))
+        npt.assert_allclose(dpos, np.sqrt(6), rtol=1e-6)
+
+
+class TestNativeKalmanFilter(unittest.TestCase):
+    def setUp(self):
+        gas = InterpolatedGas('helium', 200)
+        self.tracker = Tracker(4, 2, 2.0, 4, 2, gas, np.array([0., 0., 9e3]), np.array([0., 0., 1.75]), 20)
+        self.mass = 4 * amuToMeV
+
+        self.kf = KalmanFilter(self.tracker)
+        self.kf.kappa = 0  # Keeps the weights positive, so the covariance matrices stay positive definite
+        self.kf.Q = np.diag([1e-8] * 3 + [1e-2] * 3)
+        self.kf.R = np.eye(3) * 1e-6
+
+        # A measured track with 1 mm of noise in x and y. The z values are left alone so they stay sorted.
+        self.params = np.array([0.0, 0.0, 0.5, 2.0, 0.0, 1.0])
+        track = self.tracker.track_particle(*self.params)
+        self.zs = track[::max(1, len(track) // 40), :3].copy()
+        self.zs[:, :2] += np.random.RandomState(0).normal(0, 1e-3, (len(self.zs), 2))
+
+        self.x0 = self.kf.initial_state(*self.params)
+        self.P0 = np.diag([1e-4] * 3 + [1.0] * 3)
+
+    def make_python_filter(self):
+        """Make the Python filter with the same physics and settings as the native one."""
+        def fx(state, dt):
+            return self.kf.propagate(np.ascontiguousarray(state, dtype='float64'), dt)
+
+        def hx(state):
+            return state[:3]
+
+        def dtx(state, dpos):
+            p = np.linalg.norm(state[3:])
+            return dpos / (p / np.sqrt(p**2 + self.mass**2) * 299792458) if p > 0 else 0
+
+        ukf = pytpc.ukf.UnscentedKalmanFilter(6, 3, fx, hx, dtx)
+        ukf.kappa = self.kf.kappa
+        ukf.W = ukf.find_weights(6, ukf.kappa)
+        ukf.Q = self.kf.Q
+        ukf.R = self.kf.R
+        ukf.x = self.x0.copy()
+        ukf.P = self.P0.copy()
+        return ukf
+
+    def assert_close(self, actual, desired):
+        npt.assert_allclose(actual, desired, rtol=1e-5, atol=1e-8 * np.abs(desired).max())
+
+    def test_same_as_python(self):
+        means, covars, times = self.kf.batch_filter(self.zs, self.x0, self.P0)
+
+        ukf = self.make_python_filter()
+        exp_means, exp_covars, exp_times = ukf.batch_filter(self.zs)
+        self.assert_close(times, exp_times)
+        self.assert_close(means, exp_means)
+        self.assert_close(covars, exp_covars)
+
+        sm_means, sm_covars = self.kf.smooth(means, covars, times)
+        exp_sm_means, exp_sm_covars = ukf.smooth(exp_means, exp_covars, exp_times)
+        self.assert_close(sm_means, exp_sm_means)
+        self.assert_close(sm_covars, exp_sm_covars)
+
+    def test_propagate(self):
+        track = self.tracker.track_particle(*self.params)
+        state0 = self.kf.initial_state(*track[0, [0, 1, 2, 4, 5, 6]])
+
+        # The trackers integrate differently, so only the first half of the track is compared, before the
+        # particle slows down
+        for row in track[1:len(track) // 2:max(1, len(track) // 20)]:
+            state = self.kf.propagate(state0, row[3] - track[0, 3])
+            npt.assert_allclose(state[:3], row[:3], atol=1e-3)
+            self.assertAlmostEqual(self.kf.state_params(state)[3], row[4], delta=0.01 * row[4])
+
+    def test_singular_covariance(self):
+        with self.assertRaises(RuntimeError):
+            self.kf.batch_filter(self.zs, self.x0, np.zeros((6, 6)))
+
+    def test_failed_tracks(self):
+        # A point far outside the detector needs too long a step to reach, and a state that isn't finite can't
+        # be propagated at all
+        outside = np.vstack((self.zs, self.zs[-1] + [0, 0, 1e5]))
+        x0s = np.array([self.x0, self.x0, np.full(6, np.nan), self.x0])
+        results = self.kf.filter_tracks([self.zs, outside, self.zs, self.zs], x0s, self.P0)
+
+        self.assertEqual(len(results), 4)
+        self.assertIsNone(results[1])
+        self.assertIsNone(results[2])
+
+        means, covars, times = self.kf.batch_filter(self.zs, self.x0, self.P0)
+        exp_means, exp_covars = self.kf.smooth(means, covars, times)
+        for res in (results[0], results[3]):
+            self.assertIsNotNone(res)
+            npt.assert_allclose(res[0], exp_means)
+            npt.assert_allclose(res[1], exp_covars)
+            npt.assert_allclose(res[2], times)
+
+
 if __name__ == '__main__':
     unittest.main()
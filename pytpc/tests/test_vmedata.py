@@ -0,0 +1,138 @@
+import unittest
+import os
+import struct
+import tempfile
+import numpy as np
+import numpy.testing as nptest
+
+from pytpc.vmedata import VMEFile, ADCEvent, ScalerEvent, VMEAlignmentTable, BadVMEDataError, coincidence_bits
+from pytpc.unpack import decode_vme_buffer, VME_OK, VME_TRUNCATED, VME_BAD_SENTINEL
+
+
+def make_scaler_frame(rng, sentinel=0xffffffff):
+    scalers = rng.randint(0, 2**31, size=18).astype('<u4')
+    return struct.pack('<HH', 0x2025, 0xe238) + scalers.tobytes() + struct.pack('<I', sentinel)
+
+
+def make_adc_frame(rng, frame_index, last_tbs=(0, 0)):
+    res = struct.pack('<HH', 0x17fb, 0xe238)
+    res += struct.pack('<III', frame_index, rng.randint(0, 2**31), rng.randint(0, 2**16))
+    for last_tb in last_tbs:
+        regs = np.array([0, 0, 0, last_tb], dtype='<u4')
+        raw = rng.randint(0, 2**32, size=512, dtype='uint64').astype('<u4')
+        res += regs.tobytes() + raw.tobytes()
+    return res
+
+
+class TestVMEDecoder(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.RandomState(0)
+        frames = [b'\x00\x11' * 3]  # Some junk before the first frame
+        frame_index = 0
+        for i in range(30):
+            if i % 7 == 3:
+                frames.append(make_scaler_frame(rng))
+            else:
+                last_tbs = (i * 37 % 512, i * 37 % 512) if i != 5 else (10, 20)
+                frames.append(make_adc_frame(rng, frame_index, last_tbs))
+            frame_index += 1
+            if i == 10:
+                frames.append(struct.pack('<HH', 0x1234, 0xe238))  # Unknown frame type, which is skipped
+        self.buf = b''.join(frames)
+
+        fd, self.path = tempfile.mkstemp(suffix='.dat')
+        with os.fdopen(fd, 'wb') as f:
+            f.write(self.buf)
+
+    def tearDown(self):
+        os.remove(self.path)
+
+    def read_python(self):
+        vme_file = VMEFile(self.path)
+        events = list(vme_file)
+        vme_file.fp.close()
+        return [e for e in events if isinstance(e, ADCEvent)], [e for e in events if isinstance(e, ScalerEvent)]
+
+    def test_same_as_python(self):
+        py_adc, py_scalers = self.read_python()
+        adc, scalers, pos, status = decode_vme_buffer(self.buf)
+
+        self.assertEqual(status, VME_OK)
+        self.assertEqual(pos, len(self.buf))
+        self.assertEqual(len(adc), len(py_adc))
+        self.assertEqual(len(scalers), len(py_scalers))
+
+        for evt, row in zip(py_adc, adc):
+            self.assertEqual(row['evt_id'], evt.evt_id)
+            self.assertEqual(row['timestamp'], evt.timestamp)
+            nptest.assert_equal(coincidence_bits(row['coinc']), evt.coincidence_register)
+            nptest.assert_equal(row['data'], evt.data)
+
+        for evt, row in zip(py_scalers, scalers):
+            self.assertEqual(row['index'], evt.index)
+            nptest.assert_equal(row['scalers'], evt.scalers)
+
+    def test_chunks(self):
+        adc, scalers, _, _ = decode_vme_buffer(self.buf)
+
+        vme_file = VMEFile(self.path)
+        chunks = list(vme_file.iter_chunks(chunk_size=4))
+        vme_file.fp.close()
+
+        self.assertGreater(len(chunks), 1)
+        nptest.assert_equal(np.concatenate([c[0] for c in chunks]), adc)
+        nptest.assert_equal(np.concatenate([c[1] for c in chunks]), scalers)
+        self.assertEqual(chunks[-1][2], len(self.buf))
+
+    def test_truncated(self):
+        full_adc, _, _, _ = decode_vme_buffer(self.buf)
+        adc, _, pos, status = decode_vme_buffer(self.buf[:-100])
+        self.assertEqual(status, VME_TRUNCATED)
+        self.assertEqual(len(adc), len(full_adc) - 1)
+        nptest.assert_equal(adc, full_adc[:-1])
+
+    def test_bad_sentinel(self):
+        rng = np.random.RandomState(1)
+        buf = make_adc_frame(rng, 0) + make_scaler_frame(rng, sentinel=0) + make_adc_frame(rng, 2)
+        adc, scalers, pos, status = decode_vme_buffer(buf)
+        self.assertEqual(status, VME_BAD_SENTINEL)
+        self.assertEqual(pos, len(make_adc_frame(rng, 0)))
+        self.assertEqual(len(adc), 1)
+        self.assertEqual(len(scalers), 0)
+
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'bad.dat')
+            with open(path, 'wb') as f:
+                f.write(buf)
+            vme_file = VMEFile(path)
+            with self.assertRaises(BadVMEDataError):
+                list(vme_file.iter_chunks())
+            vme_file.fp.close()
+
+
+class TestVMEAlignmentTable(unittest.TestCase):
+
+    def test_update_offsets(self):
+        changes = [(10, 1), (50, -3), (10, 2), (99, 1)]
+        expected = VMEAlignmentTable(100)
+        for start, offset in changes:
+            expected.update_offset(start, offset)
+
+        table = VMEAlignmentTable.from_changes(100, *zip(*changes))
+        nptest.assert_equal(table.offsets, expected.offsets)
+
+    def test_invalidate_ranges(self):
+        ranges = [(5, 10), (8, 20), (40, 41), (60, 60)]
+        expected = VMEAlignmentTable(100)
+        for begin, end in ranges:
+            expected.invalidate_range(begin, end)
+
+        table = VMEAlignmentTable(100)
+        table.invalidate_ranges(*zip(*ranges))
+        nptest.assert_equal(table.valid, expected.valid)
+
+    def test_vme_to_get_array(self):
+        table = VMEAlignmentTable.from_changes(20, [5], [2])
+        nptest.assert_equal(table.vme_to_get([0, 5, 19]), [0, 7, 21])
+        self.assertEqual(table.vme_to_get(6), 8)
@@ -5,9 +5,95 @@ This module contains the implementation of a simulated multiplicity trigger for
 """
 
 cimport numpy as np
+cimport cython
 import numpy as np
 from libc.math cimport round
 
+ctypedef np.int64_t int64
+
+
+@cython.boundscheck(False)
+@cython.wraparound(False)
+cdef Py_ssize_t _fill_trigger_signals(const double[:, ::1] traces, const int64[::1] cobos,
+                                      const double[::1] pedestals, double threshold, int width, double height,
+                                      double[:, ::1] result, np.int8_t[::1] hits) nogil:
+    """Add the trigger signal from each pad in `traces` to the row of `result` for its CoBo.
+
+    A pad fires when its pedestal-subtracted signal rises above `threshold`. Its trigger signal is then a pulse of
+    height `height` that lasts for `width` samples, and the pad can't fire again until the pulse ends. The entry
+    of `hits` for each pad that fired is set to 1.
+
+    The CoBo numbers must be less than the number of rows in `result`. Pads with a negative CoBo number are not
+    added to `result`. Returns the row index of the first such pad that
+    fired, or -1 if there were none.
+
+    """
+    cdef Py_ssize_t numSamples = traces.shape[1]
+    cdef Py_ssize_t step = width if width > 0 else 1  # Always move forward, even if the pulse is empty
+    cdef Py_ssize_t p, tbIdx, k, endIdx
+    cdef int64 cobo
+    cdef double ped
+    cdef bint hit
+    cdef Py_ssize_t badRow = -1
+
+    for p in range(traces.shape[0]):
+        cobo = cobos[p]
+        ped = pedestals[p]
+        hit = False
+
+        tbIdx = 0
+        while tbIdx < numSamples:
+            if traces[p, tbIdx] - ped > threshold:
+                endIdx = tbIdx + width if tbIdx + width < numSamples else numSamples
+                if endIdx > tbIdx and height > 0:
+                    hit = True
+                if cobo >= 0:
+                    for k in range(tbIdx, endIdx):
+                        result[cobo, k] += height
+                tbIdx += step
+            else:
+                tbIdx += 1
+
+        hits[p] = hit
+        if hit and cobo < 0 and badRow < 0:
+            badRow = p
+
+    return badRow
+
+
+@cython.boundscheck(False)
+@cython.wraparound(False)
+cdef bint _window_sums(const double[:, ::1] trig, int window, double time_factor, double[:, ::1] result,
+                       bint stop_above, double threshold) nogil:
+    """Find the sum of the previous `window` samples of `trig` at each sample, multiplied by `time_factor`.
+
+    The sums are written to `result` unless it has no rows. If `stop_above` is true, this returns True as soon as
+    any sum is greater than `threshold`. Otherwise, or if no sum is above it, this returns False.
+
+    The sum is kept as a running total, so each sample is only added and removed once.
+
+    """
+    cdef Py_ssize_t numSamples = trig.shape[1]
+    cdef bint writeResult = result.shape[0] > 0
+    cdef Py_ssize_t i, j
+    cdef double accum, value
+
+    for i in range(trig.shape[0]):
+        accum = 0
+        for j in range(numSamples):
+            # The window for sample j is [max(0, j - window), j)
+            if j > 0 and window > 0:
+                accum += trig[i, j - 1]
+                if j - 1 - window >= 0:
+                    accum -= trig[i, j - 1 - window]
+            value = accum * time_factor
+            if writeResult:
+                result[i, j] = value
+            if stop_above and value > threshold:
+                return True
+
+    return False
+
 
 cdef _calculate_pad_threshold(int pad_thresh_LSB, int pad_thresh_MSB, double trig_discr_frac):
     """Calculate the pad threshold value in ADC time buckets.
@@ -74,6 +160,7 @@ cdef class MultiplicityTrigger:
         """The width of the multiplicity integration window, as listed in the config file."""
 
         dict padmap
+        np.ndarray padCobos
 
     def __cinit__(self, dict config, dict padmap):
         self.write_clock = float(config['clock']) * 1e6
@@ -93,6 +180,72 @@ cdef class MultiplicityTrigger:
 
         self.padmap = padmap
 
+        # A lookup table from pad number to CoBo, with -1 for pads that aren't in the pad map
+        maxPad = max(padmap.keys()) if len(padmap) > 0 else 0
+        self.padCobos = np.full(max(10240, maxPad + 1), -1, dtype=np.int64)
+        for pad, addr in padmap.items():
+            if not 0 <= addr[0] < 10:
+                raise ValueError('Invalid CoBo number {} for pad {}'.format(addr[0], pad))
+            self.padCobos[pad] = addr[0]
+
+    def _pad_cobos(self, np.ndarray pads):
+        if len(pads) > 0 and (pads.min() < 0 or pads.max() >= len(self.padCobos)):
+            raise KeyError('Pad number out of range')
+        return np.ascontiguousarray(self.padCobos[pads], dtype=np.int64)
+
+    def find_trigger_signals_dense(self, pads, traces, pedestals=None):
+        """Calculate the trigger signals for an event given as a block of traces.
+
+        Parameters
+        ----------
+        pads : array-like
+            The pad number of each row of `traces`.
+        traces : np.ndarray
+            The signal on each pad, as an array with shape (len(pads), 512).
+        pedestals : array-like, optional
+            The pedestal of each row of `traces`. These are subtracted from the signals before comparing them to
+            the pad threshold. The default is zero.
+
+        Returns
+        -------
+        result : np.ndarray
+            The trigger signals. This has dimensions (10, 512), with CoBo number along the axis 0 and
+            sample number along axis 1.
+        hitmask : np.ndarray
+            An array indexed by pad number showing whether each pad fired. The value is 1 if it did (0 otherwise).
+
+        """
+        pads = np.asarray(pads, dtype=np.int64)
+        cdef double[:, ::1] trView = np.ascontiguousarray(traces, dtype=np.double)
+        if trView.shape[0] != len(pads):
+            raise ValueError('Must provide one trace for each pad')
+        cdef int64[::1] cobos = self._pad_cobos(pads)
+        cdef double[::1] peds
+        if pedestals is None:
+            peds = np.zeros(len(pads), dtype=np.double)
+        else:
+            peds = np.ascontiguousarray(pedestals, dtype=np.double)
+            if peds.shape[0] != len(pads):
+                raise ValueError('Must provide one pedestal for each pad')
+
+        cdef np.ndarray[np.double_t, ndim=2] result = np.zeros((10, trView.shape[1]), dtype=np.double)
+        cdef np.ndarray[np.int8_t, ndim=1] padHits = np.zeros(len(pads), dtype=np.int8)
+        cdef double[:, ::1] resView = result
+        cdef np.int8_t[::1] hitsView = padHits
+        cdef Py_ssize_t badRow
+
+        with nogil:
+            badRow = _fill_trigger_signals(trView, cobos, peds, self.pad_threshold, self.trigger_width,
+                                           self.trigger_height, resView, hitsView)
+
+        if badRow >= 0:
+            raise KeyError(pads[badRow])
+
+        cdef np.ndarray[np.int8_t, ndim=1] hitmask = np.zeros(len(self.padCobos), dtype=np.int8)
+        hitmask[pads[padHits.astype(bool)]] = True
+
+        return result, hitmask
+
     def find_trigger_signals(self, dict evt):
         """Calculate the trigger signals for the given event.
 
@@ -111,33 +264,13 @@ cdef class MultiplicityTrigger:
             number, and the value is 1 if hit (0 otherwise).
 
         """
-        cdef np.ndarray[np.double_t, ndim=2] result = np.zeros((10, 512), dtype=np.double)
-        cdef np.ndarray[np.int8_t, ndim=1] hitmask = np.zeros(10240, dtype=np.int8)
-
-        cdef np.ndarray[np.double_t, ndim=1] trigSignal
-        cdef int tbIdx, sqIdx
-        cdef int padnum
-        cdef np.ndarray[np.double_t, ndim=1] padsig
-        cdef int cobo
-
-        for padnum, padsig in evt.items():
-
-            trigSignal = np.zeros(512, dtype=np.double)
-
-            tbIdx = 0
-            while tbIdx < 512:
-                if padsig[tbIdx] > self.pad_threshold:
-                    trigSignal[tbIdx:min(tbIdx + self.trigger_width, 512)] += self.trigger_height
-                    tbIdx += self.trigger_width
-                else:
-                    tbIdx += 1
-
-            if np.any(trigSignal > 0):
-                cobo = self.padmap[padnum][0]
-                result[cobo] += trigSignal
-                hitmask[padnum] = True
+        pads = np.fromiter(evt.keys(), dtype=np.int64, count=len(evt))
+        if len(evt) > 0:
+            traces = np.array(list(evt.values()), dtype=np.double)
+        else:
+            traces = np.zeros((0, 512), dtype=np.double)
 
-        return result, hitmask
+        return self.find_trigger_signals_dense(pads, traces)
 
     def find_multiplicity_signals(self, np.ndarray[np.double_t, ndim=2] trig):
         """Calculate the multiplicity signals from the trigger signals.
@@ -153,21 +286,13 @@ cdef class MultiplicityTrigger:
             The multiplicity signals. This array has the same dimensions as the input array.
 
         """
-        cdef np.ndarray[np.double_t, ndim=2] result = np.zeros_like(trig, dtype=np.double)
-
-        cdef int j, minIdx, maxIdx
-        cdef double accum
+        cdef np.ndarray[np.double_t, ndim=2] result = np.zeros_like(trig, dtype=np.double, order='C')
+        cdef double[:, ::1] trigView = np.ascontiguousarray(trig)
+        cdef double[:, ::1] resView = result
         cdef double time_factor = self.read_clock / self.write_clock
 
-        for j in range(trig.shape[1]):
-            minIdx = max(0, j - self.multiplicity_window)
-            maxIdx = j
-
-            for i in range(trig.shape[0]):
-                accum = 0
-                for k in range(minIdx, maxIdx):
-                    accum += trig[i, k]
-                result[i, j] = accum * time_factor
+        with nogil:
+            _window_sums(trigView, self.multiplicity_window, time_factor, resView, False, 0)
 
         return result
 
@@ -186,3 +311,36 @@ cdef class MultiplicityTrigger:
 
         """
         return np.any(np.max(mult, axis=1) > self.multiplicity_threshold)
+
+    def process_event(self, pads, traces, pedestals=None):
+        """Find the trigger signals for the event, and determine whether it would have triggered the DAQ.
+
+        This is equivalent to calling :meth:`find_trigger_signals_dense`, :meth:`find_multiplicity_signals`, and
+        :meth:`did_trigger` in turn, but it doesn't build the multiplicity signals and it stops as soon as any
+        CoBo crosses the multiplicity threshold.
+
+        Parameters
+        ----------
+        pads, traces, pedestals
+            The event, as described in :meth:`find_trigger_signals_dense`.
+
+        Returns
+        -------
+        did_trig : bool
+            Whether the event would have triggered the DAQ.
+        hitmask : np.ndarray
+            An array indexed by pad number showing whether each pad fired. The value is 1 if it did (0 otherwise).
+
+        """
+        trig, hitmask = self.find_trigger_signals_dense(pads, traces, pedestals)
+
+        cdef double[:, ::1] trigView = trig
+        cdef double[:, ::1] noResult = np.empty((0, trig.shape[1]), dtype=np.double)
+        cdef double time_factor = self.read_clock / self.write_clock
+        cdef double threshold = self.multiplicity_threshold
+        cdef bint did_trig
+
+        with nogil:
+            did_trig = _window_sums(trigView, self.multiplicity_window, time_factor, noResult, True, threshold)
+
+        return did_trig, hitmask
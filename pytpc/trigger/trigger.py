@@ -63,6 +63,10 @@ class TriggerSimulator(object):
             pedestals = np.zeros(10240, dtype='float64')
         self.pedestals = pedestals  #: The pedestal values
 
+        #: A mask indexed by pad number that is True for the pads in ``self.badpads``
+        self.badpad_mask = np.zeros(10240, dtype=bool)
+        self.badpad_mask[[p for p in self.badpads if 0 <= p < 10240]] = True
+
         self.trigger = MultiplicityTrigger(config, self.reverse_padmap)
 
     def process_event(self, evt):
@@ -91,3 +95,35 @@ class TriggerSimulator(object):
         did_trig = self.trigger.did_trigger(mult)
 
         return did_trig, hitmask
+
+    def process_dense_event(self, pads, traces):
+        """Determine if the given event would trigger the detector.
+
+        This does the same thing as :meth:`process_event`, but the event is given as a block of traces. This is
+        faster since the trigger is simulated in one pass over the block, and the simulation stops as soon as the
+        multiplicity threshold is crossed.
+
+        Parameters
+        ----------
+        pads : np.ndarray
+            The pad number of each row of `traces`.
+        traces : np.ndarray
+            The signal on each pad, with shape (len(pads), 512).
+
+        Returns
+        -------
+        did_trig : bool
+            Whether the event would have triggered the detector.
+        hitmask : np.ndarray
+            An array indexed by pad number that is 1 for each pad that fired (0 otherwise).
+
+        """
+        pads = np.asarray(pads, dtype=np.int64)
+
+        # Remove pads in exclusion region
+        keep = ~self.badpad_mask[pads]
+        if not np.all(keep):
+            pads = pads[keep]
+            traces = traces[keep]
+
+        return self.trigger.process_event(pads, traces, np.asarray(self.pedestals, dtype='float64')[pads])
@@ -5,6 +5,9 @@ ukf
 Implements an Unscented Kalman Filter. This code is based on the corresponding
 class from the filterpy library (http://github.com/rlabbe/filterpy).
 
+For particle tracks, :class:`pytpc.fitting.mcopt_wrapper.KalmanFilter` implements the same filter in compiled code,
+with the state propagated natively instead of through Python callbacks.
+
 """
 
 from __future__ import division, print_function
@@ -13,6 +16,36 @@ from numpy.linalg import cholesky, inv
 from scipy.interpolate import UnivariateSpline
 
 
+def find_step_distances(zs):
+    """Find the distance between each measured point and the one before it, for the filter's time steps.
+
+    The x and y positions are smoothed with a spline as a function of z first, so the noise in the measured points
+    doesn't make the distances too large.
+
+    Parameters
+    ----------
+    zs : array-like
+        The measured points. The first three columns must be x, y, and z, and the rows should be sorted by z.
+
+    Returns
+    -------
+    ndarray
+        The distance to each point. The first point is given the same distance as the second.
+    """
+    zs = np.asanyarray(zs)
+
+    splx = UnivariateSpline(zs[:, 2], zs[:, 0])
+    sply = UnivariateSpline(zs[:, 2], zs[:, 1])
+
+    dx = np.diff(splx(zs[:, 2]))
+    dy = np.diff(sply(zs[:, 2]))
+    dz = np.diff(zs[:, 2])
+    dpos = np.sqrt(dx**2 + dy**2 + dz**2)
+    dpos = np.insert(dpos, 0, dpos[0])  # Otherwise dpos has length n-1 because of np.diff
+
+    return dpos
+
+
 class UnscentedKalmanFilter(object):
     """Represents an unscented Kalman filter.
 
@@ -156,14 +189,7 @@ class UnscentedKalmanFilter(object):
         times = np.zeros(n)
         current_time = 0.
 
-        splx = UnivariateSpline(zs[:, 2], zs[:, 0])
-        sply = UnivariateSpline(zs[:, 2], zs[:, 1])
-
-        dx = np.diff(splx(zs[:, 2]))
-        dy = np.diff(sply(zs[:, 2]))
-        dz = np.diff(zs[:, 2])
-        dpos = np.sqrt(dx**2 + dy**2 + dz**2)
-        dpos = np.insert(dpos, 0, dpos[0])  # Otherwise dpos has length n-1 because of np.diff
+        dpos = find_step_distances(zs)
 
         for i in range(n):
             dt = self.dtx(self.x, dpos[i])  # The dt varies since the particle energy changes with time
@@ -222,8 +248,8 @@ class UnscentedKalmanFilter(object):
             xb = self.W.dot(sigmas_f)
             Pb = 0
             for i in range(num_sigmas):
-                y = sigmas_f[i] - xs[k]
-                Pb += self.W[i] + np.outer(y, y)
+                y = sigmas_f[i] - xb
+                Pb += self.W[i] * np.outer(y, y)
             Pb += self.Q
 
             # find cross-covariance
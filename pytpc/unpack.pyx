@@ -0,0 +1,650 @@
+"""unpack.pyx
+
+Native decoders for the raw data from the GET electronics. Each decoder turns the buffer for a whole event or frame
+into an array with the same dtype as :attr:`pytpc.evtdata.Event.traces` in a single pass, without creating any
+Python objects for the individual traces.
+
+There is also a decoder for the files written by the VME DAQ, which turns the ADC and scaler frames of a whole file
+into two structured arrays. See :meth:`pytpc.vmedata.VMEFile.iter_chunks`.
+
+The bit fields are extracted with shifts and masks only, and the loops have no data-dependent branches, so the
+compiler is free to vectorize the extraction.
+
+"""
+
+cimport numpy as np
+cimport cython
+import numpy as np
+from libc.stdint cimport uint8_t, uint16_t, uint32_t, int16_t, int64_t
+
+np.import_array()
+
+# This must match the layout of trace_dtype
+cdef packed struct Trace:
+    uint8_t cobo
+    uint8_t asad
+    uint8_t aget
+    uint8_t channel
+    uint16_t pad
+    int16_t data[512]
+
+#: The dtype of the arrays of traces returned by the decoders. This is the same as :attr:`pytpc.evtdata.Event.dt`.
+trace_dtype = np.dtype([('cobo', 'u1'), ('asad', 'u1'), ('aget', 'u1'), ('channel', 'u1'),
+                        ('pad', 'u2'), ('data', '512i2')])
+
+assert trace_dtype.itemsize == sizeof(Trace)
+
+cdef enum:
+    NUM_TBS = 512
+    NUM_AGETS = 4
+    NUM_CHANNELS_PER_AGET = 68
+    NUM_CHANNEL_KEYS = 128  # The channel field in a partial readout item is 7 bits wide
+
+
+cdef inline uint32_t _read_le24(const uint8_t* p) nogil:
+    return p[0] | (<uint32_t> p[1] << 8) | (<uint32_t> p[2] << 16)
+
+
+cdef inline uint32_t _read_le32(const uint8_t* p) nogil:
+    return p[0] | (<uint32_t> p[1] << 8) | (<uint32_t> p[2] << 16) | (<uint32_t> p[3] << 24)
+
+
+cdef inline uint32_t _read_be32(const uint8_t* p) nogil:
+    return (<uint32_t> p[0] << 24) | (<uint32_t> p[1] << 16) | (<uint32_t> p[2] << 8) | p[3]
+
+
+cdef inline uint16_t _read_be16(const uint8_t* p) nogil:
+    return (<uint16_t> p[0] << 8) | p[1]
+
+
+cdef inline const uint8_t* _buffer_ptr(const uint8_t[::1] buf) nogil:
+    return &buf[0] if buf.shape[0] > 0 else NULL
+
+
+@cython.boundscheck(False)
+@cython.wraparound(False)
+@cython.cdivision(True)
+cdef Py_ssize_t _decode_evt_traces(const uint8_t* buf, Py_ssize_t buflen, Py_ssize_t num_traces,
+                                   Trace* traces) nogil:
+    """Decode the traces of an event from a merged event file. Returns the number of bytes used, or -1 if the
+    buffer ended early or a trace header was invalid.
+    """
+    cdef Py_ssize_t pos = 0
+    cdef Py_ssize_t n, i, num_samples
+    cdef uint32_t size, packed, parity
+    cdef const uint8_t* th
+    cdef const uint8_t* samples
+    cdef Trace* tr
+
+    for n in range(num_traces):
+        if pos + 10 > buflen:
+            return -1
+
+        # The trace header is (size, cobo, asad, aget, ch, pad), as '<IBBBBH'
+        th = buf + pos
+        size = _read_le32(th)
+        if size < 10:
+            return -1
+
+        tr = &traces[n]
+        tr.cobo = th[4]
+        tr.asad = th[5]
+        tr.aget = th[6]
+        tr.channel = th[7]
+        tr.pad = th[8] | (<uint16_t> th[9] << 8)
+
+        num_samples = (size - 10) // 3  # (total - header) / size of packed item
+        pos += 10
+        if pos + 3 * num_samples > buflen:
+            return -1
+
+        # Each sample is packed into 3 bytes as (tb << 15) | (parity << 12) | sample
+        samples = buf + pos
+        for i in range(num_samples):
+            packed = _read_le24(samples + 3 * i)
+            parity = (packed >> 12) & 1
+            tr.data[(packed >> 15) & 0x1FF] = <int16_t> (packed & 0xFFF) * (1 - 2 * <int16_t> parity)
+
+        pos += 3 * num_samples
+
+    return pos
+
+
+def decode_evt_traces(const uint8_t[::1] buf, Py_ssize_t num_traces):
+    """Decode the traces of one event from a merged GET event file.
+
+    Parameters
+    ----------
+    buf : bytes-like
+        The part of the event after the 19-byte event header.
+    num_traces : int
+        The number of traces, from the event header.
+
+    Returns
+    -------
+    traces : ndarray
+        The traces, with dtype :data:`trace_dtype`.
+    num_bytes : int
+        The number of bytes of `buf` that were used.
+
+    Raises
+    ------
+    ValueError
+        If `buf` ended before all of the traces were read, or if a trace header was invalid.
+
+    """
+    cdef np.ndarray traces = np.zeros(num_traces, dtype=trace_dtype)
+    cdef Trace* trPtr = <Trace*> np.PyArray_DATA(traces)
+    cdef const uint8_t* bufPtr = _buffer_ptr(buf)
+    cdef Py_ssize_t buflen = buf.shape[0]
+    cdef Py_ssize_t num_bytes
+
+    with nogil:
+        num_bytes = _decode_evt_traces(bufPtr, buflen, num_traces, trPtr)
+
+    if num_bytes < 0:
+        raise ValueError('Event data was truncated or invalid')
+
+    return traces, num_bytes
+
+
+@cython.boundscheck(False)
+@cython.wraparound(False)
+def decode_graw_partial_readout(const uint8_t[::1] buf, Py_ssize_t num_items, int cobo, int asad):
+    """Decode the data items of a partial readout GRAW frame.
+
+    Each item is a big-endian 32-bit integer holding the AGET, channel, time bucket, and sample. There is one
+    trace for each (AGET, channel) pair present in the frame, sorted by AGET and then by channel.
+
+    Parameters
+    ----------
+    buf : bytes-like
+        The data section of the frame.
+    num_items : int
+        The number of items, from the frame header.
+    cobo, asad : int
+        The CoBo and AsAd numbers, from the frame header.
+
+    Returns
+    -------
+    traces : ndarray
+        The traces, with dtype :data:`trace_dtype`.
+    min_channel, max_channel : int
+        The smallest and largest channel numbers found. These are -1 if there were no items.
+
+    Raises
+    ------
+    ValueError
+        If `buf` is too short to hold `num_items` items.
+
+    """
+    if num_items < 0 or buf.shape[0] < 4 * num_items:
+        raise ValueError('Frame buffer is smaller than the number of items')
+
+    cdef const uint8_t* bufPtr = _buffer_ptr(buf)
+    cdef uint8_t seen[NUM_AGETS * NUM_CHANNEL_KEYS]
+    cdef int rowIdx[NUM_AGETS * NUM_CHANNEL_KEYS]
+    cdef Py_ssize_t i
+    cdef int key
+    cdef int numRows = 0
+    cdef int minCh = NUM_CHANNEL_KEYS
+    cdef int maxCh = -1
+    cdef uint32_t item
+
+    with nogil:
+        for key in range(NUM_AGETS * NUM_CHANNEL_KEYS):
+            seen[key] = 0
+
+        for i in range(num_items):
+            item = _read_be32(bufPtr + 4 * i)
+            seen[item >> 23] = 1  # (aget << 7) | channel
+
+        for key in range(NUM_AGETS * NUM_CHANNEL_KEYS):
+            rowIdx[key] = numRows
+            numRows += seen[key]
+            if seen[key]:
+                minCh = min(minCh, key % NUM_CHANNEL_KEYS)
+                maxCh = max(maxCh, key % NUM_CHANNEL_KEYS)
+
+    cdef np.ndarray traces = np.zeros(numRows, dtype=trace_dtype)
+    cdef Trace* trPtr = <Trace*> np.PyArray_DATA(traces)
+
+    with nogil:
+        for key in range(NUM_AGETS * NUM_CHANNEL_KEYS):
+            if seen[key]:
+                trPtr[rowIdx[key]].cobo = cobo
+                trPtr[rowIdx[key]].asad = asad
+                trPtr[rowIdx[key]].aget = key // NUM_CHANNEL_KEYS
+                trPtr[rowIdx[key]].channel = key % NUM_CHANNEL_KEYS
+
+        for i in range(num_items):
+            item = _read_be32(bufPtr + 4 * i)
+            trPtr[rowIdx[item >> 23]].data[(item >> 14) & 0x1FF] = item & 0xFFF
+
+    return traces, (minCh if maxCh >= 0 else -1), maxCh
+
+
+@cython.boundscheck(False)
+@cython.wraparound(False)
+@cython.cdivision(True)
+def decode_graw_full_readout(const uint8_t[::1] buf, Py_ssize_t num_items, int cobo, int asad):
+    """Decode the data items of a full readout GRAW frame.
+
+    Each item is a big-endian 16-bit integer holding the AGET and sample. The items for each AGET are in order
+    of time bucket and then channel, so each AGET present must have exactly 512 * 68 items. The result always has
+    68 traces for each of the 4 AGETs. The traces for AGETs that are not in the frame are left empty.
+
+    Parameters
+    ----------
+    buf : bytes-like
+        The data section of the frame.
+    num_items : int
+        The number of items, from the frame header.
+    cobo, asad : int
+        The CoBo and AsAd numbers, from the frame header.
+
+    Returns
+    -------
+    traces : ndarray
+        The traces, with dtype :data:`trace_dtype`.
+
+    Raises
+    ------
+    ValueError
+        If `buf` is too short to hold `num_items` items, or if an AGET does not have a full set of items.
+
+    """
+    if num_items < 0 or buf.shape[0] < 2 * num_items:
+        raise ValueError('Frame buffer is smaller than the number of items')
+
+    cdef const uint8_t* bufPtr = _buffer_ptr(buf)
+    cdef np.ndarray traces = np.zeros(NUM_AGETS * NUM_CHANNELS_PER_AGET, dtype=trace_dtype)
+    cdef Trace* trPtr = <Trace*> np.PyArray_DATA(traces)
+    cdef Py_ssize_t counts[NUM_AGETS]
+    cdef Py_ssize_t i, k
+    cdef int aget, ch
+    cdef uint16_t item
+
+    with nogil:
+        for aget in range(NUM_AGETS):
+            counts[aget] = 0
+
+        for i in range(num_items):
+            item = _read_be16(bufPtr + 2 * i)
+            aget = item >> 14
+            k = counts[aget]
+            counts[aget] += 1
+            if k < NUM_TBS * NUM_CHANNELS_PER_AGET:
+                trPtr[aget * NUM_CHANNELS_PER_AGET + k % NUM_CHANNELS_PER_AGET].data[k // NUM_CHANNELS_PER_AGET] = \
+                    item & 0xFFF
+
+    for aget in range(NUM_AGETS):
+        if counts[aget] == 0:
+            continue
+        elif counts[aget] != NUM_TBS * NUM_CHANNELS_PER_AGET:
+            raise ValueError('AGET {} has {} items, but a full readout needs {}'.format(
+                aget, counts[aget], NUM_TBS * NUM_CHANNELS_PER_AGET))
+
+        for ch in range(NUM_CHANNELS_PER_AGET):
+            trPtr[aget * NUM_CHANNELS_PER_AGET + ch].cobo = cobo
+            trPtr[aget * NUM_CHANNELS_PER_AGET + ch].asad = asad
+            trPtr[aget * NUM_CHANNELS_PER_AGET + ch].aget = aget
+            trPtr[aget * NUM_CHANNELS_PER_AGET + ch].channel = ch
+
+    return traces
+
+
+@cython.boundscheck(False)
+@cython.wraparound(False)
+cdef Py_ssize_t _walk_evt_file(const uint8_t* buf, Py_ssize_t buflen, Py_ssize_t start,
+                               np.int64_t* offsets, np.int64_t* evtids) nogil:
+    """Find the offset and ID of each event in a merged event file. The results are written to `offsets` and
+    `evtids` unless they are NULL. Returns the number of events, or -(pos + 1) if the data at `pos` was invalid or
+    the event there runs past the end of the buffer.
+    """
+    cdef Py_ssize_t pos = start
+    cdef Py_ssize_t count = 0
+    cdef uint32_t size
+
+    while pos < buflen:
+        # Each event starts with (magic, size, ID), as '<BII'
+        if buf[pos] != 0xEE or pos + 9 > buflen:
+            return -(pos + 1)
+        size = _read_le32(buf + pos + 1)
+        if size == 0 or pos + size > buflen:
+            return -(pos + 1)
+
+        if offsets != NULL:
+            offsets[count] = pos
+            evtids[count] = _read_le32(buf + pos + 5)
+
+        count += 1
+        pos += size
+
+    return count
+
+
+@cython.boundscheck(False)
+@cython.wraparound(False)
+cdef Py_ssize_t _walk_graw_file(const uint8_t* buf, Py_ssize_t buflen, Py_ssize_t max_len,
+                                np.int64_t* offsets, np.int64_t* evtids) nogil:
+    """Find the offset and event ID of each frame in a GRAW file. The results are written to `offsets` and
+    `evtids` unless they are NULL. At most `max_len` frames are found if it is not negative. Returns the number of
+    frames, or -(pos + 1) if the data at `pos` was invalid or the frame there runs past the end of the buffer.
+    """
+    cdef Py_ssize_t pos = 0
+    cdef Py_ssize_t count = 0
+    cdef Py_ssize_t size
+    cdef uint8_t metatype
+
+    if buflen == 0:
+        return 0
+
+    metatype = buf[0]
+    while pos < buflen and (max_len < 0 or count < max_len):
+        # The frame size is at bytes 1-3 in units of 256 bytes, and the event ID is at bytes 22-25
+        if buf[pos] != metatype or pos + 26 > buflen:
+            return -(pos + 1)
+        size = ((<Py_ssize_t> buf[pos + 1] << 16) | (<Py_ssize_t> buf[pos + 2] << 8) | buf[pos + 3]) * 256
+        if size == 0 or pos + size > buflen:
+            return -(pos + 1)
+
+        if offsets != NULL:
+            offsets[count] = pos
+            evtids[count] = _read_be32(buf + pos + 22)
+
+        count += 1
+        pos += size
+
+    return count
+
+
+def index_evt_file(const uint8_t[::1] buf, Py_ssize_t start=4):
+    """Find the offset and event ID of each event in the contents of a merged event file.
+
+    Parameters
+    ----------
+    buf : bytes-like
+        The contents of the file, e.g. as a memory map.
+    start : int, optional
+        The offset of the first event. The default skips the file's magic number.
+
+    Returns
+    -------
+    offsets, evtids : ndarray
+        The offset of each event in `buf`, and its event ID, as int64.
+
+    Raises
+    ------
+    ValueError
+        If an invalid event header, or a truncated event, was found.
+
+    """
+    cdef const uint8_t* bufPtr = _buffer_ptr(buf)
+    cdef Py_ssize_t buflen = buf.shape[0]
+    cdef Py_ssize_t count
+
+    with nogil:
+        count = _walk_evt_file(bufPtr, buflen, start, NULL, NULL)
+    if count < 0:
+        raise ValueError('Invalid or truncated event at offset {}'.format(-count - 1))
+
+    cdef np.ndarray[np.int64_t, ndim=1] offsets = np.empty(count, dtype=np.int64)
+    cdef np.ndarray[np.int64_t, ndim=1] evtids = np.empty(count, dtype=np.int64)
+    cdef np.int64_t* offsetsPtr = <np.int64_t*> np.PyArray_DATA(offsets)
+    cdef np.int64_t* evtidsPtr = <np.int64_t*> np.PyArray_DATA(evtids)
+
+    with nogil:
+        _walk_evt_file(bufPtr, buflen, start, offsetsPtr, evtidsPtr)
+
+    return offsets, evtids
+
+
+def index_graw_file(const uint8_t[::1] buf, max_len=None):
+    """Find the offset and event ID of each frame in the contents of a GRAW file.
+
+    Parameters
+    ----------
+    buf : bytes-like
+        The contents of the file, e.g. as a memory map.
+    max_len : int, optional
+        The maximum number of frames to find.
+
+    Returns
+    -------
+    offsets, evtids : ndarray
+        The offset of each frame in `buf`, and its event ID, as int64.
+
+    Raises
+    ------
+    ValueError
+        If a frame with the wrong metatype, or a truncated frame, was found.
+
+    """
+    cdef const uint8_t* bufPtr = _buffer_ptr(buf)
+    cdef Py_ssize_t buflen = buf.shape[0]
+    cdef Py_ssize_t maxLen = max_len if max_len is not None else -1
+    cdef Py_ssize_t count
+
+    with nogil:
+        count = _walk_graw_file(bufPtr, buflen, maxLen, NULL, NULL)
+    if count < 0:
+        raise ValueError('Bad frame header at offset {}: file out of position?'.format(-count - 1))
+
+    cdef np.ndarray[np.int64_t, ndim=1] offsets = np.empty(count, dtype=np.int64)
+    cdef np.ndarray[np.int64_t, ndim=1] evtids = np.empty(count, dtype=np.int64)
+    cdef np.int64_t* offsetsPtr = <np.int64_t*> np.PyArray_DATA(offsets)
+    cdef np.int64_t* evtidsPtr = <np.int64_t*> np.PyArray_DATA(evtids)
+
+    with nogil:
+        _walk_graw_file(bufPtr, buflen, maxLen, offsetsPtr, evtidsPtr)
+
+    return offsets, evtids
+
+
+# VME files
+
+# These must match the layouts of vme_adc_dtype and vme_scaler_dtype
+cdef packed struct VMEADCFrame:
+    int64_t evt_id
+    int64_t frame_index
+    uint32_t timestamp
+    uint32_t coinc
+    uint32_t last_tb[2]
+    uint16_t data[4][512]
+
+cdef packed struct VMEScalerFrame:
+    int64_t index
+    uint32_t scalers[18]
+
+#: The dtype of the ADC events returned by :func:`decode_vme_buffer`. The event ID has the number of scaler frames
+#: before the event subtracted, as in :class:`pytpc.vmedata.ADCEvent`, and `coinc` is the raw coincidence register.
+#: The `data` rows are the two channels of each of the two ADCs, rotated so that they start at the last time bucket.
+vme_adc_dtype = np.dtype([('evt_id', 'i8'), ('frame_index', 'i8'), ('timestamp', 'u4'), ('coinc', 'u4'),
+                          ('last_tb', '2u4'), ('data', '(4,512)u2')])
+
+#: The dtype of the scaler events returned by :func:`decode_vme_buffer`.
+vme_scaler_dtype = np.dtype([('index', 'i8'), ('scalers', '18u4')])
+
+assert vme_adc_dtype.itemsize == sizeof(VMEADCFrame)
+assert vme_scaler_dtype.itemsize == sizeof(VMEScalerFrame)
+
+cdef enum:
+    VME_MAGIC = 0xe238
+    VME_ADC_HEADER = 0x17fb
+    VME_SCALER_HEADER = 0x2025
+    VME_ADC_BODY_SIZE = 12 + 2 * (16 + 4 * NUM_TBS)  # After the magic number
+    VME_SCALER_BODY_SIZE = 4 * 19
+
+cdef enum VMEStatus:
+    STATUS_OK
+    STATUS_TRUNCATED
+    STATUS_BAD_SENTINEL
+    STATUS_BAD_FRAME_INDEX
+
+#: The values of `status` returned by :func:`decode_vme_buffer`.
+VME_OK = STATUS_OK
+VME_TRUNCATED = STATUS_TRUNCATED
+VME_BAD_SENTINEL = STATUS_BAD_SENTINEL
+VME_BAD_FRAME_INDEX = STATUS_BAD_FRAME_INDEX
+
+cdef struct VMEDecodeState:
+    Py_ssize_t pos
+    Py_ssize_t num_adc
+    Py_ssize_t num_scalers
+    int64_t adc_seen
+    int64_t scalers_seen
+    int status
+
+
+cdef inline uint16_t _read_le16(const uint8_t* p) nogil:
+    return p[0] | (<uint16_t> p[1] << 8)
+
+
+@cython.boundscheck(False)
+@cython.wraparound(False)
+@cython.cdivision(True)
+cdef void _decode_vme(const uint8_t* buf, Py_ssize_t buflen, Py_ssize_t max_events, VMEDecodeState* state,
+                      VMEADCFrame* adc, VMEScalerFrame* scalers) nogil:
+    """Decode the frames of a VME file, starting at `state.pos`, and update `state`. The frames are only counted
+    if `adc` and `scalers` are NULL. This follows `VMEFile._read`: the 16-bit words are searched for the magic
+    number, and the word before it gives the type of frame. Frames of an unknown type are skipped.
+    """
+    cdef Py_ssize_t pos = state.pos
+    cdef Py_ssize_t start, i
+    cdef const uint8_t* body
+    cdef const uint8_t* raw
+    cdef uint16_t header
+    cdef uint32_t frame_index, last_tb, word
+    cdef int adc_idx, ch
+    cdef VMEADCFrame* fr
+
+    state.status = STATUS_OK
+
+    while max_events < 0 or state.num_adc + state.num_scalers < max_events:
+        while pos + 2 <= buflen and _read_le16(buf + pos) != VME_MAGIC:
+            pos += 2
+        if pos + 2 > buflen:
+            pos = buflen
+            break
+        if pos < 2:
+            pos += 2  # There's no header word before the magic number
+            continue
+
+        start = pos - 2
+        header = _read_le16(buf + start)
+        body = buf + pos + 2
+
+        if header == VME_SCALER_HEADER:
+            if pos + 2 + VME_SCALER_BODY_SIZE > buflen:
+                state.status = STATUS_TRUNCATED
+                pos = start
+                break
+            state.scalers_seen += 1
+            if _read_le32(body + 4 * 18) != 0xffffffff:
+                state.status = STATUS_BAD_SENTINEL
+                pos = start
+                break
+
+            if scalers != NULL:
+                scalers[state.num_scalers].index = state.scalers_seen - 1
+                for i in range(18):
+                    scalers[state.num_scalers].scalers[i] = _read_le32(body + 4 * i)
+            state.num_scalers += 1
+            pos += 2 + VME_SCALER_BODY_SIZE
+
+        elif header == VME_ADC_HEADER:
+            if pos + 2 + VME_ADC_BODY_SIZE > buflen:
+                state.status = STATUS_TRUNCATED
+                pos = start
+                break
+            frame_index = _read_le32(body)
+            state.adc_seen += 1
+            if frame_index != state.adc_seen + state.scalers_seen - 1:
+                state.status = STATUS_BAD_FRAME_INDEX
+                pos = start
+                break
+
+            if adc != NULL:
+                fr = &adc[state.num_adc]
+                fr.frame_index = frame_index
+                fr.evt_id = <int64_t> frame_index - state.scalers_seen
+                fr.timestamp = _read_le32(body + 4)
+                fr.coinc = _read_le32(body + 8)
+
+                for adc_idx in range(2):
+                    # Each ADC has 4 registers, and then one word with both channels for each time bucket
+                    raw = body + 12 + adc_idx * (16 + 4 * NUM_TBS)
+                    last_tb = _read_le32(raw + 12) & 0x1ffff
+                    fr.last_tb[adc_idx] = last_tb
+                    raw += 16
+                    for i in range(NUM_TBS):
+                        word = _read_le32(raw + 4 * ((i + last_tb) % NUM_TBS))
+                        fr.data[2 * adc_idx][i] = (word >> 16) & 0x1fff
+                        fr.data[2 * adc_idx + 1][i] = word & 0x1fff
+
+            state.num_adc += 1
+            pos += 2 + VME_ADC_BODY_SIZE
+
+        else:
+            pos += 2  # Skip the magic number and keep looking
+
+    state.pos = pos
+
+
+def decode_vme_buffer(const uint8_t[::1] buf, Py_ssize_t start=0, Py_ssize_t max_events=-1,
+                      np.int64_t num_adc_seen=0, np.int64_t num_scalers_seen=0):
+    """Decode the ADC and scaler frames in the contents of a VME file.
+
+    This gives the same events as iterating over a :class:`pytpc.vmedata.VMEFile`. To decode a large file in
+    pieces, pass the returned position and the number of frames decoded so far to the next call.
+
+    Parameters
+    ----------
+    buf : bytes-like
+        The contents of the file, e.g. as a memory map.
+    start : int, optional
+        The offset to start at. This must be at a 16-bit boundary.
+    max_events : int, optional
+        The maximum number of frames (ADC and scaler) to decode. If this is negative, the whole buffer is decoded.
+    num_adc_seen, num_scalers_seen : int, optional
+        The number of ADC and scaler frames before `start`. These are needed to compute the event IDs.
+
+    Returns
+    -------
+    adc_events : ndarray
+        The ADC events, with dtype :data:`vme_adc_dtype`.
+    scaler_events : ndarray
+        The scaler events, with dtype :data:`vme_scaler_dtype`.
+    pos : int
+        The position where decoding stopped. If `status` is not `VME_OK`, this is the start of the bad frame.
+    status : int
+        `VME_OK` if the end of the buffer or `max_events` was reached. Otherwise, one of `VME_TRUNCATED`,
+        `VME_BAD_SENTINEL`, or `VME_BAD_FRAME_INDEX`. The events before the bad frame are still returned.
+
+    """
+    if start < 0 or start % 2 != 0:
+        raise ValueError('The start position must be a non-negative multiple of 2')
+
+    cdef const uint8_t* bufPtr = _buffer_ptr(buf)
+    cdef Py_ssize_t buflen = buf.shape[0]
+    cdef VMEDecodeState state
+    state.pos = start
+    state.num_adc = 0
+    state.num_scalers = 0
+    state.adc_seen = num_adc_seen
+    state.scalers_seen = num_scalers_seen
+
+    cdef VMEDecodeState counted = state
+    with nogil:
+        _decode_vme(bufPtr, buflen, max_events, &counted, NULL, NULL)
+
+    cdef np.ndarray adc = np.zeros(counted.num_adc, dtype=vme_adc_dtype)
+    cdef np.ndarray scalers = np.zeros(counted.num_scalers, dtype=vme_scaler_dtype)
+    cdef VMEADCFrame* adcPtr = <VMEADCFrame*> np.PyArray_DATA(adc)
+    cdef VMEScalerFrame* scalersPtr = <VMEScalerFrame*> np.PyArray_DATA(scalers)
+
+    with nogil:
+        _decode_vme(bufPtr, buflen, max_events, &state, adcPtr, scalersPtr)
+
+    return adc, scalers, state.pos, state.status
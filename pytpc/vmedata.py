@@ -1,8 +1,11 @@
 from __future__ import division, print_function
 import struct
+import mmap
 import numpy as np
 import h5py
 
+from pytpc.unpack import decode_vme_buffer, VME_OK, VME_TRUNCATED, VME_BAD_SENTINEL, VME_BAD_FRAME_INDEX
+
 import logging
 logger = logging.getLogger(__name__)
 
@@ -11,6 +14,30 @@ class BadVMEDataError(Exception):
     pass
 
 
+_vme_status_messages = {
+    VME_TRUNCATED: 'The file ended in the middle of a frame',
+    VME_BAD_SENTINEL: 'Invalid sentinel value at end of scaler frame',
+    VME_BAD_FRAME_INDEX: 'Frame index is inconsistent',
+}
+
+
+def coincidence_bits(coinc):
+    """Unpack coincidence registers into an array of 16 booleans each, like `ADCEvent.coincidence_register`.
+
+    Parameters
+    ----------
+    coinc : array-like
+        The raw coincidence registers, like the `coinc` field of the ADC events from `VMEFile.iter_chunks`.
+
+    Returns
+    -------
+    ndarray
+        A boolean array with one row per register and one column per bit, starting from the least significant.
+    """
+    coinc = np.asarray(coinc, dtype='uint32')
+    return ((coinc[..., np.newaxis] >> np.arange(16, dtype='uint32')) & 1).astype(bool)
+
+
 class ADCEvent(object):
     def __init__(self, evt_id, timestamp, coincidence_register, data):
         self.evt_id = evt_id
@@ -110,6 +137,88 @@ class VMEFile(object):
         else:
             raise IOError(f'Invalid header: {evthdr:x}')
 
+    def iter_chunks(self, chunk_size=10000):
+        """Decode the file with the native decoder, a chunk of frames at a time.
+
+        This gives the same events as iterating over the file, but as structured arrays instead of one object
+        per event. See :func:`pytpc.unpack.decode_vme_buffer` for the fields.
+
+        Parameters
+        ----------
+        chunk_size : int, optional
+            The maximum number of frames in each chunk. The ADC data takes 4 kB per event.
+
+        Yields
+        ------
+        adc_events : ndarray
+            The ADC events in the chunk.
+        scaler_events : ndarray
+            The scaler events in the chunk.
+        pos : int
+            The position in the file after the chunk.
+
+        Raises
+        ------
+        BadVMEDataError
+            If an invalid frame was found. This is raised after the events before it are yielded, and no later events
+            are decoded. This is where iterating over the file would stop as well.
+        """
+        if self._file_len == 0:
+            return
+
+        with mmap.mmap(self.fp.fileno(), 0, access=mmap.ACCESS_READ) as buf:
+            view = memoryview(buf)
+            try:
+                pos = 0
+                num_adc = 0
+                num_scalers = 0
+                while pos < self._file_len:
+                    adc, scalers, pos, status = decode_vme_buffer(view, pos, chunk_size, num_adc, num_scalers)
+                    num_adc += len(adc)
+                    num_scalers += len(scalers)
+
+                    mismatched = np.flatnonzero(adc['last_tb'][:, 0] != adc['last_tb'][:, 1])
+                    for i in mismatched:
+                        logger.warning('Last TBs do not match for event %d (frame 0x%x): %d != %d', adc['evt_id'][i],
+                                       adc['frame_index'][i], adc['last_tb'][i, 0], adc['last_tb'][i, 1])
+
+                    if len(adc) > 0 or len(scalers) > 0:
+                        yield adc, scalers, pos
+
+                    if status != VME_OK:
+                        raise BadVMEDataError('{} at offset 0x{:x}'.format(_vme_status_messages[status], pos))
+                    if len(adc) == 0 and len(scalers) == 0:
+                        break
+            finally:
+                view.release()
+
+    def read_all(self):
+        """Decode the whole file with the native decoder.
+
+        Returns
+        -------
+        adc_events, scaler_events : ndarray
+            The ADC and scaler events, as in `iter_chunks`. If an invalid frame was found, these are the events
+            before it, and an error is logged.
+        """
+        adc_chunks = []
+        scaler_chunks = []
+        try:
+            for adc, scalers, _ in self.iter_chunks(chunk_size=-1):
+                adc_chunks.append(adc)
+                scaler_chunks.append(scalers)
+        except BadVMEDataError:
+            logger.exception('Stopped reading the VME file at an invalid frame')
+
+        if len(adc_chunks) == 0:
+            return self._empty_events()
+        return np.concatenate(adc_chunks), np.concatenate(scaler_chunks)
+
+    @staticmethod
+    def _empty_events():
+        adc, scalers, _, _ = decode_vme_buffer(b'')
+        return adc, scalers
+
     def __iter__(self):
         self.fp.seek(0)
         self.scaler_events_seen = 0
@@ -160,15 +269,17 @@ class VMEAlignmentTable:
         
         Parameters
         ----------
-        evt_id : int
-            The VME event ID.
+        evt_id : int or array-like
+            The VME event ID, or an array of them.
 
         Returns
         -------
-        int
-            The GET event ID.
+        int or ndarray
+            The GET event ID, or an array of them.
 
         """
+        if np.ndim(evt_id) > 0:
+            evt_id = np.asarray(evt_id, dtype='int64')
         return evt_id + self.offsets[evt_id]
 
     def update_offset(self, start_vme_evt_id, offset):
@@ -185,6 +296,25 @@ class VMEAlignmentTable:
         """
         self.offsets[start_vme_evt_id:] += offset
 
+    def update_offsets(self, start_vme_evt_ids, offsets):
+        """Apply many calls to `update_offset` at once.
+
+        This is equivalent to calling ``update_offset(start, offset)`` for each pair, but it makes one pass over the
+        table instead of one for each pair.
+
+        Parameters
+        ----------
+        start_vme_evt_ids : array-like
+            The first event ID affected by each change.
+        offsets : array-like
+            The amount to add to the offsets starting at each of those events.
+
+        """
+        starts = np.asarray(start_vme_evt_ids, dtype='int64')
+        changes = np.zeros(len(self.offsets) + 1, dtype=self.offsets.dtype)
+        np.add.at(changes, np.clip(starts, 0, len(self.offsets)), np.asarray(offsets, dtype=self.offsets.dtype))
+        self.offsets += np.cumsum(changes[:-1])
+
     def invalidate_range(self, begin, end):
         """Mark events between ``begin`` and ``end`` as invalid.
         
@@ -199,6 +329,51 @@ class VMEAlignmentTable:
         self.valid[begin:end] = False
         logger.warning(f'VME events {begin} through {end} were invalidated')
 
+    def invalidate_ranges(self, begins, ends):
+        """Mark the events in each of the ranges ``[begin, end)`` as invalid, in one pass over the table.
+
+        Parameters
+        ----------
+        begins, ends : array-like
+            The first event in each range, and the event after the last one.
+
+        """
+        begins = np.clip(np.asarray(begins, dtype='int64'), 0, len(self.valid))
+        ends = np.clip(np.asarray(ends, dtype='int64'), 0, len(self.valid))
+        nonempty = ends > begins
+        changes = np.zeros(len(self.valid) + 1, dtype='int64')
+        np.add.at(changes, begins[nonempty], 1)
+        np.add.at(changes, ends[nonempty], -1)
+        self.valid &= np.cumsum(changes[:-1]) == 0
+        if np.any(nonempty):
+            logger.warning('%d ranges of VME events were invalidated, for a total of %d events now invalid',
+                           np.count_nonzero(nonempty), np.count_nonzero(~self.valid))
+
+    @classmethod
+    def from_changes(cls, num_events, start_vme_evt_ids=(), offsets=(), invalid_begins=(), invalid_ends=()):
+        """Build a table from a list of offset changes and invalid ranges.
+
+        Parameters
+        ----------
+        num_events : int
+            The number of VME events.
+        start_vme_evt_ids, offsets : array-like, optional
+            The offset changes, as for `update_offsets`.
+        invalid_begins, invalid_ends : array-like, optional
+            The ranges of invalid events, as for `invalidate_ranges`.
+
+        Returns
+        -------
+        VMEAlignmentTable
+            The table.
+
+        """
+        instance = cls(num_events)
+        instance.update_offsets(start_vme_evt_ids, offsets)
+        if len(invalid_begins) > 0:
+            instance.invalidate_ranges(invalid_begins, invalid_ends)
+        return instance
+
     def to_hdf(self, path):
         """Write the results to an HDF5 file.
         
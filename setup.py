@@ -23,6 +23,36 @@ class BuildGasDBCommand(Command):
         build()
 
 
+class BenchmarkCommand(Command):
+    """A command to run the benchmarks in benchmarks/run.py."""
+    description = "run the benchmarks and compare them to the baseline"
+    user_options = [
+        ('config=', 'c', 'a fit config file, for the mcopt benchmarks'),
+        ('threads=', 't', 'a comma-separated list of thread counts'),
+        ('save-baseline', None, 'save the results as the new baseline'),
+    ]
+    boolean_options = ['save-baseline']
+
+    def initialize_options(self):
+        self.config = None
+        self.threads = None
+        self.save_baseline = False
+
+    def finalize_options(self):
+        pass
+
+    def run(self):
+        import subprocess
+        cmd = [sys.executable, os.path.join('benchmarks', 'run.py')]
+        if self.config is not None:
+            cmd += ['--config', self.config]
+        if self.threads is not None:
+            cmd += ['--threads'] + self.threads.split(',')
+        if self.save_baseline:
+            cmd.append('--save-baseline')
+        subprocess.check_call(cmd)
+
+
 class BuildPyCommand(build_py):
     # Extend the build_py command to force it to build the gas DB
     def run(self):
@@ -65,9 +95,11 @@ def make_extension(module, sources, language, libraries=[], extra_args=[], openm
 
 fitter_ext = make_extension(
     module='pytpc.fitting.mcopt_wrapper',
-    sources=['pytpc/fitting/mcopt_wrapper.pyx'],
+    sources=['pytpc/fitting/mcopt_wrapper.pyx', 'pytpc/fitting/mcopt_parallel.cpp',
+             'pytpc/fitting/ukf_native.cpp', 'pytpc/fitting/padlut.cpp', 'pytpc/fitting/prefit.cpp'],
     language='c++',
     libraries=['mcopt'],
+    openmp=True,
 )
 
 armadillo_ext = make_extension(
@@ -90,7 +122,20 @@ multiplicity_ext = make_extension(
     language='c',
 )
 
-all_extensions = [fitter_ext, armadillo_ext, cleaner_ext, multiplicity_ext]
+unpack_ext = make_extension(
+    module='pytpc.unpack',
+    sources=['pytpc/unpack.pyx'],
+    language='c',
+)
+
+peaks_ext = make_extension(
+    module='pytpc.peaks_wrapper',
+    sources=['pytpc/peaks_wrapper.pyx', 'pytpc/peaks.c'],
+    language='c',
+    openmp=True,
+)
+
+all_extensions = [fitter_ext, armadillo_ext, cleaner_ext, multiplicity_ext, unpack_ext, peaks_ext]
 
 setup(
     name='pytpc',
@@ -129,9 +174,11 @@ setup(
     extras_require={
         'docs': ['sphinx_rtd_theme>=0.2.4', 'sphinx>=1.5'],
         'plots': ['matplotlib', 'seaborn'],
+        'hdf5plugin': ['hdf5plugin'],
     },
     cmdclass={
         'build_gasdb': BuildGasDBCommand,
         'build_py': BuildPyCommand,
+        'benchmark': BenchmarkCommand,
     },
 )